@@ -15,7 +15,14 @@
 //   under the License.
 
 #include "SimpleHttp.h"
+#include <algorithm>
+#include <cerrno>
 #include <stdexcept>
+#if !WINDOWS_BUILD
+#include <future>
+#include <mutex>
+#include <thread>
+#endif
 
 #ifndef DXTOOLKIT_GITVERSION
   #error  "Macro DXTOOLKIT_GITVERSION must be defined"
@@ -41,6 +48,12 @@ namespace dx {
       return local;
     }
 
+    // Returns a mutable reference to DX_HTTP2 (see HttpEngine::http2())
+    std::string& HTTP2() {
+      static std::string local = "";
+      return local;
+    }
+
     // Returns a mutable reference to USER_AGENT_STRING()
     // This value will be used for setting user agent header, for all calls made by dxhttp 
     std::string& USER_AGENT_STRING() {
@@ -91,6 +104,197 @@ namespace dx {
   int curlInitializer::init_count = 0; // definition
   curlInitializer curl_initializer_variable; // should be created just once
 
+  //////////////////////////////////////////////////
+  /////////// HttpConnectionPool ///////////////////
+  //////////////////////////////////////////////////
+
+#if !WINDOWS_BUILD
+  // Guards HttpConnectionPool::idle (the pool is a singleton)
+  static std::mutex pool_mutex;
+  typedef std::lock_guard<std::mutex> PoolLock;
+
+  // One lock per kind of data shared through HttpConnectionPool::share
+  static std::mutex share_mutexes[CURL_LOCK_DATA_LAST];
+
+  static void share_lock(CURL *, curl_lock_data data, curl_lock_access, void *) {
+    share_mutexes[data].lock();
+  }
+
+  static void share_unlock(CURL *, curl_lock_data data, void *) {
+    share_mutexes[data].unlock();
+  }
+#else
+  // No std::mutex in our MinGW toolchain: handles are never pooled (see
+  // HttpConnectionPool::release()), nor share anything, so there is nothing
+  // to guard
+  struct PoolLock {
+    explicit PoolLock(int) {}
+  };
+  static const int pool_mutex = 0;
+#endif
+
+  HttpConnectionPool::HttpConnectionPool(): maxIdlePerHost(16), idleTimeout(30), share(NULL) {
+#if !WINDOWS_BUILD
+    // Without a share object, handles just have their own caches
+    share = curl_share_init();
+    if (share != NULL &&
+        (curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock) != CURLSHE_OK ||
+         curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock) != CURLSHE_OK ||
+         curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS) != CURLSHE_OK ||
+         curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK)) {
+      curl_share_cleanup(share);
+      share = NULL;
+    }
+#endif
+  }
+
+  HttpConnectionPool::~HttpConnectionPool() {
+    clear();
+    // Fails (harmlessly) if a handle still uses it
+    if (share != NULL)
+      curl_share_cleanup(share);
+  }
+
+  HttpConnectionPool& HttpConnectionPool::instance() {
+    // Constructed after curl_initializer_variable (on first use), and
+    // therefore destroyed before curl_global_cleanup() is called
+    static HttpConnectionPool pool;
+    return pool;
+  }
+
+  std::string HttpConnectionPool::hostKey(const std::string &url) {
+    size_t start = url.find("://");
+    std::string scheme = (start == std::string::npos) ? "http" : url.substr(0, start);
+    start = (start == std::string::npos) ? 0u : start + 3u;
+    const size_t end = url.find_first_of("/?#", start);
+    std::string host = url.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+    const size_t at = host.rfind('@');
+    if (at != std::string::npos)
+      host.erase(0, at + 1); // user:password@
+    std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+    std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+    // A ':' inside brackets is part of an IPv6 address, not a port
+    const size_t colon = host.rfind(':'), bracket = host.rfind(']');
+    if (colon == std::string::npos || (bracket != std::string::npos && colon < bracket))
+      host += (scheme == "https") ? ":443" : ":80";
+    return scheme + "://" + host;
+  }
+
+  // Handles pinned to an IP address are kept under a key of their own
+  static std::string poolKey(const std::string &url, const std::string &pin) {
+    const std::string key = HttpConnectionPool::hostKey(url);
+    return pin.empty() ? key : key + " " + pin;
+  }
+
+  CURL* HttpConnectionPool::acquire(const std::string &url, const std::string &pin) {
+    const std::string key = poolKey(url, pin);
+    const time_t now = time(NULL);
+    std::vector<CURL*> expired;
+    CURL *handle = NULL;
+    {
+      PoolLock lock(pool_mutex);
+      std::map<std::string, std::vector<IdleHandle> >::iterator it = idle.find(key);
+      if (it != idle.end()) {
+        std::vector<IdleHandle> &handles = it->second;
+        // Handles are in order of release: the most recently used one is
+        // taken, the ones idle for too long (at the front) are dropped
+        size_t fresh = 0;
+        while (fresh < handles.size() && now - handles[fresh].since >= idleTimeout)
+          expired.push_back(handles[fresh++].handle);
+        handles.erase(handles.begin(), handles.begin() + fresh);
+        if (!handles.empty()) {
+          handle = handles.back().handle;
+          handles.pop_back();
+        }
+        if (handles.empty())
+          idle.erase(it);
+      }
+    }
+    for (size_t i = 0; i < expired.size(); ++i)
+      curl_easy_cleanup(expired[i]);
+    if (handle != NULL)
+      return handle;
+    handle = curl_easy_init();
+    // Kept by curl_easy_reset(), so it's set only once per handle (and never
+    // on a pinned one, whose pin would otherwise go into the shared DNS cache)
+    if (handle != NULL && share != NULL && pin.empty() && curl_easy_setopt(handle, CURLOPT_SHARE, share) != CURLE_OK) {
+      curl_easy_cleanup(handle);
+      handle = NULL;
+    }
+    return handle;
+  }
+
+  void HttpConnectionPool::release(const std::string &url, CURL *handle, const std::string &pin) {
+    if (handle == NULL)
+      return;
+    // Options set for the previous transfer (e.g., pointers to its buffers)
+    // must not stick around
+    curl_easy_reset(handle);
+#if !WINDOWS_BUILD
+    const std::string key = poolKey(url, pin);
+    {
+      PoolLock lock(pool_mutex);
+      std::vector<IdleHandle> &handles = idle[key];
+      if (handles.size() < maxIdlePerHost) {
+        IdleHandle h = {handle, time(NULL)};
+        handles.push_back(h);
+        return;
+      }
+      if (handles.empty())
+        idle.erase(key);
+    }
+#else
+    (void) url;
+    (void) pin;
+#endif
+    curl_easy_cleanup(handle);
+  }
+
+  void HttpConnectionPool::discard(CURL *handle) {
+    if (handle != NULL)
+      curl_easy_cleanup(handle);
+  }
+
+  void HttpConnectionPool::setMaxIdlePerHost(size_t n) {
+    PoolLock lock(pool_mutex);
+    maxIdlePerHost = n;
+  }
+
+  size_t HttpConnectionPool::getMaxIdlePerHost() const {
+    PoolLock lock(pool_mutex);
+    return maxIdlePerHost;
+  }
+
+  void HttpConnectionPool::setIdleTimeout(long seconds) {
+    PoolLock lock(pool_mutex);
+    idleTimeout = seconds;
+  }
+
+  long HttpConnectionPool::getIdleTimeout() const {
+    PoolLock lock(pool_mutex);
+    return idleTimeout;
+  }
+
+  size_t HttpConnectionPool::idleCount() const {
+    PoolLock lock(pool_mutex);
+    size_t count = 0;
+    for (std::map<std::string, std::vector<IdleHandle> >::const_iterator it = idle.begin(); it != idle.end(); ++it)
+      count += it->second.size();
+    return count;
+  }
+
+  void HttpConnectionPool::clear() {
+    std::map<std::string, std::vector<IdleHandle> > handles;
+    {
+      PoolLock lock(pool_mutex);
+      handles.swap(idle);
+    }
+    for (std::map<std::string, std::vector<IdleHandle> >::iterator it = handles.begin(); it != handles.end(); ++it) {
+      for (size_t i = 0; i < it->second.size(); ++i)
+        curl_easy_cleanup(it->second[i].handle);
+    }
+  }
+
   /*
    * This function serves as a callback for response headers read by libcurl
    *
@@ -151,11 +355,10 @@ namespace dx {
   /* Callback for response data */
   static size_t write_callback(void *buffer, size_t size, size_t nmemb, void *userdata) {
     char *buf = reinterpret_cast<char*>(buffer);
-    std::string *response = reinterpret_cast<std::string*>(userdata);
+    HttpRequest *req = reinterpret_cast<HttpRequest*>(userdata);
     size_t result = 0u;
     if (userdata != NULL) {
-      response->append(buf, size * nmemb);
-      result = size * nmemb;
+      result = req->receiveBody(buf, size * nmemb);
     }
     return result;
   }
@@ -180,7 +383,8 @@ namespace dx {
   }
 
   // convert int to string
-  static std::string itos(int i)  {
+  template<typename T>
+  static std::string itos(T i)  {
     std::stringstream s;
     s << i;
     return s.str();
@@ -206,23 +410,116 @@ namespace dx {
   /////////// Class method defintions //////////////
   //////////////////////////////////////////////////
 
-  // This function makes the actual http request.
-  // Throws HttpRequestException in case of an error
-  // HttpRequestException::errorCode 
-  //    - is positive if error is due to a failed libcurl function (and is == returned curl_code by function)
-  //    - is never 0 (since 0 = CURLE_OK)
-  //    - is negative (one of static const value defined in HttpRequestException class)
-  //      if error is due to some other reason.
-  void HttpRequest::send() {
-    // TODO: Not call curl_easy_cleanup() always at end of send()
-    //       Instead allow to reuse the same curl handle for subsequent requests
-    //       curl will reuse the existing connection this way - should be much faster
+  // Returns number of bytes consumed (anything other than "len" makes libcurl
+  // abort the transfer). Exceptions must not propagate through libcurl, so the
+  // ones thrown by respSink are stored, and rethrown by send().
+  size_t HttpRequest::receiveBody(const char *data, size_t len) {
+    if (respSink != NULL && respLength == 0u) {
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode);
+      try {
+        respSinkUsed = respSink->begin(responseCode);
+        if (respSinkUsed) {
+#if LIBCURL_VERSION_NUM >= 0x073700
+          curl_off_t contentLength = -1;
+          curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &contentLength);
+#else
+          double contentLength = -1;
+          curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &contentLength);
+#endif
+          if (contentLength >= 0)
+            respSink->reserve(static_cast<size_t>(contentLength));
+        }
+      } catch (...) {
+        sinkError = std::current_exception();
+        return 0u;
+      }
+    }
+    respLength += len;
+    if (!respSinkUsed) {
+      respData.append(data, len);
+      return len;
+    }
+    try {
+      respSink->write(data, len);
+    } catch (...) {
+      sinkError = std::current_exception();
+      return 0u;
+    }
+    return len;
+  }
+
+  //////////////////////////////////////////////////
+  /////////// Response sinks ///////////////////////
+  //////////////////////////////////////////////////
 
+  static bool isSuccess(long responseCode) {
+    return (responseCode >= 200 && responseCode < 300);
+  }
+
+  bool HttpBufferSink::begin(long responseCode) {
+    length = 0;
+    return isSuccess(responseCode);
+  }
+
+  void HttpBufferSink::reserve(size_t len) {
+    if (len > capacity)
+      throw HttpRequestException("Response body (" + itos(len) + " bytes) larger than the buffer (" + itos(capacity) + " bytes)", HttpRequestException::RESPONSE_TOO_LARGE);
+  }
+
+  void HttpBufferSink::write(const char *data, size_t len) {
+    if (len > capacity - length)
+      throw HttpRequestException("Response body larger than the buffer (" + itos(capacity) + " bytes)", HttpRequestException::RESPONSE_TOO_LARGE);
+    memcpy(buffer + length, data, len);
+    length += len;
+  }
+
+  bool HttpStringSink::begin(long responseCode) {
+    out.resize(initial);
+    return isSuccess(responseCode);
+  }
+
+  void HttpStringSink::reserve(size_t len) {
+    out.reserve(initial + len);
+  }
+
+  void HttpStringSink::write(const char *data, size_t len) {
+    out.append(data, len);
+  }
+
+  bool HttpFileSink::begin(long responseCode) {
+    length = 0;
+    return isSuccess(responseCode);
+  }
+
+  void HttpFileSink::write(const char *data, size_t len) {
+    while (len > 0) {
+#if !WINDOWS_BUILD
+      const ssize_t n = pwrite(fd, data, len, offset + length);
+#else
+      ssize_t n = -1;
+      if (lseek(fd, offset + length, SEEK_SET) >= 0)
+        n = ::write(fd, data, len);
+#endif
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw HttpRequestException(std::string("Error writing the response body: ") + strerror(errno), HttpRequestException::SINK_WRITE_FAILED);
+      }
+      data += n;
+      len -= n;
+      length += n;
+    }
+  }
+
+  // Gets a curl handle ready for the request (see send()): the handle comes
+  // from HttpConnectionPool (and goes back to it once the request succeeds,
+  // see complete()), so that connections are reused across requests.
+  void HttpRequest::prepare() {
     // This function should never be called while "curl" member variable is in use
     if (curl != NULL)
       throw HttpRequestException("ERROR: curl member variable is already in use. Cannot be reused until previous operation is complete", HttpRequestException::ALREADY_IN_USE);
 
-    curl = curl_easy_init();
+    curl = HttpConnectionPool::instance().acquire(url);
     
     errorBuffer[0] = 0; // since it can be the case that nothing is written to the error buffer (despite an error occured)
     // Set errorBuffer to recieve human readable error messages from libcurl
@@ -242,6 +539,9 @@ namespace dx {
         }
       }
       respData = "";
+      respSinkUsed = false;
+      respLength = 0u;
+      sinkError = std::exception_ptr();
       // Set time out to infinite
       assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_TIMEOUT, 0l));
 
@@ -253,21 +553,27 @@ namespace dx {
       assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1l));
 
       /* Set the header(s) */
-      curl_slist *header = NULL;
       std::vector<std::string> header_vec;
       header_vec = reqHeader.getAllHeadersAsVector(); // inefficient quick hack, use iterator instead
       for (unsigned i = 0;i < header_vec.size(); i++) {
-        header = curl_slist_append(header, header_vec[i].c_str());
+        reqHeaderList = curl_slist_append(reqHeaderList, header_vec[i].c_str());
       }
 
-      if (header != NULL) {
-        assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_HTTPHEADER, header));
+      if (reqHeaderList != NULL) {
+        assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_HTTPHEADER, reqHeaderList));
       }
       
       if (!config::LIBCURL_VERBOSE().empty() && config::LIBCURL_VERBOSE() != "0") {
         assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_VERBOSE, 1));
       }
 
+#if LIBCURL_VERSION_NUM >= 0x072f00
+      if (HttpEngine::http2()) {
+        assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS));
+        assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1l));
+      }
+#endif
+
       /*
        * Set the URL that is about to receive our POST. This URL can
        * just as well be a https:// URL if that is what should receive the
@@ -275,8 +581,7 @@ namespace dx {
        */
       assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_URL, url.c_str()));
 
-      // Make a copy of reqData, because read_callback (see HTTP_PUT case below) will modify it
-      reqData_struct reqData_temp;
+      // Make a copy of reqData (in reqDataToSend), because read_callback (see HTTP_PUT case below) will modify it
 
       switch (method) {
         case HTTP_POST:
@@ -288,7 +593,7 @@ namespace dx {
           assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, reqData.length));
           break;
         case HTTP_PUT:
-          reqData_temp = reqData; // Make a copy, since it will be modified
+          reqDataToSend = reqData; // Make a copy, since it will be modified
           // Set the request type to PUT
           // Using two methods to do it just to be safe
           // NOTE: CURLOPT_PUT will be deprecated in future libcurl)
@@ -299,7 +604,7 @@ namespace dx {
            // Now set the read_call back function.
             assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_callback));
             /** set data object to pass to callback function */
-            assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_READDATA, &reqData_temp));
+            assertLibCurlFunctions(curl_easy_setopt(curl, CURLOPT_READDATA, &reqDataToSend));
           }
           break;
         case HTTP_GET:
@@ -323,20 +628,386 @@ namespace dx {
       // Set callback for recieving the response data
       /** set callback function */
       assertLibCurlFunctions( curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback) );
-      /** "respData" is a member variable of HttpRequest */
-      assertLibCurlFunctions( curl_easy_setopt(curl, CURLOPT_WRITEDATA, &respData) );
-      
-      /* Perform the actual request */
-      assertLibCurlFunctions( curl_easy_perform(curl), "Error in using curl_easy_perform.");
-      
-      assertLibCurlFunctions( curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode) );
-
-      /* always cleanup */
-      curl_easy_cleanup(curl);
+      /** Response data is stored in respData, or handed over to respSink (see receiveBody()) */
+      assertLibCurlFunctions( curl_easy_setopt(curl, CURLOPT_WRITEDATA, this) );
       
-      curl = NULL;
     } else {
       throw HttpRequestException("Error: Unable to initialize object of type CURL", HttpRequestException::INIT_FAILED);
     }
   }
+
+  // Finishes a request prepared by prepare(), given the outcome of the transfer
+  void HttpRequest::complete(CURLcode performResult) {
+    // The handle is not used for another transfer until it's reset (see
+    // HttpConnectionPool::release()), or cleaned up
+    curl_slist_free_all(reqHeaderList);
+    reqHeaderList = NULL;
+    if (sinkError) {
+      HttpConnectionPool::discard(curl);
+      curl = NULL;
+      std::rethrow_exception(sinkError);
+    }
+    assertLibCurlFunctions(performResult, "Error in using curl_easy_perform.");
+
+    assertLibCurlFunctions( curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode) );
+#if LIBCURL_VERSION_NUM >= 0x073200
+    assertLibCurlFunctions( curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &httpVersion) );
+#endif
+    assertLibCurlFunctions( curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &numConnects) );
+
+    /* The connection stays open, for the next request to the same host */
+    HttpConnectionPool::instance().release(url, curl);
+
+    curl = NULL;
+  }
+
+  void HttpRequest::abort() {
+    if (reqHeaderList != NULL) {
+      curl_slist_free_all(reqHeaderList);
+      reqHeaderList = NULL;
+    }
+    if (curl != NULL) {
+      HttpConnectionPool::discard(curl);
+      curl = NULL;
+    }
+  }
+
+  // This function makes the actual http request.
+  // Throws HttpRequestException in case of an error
+  // HttpRequestException::errorCode 
+  //    - is positive if error is due to a failed libcurl function (and is == returned curl_code by function)
+  //    - is never 0 (since 0 = CURLE_OK)
+  //    - is negative (one of static const value defined in HttpRequestException class)
+  //      if error is due to some other reason.
+  void HttpRequest::send() {
+#if !WINDOWS_BUILD
+    if (HttpEngine::http2()) {
+      // The engine's I/O thread, shared by all the requests, must not be
+      // held up: unless respSink only stores the body, the body is stored in
+      // respData, and respSink gets it on this thread, once the transfer is
+      // over
+      HttpResponseSink *deferred = (respSink != NULL && !respSink->storesOnly()) ? respSink : NULL;
+      if (deferred != NULL)
+        respSink = NULL;
+      try {
+        HttpEngine::instance().send(*this);
+      } catch (...) {
+        if (deferred != NULL)
+          respSink = deferred;
+        throw;
+      }
+      if (deferred == NULL)
+        return;
+      respSink = deferred;
+      if (!respData.empty() && respSink->begin(responseCode)) {
+        respSinkUsed = true;
+        respSink->reserve(respData.size());
+        respSink->write(respData.data(), respData.size());
+        std::string().swap(respData);
+      }
+      return;
+    }
+#endif
+    prepare();
+    complete(curl_easy_perform(curl));
+  }
+
+  //////////////////////////////////////////////////
+  /////////// HttpEngine ///////////////////////////
+  //////////////////////////////////////////////////
+
+#if !WINDOWS_BUILD
+  namespace {
+    struct EngineTransfer {
+      HttpEngine::TransferId id;
+      HttpRequest *req;
+      HttpEngine::Callback done;
+    };
+  }
+
+  // State of the I/O thread. Submitted requests, and cancellations, are
+  // queued (under "lock"), and picked up by the thread, which alone uses
+  // the multi handle (and the easy handles added to it).
+  class HttpEngine::Worker {
+  public:
+    CURLM *multi;
+    std::mutex lock;
+    std::vector<EngineTransfer> submitted;
+    std::vector<HttpEngine::TransferId> cancelled;
+    HttpEngine::TransferId lastId;
+    bool stopping;
+    long maxConcurrentStreams, maxHostConnections;
+    bool optionsChanged;
+    std::map<CURL*, EngineTransfer> active;
+    std::thread thread;
+
+    Worker(): multi(curl_multi_init()), lastId(0), stopping(false), maxConcurrentStreams(0), maxHostConnections(0), optionsChanged(true) {
+      if (multi == NULL)
+        throw HttpRequestException("Error: Unable to initialize object of type CURLM", HttpRequestException::INIT_FAILED);
+#if LIBCURL_VERSION_NUM >= 0x072b00
+      // The default since libcurl 7.62.0
+      curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+      thread = std::thread(&Worker::run, this);
+    }
+
+    ~Worker() {
+      {
+        std::lock_guard<std::mutex> l(lock);
+        stopping = true;
+      }
+      wake();
+      thread.join();
+      curl_multi_cleanup(multi);
+    }
+
+    // Interrupts the wait for network activity in run()
+    void wake() {
+#if LIBCURL_VERSION_NUM >= 0x074400
+      curl_multi_wakeup(multi);
+#endif
+    }
+
+    static void finish(EngineTransfer &t, CURLcode result) {
+      std::exception_ptr error;
+      try {
+        t.req->complete(result);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      notify(t, error);
+    }
+
+    static void finishCancelled(EngineTransfer &t) {
+      t.req->abort();
+      notify(t, std::make_exception_ptr(HttpRequestException("Request cancelled", HttpRequestException::CANCELLED)));
+    }
+
+    static void notify(EngineTransfer &t, std::exception_ptr error) {
+      try {
+        t.done(*t.req, error);
+      } catch (...) {
+        // Callbacks must not throw: there is nobody to report it to
+      }
+    }
+
+    void cancel(HttpEngine::TransferId id) {
+      for (std::map<CURL*, EngineTransfer>::iterator it = active.begin(); it != active.end(); ++it) {
+        if (it->second.id == id) {
+          EngineTransfer t = it->second;
+          curl_multi_remove_handle(multi, it->first);
+          active.erase(it);
+          finishCancelled(t);
+          return;
+        }
+      }
+    }
+
+    void setOptions(long streams, long hostConnections) {
+#if LIBCURL_VERSION_NUM >= 0x074300
+      curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, streams > 0 ? streams : 100l); // libcurl's default
+#endif
+      curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, hostConnections);
+    }
+
+    void run() {
+      std::vector<EngineTransfer> toAdd;
+      std::vector<HttpEngine::TransferId> toCancel;
+      while (true) {
+        bool stop, setOpts;
+        long streams, hostConnections;
+        {
+          std::lock_guard<std::mutex> l(lock);
+          toAdd.swap(submitted);
+          toCancel.swap(cancelled);
+          stop = stopping;
+          setOpts = optionsChanged;
+          optionsChanged = false;
+          streams = maxConcurrentStreams;
+          hostConnections = maxHostConnections;
+        }
+        // Multi handle options can only be set by the thread using it
+        if (setOpts)
+          setOptions(streams, hostConnections);
+        for (size_t i = 0; i < toAdd.size(); ++i) {
+          CURLMcode code = curl_multi_add_handle(multi, toAdd[i].req->handle());
+          if (code == CURLM_OK) {
+            active[toAdd[i].req->handle()] = toAdd[i];
+          } else {
+            toAdd[i].req->abort();
+            notify(toAdd[i], std::make_exception_ptr(HttpRequestException(std::string("Error in curl_multi_add_handle: ") + curl_multi_strerror(code), HttpRequestException::INIT_FAILED)));
+          }
+        }
+        toAdd.clear();
+        for (size_t i = 0; i < toCancel.size(); ++i)
+          cancel(toCancel[i]);
+        toCancel.clear();
+        if (stop) {
+          while (!active.empty())
+            cancel(active.begin()->second.id);
+          return;
+        }
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+          if (msg->msg != CURLMSG_DONE)
+            continue;
+          CURL *handle = msg->easy_handle;
+          const CURLcode result = msg->data.result;
+          curl_multi_remove_handle(multi, handle);
+          std::map<CURL*, EngineTransfer>::iterator it = active.find(handle);
+          if (it == active.end())
+            continue;
+          EngineTransfer t = it->second;
+          active.erase(it);
+          finish(t, result);
+        }
+#if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_poll(multi, NULL, 0, 1000, NULL);
+#else
+        // Without curl_multi_wakeup(), new submissions are picked up at the
+        // next timeout
+        curl_multi_wait(multi, NULL, 0, 10, NULL);
+#endif
+      }
+    }
+  };
+
+  HttpEngine::HttpEngine(): worker(NULL) {
+    // The pool must outlive the engine (whose transfers use it)
+    HttpConnectionPool::instance();
+    worker = new Worker();
+  }
+
+  HttpEngine::~HttpEngine() {
+    delete worker;
+  }
+
+  HttpEngine::TransferId HttpEngine::submit(HttpRequest &req, const Callback &done) {
+    try {
+      req.prepare();
+    } catch (...) {
+      req.abort();
+      throw;
+    }
+    EngineTransfer t = {0, &req, done};
+    {
+      std::lock_guard<std::mutex> l(worker->lock);
+      t.id = ++worker->lastId;
+      worker->submitted.push_back(t);
+    }
+    worker->wake();
+    return t.id;
+  }
+
+  void HttpEngine::cancel(TransferId id) {
+    {
+      std::lock_guard<std::mutex> l(worker->lock);
+      worker->cancelled.push_back(id);
+    }
+    worker->wake();
+  }
+
+  void HttpEngine::send(HttpRequest &req) {
+    std::promise<void> done;
+    submit(req, [&done](HttpRequest &, std::exception_ptr error) {
+      if (error)
+        done.set_exception(error);
+      else
+        done.set_value();
+    });
+    done.get_future().get();
+  }
+
+  void HttpEngine::setMaxConcurrentStreams(long n) {
+    {
+      std::lock_guard<std::mutex> l(worker->lock);
+      worker->maxConcurrentStreams = n;
+      worker->optionsChanged = true;
+    }
+    worker->wake();
+  }
+
+  long HttpEngine::getMaxConcurrentStreams() const {
+    std::lock_guard<std::mutex> l(worker->lock);
+    return worker->maxConcurrentStreams;
+  }
+
+  void HttpEngine::setMaxHostConnections(long n) {
+    {
+      std::lock_guard<std::mutex> l(worker->lock);
+      worker->maxHostConnections = n;
+      worker->optionsChanged = true;
+    }
+    worker->wake();
+  }
+
+  long HttpEngine::getMaxHostConnections() const {
+    std::lock_guard<std::mutex> l(worker->lock);
+    return worker->maxHostConnections;
+  }
+#else
+  // No std::thread in our MinGW toolchain: requests are sent right away,
+  // on the calling thread (so there is no multiplexing, and the limits are
+  // only recorded)
+  class HttpEngine::Worker {
+  public:
+    TransferId lastId;
+    long maxConcurrentStreams, maxHostConnections;
+    Worker(): lastId(0), maxConcurrentStreams(0), maxHostConnections(0) {}
+  };
+
+  HttpEngine::HttpEngine(): worker(new Worker()) {
+  }
+
+  HttpEngine::~HttpEngine() {
+    delete worker;
+  }
+
+  HttpEngine::TransferId HttpEngine::submit(HttpRequest &req, const Callback &done) {
+    std::exception_ptr error;
+    try {
+      req.send();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    done(req, error);
+    return ++worker->lastId;
+  }
+
+  void HttpEngine::cancel(TransferId) {
+  }
+
+  void HttpEngine::send(HttpRequest &req) {
+    req.send();
+  }
+
+  void HttpEngine::setMaxConcurrentStreams(long n) {
+    worker->maxConcurrentStreams = n;
+  }
+
+  long HttpEngine::getMaxConcurrentStreams() const {
+    return worker->maxConcurrentStreams;
+  }
+
+  void HttpEngine::setMaxHostConnections(long n) {
+    worker->maxHostConnections = n;
+  }
+
+  long HttpEngine::getMaxHostConnections() const {
+    return worker->maxHostConnections;
+  }
+#endif
+
+  bool HttpEngine::http2() {
+    return !config::HTTP2().empty() && config::HTTP2() != "0";
+  }
+
+  HttpEngine& HttpEngine::instance() {
+    static HttpEngine engine;
+    return engine;
+  }
 }
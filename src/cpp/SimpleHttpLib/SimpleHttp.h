@@ -25,8 +25,11 @@
 #include <cstring>
 #include <curl/curl.h>
 #include <exception>
+#include <functional>
 #include <cassert>
 #include <sstream>
+#include <map>
+#include <ctime>
 #include <unistd.h>
 
 #include "SimpleHttpHeaders.h"
@@ -37,6 +40,11 @@ namespace dx {
     std::string& CA_CERT();
     std::string& USER_AGENT_STRING();
     std::string& LIBCURL_VERBOSE();
+    // HTTP/2 mode (see HttpEngine::http2()). Note that a response sink which
+    // does more than store the body (see HttpResponseSink::storesOnly())
+    // then gets it only once it's complete: its peak memory use doubles, and
+    // it can't process the body while it downloads.
+    std::string& HTTP2();
   }
 
   enum HttpMethod {
@@ -59,17 +67,227 @@ namespace dx {
     return "UNKNOWN_HTTP_METHOD";
   }
 
+  /** A thread-safe pool of libcurl easy handles, from which every
+    * HttpRequest::send() draws its handle (it can be used by other code
+    * using libcurl directly as well, e.g., the upload agent).
+    *
+    * A handle keeps its connections open after a transfer, so the next
+    * transfer through it to the same scheme/host/port reuses them, instead
+    * of connecting again. Idle handles are therefore kept per
+    * scheme/host/port (see hostKey()).
+    *
+    * All the handles also share a DNS cache, and TLS session IDs (through a
+    * CURLSH, see getShare()), so that a new connection, from any handle,
+    * resumes a TLS session rather than making a full handshake. Connections
+    * themselves are not shared that way: libcurl does not support sharing
+    * them between concurrent threads.
+    *
+    * Code pinning a host to an IP address of its own (with CURLOPT_RESOLVE)
+    * passes that pin to acquire()/release(): its handles are then kept apart
+    * from the others (a connection to another IP is never reused for it),
+    * and do not use the shared DNS cache (so its pin can't leak into other
+    * handles, nor theirs into it).
+    */
+  class HttpConnectionPool {
+  public:
+    /** Returns the pool shared by the whole process */
+    static HttpConnectionPool& instance();
+
+    /** Returns a handle (with default options, apart from CURLOPT_SHARE)
+      * for a transfer to url: one left idle by a previous transfer to the
+      * same scheme/host/port if possible, a new one otherwise (NULL if
+      * curl_easy_init() fails). Idle handles older than the idle timeout are
+      * cleaned up along the way.
+      *
+      * If pin is not empty (e.g., "host:443:1.2.3.4", the CURLOPT_RESOLVE
+      * entries the caller sets), only handles released with the same pin are
+      * reused, and a new handle is not given CURLOPT_SHARE.
+      */
+    CURL* acquire(const std::string &url, const std::string &pin = std::string());
+
+    /** Gives back a handle obtained from acquire(), after a successful
+      * transfer to url: its options are reset (its connections are kept),
+      * and it's kept for reuse, unless the maximum number of idle handles
+      * for that scheme/host/port is reached (in which case it's cleaned up).
+      * pin must be the one given to acquire().
+      */
+    void release(const std::string &url, CURL *handle, const std::string &pin = std::string());
+
+    /** Cleans up a handle obtained from acquire(), instead of giving it back
+      * (e.g., after a failed transfer, which may have left its connection
+      * in an unknown state).
+      */
+    static void discard(CURL *handle);
+
+    /** Maximum number of idle handles kept per scheme/host/port (default:
+      * 16). 0 disables pooling (every handle is cleaned up by release()).
+      */
+    void setMaxIdlePerHost(size_t n);
+    size_t getMaxIdlePerHost() const;
+
+    /** Number of seconds after which an idle handle is cleaned up, rather
+      * than reused (default: 30): servers close idle connections on their
+      * end eventually.
+      */
+    void setIdleTimeout(long seconds);
+    long getIdleTimeout() const;
+
+    /** Returns the share object set (as CURLOPT_SHARE) on the handles
+      * returned by acquire(), or NULL if it could not be created (or on
+      * Windows builds, where nothing is shared).
+      */
+    CURLSH* getShare() const { return share; }
+
+    /** Returns the number of idle handles in the pool */
+    size_t idleCount() const;
+
+    /** Cleans up all the idle handles */
+    void clear();
+
+    /** Returns the key under which handles for url are kept: lowercase
+      * "scheme://host:port" (with the default port of the scheme, if url has
+      * none), e.g., "https://api.dnanexus.com:443".
+      */
+    static std::string hostKey(const std::string &url);
+
+    ~HttpConnectionPool();
+
+  private:
+    struct IdleHandle {
+      CURL *handle;
+      time_t since; // When the handle was released
+    };
+
+    std::map<std::string, std::vector<IdleHandle> > idle;
+    size_t maxIdlePerHost;
+    long idleTimeout;
+    CURLSH *share;
+
+    HttpConnectionPool();
+    HttpConnectionPool(const HttpConnectionPool &);
+    HttpConnectionPool& operator=(const HttpConnectionPool &);
+  };
+
+  /** Receives the response body of a HttpRequest piece by piece, while it is
+    * being downloaded (see HttpRequest::respSink).
+    */
+  class HttpResponseSink {
+  public:
+    /** Called once per request, before the first piece of response body is
+      * received (i.e., not at all if the body is empty).
+      * @param responseCode HTTP status code of the response
+      * @return true to receive the body through write(), false to have it
+      * stored in HttpRequest::respData instead.
+      */
+    virtual bool begin(long responseCode) = 0;
+
+    /** Called for each piece of the response body (after begin() returned true).
+      * An exception thrown from here aborts the transfer, and is rethrown by
+      * HttpRequest::send().
+      */
+    virtual void write(const char *data, size_t len) = 0;
+
+    /** Called after begin() returned true, with the length of the response
+      * body, if the response has a Content-Length header.
+      */
+    virtual void reserve(size_t /*len*/) { }
+
+    /** Returns true if the sink only stores the body (as the ones below do),
+      * i.e., takes little time per piece. In HTTP/2 mode, only such sinks
+      * receive the body while it's being downloaded (see HttpRequest::send()).
+      */
+    virtual bool storesOnly() const { return false; }
+
+    virtual ~HttpResponseSink() { }
+  };
+
+  /** Writes the body of a successful (2xx) response into a fixed buffer,
+    * owned by the caller. The body of other responses goes to respData.
+    */
+  class HttpBufferSink: public HttpResponseSink {
+  public:
+    HttpBufferSink(char *buffer, size_t capacity): buffer(buffer), capacity(capacity), length(0) { }
+
+    bool begin(long responseCode);
+    /** @throw HttpRequestException (RESPONSE_TOO_LARGE) If the body does not fit in the buffer */
+    void write(const char *data, size_t len);
+    void reserve(size_t len);
+    bool storesOnly() const { return true; }
+
+    /** Returns the number of bytes written into the buffer (by the last request) */
+    size_t size() const { return length; }
+
+  private:
+    char *buffer;
+    size_t capacity, length;
+  };
+
+  /** Appends the body of a successful (2xx) response to a string, owned by
+    * the caller, with room reserved from Content-Length. If the request is
+    * sent again (e.g., retried), what the previous attempt appended is
+    * replaced.
+    */
+  class HttpStringSink: public HttpResponseSink {
+  public:
+    explicit HttpStringSink(std::string &out): out(out), initial(out.size()) { }
+
+    bool begin(long responseCode);
+    void write(const char *data, size_t len);
+    void reserve(size_t len);
+    bool storesOnly() const { return true; }
+
+    /** Returns the number of bytes appended (by the last request) */
+    size_t size() const { return out.size() - initial; }
+
+  private:
+    std::string &out;
+    size_t initial;
+  };
+
+  /** Writes the body of a successful (2xx) response to a file descriptor,
+    * from the given offset in the file (so that ranges of a download can be
+    * written concurrently, each at its own place). The file position of fd
+    * is left unchanged, except on Windows.
+    */
+  class HttpFileSink: public HttpResponseSink {
+  public:
+    HttpFileSink(int fd, int64_t offset): fd(fd), offset(offset), length(0) { }
+
+    bool begin(long responseCode);
+    /** @throw HttpRequestException (SINK_WRITE_FAILED) If writing fails */
+    void write(const char *data, size_t len);
+    bool storesOnly() const { return true; }
+
+    /** Returns the number of bytes written (by the last request) */
+    size_t size() const { return length; }
+
+  private:
+    int fd;
+    int64_t offset;
+    size_t length;
+  };
+
   class HttpRequest {
   private:
 
     CURL *curl;
 
+    // Exception thrown by respSink (rethrown once libcurl returns)
+    std::exception_ptr sinkError;
+
+    // Request headers, in the form libcurl takes them (while a request is in progress)
+    curl_slist *reqHeaderList;
+
   public:
 
     HttpHeaders reqHeader, respHeader;
     HttpMethod method;
     std::string url;
     long responseCode;
+    // HTTP version of the response (one of CURL_HTTP_VERSION_*), or 0 if unknown
+    long httpVersion;
+    // Number of connections opened for the request (0 if it reused one)
+    long numConnects;
     //http://curl.haxx.se/libcurl/c/curl_easy_setopt.html#CURLOPTERRORBUFFER
     char errorBuffer[CURL_ERROR_SIZE + 1];
 
@@ -92,8 +310,18 @@ namespace dx {
     // implementation store it as contiguous storage, so no performance loss there.
     std::string respData;
 
+    // If set, the response body is handed over to it as it arrives (if it
+    // accepts it, see HttpResponseSink::begin()), instead of being stored in respData.
+    HttpResponseSink *respSink;
+
+    // True if the response body was handed over to respSink
+    bool respSinkUsed;
+
+    // Number of bytes in response body (whether stored in respData, or not)
+    size_t respLength;
+
     HttpRequest()
-      : curl(NULL), method(HTTP_POST), responseCode(-1) {
+      : curl(NULL), reqHeaderList(NULL), method(HTTP_POST), responseCode(-1), httpVersion(0), numConnects(0), respSink(NULL), respSinkUsed(false), respLength(0) {
         memset(errorBuffer, 0, CURL_ERROR_SIZE + 1); // Reset error buffer to zero
     }
 
@@ -116,8 +344,33 @@ namespace dx {
       setReqData(_data, _length);
     }
 
+    /** Sends the request (built by buildRequest(), or the set*() functions),
+      * and waits for the response. See HttpEngine for sending requests
+      * concurrently, without a thread per request.
+      *
+      * In HTTP/2 mode (see config::HTTP2()), the request goes through
+      * HttpEngine::send() instead, so that requests from all threads share
+      * (multiplexed) connections. The body is then handed over to respSink
+      * on the engine's I/O thread (shared by all the requests) only if the
+      * sink stores it (see HttpResponseSink::storesOnly()). Any other sink
+      * (e.g., a streaming parser) gets it on the calling thread, once the
+      * transfer is over: the complete body is stored in respData in the
+      * meantime, so it's held in memory whole (and the sink does not
+      * process it while it downloads).
+      * @throw HttpRequestException
+      */
     void send();
 
+    /** @internal
+      * send() in steps (used by HttpEngine): prepare() gets a curl handle
+      * (see handle()) set up for the request, complete() processes the
+      * outcome of the transfer, and abort() gives up on it.
+      */
+    void prepare();
+    void complete(CURLcode performResult);
+    void abort();
+    CURL* handle() const { return curl; }
+
     const HttpHeaders& getRespHeaders() const {
       return respHeader;
     }
@@ -130,19 +383,23 @@ namespace dx {
       respHeader.clear(); reqHeader.clear();
       reqData.data = NULL; reqData.length = 0u;
       respData = "";
+      respSink = NULL; respSinkUsed = false; respLength = 0u;
       responseCode = -1;
-      curl = NULL;
+      httpVersion = 0;
+      numConnects = 0;
+      abort(); // Anything left over by a send() which threw
       method = HTTP_POST;
       url = "";
     }
 
     ~HttpRequest() {
-      if (curl != NULL) {
-        curl_easy_cleanup(curl);
-      }
+      abort();
     }
     
     void assertLibCurlFunctions(CURLcode retVal, const std::string &msg);
+
+    // Used by the libcurl write callback: stores, or hands over a piece of response body
+    size_t receiveBody(const char *data, size_t len);
     
     static HttpRequest request(const HttpMethod& _method, const std::string& _url,
                                const HttpHeaders& _reqHeader = HttpHeaders(), const char* _data = NULL, const size_t& _length = 0u) {
@@ -152,6 +409,98 @@ namespace dx {
       return hr;
     }
 
+  private:
+    // Copy of reqData, consumed by the transfer (for HTTP_PUT)
+    reqData_struct reqDataToSend;
+  };
+
+  /** Sends HttpRequests concurrently, from a single I/O thread driving the
+    * libcurl multi interface, rather than from one thread per request
+    * (blocked in HttpRequest::send()). Requests draw their curl handles from
+    * HttpConnectionPool, as with send(); connections are kept by the multi
+    * handle between transfers.
+    * @code
+    * HttpRequest req;
+    * req.buildRequest(HTTP_GET, url, headers);
+    * HttpEngine::instance().submit(req, [&](HttpRequest &r, std::exception_ptr error) {
+    *   // On the I/O thread: r.responseCode, r.respData, ... are ready
+    * });
+    * @endcode
+    */
+  class HttpEngine {
+  public:
+    /** Called (on the I/O thread) when a request is complete. error is
+      * empty on success, or holds what HttpRequest::send() would have thrown.
+      * Callbacks must not block (no other request makes progress while one
+      * runs), nor throw; they may submit other requests.
+      */
+    typedef std::function<void(HttpRequest &req, std::exception_ptr error)> Callback;
+
+    /** Identifies a request submitted to the engine (see submit()). Ids are
+      * never reused (unlike the address of a HttpRequest, which may be sent
+      * again, or destroyed and replaced by another one), and never 0.
+      */
+    typedef unsigned long long TransferId;
+
+    /** Returns the engine shared by the whole process (its I/O thread is
+      * started on first use)
+      */
+    static HttpEngine& instance();
+
+    /** Returns true if HTTP/2 mode is on, i.e., if config::HTTP2() is set
+      * (and not "0"). Requests then negotiate HTTP/2 over TLS (falling back
+      * to HTTP/1.1 if the server does not support it), and wait for a
+      * connection to the host to be multiplexed on, rather than opening new
+      * ones.
+      */
+    static bool http2();
+
+    /** Starts sending req (built as for HttpRequest::send()), and returns
+      * the id to cancel it with. req must not be used, or destroyed, by the
+      * caller until "done" has been called (which may happen before submit()
+      * returns).
+      * @throw HttpRequestException If the request cannot be set up (in which
+      * case "done" is never called).
+      */
+    TransferId submit(HttpRequest &req, const Callback &done);
+
+    /** Aborts the request submitted as id, if it's in progress: its callback
+      * then gets an HttpRequestException with errorCode CANCELLED.
+      * Asynchronous: the request may complete normally before the
+      * cancellation is picked up. Does nothing once it's complete.
+      */
+    void cancel(TransferId id);
+
+    /** Sends req through the engine, and waits for it to complete (as
+      * HttpRequest::send() does). Must not be called from a Callback. Use
+      * submit() instead for a request that may have to be cancelled.
+      * @throw HttpRequestException
+      */
+    void send(HttpRequest &req);
+
+    /** Sets the maximum number of concurrent streams on a multiplexed
+      * (HTTP/2) connection. 0 (default) means the limit set by the server.
+      * Requires libcurl 7.67.0 or later (ignored otherwise).
+      */
+    void setMaxConcurrentStreams(long n);
+    long getMaxConcurrentStreams() const;
+
+    /** Sets the maximum number of connections to a host (requests beyond the
+      * limit wait for a connection). 0 (default) means no limit.
+      */
+    void setMaxHostConnections(long n);
+    long getMaxHostConnections() const;
+
+    /** Aborts the requests in progress (see cancel()), and stops the I/O thread */
+    ~HttpEngine();
+
+  private:
+    class Worker;
+    Worker *worker;
+
+    HttpEngine();
+    HttpEngine(const HttpEngine &);
+    HttpEngine& operator=(const HttpEngine &);
   };
 
   class HttpRequestException : public std::exception {
@@ -160,6 +509,9 @@ namespace dx {
       UNSUPPORTED_HTTP_METHOD = -1,
       INIT_FAILED = -2,
       ALREADY_IN_USE = -3,
+      CANCELLED = -4,
+      RESPONSE_TOO_LARGE = -5,
+      SINK_WRITE_FAILED = -6,
       DEFAULT_VALUE = -100 // Used just for default constructor (never actually set by any function)
     };
     std::string err;
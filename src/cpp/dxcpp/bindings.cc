@@ -79,14 +79,25 @@ namespace dx {
     } while (elapsed <= timeout);
   }
 
-  JSON DXDataObject::describe(bool incl_properties, bool incl_details) const {
+  // Input of /describe, for describe() and describeLazy()
+  static string describeInput(const string &proj, bool incl_properties, bool incl_details) {
     stringstream input_hash;
     input_hash << "{";
-    if (proj_ != "")
-      input_hash << "\"project\": \"" << proj_ << "\",";
+    if (proj != "")
+      input_hash << "\"project\": \"" << proj << "\",";
     input_hash << "\"properties\": " << (incl_properties ? "true" : "false")<<",";
     input_hash << "\"details\": " << ((incl_details) ? "true" : "false")<< "}";
-    return describe_(input_hash.str());
+    return input_hash.str();
+  }
+
+  JSON DXDataObject::describe(bool incl_properties, bool incl_details) const {
+    return describe_(describeInput(proj_, incl_properties, incl_details));
+  }
+
+  JSON DXDataObject::describeLazy(bool incl_properties, bool incl_details) const {
+    // Same route as describe_(), but the response is parsed lazily: details
+    // and properties can be big, and are often never looked at
+    return DXHTTPRequestLazy("/" + dxid_ + "/describe", describeInput(proj_, incl_properties, incl_details), true);
   }
 
   void DXDataObject::addTypes(const dx::JSON &types) const {
@@ -131,6 +142,16 @@ namespace dx {
     setProperties_(input_hash.str());
   }
 
+  void DXDataObject::updateProperties(const dx::JSON &current, const dx::JSON &properties) const {
+    if (current.type() != JSON_OBJECT || properties.type() != JSON_OBJECT)
+      throw DXError("updateProperties() requires two JSON hashes");
+    // A merge patch: properties which are removed are set to null, which
+    // is how /class-xxxx/setProperties unsets them
+    const JSON changes = JSON::diffMergePatch(current, properties);
+    if (changes.size() > 0)
+      setProperties(changes);
+  }
+
   dx::JSON DXDataObject::getProperties() const {
     return describe(true)["properties"];
   }
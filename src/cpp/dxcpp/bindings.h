@@ -163,6 +163,19 @@ namespace dx {
      */
     JSON describe(bool incl_properties=false, bool incl_details=false) const;
 
+    /**
+     * Same as describe(), except that the description is parsed lazily (see
+     * JSON::parseLazy()): e.g., big details or properties are never parsed if they are not
+     * looked at.
+     *
+     * @note Accessing a lazily parsed value (even through const functions) parses it in place, so
+     * the description must not be accessed from several threads at once (copy it first, with
+     * each thread using its own copy, or use describe()).
+     *
+     * @see describe()
+     */
+    JSON describeLazy(bool incl_properties=false, bool incl_details=false) const;
+
     /**
      * Adds the specified types to the object.
      *
@@ -248,6 +261,18 @@ namespace dx {
      */
     void setProperties(const JSON &properties) const;
 
+    /**
+     * Changes the properties of the object from current to properties, by
+     * setting only the properties which differ (and unsetting the ones which
+     * are not in properties). No request is made if there is no difference.
+     *
+     * @param current JSON hash mapping strings to strings: properties of the
+     * object, e.g., as returned by getProperties().
+     * @param properties JSON hash mapping strings to strings: the desired
+     * properties.
+     */
+    void updateProperties(const JSON &current, const JSON &properties) const;
+
     /**
      * Retrieves all properties of the object.
      *
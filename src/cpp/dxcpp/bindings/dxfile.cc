@@ -15,6 +15,8 @@
 //   under the License.
 
 #include <vector>
+#include <deque>
+#include <memory>
 #include <boost/lexical_cast.hpp>
 #include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp> //include all types plus i/o
@@ -27,7 +29,8 @@ using namespace std;
 
 namespace dx {
   // A helper function for making http requests with retry logic
-  void makeHTTPRequestForFileReadAndWrite(HttpRequest &resp, const string &url, const HttpHeaders &headers, const HttpMethod &method, const char *data = NULL, const size_t size=0u, const int MAX_TRIES = 5) {
+  // If given, sink receives the body of a successful response (see HttpRequest::respSink)
+  void makeHTTPRequestForFileReadAndWrite(HttpRequest &resp, const string &url, const HttpHeaders &headers, const HttpMethod &method, const char *data = NULL, const size_t size=0u, const int MAX_TRIES = 5, HttpResponseSink *sink = NULL) {
     DXLOG(logDEBUG) << "In makeHTTPRequestForFileReadAndWrite(), inputs:" << endl
                     << " --url = '" << url << "'" << endl
                     << " --MAX_TRIES = " << MAX_TRIES << endl
@@ -39,7 +42,10 @@ namespace dx {
     while (true) {
       try {
         DXLOG(logDEBUG) << "Attempting the actual HTTP request ...";
-        resp = HttpRequest::request(method, url, headers, data, size);
+        resp.clear();
+        resp.buildRequest(method, url, headers, data, size);
+        resp.respSink = sink;
+        resp.send();
         DXLOG(logDEBUG) << "Request completed, responseCode = '" << resp.responseCode << "'";
       } catch(HttpRequestException e) {
         DXLOG(logDEBUG) << "HttpRequestException thrown ... message = '" << e.what() << "'";
@@ -173,11 +179,11 @@ namespace dx {
 
     pos_ = endbyte + 1;
 
+    // The body lands directly in the caller's buffer
     HttpRequest resp;
-    makeHTTPRequestForFileReadAndWrite(resp, url, headers, HTTP_GET);
-
-    memcpy(ptr, resp.respData.data(), resp.respData.length());
-    gcount_ = resp.respData.length();
+    HttpBufferSink sink(ptr, n);
+    makeHTTPRequestForFileReadAndWrite(resp, url, headers, HTTP_GET, NULL, 0u, 5, &sink);
+    gcount_ = sink.size();
   }
 
   /////////////////////////////////////////////////////////////////////////////////
@@ -203,33 +209,41 @@ namespace dx {
     lq_url = dlResp["url"].get<string>();
     lq_headers = dlResp["headers"];
 
+#if !WINDOWS_BUILD
+    lq_readThreads_.push_back(boost::thread(boost::bind(&DXFile::readChunks_, this, std::max(thread_count, 1u))));
+#else
     for (unsigned i = 0; i < thread_count; ++i)
       lq_readThreads_.push_back(boost::thread(boost::bind(&DXFile::readChunk_, this)));
+#endif
+  }
+
+  namespace {
+    HttpHeaders rangeHeaders(const JSON &lq_headers, int64_t start, int64_t end) {
+      HttpHeaders headers;
+      headers["Range"] = "bytes=" + boost::lexical_cast<string>(start) + "-" + boost::lexical_cast<string>(end);
+      for (JSON::const_object_iterator it = lq_headers.object_begin(); it != lq_headers.object_end(); ++it)
+        headers[it->first] = it->second.get<string>();
+      return headers;
+    }
   }
 
+  // Appends bytes [start, end] of the file to result (the response bodies are written there directly).
   // Do *NOT* call this function with value of "end" past the (last - 1) byte of file, i.e.,
   // the Range: [start,end] should be a valid byte range in file (shouldn't be past the end of file)
   void DXFile::getChunkHttp_(int64_t start, int64_t end, string &result) const {
+    const size_t initial_size = result.size();
     int64_t last_byte_in_result = start - 1;
 
     while (last_byte_in_result < end) {
-      HttpHeaders headers;
-      string range = boost::lexical_cast<string>(last_byte_in_result + 1) + "-" + boost::lexical_cast<string>(end);
-      headers["Range"] = "bytes=" + range;
-      for (JSON::const_object_iterator it = lq_headers.object_begin(); it != lq_headers.object_end(); ++it)
-        headers[it->first] = it->second.get<string>();
+      HttpHeaders headers = rangeHeaders(lq_headers, last_byte_in_result + 1, end);
 
       HttpRequest resp;
-      makeHTTPRequestForFileReadAndWrite(resp, lq_url, headers, HTTP_GET);
-
-      if (result == "")
-        result = resp.respData;
-      else
-        result.append(resp.respData);
+      HttpStringSink sink(result);
+      makeHTTPRequestForFileReadAndWrite(resp, lq_url, headers, HTTP_GET, NULL, 0u, 5, &sink);
 
-      last_byte_in_result += resp.respData.size();
+      last_byte_in_result += sink.size();
     }
-    assert(result.size() == (end - start + 1));
+    assert(result.size() - initial_size == (end - start + 1));
   }
 
   void DXFile::readChunk_() const {
@@ -247,19 +261,111 @@ namespace dx {
 
       std::string tmp;
       getChunkHttp_(start, end, tmp);
+      storeChunk_(start, tmp);
+    }
+  }
 
-      boost::mutex::scoped_lock r_lock(lq_results_mutex_);
-      while (lq_next_result_ != start && lq_results_.size() >= lq_max_chunks_) {
-        r_lock.unlock();
-        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
-        r_lock.lock();
-      }
-      lq_results_[start] = tmp;
+  void DXFile::storeChunk_(int64_t start, std::string &chunk) const {
+    boost::mutex::scoped_lock r_lock(lq_results_mutex_);
+    while (lq_next_result_ != start && lq_results_.size() >= lq_max_chunks_) {
       r_lock.unlock();
-      boost::this_thread::interruption_point();
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+      r_lock.lock();
     }
+    lq_results_[start].swap(chunk);
+    r_lock.unlock();
+    boost::this_thread::interruption_point();
   }
 
+#if !WINDOWS_BUILD
+  namespace {
+    // A range request in flight, for DXFile::readChunks_()
+    struct ChunkRequest {
+      int64_t start, end;
+      HttpRequest req;
+      HttpEngine::TransferId id;
+      std::string data; // Body of a successful response (see sink)
+      HttpStringSink sink;
+      bool done;
+      std::exception_ptr error;
+
+      ChunkRequest(): id(0), sink(data) { }
+    };
+  }
+
+  // Fetches the chunks with up to max_requests range requests in flight at
+  // a time (sent by HttpEngine, from its I/O thread), rather than with one
+  // thread per request. Chunks are stored in order (the oldest request is
+  // always waited for first), which keeps the max_chunks limit of
+  // storeChunk_() from blocking a chunk that getNextChunk() is waiting for.
+  void DXFile::readChunks_(const unsigned max_requests) const {
+    boost::mutex done_mutex;
+    boost::condition_variable done_cond;
+    std::deque<std::shared_ptr<ChunkRequest> > inFlight;
+    try {
+      while (true) {
+        while (inFlight.size() < max_requests) {
+          boost::mutex::scoped_lock qs_lock(lq_query_start_mutex_);
+          if (lq_query_start_ >= lq_query_end_)
+            break; // We are done requesting all chunks
+          const int64_t start = lq_query_start_;
+          lq_query_start_ += lq_chunk_limit_;
+          qs_lock.unlock();
+
+          std::shared_ptr<ChunkRequest> c(new ChunkRequest());
+          c->start = start;
+          c->end = std::min((start + lq_chunk_limit_ - 1), lq_query_end_ - 1);
+          c->done = false;
+          c->req.buildRequest(HTTP_GET, lq_url, rangeHeaders(lq_headers, c->start, c->end));
+          c->req.respSink = &c->sink;
+          c->id = HttpEngine::instance().submit(c->req, [c, &done_mutex, &done_cond](HttpRequest &, std::exception_ptr error) {
+            boost::mutex::scoped_lock l(done_mutex);
+            c->error = error;
+            c->done = true;
+            done_cond.notify_all();
+          });
+          inFlight.push_back(c);
+        }
+        if (inFlight.empty())
+          break; // We are done fetching all chunks
+
+        std::shared_ptr<ChunkRequest> c = inFlight.front();
+        {
+          boost::mutex::scoped_lock l(done_mutex);
+          while (!c->done)
+            done_cond.wait(l);
+        }
+        inFlight.pop_front();
+
+        // Whatever did not arrive (failed request, or response cut short)
+        // is fetched again, with retries, by getChunkHttp_()
+        const size_t expected = c->end - c->start + 1;
+        std::string chunk;
+        if (!c->error && c->req.responseCode >= 200 && c->req.responseCode < 300 && c->data.size() <= expected) {
+          chunk.swap(c->data);
+        } else if (c->error) {
+          DXLOG(logWARNING) << "Range request for bytes " << c->start << "-" << c->end << " of " << dxid_ << " failed, retrying";
+        }
+        if (chunk.size() < expected)
+          getChunkHttp_(c->start + chunk.size(), c->end, chunk);
+        storeChunk_(c->start, chunk);
+      }
+    } catch (...) {
+      // Interrupted (by stopLinearQuery()), or failed: the requests in
+      // flight refer to locals, so they must be over before returning
+      boost::this_thread::disable_interruption di;
+      for (size_t i = 0; i < inFlight.size(); ++i)
+        HttpEngine::instance().cancel(inFlight[i]->id);
+      boost::mutex::scoped_lock l(done_mutex);
+      for (size_t i = 0; i < inFlight.size(); ++i) {
+        while (!inFlight[i]->done)
+          done_cond.wait(l);
+      }
+      throw;
+    }
+  }
+#endif
+
   bool DXFile::getNextChunk(string &chunk) const {
     if (lq_readThreads_.size() == 0) // Linear query was not called
       return false;
@@ -498,11 +604,10 @@ namespace dx {
       //  1) Total number of tries are exhausted (in which case we "throw")
       //  2) Request is completed (in which case we "break" from the loop)
 
+      const DXUploadURL resp = fileUploadURL(dxid_, input_params);
       HttpHeaders req_headers;
-      
-      const JSON resp = fileUpload(dxid_, input_params);
-      for (JSON::const_object_iterator it = resp["headers"].object_begin(); it != resp["headers"].object_end(); ++it)
-        req_headers[it->first] = it->second.get<string>();
+      for (map<string, string>::const_iterator it = resp.headers.begin(); it != resp.headers.end(); ++it)
+        req_headers[it->first] = it->second;
       
       req_headers["Content-Length"] = boost::lexical_cast<string>(n);
       req_headers["Content-Type"] = ""; // this is necessary because libcurl otherwise adds "Content-Type: application/x-www-form-urlencoded"
@@ -510,15 +615,15 @@ namespace dx {
       HttpRequest resp2;
       try {
         DXLOG(logDEBUG) << "In uploadPart(), index = " << index << ", calling makeHTTPRequestForFileReadAndWrite() ...";
-        makeHTTPRequestForFileReadAndWrite(resp2, resp["url"].get<string>(), req_headers, HTTP_POST, ptr, n, 1);
+        makeHTTPRequestForFileReadAndWrite(resp2, resp.url, req_headers, HTTP_POST, ptr, n, 1);
         DXLOG(logDEBUG) << "In uploadPart(), index = " << index << ", makeHTTPRequestForFileReadAndWrite() finished";
         break; // request successfully completed, break from the loop
       } catch (DXFileError &e) {
         DXLOG(logDEBUG) << "DXFileError thrown, tries = " << tries << ", MAX_TRIES = " << MAX_TRIES;
         if (tries >= MAX_TRIES)
-          throw DXFileError("POST '" + resp["url"].get<string>() + "' failed after " + boost::lexical_cast<string>(tries) + " number of tries. Giving up. Error message in last try: '" + e.what() + "'");
+          throw DXFileError("POST '" + resp.url + "' failed after " + boost::lexical_cast<string>(tries) + " number of tries. Giving up. Error message in last try: '" + e.what() + "'");
         int sleep = (1<<tries);
-        DXLOG(logWARNING) << "POST '" << resp["url"].get<string>() << "' failed in try #" << tries << " of " << MAX_TRIES << ". Retrying in " << sleep << " seconds ... Error message: '" << e.what() << "'";
+        DXLOG(logWARNING) << "POST '" << resp.url << "' failed in try #" << tries << " of " << MAX_TRIES << ". Retrying in " << sleep << " seconds ... Error message: '" << e.what() << "'";
         boost::this_thread::interruption_point();
         _internal::sleepUsingNanosleep(sleep);
         DXLOG(logDEBUG) << "Sleep finished, will continue retrying the uploadPart() request...";
@@ -100,6 +100,8 @@ namespace dx {
    
     // For linear query ///////////////////////////////////////////////
     void readChunk_() const;
+    void readChunks_(unsigned max_requests) const;
+    void storeChunk_(int64_t start, std::string& chunk) const;
     void getChunkHttp_(int64_t start, int64_t end, std::string& result) const;
     ///////////////////////////////////////////////////////////////////
 
@@ -501,7 +503,9 @@ namespace dx {
      * @param num_bytes Total number of bytes to be fetched. If not specified, all data to the end of the file is read.
      * @param chunk_size Number of bytes to be fetched in each chunk. (Each chunk will be this length, except possibly the last one, which may be shorter.)
      * @param max_chunks Number of fetched chunks to be kept in memory at any time. Note that the number of real chunks in memory could be as high as (max_chunks + thread_count).
-     * @param thread_count Number of threads to be used for fetching data.
+     * @param thread_count Number of chunks to be fetched concurrently. (The requests are sent by
+     * HttpEngine, from its I/O thread, plus one thread of this File; except on Windows, where
+     * this is the number of threads used for fetching data.)
      *
      * @see stopLinearQuery(), getNextChunk()
      */
@@ -61,7 +61,8 @@ namespace dx {
     return to_ret;
   }
 
-  JSON DXSystem::findDataObjects(JSON query) {
+  // Resolves the timestamps, and the default project, of a findDataObjects query
+  static void adjustFindDataObjectsQuery(JSON &query) {
     if (query.has("modified")) {
       query["modified"] = getTimestampAdjustedField(query["modified"]);
     }
@@ -75,9 +76,19 @@ namespace dx {
         query["scope"]["project"] = config::CURRENT_PROJECT();
       }
     }
+  }
+
+  JSON DXSystem::findDataObjects(JSON query) {
+    adjustFindDataObjectsQuery(query);
     return systemFindDataObjects(query); 
   }
 
+  JSON DXSystem::findDataObjectsLazy(JSON query) {
+    adjustFindDataObjectsQuery(query);
+    // Results are parsed lazily (only the parts which are accessed are parsed)
+    return DXHTTPRequestLazy("/system/findDataObjects", query.toString(), true);
+  }
+
   JSON DXSystem::findOneDataObject(JSON query) {
     query["limit"] = 1;
     JSON res = findDataObjects(query);
@@ -63,6 +63,19 @@ namespace dx {
      */
     static dx::JSON findDataObjects(dx::JSON query);
 
+    /**
+     * Same as findDataObjects(), except that the result is parsed lazily (see
+     * dx::JSON::parseLazy()): only the parts which are accessed are ever parsed, which is much
+     * cheaper for large results (e.g., with "describe") of which little is looked at.
+     *
+     * @note Accessing a lazily parsed value (even through const functions) parses it in place, so
+     * the result must not be accessed from several threads at once (copy it first, with each
+     * thread using its own copy, or use findDataObjects()).
+     *
+     * @see findDataObjects()
+     */
+    static dx::JSON findDataObjectsLazy(dx::JSON query);
+
     /**
      * Exactly the same as findDataObjects(), except that only the first result is returned (or null
      * if there are no results).
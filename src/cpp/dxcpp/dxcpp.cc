@@ -24,6 +24,7 @@
 #include "dxlog.h"
 #include "dxcpp.h"
 #include "SimpleHttp.h"
+#include "dxjson/reader.h"
 #include "ignore_sigpipe.h"
 #include "utils.h"
 
@@ -107,8 +108,132 @@ namespace dx {
     return (c == 2 || c == 5 || c == 6 || c == 7 || c == 35);
   }
 
+  // Interprets body of a successful (200) response from the API server.
+  // parse() must throw JSONException if the body is not a valid JSON.
+  //
+  // A parser which can consume the body while it is being downloaded returns
+  // a HttpResponseSink from sink(). Body of a 200 response is then handed over
+  // to the sink instead of parse(), and finish() is called once the transfer
+  // is complete (it must throw JSONException if the body was not a valid JSON).
+  class DXResponseParser {
+  public:
+    virtual void parse(string &body) = 0;
+    virtual HttpResponseSink* sink() { return NULL; }
+    virtual void finish() { }
+
+    // Returns (at most) first 1000 bytes of the response body, for error messages
+    virtual string bodyExcerpt(const HttpRequest &req) const { return req.respData.substr(0, 1000); }
+
+    virtual ~DXResponseParser() { }
+  };
+
+  // Builds the JSON object while the response is being downloaded, so the
+  // complete body is never held in memory (only the resulting object is).
+  // If JSON::setParallelThreads() was called with more than one thread,
+  // large bodies (e.g., of findDataObjects, or gtableGet) are stored
+  // instead, and parsed on several threads once complete (see
+  // JSON::parseParallel()): the body and the object are then both held in
+  // memory, for a while.
+  class DXJSONResponseParser: public DXResponseParser, public HttpResponseSink {
+  public:
+    JSON out;
+
+    // Bodies (with a Content-Length) at least this large are stored, and
+    // parsed by parseParallel() (which does not split smaller ones), when
+    // asked to (see JSON::parallelParseRequested())
+    static const size_t PARALLEL_PARSE_MIN_BYTES = 1u << 20;
+
+    DXJSONResponseParser(): pushParser(builder), failed(false), buffered(false) { }
+
+    void parse(string &body) { out = JSON::parseParallel(body); }
+    HttpResponseSink* sink() { return this; }
+
+    bool begin(long responseCode) {
+      if (responseCode != 200)
+        return false;
+      builder = JSONBuilder();
+      pushParser.reset();
+      failed = false;
+      buffered = false;
+      body.clear();
+      head.clear();
+      return true;
+    }
+
+    void reserve(size_t len) {
+      if (len >= PARALLEL_PARSE_MIN_BYTES && JSON::parallelParseRequested()) {
+        buffered = true;
+        body.reserve(len);
+      }
+    }
+
+    // Parse errors are reported by finish(), so that the complete body is
+    // received (and checked against Content-Length) as usual.
+    void write(const char *data, size_t len) {
+      if (head.size() < 1000u)
+        head.append(data, min(len, 1000u - head.size()));
+      if (buffered) {
+        body.append(data, len);
+        return;
+      }
+      if (failed)
+        return;
+      try {
+        pushParser.feed(data, len);
+      } catch (JSONException &e) {
+        failed = true;
+        error = e.what();
+      }
+    }
+
+    void finish() {
+      if (buffered) {
+        out = JSON::parseParallel(body);
+        string().swap(body);
+        return;
+      }
+      if (failed)
+        throw JSONException(error);
+      pushParser.finish();
+      out = std::move(builder.result());
+    }
+
+    string bodyExcerpt(const HttpRequest &req) const {
+      return (req.respSinkUsed) ? head : DXResponseParser::bodyExcerpt(req);
+    }
+
+  private:
+    JSONBuilder builder;
+    JSONPushParser pushParser;
+    bool failed;
+    string error;
+    string head;
+    bool buffered; // Body is stored in "body" (see reserve())
+    string body;
+  };
+
+  // Only validates the body (without building a JSON object out of it)
+  class DXRawResponseParser: public DXResponseParser {
+  public:
+    string out;
+    void parse(string &body) {
+      JSONReader reader(body.data(), body.size());
+      while (reader.next());
+      out.swap(body);
+    }
+  };
+
+  // Takes over the body, without parsing it (see JSON::parseLazy(), which
+  // checks its structure)
+  class DXLazyResponseParser: public DXResponseParser {
+  public:
+    JSON out;
+    void parse(string &body) { out = JSON::parseLazy(std::move(body)); }
+  };
+
   // Note: We only consider 200 as a successful response, all others are considered "failures"
-  JSON DXHTTPRequest(const string &resource, const string &data, const bool safeToRetry, const map<string, string> &headers) {
+  static void DXHTTPRequest_(const string &resource, const string &data, const bool safeToRetry, const map<string, string> &headers,
+                             DXResponseParser &parser) {
     DXLOG(logDEBUG) << "In DXHTTPRequest(), inputs:" << endl
                   << " --resources = '" << resource << "'" << endl
                   << " --safeToRetry = " << safeToRetry << endl
@@ -182,7 +307,10 @@ namespace dx {
       try {
         DXLOG(logDEBUG) << "Attempting the actual HTTP request (countTries = " << countTries << ")...";
         // Attempt a POST request
-        req = HttpRequest::request(HTTP_POST, url, req_headers, data.data(), data.size());
+        req.clear();
+        req.buildRequest(HTTP_POST, url, req_headers, data.data(), data.size());
+        req.respSink = parser.sink();
+        req.send();
         DXLOG(logDEBUG) << "Request completed, responseCode = '" << req.responseCode << "'";
       } catch (HttpRequestException &e) {
         DXLOG(logDEBUG) << "HttpRequestException thrown ... message = '" << e.what() << "'";
@@ -214,21 +342,24 @@ namespace dx {
           // We are here => The request went thru, we got 200 and a response
           string clHeader; // content-length header
           contentLengthMissing = !req.respHeader.getHeaderString("Content-Length", clHeader);
-          contentLengthMismatch = !contentLengthMissing && (boost::lexical_cast<size_t>(clHeader) != req.respData.size());
+          contentLengthMismatch = !contentLengthMissing && (boost::lexical_cast<size_t>(clHeader) != req.respLength);
           if (contentLengthMismatch) {
             // This is an error situation for us, retry only if explicitly asked
             toRetry = safeToRetry;
             DXLOG(logWARNING) << "POST '" << url << "': Expected Content-Length to be '" << clHeader << "' (from Content-Length header)"
-                              << "but received " << req.respData.size() << ", retry = " << ((safeToRetry) ? "true" : "false");
+                              << "but received " << req.respLength << ", retry = " << ((safeToRetry) ? "true" : "false");
           } else {
             try {
-              JSON out = JSON::parse(req.respData);
+              if (req.respSinkUsed)
+                parser.finish();
+              else
+                parser.parse(req.respData);
               if (countTries != 0u) {
                 // if at least one retry was made, print eventual success on stderr
                 DXLOG(logWARNING) << "Request completed successfully in Retry #" << countTries;
               }
               DXLOG(logDEBUG) << "Exiting DXHTTPRequest() successfully";
-              return out;
+              return;
             } catch (JSONException &je) {
               if (contentLengthMissing) {
                 DXLOG(logWARNING) << "POST '" << url << "': Unable to parse response from server as valid JSON, and no 'Content-Length' header was found either"
@@ -239,8 +370,8 @@ namespace dx {
                                 << clHeader << "). Will throw DXError()";
                 ostringstream errStr;
                 errStr << "\nERROR: Unable to parse output returned by Apiserver as JSON (and 'Content-length' header was present = " << clHeader << ")" << endl;
-                errStr << "HttpRequest url: " << url << "; response code: " << req.responseCode << "; response size: '" << req.respData.size()
-                       << "; response body: '" << req.respData.substr(0, 1000) << "'" << endl; // return at most 1000 characters from response (don't overwhelm user!)
+                errStr << "HttpRequest url: " << url << "; response code: " << req.responseCode << "; response size: '" << req.respLength
+                       << "; response body: '" << parser.bodyExcerpt(req) << "'" << endl; // return at most 1000 characters from response (don't overwhelm user!)
                 errStr << "JSONException: '" << je.what() << "'" << endl;
                 throw DXError(errStr.str(), "UnableToParseAsJSON");
               }
@@ -301,6 +432,37 @@ namespace dx {
     // Unreachable line
   }
 
+  JSON DXHTTPRequest(const string &resource, const string &data, const bool safeToRetry, const map<string, string> &headers) {
+    DXJSONResponseParser parser;
+    DXHTTPRequest_(resource, data, safeToRetry, headers, parser);
+    return std::move(parser.out);
+  }
+
+  string DXHTTPRequestRaw(const string &resource, const string &data, const bool safeToRetry, const map<string, string> &headers) {
+    DXRawResponseParser parser;
+    DXHTTPRequest_(resource, data, safeToRetry, headers, parser);
+    return std::move(parser.out);
+  }
+
+  JSON DXHTTPRequestLazy(const string &resource, const string &data, const bool safeToRetry, const map<string, string> &headers) {
+    DXLazyResponseParser parser;
+    DXHTTPRequest_(resource, data, safeToRetry, headers, parser);
+    return std::move(parser.out);
+  }
+
+  const JSONFields<DXUploadURL>& DXUploadURL::jsonFields() {
+    static const JSONFields<DXUploadURL> fields = JSONFields<DXUploadURL>()
+      .required("url", &DXUploadURL::url)
+      .optional("headers", &DXUploadURL::headers);
+    return fields;
+  }
+
+  DXUploadURL fileUploadURL(const string &object_id, const JSON &input_params, const bool safe_to_retry) {
+    DXUploadURL out;
+    bindJSON(DXHTTPRequestRaw("/" + object_id + "/upload", input_params.toString(), safe_to_retry), out);
+    return out;
+  }
+
   // This sub-namespace contains loadFromEnvironment(), and several other helper functions/variables,
   // which are used for reading dxcpp configuration when the library is loaded
   // -> Configuration is read by a constructor of a global variable (so before main() is loaded)
@@ -363,14 +525,13 @@ namespace dx {
       }
       if (g_json_config_file_contents.type() == JSON_UNDEFINED) {
         // This is the first time this function is called, so parse the file, sanity check etc   
-        ifstream fp(fname, std::fstream::in);
-        if (!fp.is_open()) {
+        if (!ifstream(fname).is_open()) {
           // file not found
           g_json_config_file_contents = JSON(JSON_NULL);
           return false;
         }
         try {
-          g_json_config_file_contents.read(fp);
+          g_json_config_file_contents = JSON::loadFile(fname);
         } catch (JSONException &j) {
           DXLOG(logWARNING) << "An error occured while trying to parse the JSON file '" << fname << "'. Will ignore contents of this file."
                << "Error = '" << j.what() << "'";
@@ -462,6 +623,7 @@ namespace dx {
       getFromEnvOrConfig("DX_APISERVER_PROTOCOL", APISERVER_PROTOCOL());
       getFromEnvOrConfig("DX_CA_CERT", CA_CERT());
       getFromEnvOrConfig("DX_LIBCURL_VERBOSE", LIBCURL_VERBOSE());
+      getFromEnvOrConfig("DX_HTTP2", HTTP2());
       getFromEnvOrConfig("DX_JOB_ID", JOB_ID());
       getFromEnvOrConfig("DX_WORKSPACE_ID", WORKSPACE_ID());
       getFromEnvOrConfig("DX_PROJECT_CONTEXT_ID", PROJECT_CONTEXT_ID());
@@ -501,6 +663,7 @@ namespace dx {
       DXLOG(logINFO) << "11. Current Project: " << getVariableForPrinting(CURRENT_PROJECT());
       DXLOG(logINFO) << "12. User Agent String: " << getVariableForPrinting(USER_AGENT_STRING());
       DXLOG(logINFO) << "13. Libcurl verbose: " << getVariableForPrinting(LIBCURL_VERBOSE());
+      DXLOG(logINFO) << "14. HTTP/2: " << getVariableForPrinting(HTTP2());
       DXLOG(logINFO) << "***** Will exit loadFromEnvironment() function in dxcpp.cc *****";
       
       g_config_file_contents_old.clear(); // Remove the contents of config file - we no longer need them
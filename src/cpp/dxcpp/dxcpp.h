@@ -22,6 +22,7 @@
 #include <map>
 #include <string>
 #include "dxjson/dxjson.h"
+#include "dxjson/bind.h"
 
 // A macro to allow unused variable (without throwing warning)
 // Does work for GCC, will need to be expanded for other compilers.
@@ -73,6 +74,58 @@ namespace dx {
   dx::JSON DXHTTPRequest(const std::string &resource, const std::string &data, const bool safeToRetry = false,
                          const std::map<std::string, std::string> &headers = std::map<std::string, std::string>());
 
+  /**
+   * Same as DXHTTPRequest(), except that the response body is returned as is,
+   * instead of being parsed into a JSON object. The body is guaranteed to be
+   * valid JSON. This is meant to be used with dx::JSONReader, for scanning
+   * large responses without materializing them.
+   *
+   * @param resource API server route to access, e.g. "/file/new"
+   * @param data Data to send in the request
+   * @param safeToRetry If true, indicates that the request is idempotent and that a failed request may be retried. Defaults to false.
+   * @param headers Additional HTTP headers to include in the request
+   * @return The (serialized JSON) response body from the API server
+   */
+  std::string DXHTTPRequestRaw(const std::string &resource, const std::string &data, const bool safeToRetry = false,
+                               const std::map<std::string, std::string> &headers = std::map<std::string, std::string>());
+
+  /**
+   * Same as DXHTTPRequest(), except that the response is parsed lazily (see
+   * dx::JSON::parseLazy()). Only its structure is checked (that brackets and
+   * quotes match up): errors inside it are found when the parts containing
+   * them are accessed.
+   *
+   * @param resource API server route to access, e.g. "/file/new"
+   * @param data Data to send in the request
+   * @param safeToRetry If true, indicates that the request is idempotent and that a failed request may be retried. Defaults to false.
+   * @param headers Additional HTTP headers to include in the request
+   * @return The response from the API server, parsed lazily
+   */
+  dx::JSON DXHTTPRequestLazy(const std::string &resource, const std::string &data, const bool safeToRetry = false,
+                             const std::map<std::string, std::string> &headers = std::map<std::string, std::string>());
+
+  /**
+   * The part of the response of /file-xxxx/upload needed to upload a part:
+   * the URL to upload it to, and the headers to send along.
+   */
+  struct DXUploadURL {
+    std::string url;
+    std::map<std::string, std::string> headers;
+
+    static const dx::JSONFields<DXUploadURL>& jsonFields();
+  };
+
+  /**
+   * Same as fileUpload(), but the response is read directly into a
+   * DXUploadURL (see dx::bindJSON()), instead of into a JSON object.
+   *
+   * @param object_id ID of the file
+   * @param input_params Input hash of /file-xxxx/upload (e.g., the part index)
+   * @param safe_to_retry If true, the request may be retried
+   * @return The upload URL and headers
+   */
+  DXUploadURL fileUploadURL(const std::string &object_id, const dx::JSON &input_params, const bool safe_to_retry = true);
+
   /**
    * Loads the data from environment variables and calls setAPIServerInfo(),
    * setSecurityContext(), setWorkspaceID(), and setProjectContext() as
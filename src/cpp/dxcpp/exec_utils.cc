@@ -23,13 +23,13 @@ using namespace std;
 
 namespace dx {
   void dxLoadInput(JSON &input) {
-    ifstream ifs(joinPath(getUserHomeDirectory(), "job_input.json"));
-    input.read(ifs);
+    input = JSON::loadFile(joinPath(getUserHomeDirectory(), "job_input.json"));
   }
 
   void dxWriteOutput(const JSON &output) {
     ofstream ofs(joinPath(getUserHomeDirectory(), "job_output.json"));
-    ofs << output.toString() << endl;
+    output.write(ofs);
+    ofs << endl;
     ofs.close();
   }
 
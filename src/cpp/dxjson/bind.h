@@ -0,0 +1,258 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_BIND_H__
+#define __DXJSON_BIND_H__
+
+#include <map>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+
+#include "dxjson.h"
+#include "reader.h"
+
+/** @file */
+
+namespace dx {
+
+  template<typename T> class JSONFields;
+
+  /** Reads serialized JSON into a C++ struct, whose fields are bound to keys
+    * of a JSON object, directly from a JSONReader (i.e., without building a
+    * JSON object). Keys which are not bound are skipped.
+    *
+    * A struct is bound by a static member function jsonFields(), returning
+    * the binding of its fields. The types supported for fields are:
+    * std::string, bool, integral types, double, JSON (any value), structs
+    * which are bound themselves, std::vector of any of these (for a
+    * JSON_ARRAY), and std::map<std::string, ...> (for a JSON_OBJECT).
+    * @code
+    * struct UploadURL {
+    *   std::string url;
+    *   std::map<std::string, std::string> headers;
+    *
+    *   static const JSONFields<UploadURL>& jsonFields() {
+    *     static const JSONFields<UploadURL> fields = JSONFields<UploadURL>()
+    *       .required("url", &UploadURL::url)
+    *       .optional("headers", &UploadURL::headers);
+    *     return fields;
+    *   }
+    * };
+    *
+    * UploadURL u;
+    * bindJSON(DXHTTPRequestRaw("/" + fileID + "/upload", input), u);
+    * @endcode
+    * @note Optional fields which are missing (or null) keep their value.
+    * If a key appears more than once, the last one wins.
+    */
+  template<typename T>
+  class JSONFields {
+  public:
+    /** Binds a field which must be present in the JSON object (and must not be null) */
+    template<typename M>
+    JSONFields& required(const std::string &key, M T::*member) {
+      fields.push_back(std::make_shared<Field<M> >(key, member, true));
+      return *this;
+    }
+
+    /** Binds a field which may be absent from the JSON object */
+    template<typename M>
+    JSONFields& optional(const std::string &key, M T::*member) {
+      fields.push_back(std::make_shared<Field<M> >(key, member, false));
+      return *this;
+    }
+
+    /** Reads a JSON_OBJECT into out. The reader must be at its
+      * JSON_EVENT_START_OBJECT event, and is left at the matching
+      * JSON_EVENT_END_OBJECT event.
+      * @throw JSONException If the value is not a JSON_OBJECT, a required key
+      * is missing, or a value has a type not matching its field.
+      */
+    void read(JSONReader &reader, T &out) const;
+
+  private:
+    struct FieldBase {
+      std::string key;
+      bool isRequired;
+      FieldBase(const std::string &key_, bool isRequired_): key(key_), isRequired(isRequired_) {}
+      virtual void read(JSONReader &reader, T &out) const = 0;
+      virtual ~FieldBase() { }
+    };
+
+    template<typename M>
+    struct Field: public FieldBase {
+      M T::*member;
+      Field(const std::string &key_, M T::*member_, bool isRequired_): FieldBase(key_, isRequired_), member(member_) {}
+      void read(JSONReader &reader, T &out) const;
+    };
+
+    std::vector<std::shared_ptr<FieldBase> > fields;
+  };
+
+  /** @internal
+    * Reads the value at the current event of the reader (which must be the
+    * first event of the value) into out, and leaves the reader at the last
+    * event of the value. Specialized for each supported type.
+    */
+  template<typename T, typename Enable = void>
+  struct JSONBinder {
+    static void read(JSONReader &reader, T &out) { T::jsonFields().read(reader, out); }
+  };
+
+  /** @internal Throws a JSONException unless the reader is at a value of the given type */
+  inline void expectJSONType(const JSONReader &reader, JSONValue type, const char *name) {
+    if (reader.type() != type)
+      throw JSONException(std::string("Expected ") + name);
+  }
+
+  template<>
+  struct JSONBinder<std::string> {
+    static void read(JSONReader &reader, std::string &out) {
+      expectJSONType(reader, JSON_STRING, "a JSON_STRING");
+      out = reader.getString();
+    }
+  };
+
+  template<>
+  struct JSONBinder<bool> {
+    static void read(JSONReader &reader, bool &out) {
+      expectJSONType(reader, JSON_BOOLEAN, "a JSON_BOOLEAN");
+      out = reader.getBoolean();
+    }
+  };
+
+  template<typename T>
+  struct JSONBinder<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+    static void read(JSONReader &reader, T &out) {
+      expectJSONType(reader, JSON_INTEGER, "a JSON_INTEGER");
+      const int64_t i = reader.getInteger();
+      out = static_cast<T>(i);
+      if (static_cast<int64_t>(out) != i || (!std::is_signed<T>::value && i < 0))
+        throw JSONException("Integer out of range: " + boost::lexical_cast<std::string>(i));
+    }
+  };
+
+  template<>
+  struct JSONBinder<double> {
+    static void read(JSONReader &reader, double &out) {
+      if (reader.type() == JSON_INTEGER)
+        out = static_cast<double>(reader.getInteger());
+      else {
+        expectJSONType(reader, JSON_REAL, "a JSON_REAL or JSON_INTEGER");
+        out = reader.getReal();
+      }
+    }
+  };
+
+  template<>
+  struct JSONBinder<JSON> {
+    static void read(JSONReader &reader, JSON &out) { out = reader.readValue(); }
+  };
+
+  template<typename T>
+  struct JSONBinder<std::vector<T> > {
+    static void read(JSONReader &reader, std::vector<T> &out) {
+      expectJSONType(reader, JSON_ARRAY, "a JSON_ARRAY");
+      out.clear();
+      while (reader.next() && reader.event() != JSON_EVENT_END_ARRAY) {
+        out.push_back(T());
+        JSONBinder<T>::read(reader, out.back());
+      }
+    }
+  };
+
+  template<typename T>
+  struct JSONBinder<std::map<std::string, T> > {
+    static void read(JSONReader &reader, std::map<std::string, T> &out) {
+      expectJSONType(reader, JSON_OBJECT, "a JSON_OBJECT");
+      out.clear();
+      while (reader.next() && reader.event() == JSON_EVENT_KEY) {
+        const std::string key = reader.key();
+        T &value = out[key];
+        reader.next();
+        try {
+          JSONBinder<T>::read(reader, value);
+        } catch (JSONException &e) {
+          throw JSONException("Value of key \"" + key + "\": " + e.err);
+        }
+      }
+    }
+  };
+
+  template<typename T>
+  void JSONFields<T>::read(JSONReader &reader, T &out) const {
+    expectJSONType(reader, JSON_OBJECT, "a JSON_OBJECT");
+    std::vector<bool> found(fields.size(), false);
+    while (reader.next() && reader.event() == JSON_EVENT_KEY) {
+      size_t i = 0;
+      while (i < fields.size() && fields[i]->key != reader.key())
+        ++i;
+      if (i == fields.size()) {
+        reader.skip();
+        continue;
+      }
+      reader.next();
+      if (reader.type() == JSON_NULL && !fields[i]->isRequired)
+        continue;
+      fields[i]->read(reader, out);
+      found[i] = true;
+    }
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields[i]->isRequired && !found[i])
+        throw JSONException("Missing required key \"" + fields[i]->key + "\"");
+    }
+  }
+
+  template<typename T>
+  template<typename M>
+  void JSONFields<T>::Field<M>::read(JSONReader &reader, T &out) const {
+    try {
+      JSONBinder<M>::read(reader, out.*member);
+    } catch (JSONException &e) {
+      throw JSONException("Value of key \"" + this->key + "\": " + e.err);
+    }
+  }
+
+  /** Reads the value at the current position of the reader (see JSONBinder)
+    * into out. If the reader is before the value (JSON_EVENT_NONE), or at its
+    * key (JSON_EVENT_KEY), it's advanced to the value first.
+    * @throw JSONException If illegal JSON is encountered, or the value does
+    * not match out (see JSONFields).
+    */
+  template<typename T>
+  void bindJSON(JSONReader &reader, T &out) {
+    if (reader.event() == JSON_EVENT_NONE || reader.event() == JSON_EVENT_KEY)
+      reader.next();
+    JSONBinder<T>::read(reader, out);
+  }
+
+  /** Reads the serialized JSON value held in buffer into out (see JSONFields) */
+  template<typename T>
+  void bindJSON(const char *data, size_t len, T &out) {
+    JSONReader reader(data, len);
+    bindJSON(reader, out);
+  }
+
+  template<typename T>
+  void bindJSON(const std::string &data, T &out) {
+    bindJSON(data.data(), data.size(), out);
+  }
+}
+
+#endif
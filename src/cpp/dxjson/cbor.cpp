@@ -0,0 +1,436 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "cbor.h"
+#include <cmath>
+
+using namespace dx;
+
+namespace {
+
+  // Major types of CBOR items
+  enum Major {
+    MAJOR_UNSIGNED = 0,
+    MAJOR_NEGATIVE = 1,
+    MAJOR_BYTES = 2,
+    MAJOR_TEXT = 3,
+    MAJOR_ARRAY = 4,
+    MAJOR_MAP = 5,
+    MAJOR_TAG = 6,
+    MAJOR_SIMPLE = 7
+  };
+
+  const unsigned char CBOR_FALSE = 0xf4;
+  const unsigned char CBOR_TRUE = 0xf5;
+  const unsigned char CBOR_NULL = 0xf6;
+  const unsigned char CBOR_FLOAT64 = 0xfb;
+
+  // Appends the initial byte of an item (and its argument, in big endian)
+  void writeHead(Major major, uint64_t arg, std::string &out) {
+    unsigned char buf[9];
+    size_t n;
+    if (arg < 24) {
+      buf[0] = static_cast<unsigned char>((major << 5) | arg);
+      n = 0;
+    } else if (arg <= 0xffu) {
+      buf[0] = static_cast<unsigned char>((major << 5) | 24);
+      n = 1;
+    } else if (arg <= 0xffffu) {
+      buf[0] = static_cast<unsigned char>((major << 5) | 25);
+      n = 2;
+    } else if (arg <= 0xffffffffu) {
+      buf[0] = static_cast<unsigned char>((major << 5) | 26);
+      n = 4;
+    } else {
+      buf[0] = static_cast<unsigned char>((major << 5) | 27);
+      n = 8;
+    }
+    for (size_t i = 0; i < n; ++i)
+      buf[n - i] = static_cast<unsigned char>(arg >> (8 * i));
+    out.append(reinterpret_cast<const char*>(buf), n + 1);
+  }
+
+  void writeValue(const JSON &j, std::string &out) {
+    switch (j.type()) {
+      case JSON_INTEGER: {
+        const int64_t i = j.i;
+        if (i >= 0)
+          writeHead(MAJOR_UNSIGNED, static_cast<uint64_t>(i), out);
+        else
+          writeHead(MAJOR_NEGATIVE, static_cast<uint64_t>(-1 - i), out);
+        break;
+      }
+      case JSON_REAL: {
+        const double d = j.d;
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        unsigned char buf[9];
+        buf[0] = CBOR_FLOAT64;
+        for (size_t i = 0; i < 8; ++i)
+          buf[8 - i] = static_cast<unsigned char>(bits >> (8 * i));
+        out.append(reinterpret_cast<const char*>(buf), 9);
+        break;
+      }
+      case JSON_STRING: {
+        const std::string &s = static_cast<const String*>(j.val)->val;
+        writeHead(MAJOR_TEXT, s.size(), out);
+        out.append(s);
+        break;
+      }
+      case JSON_BOOLEAN:
+        out.push_back(static_cast<char>(j.b ? CBOR_TRUE : CBOR_FALSE));
+        break;
+      case JSON_NULL:
+        out.push_back(static_cast<char>(CBOR_NULL));
+        break;
+      case JSON_ARRAY: {
+        const std::vector<JSON> &arr = static_cast<const Array*>(j.val)->val;
+        writeHead(MAJOR_ARRAY, arr.size(), out);
+        for (size_t i = 0; i < arr.size(); ++i)
+          writeValue(arr[i], out);
+        break;
+      }
+      case JSON_OBJECT: {
+        writeHead(MAJOR_MAP, j.size(), out);
+        for (JSON::const_object_iterator it = j.object_begin(); it != j.object_end(); ++it) {
+          writeHead(MAJOR_TEXT, it->first.size(), out);
+          out.append(it->first);
+          writeValue(it->second, out);
+        }
+        break;
+      }
+      default:
+        throw JSONException("Cannot encode a JSON_UNDEFINED value as CBOR");
+    }
+  }
+
+  // A decoded item. For arrays/objects only the head is decoded (and "count"
+  // is number of elements/members).
+  struct Item {
+    JSONValue type;
+    uint64_t count;
+    JSONStringRef str;
+    int64_t i;
+    double d;
+    bool b;
+  };
+
+  void throwEOF() {
+    throw JSONException("Unexpected end of CBOR data");
+  }
+
+  double halfToDouble(uint16_t h) {
+    const int exp = (h >> 10) & 0x1f;
+    const int mant = h & 0x3ff;
+    double d;
+    if (exp == 0)
+      d = std::ldexp(static_cast<double>(mant), -24);
+    else if (exp != 31)
+      d = std::ldexp(static_cast<double>(mant + 1024), exp - 25);
+    else
+      d = (mant == 0) ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+    return (h & 0x8000) ? -d : d;
+  }
+
+  // Decodes the item starting at p (skipping any tags), and returns pointer
+  // past it (past the head, for arrays/objects)
+  const unsigned char* readItem(const unsigned char *p, const unsigned char *end, Item &item) {
+    unsigned major, info;
+    uint64_t arg;
+    do {
+      if (p >= end)
+        throwEOF();
+      major = *p >> 5;
+      info = *p & 0x1f;
+      ++p;
+      if (info < 24) {
+        arg = info;
+      } else if (info <= 27) {
+        const size_t n = static_cast<size_t>(1) << (info - 24);
+        if (static_cast<size_t>(end - p) < n)
+          throwEOF();
+        arg = 0;
+        for (size_t i = 0; i < n; ++i)
+          arg = (arg << 8) | p[i];
+        p += n;
+      } else if (info == 31) {
+        throw JSONException("Indefinite length CBOR items are not supported");
+      } else {
+        throw JSONException("Invalid CBOR data: reserved value of additional information");
+      }
+    } while (major == MAJOR_TAG);
+
+    const uint64_t INT64_LIMIT = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+    switch (major) {
+      case MAJOR_UNSIGNED:
+        item.type = JSON_INTEGER;
+        item.i = (arg > INT64_LIMIT) ? std::numeric_limits<int64_t>::max() : static_cast<int64_t>(arg);
+        break;
+      case MAJOR_NEGATIVE:
+        item.type = JSON_INTEGER;
+        item.i = (arg > INT64_LIMIT) ? std::numeric_limits<int64_t>::min() : -1 - static_cast<int64_t>(arg);
+        break;
+      case MAJOR_TEXT:
+        if (arg > static_cast<uint64_t>(end - p))
+          throwEOF();
+        item.type = JSON_STRING;
+        item.str.data = reinterpret_cast<const char*>(p);
+        item.str.size = static_cast<size_t>(arg);
+        p += arg;
+        break;
+      case MAJOR_ARRAY:
+      case MAJOR_MAP:
+        // Every element takes at least one byte, and every member two
+        if (arg > static_cast<uint64_t>(end - p) / ((major == MAJOR_MAP) ? 2 : 1))
+          throwEOF();
+        item.type = (major == MAJOR_MAP) ? JSON_OBJECT : JSON_ARRAY;
+        item.count = arg;
+        break;
+      case MAJOR_SIMPLE:
+        switch (info) {
+          case 20:
+          case 21:
+            item.type = JSON_BOOLEAN;
+            item.b = (info == 21);
+            break;
+          case 22:
+            item.type = JSON_NULL;
+            break;
+          case 25:
+            item.type = JSON_REAL;
+            item.d = halfToDouble(static_cast<uint16_t>(arg));
+            break;
+          case 26: {
+            const uint32_t bits = static_cast<uint32_t>(arg);
+            float f;
+            memcpy(&f, &bits, sizeof(f));
+            item.type = JSON_REAL;
+            item.d = f;
+            break;
+          }
+          case 27:
+            item.type = JSON_REAL;
+            memcpy(&item.d, &arg, sizeof(item.d));
+            break;
+          default:
+            throw JSONException("Unsupported CBOR simple value (only false, true, null and floats are allowed)");
+        }
+        if (item.type == JSON_REAL && !boost::math::isfinite(item.d))
+          throw JSONException("CBOR floats must be finite (NaN and infinity are not allowed in JSON)");
+        break;
+      default:
+        throw JSONException("Unsupported CBOR item: byte strings are not allowed");
+    }
+    return p;
+  }
+
+  const unsigned char* decodeValue(const unsigned char *p, const unsigned char *end, JSON &j) {
+    Item item;
+    p = readItem(p, end, item);
+    j.clear();
+    switch (item.type) {
+      case JSON_INTEGER: j = item.i; break;
+      case JSON_REAL: j = item.d; break;
+      case JSON_STRING: j = item.str.str(); break;
+      case JSON_BOOLEAN: j = item.b; break;
+      case JSON_NULL: j = JSON_NULL; break;
+      case JSON_ARRAY: {
+        Array *a = new Array();
+        j.tag = JSON_ARRAY;
+        j.val = a;
+        a->val.resize(static_cast<size_t>(item.count));
+        for (size_t i = 0; i < a->val.size(); ++i)
+          p = decodeValue(p, end, a->val[i]);
+        break;
+      }
+      default: {
+        Object *o = new Object();
+        j.tag = JSON_OBJECT;
+        j.val = o;
+        for (uint64_t i = 0; i < item.count; ++i) {
+          Item key;
+          p = readItem(p, end, key);
+          if (key.type != JSON_STRING)
+            throw JSONException("CBOR map keys must be text strings");
+          p = decodeValue(p, end, o->val[key.str.str()]);
+        }
+      }
+    }
+    return p;
+  }
+
+  const unsigned char* toBytes(const char *data) {
+    return reinterpret_cast<const unsigned char*>(data);
+  }
+}
+
+namespace dx {
+  void writeCBOR(const JSON &j, std::string &out) {
+    writeValue(j, out);
+  }
+
+  std::string toCBOR(const JSON &j) {
+    std::string out;
+    writeValue(j, out);
+    return out;
+  }
+
+  JSON fromCBOR(const char *data, size_t len) {
+    JSON j;
+    decodeValue(toBytes(data), toBytes(data) + len, j);
+    return j;
+  }
+
+  JSON fromCBOR(const std::string &data) {
+    return fromCBOR(data.data(), data.size());
+  }
+}
+
+CBORReader::CBORReader(const char *data, size_t len): p(toBytes(data)), end(toBytes(data) + len), itemStart(p),
+                                                      evt(JSON_EVENT_NONE), done(false), valType(JSON_UNDEFINED),
+                                                      intVal(0), realVal(0.0), boolVal(false) {
+  keyRef.data = strVal.data = NULL;
+  keyRef.size = strVal.size = 0;
+}
+
+JSONValue CBORReader::type() const {
+  switch (evt) {
+    case JSON_EVENT_START_OBJECT: return JSON_OBJECT;
+    case JSON_EVENT_START_ARRAY: return JSON_ARRAY;
+    case JSON_EVENT_VALUE: return valType;
+    default: return JSON_UNDEFINED;
+  }
+}
+
+JSONStringRef CBORReader::getString() const {
+  if (evt != JSON_EVENT_VALUE || valType != JSON_STRING)
+    throw JSONException("CBORReader::getString() can only be called for a JSON_STRING value");
+  return strVal;
+}
+
+int64_t CBORReader::getInteger() const {
+  if (evt != JSON_EVENT_VALUE || valType != JSON_INTEGER)
+    throw JSONException("CBORReader::getInteger() can only be called for a JSON_INTEGER value");
+  return intVal;
+}
+
+double CBORReader::getReal() const {
+  if (evt != JSON_EVENT_VALUE || valType != JSON_REAL)
+    throw JSONException("CBORReader::getReal() can only be called for a JSON_REAL value");
+  return realVal;
+}
+
+bool CBORReader::getBoolean() const {
+  if (evt != JSON_EVENT_VALUE || valType != JSON_BOOLEAN)
+    throw JSONException("CBORReader::getBoolean() can only be called for a JSON_BOOLEAN value");
+  return boolVal;
+}
+
+// Reads a value: either a complete scalar, or head of a container
+void CBORReader::readItem() {
+  itemStart = p;
+  Item item;
+  p = ::readItem(p, end, item);
+  if (item.type == JSON_OBJECT || item.type == JSON_ARRAY) {
+    Container c = {item.type == JSON_OBJECT, item.count, true};
+    stack.push_back(c);
+    evt = (item.type == JSON_OBJECT) ? JSON_EVENT_START_OBJECT : JSON_EVENT_START_ARRAY;
+    return;
+  }
+  evt = JSON_EVENT_VALUE;
+  valType = item.type;
+  switch (item.type) {
+    case JSON_INTEGER: intVal = item.i; break;
+    case JSON_REAL: realVal = item.d; break;
+    case JSON_STRING: strVal = item.str; break;
+    case JSON_BOOLEAN: boolVal = item.b; break;
+    default: break;
+  }
+  if (stack.empty())
+    done = true;
+}
+
+bool CBORReader::next() {
+  if (done) {
+    evt = JSON_EVENT_END;
+    return false;
+  }
+  if (!stack.empty()) {
+    Container &c = stack.back();
+    if (c.remaining == 0) {
+      evt = (c.isObject) ? JSON_EVENT_END_OBJECT : JSON_EVENT_END_ARRAY;
+      stack.pop_back();
+      if (stack.empty())
+        done = true;
+      return true;
+    }
+    if (c.isObject && c.atKey) {
+      Item key;
+      p = ::readItem(p, end, key);
+      if (key.type != JSON_STRING)
+        throw JSONException("CBOR map keys must be text strings");
+      keyRef = key.str;
+      c.atKey = false;
+      evt = JSON_EVENT_KEY;
+      return true;
+    }
+    --c.remaining;
+    c.atKey = true;
+  }
+  readItem();
+  return true;
+}
+
+void CBORReader::skip() {
+  if (evt == JSON_EVENT_KEY) {
+    next();
+    skip();
+    return;
+  }
+  if (evt != JSON_EVENT_START_OBJECT && evt != JSON_EVENT_START_ARRAY)
+    return;
+  const size_t d = stack.size();
+  while (stack.size() >= d)
+    next();
+}
+
+JSON CBORReader::readValue() {
+  if (evt == JSON_EVENT_KEY)
+    next();
+  JSON j;
+  switch (evt) {
+    case JSON_EVENT_VALUE:
+      switch (valType) {
+        case JSON_INTEGER: j = intVal; break;
+        case JSON_REAL: j = realVal; break;
+        case JSON_STRING: j = strVal.str(); break;
+        case JSON_BOOLEAN: j = boolVal; break;
+        default: j = JSON_NULL;
+      }
+      return j;
+    case JSON_EVENT_START_OBJECT:
+    case JSON_EVENT_START_ARRAY:
+      // Decode the complete container again, directly into a JSON object
+      p = decodeValue(itemStart, end, j);
+      evt = (evt == JSON_EVENT_START_OBJECT) ? JSON_EVENT_END_OBJECT : JSON_EVENT_END_ARRAY;
+      stack.pop_back();
+      if (stack.empty())
+        done = true;
+      return j;
+    default:
+      throw JSONException("CBORReader::readValue() can only be called at start of a value, or on a key");
+  }
+}
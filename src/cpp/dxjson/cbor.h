@@ -0,0 +1,155 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_CBOR_H__
+#define __DXJSON_CBOR_H__
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "dxjson.h"
+#include "reader.h"
+
+/** @file
+  * Binary encoding of JSON values as CBOR (RFC 8949). Unlike the text
+  * serialization, no number formatting/parsing or string escaping is
+  * involved, so encoding and decoding are much faster. The JSON type of
+  * every value is preserved: a JSON_INTEGER is encoded as a CBOR integer,
+  * and a JSON_REAL as a double precision float (even if it has an integral
+  * value).
+  *
+  * Only definite length items are produced. When decoding, all the CBOR
+  * items corresponding to a JSON type are accepted (including half and
+  * single precision floats), semantic tags are ignored, and anything else
+  * (byte strings, indefinite length items, undefined, non-string map keys,
+  * etc) results in a JSONException. Integers outside the int64_t range are
+  * clamped to it (same as for the text format).
+  */
+
+namespace dx {
+
+  /** Appends CBOR encoding of j to out.
+    * @throw JSONException If j (or any value inside it) is JSON_UNDEFINED.
+    */
+  void writeCBOR(const JSON &j, std::string &out);
+
+  /** Returns CBOR encoding of j (see writeCBOR()) */
+  std::string toCBOR(const JSON &j);
+
+  /** Decodes a CBOR encoded value.
+    * @param data Pointer to the first byte of the encoding
+    * @param len Number of bytes available at data (any bytes following the
+    * encoded value are ignored)
+    * @throw JSONException If the data is not a valid encoding of a JSON value.
+    */
+  JSON fromCBOR(const char *data, size_t len);
+  JSON fromCBOR(const std::string &data);
+
+  /** A reference to a string held in a buffer (which is not NUL terminated) */
+  struct JSONStringRef {
+    const char *data;
+    size_t size;
+
+    std::string str() const { return std::string(data, size); }
+    bool operator ==(const std::string &s) const { return s.size() == size && memcmp(s.data(), data, size) == 0; }
+    bool operator !=(const std::string &s) const { return !(*this == s); }
+    bool operator ==(const char *s) const { return strlen(s) == size && memcmp(s, data, size) == 0; }
+    bool operator !=(const char *s) const { return !(*this == s); }
+  };
+
+  /** A pull parser over CBOR encoded JSON (see JSONReader, which has the same
+    * interface for the text format). Strings and keys are never copied: they
+    * are returned as references into the input buffer.
+    * @note The buffer is not copied, it must outlive the reader (and any
+    * JSONStringRef returned by it).
+    */
+  class CBORReader {
+  public:
+    /** @param data Pointer to the first byte of the encoding
+      * @param len Number of bytes available at "data"
+      */
+    CBORReader(const char *data, size_t len);
+
+    /** Advances to the next event.
+      * @return false once the top level value has been read completely (event()
+      * returns JSON_EVENT_END after that), true otherwise.
+      * @throw JSONException If the data is not a valid encoding of a JSON value.
+      */
+    bool next();
+
+    /** Returns the current event */
+    JSONEvent event() const { return evt; }
+
+    /** Returns the type of the current value: JSON_OBJECT/JSON_ARRAY for
+      * JSON_EVENT_START_OBJECT/JSON_EVENT_START_ARRAY events, the scalar type for
+      * JSON_EVENT_VALUE events, and JSON_UNDEFINED otherwise.
+      */
+    JSONValue type() const;
+
+    /** Number of containers (objects/arrays) enclosing the current position.
+      * For a JSON_EVENT_START_* event it includes the container just opened.
+      */
+    size_t depth() const { return stack.size(); }
+
+    /** Returns the most recently read key */
+    JSONStringRef key() const { return keyRef; }
+
+    /** Returns value of the current JSON_STRING value */
+    JSONStringRef getString() const;
+
+    /** Returns value of the current JSON_INTEGER value */
+    int64_t getInteger() const;
+
+    /** Returns value of the current JSON_REAL value */
+    double getReal() const;
+
+    /** Returns value of the current JSON_BOOLEAN value */
+    bool getBoolean() const;
+
+    /** Skips the current value (same as JSONReader::skip()) */
+    void skip();
+
+    /** Materializes the current value as a JSON object (same as JSONReader::readValue()) */
+    JSON readValue();
+
+  private:
+    struct Container {
+      bool isObject;
+      uint64_t remaining; // Number of values (not counting keys) yet to be read
+      bool atKey; // true if a key is expected next (objects only)
+    };
+
+    const unsigned char *p;
+    const unsigned char *end;
+    const unsigned char *itemStart; // Start of encoding of the current value
+    JSONEvent evt;
+    std::vector<Container> stack;
+    bool done;
+
+    JSONStringRef keyRef;
+    JSONValue valType;
+    JSONStringRef strVal;
+    int64_t intVal;
+    double realVal;
+    bool boolVal;
+
+    void readItem();
+  };
+}
+
+#endif
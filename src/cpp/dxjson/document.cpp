@@ -0,0 +1,439 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "document.h"
+#include "reader.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace dx;
+
+namespace {
+
+  const size_t ARENA_ALIGNMENT = 8;
+
+  // Shared by all default constructed JSONNode
+  const JSONDocNode UNDEFINED_NODE = {JSON_UNDEFINED, 0, {0}};
+
+  // Same order as std::string::compare()
+  inline int compareKeys(const char *a, size_t aLen, const char *b, size_t bLen) {
+    int cmp = memcmp(a, b, std::min(aLen, bLen));
+    if (cmp != 0)
+      return cmp;
+    return (aLen < bLen) ? -1 : ((aLen > bLen) ? 1 : 0);
+  }
+
+  // Comparing prefixes gives the same order as comparing keys, unless the prefixes are equal
+  inline uint64_t keyPrefix(const char *key, size_t len) {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; ++i)
+      prefix = (prefix << 8) | ((i < len) ? static_cast<unsigned char>(key[i]) : 0u);
+    return prefix;
+  }
+
+  struct MemberLess {
+    bool operator()(const JSONDocMember &a, const JSONDocMember &b) const {
+      if (a.keyPrefix != b.keyPrefix)
+        return a.keyPrefix < b.keyPrefix;
+      return compareKeys(a.key, a.keyLen, b.key, b.keyLen) < 0;
+    }
+  };
+
+  // Objects with at most these many members are searched linearly for a JSONKey
+  const size_t LINEAR_SEARCH_LIMIT = 16;
+
+  // FNV-1a
+  inline uint64_t hashKey(const char *key, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; ++i)
+      h = (h ^ static_cast<unsigned char>(key[i])) * 1099511628211ULL;
+    return h;
+  }
+
+  // Binary search for a key in sorted members
+  const JSONDocMember* findMember(const JSONDocMember *members, size_t count, const char *key, size_t len) {
+    const uint64_t prefix = keyPrefix(key, len);
+    const JSONDocMember *lo = members, *hi = members + count;
+    while (lo < hi) {
+      const JSONDocMember *mid = lo + (hi - lo) / 2;
+      int cmp = (mid->keyPrefix != prefix) ? ((mid->keyPrefix < prefix) ? -1 : 1) : compareKeys(mid->key, mid->keyLen, key, len);
+      if (cmp == 0)
+        return mid;
+      if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return NULL;
+  }
+
+  // Interned keys are equal iff their addresses are
+  const JSONDocMember* findInterned(const JSONDocMember *members, size_t count, const char *keyAddr, size_t len) {
+    if (keyAddr == NULL)
+      return NULL;
+    if (count > LINEAR_SEARCH_LIMIT)
+      return findMember(members, count, keyAddr, len);
+    for (size_t i = 0; i < count; ++i) {
+      if (members[i].key == keyAddr)
+        return members + i;
+    }
+    return NULL;
+  }
+
+  // Returns true if keys are in strictly increasing order (i.e., sorted, and without duplicates)
+  bool strictlySorted(const JSONDocMember *members, size_t count) {
+    for (size_t i = 1; i < count; ++i) {
+      if (!MemberLess()(members[i - 1], members[i]))
+        return false;
+    }
+    return true;
+  }
+
+  // Sorts members of an object by key, and removes duplicate keys (the last
+  // value wins, same as JSON). "orig" holds the members in order of their
+  // appearance. Returns the number of unique members.
+  size_t sortMembers(JSONDocMember *members, size_t count, std::vector<JSONDocMember>::const_iterator orig) {
+    if (strictlySorted(members, count))
+      return count;
+    std::sort(members, members + count, MemberLess());
+    if (strictlySorted(members, count))
+      return count;
+
+    // Duplicate keys are rare, only then the relative order of members matters
+    std::copy(orig, orig + count, members);
+    std::stable_sort(members, members + count, MemberLess());
+    size_t unique = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (unique > 0 && !MemberLess()(members[unique - 1], members[i]))
+        members[unique - 1] = members[i];
+      else
+        members[unique++] = members[i];
+    }
+    return unique;
+  }
+
+  // State of an array/object which is being read
+  struct OpenContainer {
+    size_t start; // Index of its first element in the stack of values
+    bool isObject;
+    const char *key; // Key of this container in its parent (if parent is an object)
+    size_t keyLen;
+    uint64_t keyPrefix;
+  };
+
+  JSON toJSON(const JSONDocNode &n) {
+    switch (n.type) {
+      case JSON_OBJECT: {
+        JSON j(JSON_OBJECT);
+        for (size_t i = 0; i < n.len; ++i)
+          j[std::string(n.u.members[i].key, n.u.members[i].keyLen)] = toJSON(n.u.members[i].value);
+        return j;
+      }
+      case JSON_ARRAY: {
+        JSON j(JSON_ARRAY);
+        for (size_t i = 0; i < n.len; ++i)
+          j.push_back(toJSON(n.u.elems[i]));
+        return j;
+      }
+      case JSON_INTEGER: return JSON(n.u.i);
+      case JSON_REAL: return JSON(n.u.d);
+      case JSON_STRING: return JSON(std::string(n.string(), n.len));
+      case JSON_BOOLEAN: return JSON(n.u.b);
+      case JSON_NULL: return JSON(JSON_NULL);
+      default: return JSON();
+    }
+  }
+}
+
+JSONArena::JSONArena(size_t blockSize_): cur(NULL), left(0), blockSize(blockSize_), reserved(0) {}
+
+void* JSONArena::allocate(size_t n) {
+  n = (n + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+  if (n > left) {
+    if (n > blockSize / 4) {
+      // Large allocations get a block of their own (so that rest of the current block is not wasted)
+      char *block = new char[n];
+      blocks.insert(blocks.end() - ((blocks.empty()) ? 0 : 1), block);
+      reserved += n;
+      return block;
+    }
+    cur = new char[blockSize];
+    left = blockSize;
+    blocks.push_back(cur);
+    reserved += blockSize;
+  }
+  void *res = cur;
+  cur += n;
+  left -= n;
+  return res;
+}
+
+const char* JSONArena::copyString(const char *s, size_t len) {
+  char *res = static_cast<char*>(allocate(len + 1));
+  memcpy(res, s, len);
+  res[len] = '\0';
+  return res;
+}
+
+const char* JSONKeyTable::find(const char *s, size_t len) const {
+  if (slots.empty())
+    return NULL;
+  const uint64_t h = hashKey(s, len);
+  const size_t mask = slots.size() - 1;
+  for (size_t i = static_cast<size_t>(h) & mask; slots[i].key != NULL; i = (i + 1) & mask) {
+    if (slots[i].hash == h && slots[i].len == len && memcmp(slots[i].key, s, len) == 0)
+      return slots[i].key;
+  }
+  return NULL;
+}
+
+const char* JSONKeyTable::intern(JSONArena &mem, const char *s, size_t len) {
+  // Kept at most half full
+  if (2 * (count + 1) > slots.size())
+    grow();
+  const uint64_t h = hashKey(s, len);
+  const size_t mask = slots.size() - 1;
+  size_t i = static_cast<size_t>(h) & mask;
+  for (; slots[i].key != NULL; i = (i + 1) & mask) {
+    if (slots[i].hash == h && slots[i].len == len && memcmp(slots[i].key, s, len) == 0)
+      return slots[i].key;
+  }
+  slots[i].key = mem.copyString(s, len);
+  slots[i].len = len;
+  slots[i].hash = h;
+  ++count;
+  return slots[i].key;
+}
+
+void JSONKeyTable::grow() {
+  std::vector<Slot> old;
+  old.swap(slots);
+  const Slot empty = {NULL, 0, 0};
+  slots.assign((old.empty()) ? 64 : 2 * old.size(), empty);
+  const size_t mask = slots.size() - 1;
+  for (size_t j = 0; j < old.size(); ++j) {
+    if (old[j].key == NULL)
+      continue;
+    size_t i = static_cast<size_t>(old[j].hash) & mask;
+    while (slots[i].key != NULL)
+      i = (i + 1) & mask;
+    slots[i] = old[j];
+  }
+}
+
+void JSONKeyTable::clear() {
+  slots.clear();
+  count = 0;
+}
+
+void JSONArena::clear() {
+  for (size_t i = 0; i < blocks.size(); ++i)
+    delete [] blocks[i];
+  blocks.clear();
+  cur = NULL;
+  left = 0;
+  reserved = 0;
+}
+
+JSONNode::JSONNode(): node(&UNDEFINED_NODE) {}
+
+size_t JSONNode::size() const {
+  if (node->type != JSON_ARRAY && node->type != JSON_OBJECT && node->type != JSON_STRING)
+    throw JSONException("size()/length() can only be called for JSON_ARRAY/JSON_OBJECT/JSON_STRING");
+  return node->len;
+}
+
+bool JSONNode::has(const size_t &indx) const {
+  if (node->type != JSON_ARRAY)
+    throw JSONException("Illegal call to has(size_t) for non JSON_ARRAY object");
+  return (indx < node->len);
+}
+
+bool JSONNode::has(const std::string &key) const {
+  if (node->type != JSON_OBJECT)
+    throw JSONException("Illegal call to has(size_t) for non JSON_OBJECT object");
+  return (findMember(node->u.members, node->len, key.data(), key.size()) != NULL);
+}
+
+bool JSONNode::has(const JSONKey &key) const {
+  if (node->type != JSON_OBJECT)
+    throw JSONException("Illegal call to has(JSONKey) for non JSON_OBJECT object");
+  return (findInterned(node->u.members, node->len, key.key, key.len) != NULL);
+}
+
+JSONNode JSONNode::operator[](const size_t &indx) const {
+  if (node->type != JSON_ARRAY)
+    throw JSONException("Cannot use size_t to index value of a non-JSON_ARRAY using [] operator");
+  if (indx >= node->len)
+    throw JSONException("Illegal: Out of bound JSON_ARRAY access");
+  return JSONNode(node->u.elems + indx);
+}
+
+JSONNode JSONNode::operator[](const std::string &key) const {
+  if (node->type != JSON_OBJECT)
+    throw JSONException("Cannot use string to index value of a non-JSON_OBJECT using [] operator");
+  const JSONDocMember *m = findMember(node->u.members, node->len, key.data(), key.size());
+  if (m == NULL)
+    throw JSONException("Key \"" + key + "\" not found in JSON_OBJECT");
+  return JSONNode(&m->value);
+}
+
+JSONNode JSONNode::operator[](const JSONKey &key) const {
+  if (node->type != JSON_OBJECT)
+    throw JSONException("Cannot use JSONKey to index value of a non-JSON_OBJECT using [] operator");
+  const JSONDocMember *m = findInterned(node->u.members, node->len, key.key, key.len);
+  if (m == NULL)
+    throw JSONException("Key \"" + ((key.valid()) ? std::string(key.key, key.len) : std::string()) + "\" not found in JSON_OBJECT");
+  return JSONNode(&m->value);
+}
+
+const char* JSONNode::c_str() const {
+  if (node->type != JSON_STRING)
+    throw JSONException("c_str() can only be called for a JSON_STRING value");
+  return node->string();
+}
+
+JSON JSONNode::toJSON() const {
+  return ::toJSON(*node);
+}
+
+JSONNodeObjectIterator JSONNode::object_begin() const {
+  if (node->type != JSON_OBJECT)
+    throw JSONException("Cannot get JSONNode::const_object_iterator for a non-JSON_OBJECT");
+  return JSONNodeObjectIterator(node->u.members);
+}
+
+JSONNodeObjectIterator JSONNode::object_end() const {
+  if (node->type != JSON_OBJECT)
+    throw JSONException("Cannot get JSONNode::const_object_iterator for a non-JSON_OBJECT");
+  return JSONNodeObjectIterator(node->u.members + node->len);
+}
+
+JSONNodeArrayIterator JSONNode::array_begin() const {
+  if (node->type != JSON_ARRAY)
+    throw JSONException("Cannot get JSONNode::const_array_iterator for a non-JSON_ARRAY");
+  return JSONNodeArrayIterator(node->u.elems);
+}
+
+JSONNodeArrayIterator JSONNode::array_end() const {
+  if (node->type != JSON_ARRAY)
+    throw JSONException("Cannot get JSONNode::const_array_iterator for a non-JSON_ARRAY");
+  return JSONNodeArrayIterator(node->u.elems + node->len);
+}
+
+JSONDocument::JSONDocument() {
+  rootNode = UNDEFINED_NODE;
+}
+
+JSONKey JSONDocument::key(const std::string &k) const {
+  const char *interned = keys.find(k.data(), k.size());
+  return JSONKey(interned, (interned != NULL) ? k.size() : 0);
+}
+
+// Values are collected on a stack while a container is being read. Once
+// the container is over, its values are moved to a single arena allocation
+// (members of an object are sorted by key at this point).
+void JSONDocument::parse(const char *data, size_t len) {
+  mem.clear();
+  keys.clear();
+  rootNode = UNDEFINED_NODE;
+
+  JSONReader r(data, len);
+  std::vector<JSONDocMember> values;
+  std::vector<OpenContainer> open;
+  const char *key = NULL;
+  size_t keyLen = 0;
+  uint64_t prefix = 0;
+  JSONDocNode result = UNDEFINED_NODE;
+
+  while (r.next()) {
+    JSONDocMember m;
+    m.key = key;
+    m.keyLen = keyLen;
+    m.keyPrefix = prefix;
+    JSONDocNode &n = m.value;
+    switch (r.event()) {
+      case JSON_EVENT_KEY:
+        keyLen = r.key().size();
+        key = keys.intern(mem, r.key().data(), keyLen);
+        prefix = keyPrefix(key, keyLen);
+        continue;
+
+      case JSON_EVENT_START_OBJECT:
+      case JSON_EVENT_START_ARRAY: {
+        OpenContainer c = {values.size(), (r.event() == JSON_EVENT_START_OBJECT), key, keyLen, prefix};
+        open.push_back(c);
+        continue;
+      }
+
+      case JSON_EVENT_END_OBJECT:
+      case JSON_EVENT_END_ARRAY: {
+        const OpenContainer c = open.back();
+        open.pop_back();
+        const size_t count = values.size() - c.start;
+        m.key = c.key;
+        m.keyLen = c.keyLen;
+        m.keyPrefix = c.keyPrefix;
+        n.len = count;
+        if (c.isObject) {
+          n.type = JSON_OBJECT;
+          JSONDocMember *members = static_cast<JSONDocMember*>(mem.allocate(count * sizeof(JSONDocMember)));
+          std::copy(values.begin() + c.start, values.end(), members);
+          n.len = sortMembers(members, count, values.begin() + c.start);
+          n.u.members = members;
+        } else {
+          n.type = JSON_ARRAY;
+          JSONDocNode *elems = static_cast<JSONDocNode*>(mem.allocate(count * sizeof(JSONDocNode)));
+          for (size_t i = 0; i < count; ++i)
+            elems[i] = values[c.start + i].value;
+          n.u.elems = elems;
+        }
+        values.resize(c.start);
+        break;
+      }
+
+      case JSON_EVENT_VALUE:
+        n.type = r.type();
+        n.len = 0;
+        switch (n.type) {
+          case JSON_STRING:
+            n.len = r.getString().size();
+            if (n.len < sizeof(n.u.chars)) {
+              memcpy(n.u.chars, r.getString().data(), n.len);
+              n.u.chars[n.len] = '\0';
+            } else {
+              n.u.str = mem.copyString(r.getString().data(), n.len);
+            }
+            break;
+          case JSON_INTEGER: n.u.i = r.getInteger(); break;
+          case JSON_REAL: n.u.d = r.getReal(); break;
+          case JSON_BOOLEAN: n.u.b = r.getBoolean(); break;
+          default: n.u.i = 0; break;
+        }
+        break;
+
+      default:
+        continue;
+    }
+
+    if (open.empty())
+      result = n;
+    else
+      values.push_back(m);
+  }
+  rootNode = result;
+}
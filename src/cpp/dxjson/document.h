@@ -0,0 +1,372 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_DOCUMENT_H__
+#define __DXJSON_DOCUMENT_H__
+
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "dxjson.h"
+
+/** @file */
+
+namespace dx {
+
+  /** A bump allocator: memory is handed out sequentially from large blocks,
+    * and is released only all at once (by clear() or the destructor).
+    */
+  class JSONArena {
+  public:
+    /** @param blockSize_ Size (in bytes) of each block requested from the system */
+    explicit JSONArena(size_t blockSize_ = 64 * 1024);
+    ~JSONArena() { clear(); }
+
+    /** Returns n bytes of uninitialized memory, suitably aligned for any
+      * of the node types used by JSONDocument.
+      */
+    void* allocate(size_t n);
+
+    /** Copies len bytes at s (and a terminating NUL) to the arena */
+    const char* copyString(const char *s, size_t len);
+
+    /** Releases all the memory allocated so far */
+    void clear();
+
+    /** Total number of bytes requested from the system */
+    size_t capacity() const { return reserved; }
+
+  private:
+    std::vector<char*> blocks;
+    char *cur; // Next free byte in the last block
+    size_t left; // Number of free bytes at cur
+    size_t blockSize;
+    size_t reserved;
+
+    // Not copyable
+    JSONArena(const JSONArena &);
+    JSONArena& operator=(const JSONArena &);
+  };
+
+  /** @internal
+    * Interns the keys of a JSONDocument: each distinct key is copied to the
+    * arena once, and all of its occurrences point to that copy. This saves
+    * memory (API responses repeat the same few keys over and over), and
+    * allows comparing keys by address (see JSONKey).
+    */
+  class JSONKeyTable {
+  public:
+    JSONKeyTable(): count(0) {}
+
+    /** Returns the interned copy of key s (of length len), copying it to mem if it's new */
+    const char* intern(JSONArena &mem, const char *s, size_t len);
+
+    /** Returns the interned copy of key s (of length len), or NULL if there is none */
+    const char* find(const char *s, size_t len) const;
+
+    /** Number of distinct keys */
+    size_t size() const { return count; }
+
+    void clear();
+
+  private:
+    // Open addressing hash table: "key" is NULL for an empty slot
+    struct Slot {
+      const char *key;
+      size_t len;
+      uint64_t hash;
+    };
+    std::vector<Slot> slots;
+    size_t count;
+
+    void grow();
+  };
+
+  /** A key interned in a JSONDocument (see JSONDocument::key()). Looking it up
+    * in an object of the document compares addresses instead of strings. A
+    * JSONKey can only be used with the document it was obtained from, as long
+    * as that document is neither destroyed nor re-parsed.
+    */
+  class JSONKey {
+  public:
+    /** Creates a key which is not present in any document */
+    JSONKey(): key(NULL), len(0) {}
+
+    /** false if the key is not present anywhere in the document it was
+      * obtained from (so it's not present in any of its objects either)
+      */
+    bool valid() const { return key != NULL; }
+
+  private:
+    friend class JSONDocument;
+    friend class JSONNode;
+
+    JSONKey(const char *key_, size_t len_): key(key_), len(len_) {}
+
+    const char *key;
+    size_t len;
+  };
+
+  struct JSONDocMember;
+  class JSONNodeObjectIterator;
+  class JSONNodeArrayIterator;
+
+  /** @internal
+    * A value inside a JSONDocument. For strings "len" is the length of string, and
+    * for arrays/objects it is the number of elements/members.
+    */
+  struct JSONDocNode {
+    JSONValue type;
+    size_t len;
+    union {
+      int64_t i;
+      double d;
+      bool b;
+      const char *str;
+      char chars[8]; // Strings shorter than this are held inline (NUL terminated), instead of in "str"
+      const JSONDocNode *elems;
+      const JSONDocMember *members; // Sorted by key
+    } u;
+
+    /** Characters of a string (NUL terminated) */
+    const char* string() const { return (len < sizeof(u.chars)) ? u.chars : u.str; }
+  };
+
+  /** @internal A key/value pair of an object inside a JSONDocument */
+  struct JSONDocMember {
+    const char *key; // Interned (see JSONKeyTable)
+    size_t keyLen;
+    uint64_t keyPrefix; // First 8 bytes of key (big endian, zero padded): makes most key comparisons cheap
+    JSONDocNode value;
+  };
+
+  /** A read-only handle to a value inside a JSONDocument. It provides the
+    * same accessors as a const JSON (operator[], has(), get<T>(), size(),
+    * iterators) and is cheap to copy. A JSONNode is valid only as long as
+    * the JSONDocument it belongs to is neither destroyed nor re-parsed.
+    */
+  class JSONNode {
+  public:
+    typedef JSONNodeObjectIterator const_object_iterator;
+    typedef JSONNodeArrayIterator const_array_iterator;
+
+    /** Creates a handle to a JSON_UNDEFINED value */
+    JSONNode();
+    explicit JSONNode(const JSONDocNode *node_): node(node_) {}
+
+    /** Returns the type of the value */
+    JSONValue type() const { return node->type; }
+
+    /** Returns number of elements/members of a JSON_ARRAY/JSON_OBJECT, or length of a JSON_STRING
+      * @throw JSONException For any other type
+      */
+    size_t size() const;
+    size_t length() const { return size(); }
+
+    /** Same as JSON::has() */
+    bool has(const size_t &indx) const;
+    bool has(const std::string &key) const;
+    bool has(const char *key) const { return has(std::string(key)); }
+    bool has(const JSONKey &key) const;
+    template<typename T>
+    bool has(const T &indx) const { return has(static_cast<size_t>(indx)); }
+
+    /** Returns the element at index indx of a JSON_ARRAY
+      * @throw JSONException If not a JSON_ARRAY, or indx is out of bounds
+      */
+    JSONNode operator[](const size_t &indx) const;
+
+    /** Returns the value associated with key in a JSON_OBJECT
+      * @throw JSONException If not a JSON_OBJECT, or the key is not present
+      */
+    JSONNode operator[](const std::string &key) const;
+    JSONNode operator[](const char *key) const { return (*this)[std::string(key)]; }
+
+    /** Same as operator[](const std::string &), but faster: in objects with
+      * few members (most of them), keys are compared by address instead of by
+      * contents. Meant for keys which are looked up in many objects:
+      * @code
+      * const JSONKey state = doc.key("state");
+      * for (size_t i = 0; i < doc["results"].size(); ++i)
+      *   if (doc["results"][i].has(state) && doc["results"][i][state].get<std::string>() == "closed")
+      *     ++closed;
+      * @endcode
+      * @throw JSONException If not a JSON_OBJECT, or the key is not present
+      */
+    JSONNode operator[](const JSONKey &key) const;
+    template<typename T>
+    JSONNode operator[](const T &indx) const { return (*this)[static_cast<size_t>(indx)]; }
+
+    /** Same as JSON::get<T>(): converts a numeric/boolean value to T (or a
+      * JSON_STRING to std::string).
+      * @throw JSONException If no conversion is possible
+      */
+    template<typename T>
+    T get() const;
+
+    /** Returns pointer to the (NUL terminated) characters of a JSON_STRING,
+      * without copying them. Use size() for its length (the string can
+      * contain NUL characters).
+      * @throw JSONException If not a JSON_STRING
+      */
+    const char* c_str() const;
+
+    /** Returns a (deep) copy of the value as a JSON object */
+    JSON toJSON() const;
+
+    /** Returns the serialized value (same as toJSON().toString()) */
+    std::string toString() const { return toJSON().toString(); }
+
+    const_object_iterator object_begin() const;
+    const_object_iterator object_end() const;
+    const_array_iterator array_begin() const;
+    const_array_iterator array_end() const;
+
+  private:
+    const JSONDocNode *node;
+  };
+
+  /** Iterates over key/value pairs of an object inside a JSONDocument, in
+    * increasing order of keys.
+    */
+  class JSONNodeObjectIterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef std::pair<std::string, JSONNode> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const value_type* pointer;
+    typedef const value_type& reference;
+
+    explicit JSONNodeObjectIterator(const JSONDocMember *m_ = NULL): m(m_) {}
+    reference operator*() const { load(); return cur; }
+    pointer operator->() const { load(); return &cur; }
+    JSONNodeObjectIterator& operator++() { ++m; return *this; }
+    JSONNodeObjectIterator operator++(int) { JSONNodeObjectIterator tmp(*this); ++m; return tmp; }
+    bool operator==(const JSONNodeObjectIterator &other) const { return m == other.m; }
+    bool operator!=(const JSONNodeObjectIterator &other) const { return m != other.m; }
+
+  private:
+    const JSONDocMember *m;
+    mutable value_type cur;
+    void load() const {
+      cur.first.assign(m->key, m->keyLen);
+      cur.second = JSONNode(&m->value);
+    }
+  };
+
+  /** Iterates over elements of an array inside a JSONDocument */
+  class JSONNodeArrayIterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef JSONNode value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const JSONNode* pointer;
+    typedef JSONNode reference;
+
+    explicit JSONNodeArrayIterator(const JSONDocNode *p_ = NULL): p(p_) {}
+    JSONNode operator*() const { return JSONNode(p); }
+    JSONNodeArrayIterator& operator++() { ++p; return *this; }
+    JSONNodeArrayIterator operator++(int) { JSONNodeArrayIterator tmp(*this); ++p; return tmp; }
+    bool operator==(const JSONNodeArrayIterator &other) const { return p == other.p; }
+    bool operator!=(const JSONNodeArrayIterator &other) const { return p != other.p; }
+
+  private:
+    const JSONDocNode *p;
+  };
+
+  /** A read-only JSON document, parsed in one go. All the values, keys and
+    * string contents are allocated from a single arena owned by the document
+    * (each distinct key is stored once, and short strings inside the values),
+    * which is released at once when the document is destroyed (or another
+    * document is parsed into it). This is much faster than building a JSON
+    * object (which allocates each value, key and string on its own) for
+    * large inputs, such as a file describe response with many parts:
+    * @code
+    * JSONDocument doc;
+    * std::string resp = DXHTTPRequestRaw("/" + fileID + "/describe", "{\"parts\": true}");
+    * doc.parse(resp);
+    * for (JSONNode::const_object_iterator it = doc["parts"].object_begin(); it != doc["parts"].object_end(); ++it)
+    *   total += it->second["size"].get<int64_t>();
+    * @endcode
+    * The input buffer is not referenced once parse() returns.
+    */
+  class JSONDocument {
+  public:
+    JSONDocument();
+
+    /** Parses the JSON value held in the buffer, replacing any previous contents.
+      * The grammar is same as for JSON::readFromBuffer().
+      * @param data Pointer to the first character of serialized JSON
+      * @param len Number of bytes available at "data"
+      * @throw JSONException If the input is not valid JSON.
+      */
+    void parse(const char *data, size_t len);
+    void parse(const std::string &str) { parse(str.data(), str.size()); }
+
+    /** Returns the top level value */
+    JSONNode root() const { return JSONNode(&rootNode); }
+
+    /** Returns the interned key (see JSONKey) equal to given string. The
+      * returned key is not valid() if no object in the document has such a key.
+      */
+    JSONKey key(const std::string &k) const;
+
+    /** Number of distinct keys in the document (each of them is stored once) */
+    size_t keyCount() const { return keys.size(); }
+
+    /** Shorthands for root().type(), root().has(), root()[] */
+    JSONValue type() const { return rootNode.type; }
+    template<typename T>
+    bool has(const T &x) const { return root().has(x); }
+    template<typename T>
+    JSONNode operator[](const T &x) const { return root()[x]; }
+
+    /** The arena holding all the values of the document */
+    const JSONArena& arena() const { return mem; }
+
+  private:
+    JSONArena mem;
+    JSONKeyTable keys;
+    JSONDocNode rootNode;
+
+    // Not copyable
+    JSONDocument(const JSONDocument &);
+    JSONDocument& operator=(const JSONDocument &);
+  };
+
+  template<typename T>
+  T JSONNode::get() const {
+    switch (node->type) {
+      case JSON_INTEGER: return static_cast<T>(node->u.i);
+      case JSON_REAL: return static_cast<T>(node->u.d);
+      case JSON_BOOLEAN: return static_cast<T>(node->u.b);
+      default: throw JSONException("No typecast available for this JSON object to a Numeric/Boolean type");
+    }
+  }
+
+  template<>
+  inline std::string JSONNode::get<std::string>() const {
+    if (node->type != JSON_STRING)
+      throw JSONException("You cannot use get<std::string>/get<char*> for a non JSON_STRING value");
+    return std::string(node->string(), node->len);
+  }
+}
+
+#endif
@@ -15,6 +15,11 @@
 //   under the License.
 
 #include "dxjson.h"
+#include "scanner.h"
+#include "numbers.h"
+#include "writer.h"
+#include "mapped.h"
+#include "lazy.h"
 #include <cstdio>
 
 using namespace dx;
@@ -28,6 +33,20 @@ double JSON::getEpsilon() {
   return json_epsilon;
 }
 
+// Hashes cached by JSON::hash() are valid only in the epoch (value of
+// hash_epoch) they were computed in. Modifying any JSON value starts a new
+// epoch, but only if some hash may have been cached in the current one
+// (hash_cached_at >= hash_epoch): this way no shared memory is written on hot
+// paths (e.g., by parsers running on several threads) when hashes are not used.
+static std::atomic<uint64_t> hash_epoch(1);
+static std::atomic<uint64_t> hash_cached_at(0);
+
+void JSON::invalidateHashes() {
+  const uint64_t epoch = hash_epoch.load(std::memory_order_relaxed);
+  if (hash_cached_at.load(std::memory_order_relaxed) >= epoch)
+    hash_epoch.fetch_add(1, std::memory_order_release);
+}
+
 // TODO:
 // 1) Currently json strings are "escaped" only when using write() method, and stored as normal
 //    std::string. So if we use iterators like object_iterator for accessing all key in
@@ -40,19 +59,6 @@ double JSON::getEpsilon() {
 namespace JSON_Utility
 {
 
-  std::string getValidatedUTF8String(const std::string &src) {
-    std::string out;
-    utf8::replace_invalid(src.begin(), src.end(), back_inserter(out));
-    return out;
-  }
-
-  std::string itos(int i)  // convert int to string
-  {
-    std::stringstream s;
-    s << i;
-    return s.str();
-  }
-
   void SkipWhiteSpace(std::istream &in)
   {
     int c;
@@ -64,56 +70,27 @@ namespace JSON_Utility
       in.unget();
   }
 
-  void WriteEscapedString(const std::string &s, std::ostream &out, bool enclosingQuotes = true)
-  {
-    if (enclosingQuotes)
-      out<<'"';
-
-    for (unsigned i = 0; i < s.length(); ++i)
-    {
-      if (s[i] >= 0x0000 && s[i] <= 0x001f)
-      {
-        // Control character case, should be escaped
-        // http://stackoverflow.com/questions/4901133/json-and-escaping-characters
-        char temphex[5] = {0};
-        switch(s[i]) {
-          case '\b':
-            out<<"\\b";
-            break;
-          case '\f':
-            out<<"\\f";
-            break;
-          case '\n':
-            out<<"\\n";
-            break;
-          case '\r':
-            out<<"\\r";
-            break;
-          case '\t':
-            out<<"\\t";
-            break;
-          default:
-            out<<"\\u";
-            sprintf(temphex, "%04x", s[i]);
-            out<<std::string(temphex);
-            break;
-        }
-      }
-      else {
-        switch(s[i]) {
-          case '"':
-            out<<"\\\"";
-            break;
-          case '\\':
-            out<<"\\\\";
-            break;
-          default:
-            out<<s[i];
-        }
-      }
+  // Writes a member of an array/object (which must not be JSON_UNDEFINED)
+  void WriteJSONValue(const JSON &j, JSONWriter &out) {
+    // j.tag, not j.type(), which would parse a value that's not parsed yet
+    switch (j.tag) {
+      case JSON_INTEGER: out.writeInteger(j.i); break;
+      case JSON_REAL: out.writeReal(j.d); break;
+      case JSON_BOOLEAN:
+        if (j.b)
+          out.write("true", 4);
+        else
+          out.write("false", 5);
+        break;
+      case JSON_NULL: out.write("null", 4); break;
+      case JSON_STRING: out.writeString(static_cast<const String*>(j.val)->val); break;
+      case JSON_OBJECT: static_cast<const Object*>(j.val)->write(out); break;
+      case JSON_ARRAY: static_cast<const Array*>(j.val)->write(out); break;
+      default:
+        if (j.val == NULL)
+          throw JSONException("Cannot call write() method on uninitialized json object");
+        j.val->write(out);
     }
-    if (enclosingQuotes)
-      out<<'"';
   }
 
   // Returns true if "ch" represent start of a number token in JSON
@@ -143,107 +120,32 @@ namespace JSON_Utility
     return (ch == '{');
   }
 
-  // This function is designed specifically for use from ReadNumberValue() only
-  // It assumes that string provided as *input* to the function is already in this form (regex):
-  //  [0-9-]{1,1}[-0-9+eE.]*
-  // It will then perform extra checks to find out if it corresponds to a valid JSON number or not
-  // Ref: http://www.json.org
-  //      http://jsonlint.com/
-  // Added later:
-  // Note: actually now this function does not assume input in any particular format
-  //       and finds out if any arbitrary json string is a valid number or not.
-  bool isValidJsonNumber(const std::string &s) {
-    unsigned len = s.length();
-    bool dot = false;
-    bool e = false;
-    if (len == 0)
-      return false;
-
-    unsigned start = (s[0] == '-') ? 1 : 0;
-    if (!isdigit(s[start]))
-      return false;
-
-    if (start + 1 == len)
-      return true;
-
-    if (s[start] == '0' && isdigit(s[start + 1]))
-      return false;
-
-    for (unsigned i = start + 1; i < len; ++i) {
-      switch (s[i]) {
-        case '.':
-          if (e || dot)
-            return false;
-          dot = true;
-          break;
-        case 'e': // Desired fall through to next case statement ('E')
-        case 'E':
-          if (e)
-            return false;
-          e = true;
-          if (i + 1 >= len)
-            return false;
-          else {
-            if (s[i + 1] == '+' || s[i + 1] == '-') {
-              i++;
-              if (i + 1 >= len)
-                return false;
-            }
-          }
-          break;
-        default:
-          if (!isdigit(s[i]))
-            return false;
-      }
-    }
-    return true;
-  }
-  Value* ReadNumberValue(std::istream &in) {
-    Value *toReturn = NULL;
+  void ReadNumberValue(std::istream &in, JSON &j) {
     std::string toParse = "";
     int ch;
-    bool isDouble = false; // By default the number is integer, unless set otherwise
     do {
       ch = in.get();
       if (in.eof())
         break;
 
       // For time being allow all ., -, +,digit,e,E, as valid characters
-      // Then use isValidJsonNumber() to test validity more strictly
-      if (isdigit(ch) || ch == '+' || ch == '-') // All integer characters
+      // The scanner will then test validity more strictly
+      if (isdigit(ch) || ch == '+' || ch == '-' || ch == '.' || ch == 'e' || ch == 'E')
         toParse += ch;
-      else {
-        if (ch == '.' || ch == 'e' || ch == 'E') { // All floating point characters
-          isDouble = true;
-          toParse += ch;
-        }
-        else // If none of these valid characters, then input is over. Push last character back
-        {
-          in.unget();
-          break;
-        }
+      else // If none of these valid characters, then input is over. Push last character back
+      {
+        in.unget();
+        break;
       }
     } while (true);
 
-    // Validate number now
-    // TODO: Rather than parsing string again add logic of isValidJsonNumber() to the
-    //       above do-while loop itself. : Slight optimization.
-    if (!isValidJsonNumber(toParse))
-      throw JSONException("Invalid JSON number: \"" + toParse + "\". Unable to parse");
-
-    std::stringstream stream(toParse);
-    if (isDouble) {
-      Real *r = new Real();
-      stream>>r->val;
-      toReturn = dynamic_cast<Value*>(r);
-    }
-    else {
-      Integer *i = new Integer();
-      stream>>i->val;
-      toReturn = dynamic_cast<Value*>(i);
-    }
-    assert(toReturn != NULL); // To check that dynamic_cast was succesful
-    return toReturn;
+    JSONScanner scanner(toParse.data(), toParse.size());
+    JSONScanner::Number n;
+    scanner.readNumber(n);
+    if (n.isReal)
+      j = n.d;
+    else
+      j = n.i;
   }
 
   void ReadJSONValue(std::istream &in, JSON &j, bool topLevel = false) {
@@ -256,184 +158,234 @@ namespace JSON_Utility
     int ch = in.get();
     in.unget();
     if (isObjectStart(ch))
-      j.val = new Object();
+      j = JSON_OBJECT;
 
     if (isArrayStart(ch))
-      j.val = new Array();
+      j = JSON_ARRAY;
 
     // If it's not an object or array, throw error if it was supposed to be a top-level object
-    if (topLevel && j.val == NULL)
+    if (topLevel && j.tag == JSON_UNDEFINED)
       throw JSONException("JSON::read() - Expected top level JSON to be an Object OR Array");
 
     if (isStringStart(ch))
-      j.val = new String();
+      j = JSON_STRING;
 
-    if (isBooleanStart(ch))
-      j.val = new Boolean();
-
-    if (isNullStart(ch))
-      j.val = new Null();
-
-    if (j.val != NULL)
+    if (j.tag != JSON_UNDEFINED) {
       j.val->read(in);
-    else {
+    } else if (isBooleanStart(ch)) {
+      Boolean b;
+      b.read(in);
+      j = b.val;
+    } else if (isNullStart(ch)) {
+      Null().read(in);
+      j = JSON_NULL;
+    } else {
       // Treat number case slightly differently - since there can be two different types of numbers
       if (isNumberStart(ch))
-        j.val = JSON_Utility::ReadNumberValue(in);
+        JSON_Utility::ReadNumberValue(in, j);
       else
         throw JSONException("Illegal JSON value. Cannot start with : " + std::string(1, char(ch)));
     }
   }
 
-/*  std::string appendUTF8(uint32_t x) {
-    std::string temp_str = "";
-    //unsigned char tmp[5] = {0};
-    utf8::append(x, std::back_inserter(temp_str));
-    //return std::string(tmp);
-    return temp_str;
-  }*/
-  // See this function in utf8 namespace to fix invalid utf8 characters
-  // void fix_utf8_string(std::string& str);
-
-  inline int32_t hexdigit_to_num(char ch) {
-    if (ch >= '0' && ch <= '9')
-      return uint32_t(ch - '0');
-    ch = toupper(ch);
-    if (ch >= 'A' && ch <= 'F')
-      return uint32_t(ch - 'A' + 10);
-    throw JSONException("Invalid Hex digit in unicode escape \\uxxxx: " + std::string(1,ch));
-  }
-
-  inline int32_t string4_to_hex(char str[]) {
-    // We assume that str is always exactly 4 character long
-    return ( (hexdigit_to_num(str[0]) << 12) +
-             (hexdigit_to_num(str[1]) << 8)  +
-             (hexdigit_to_num(str[2]) << 4) +
-             (hexdigit_to_num(str[3])) );
-  }
-
-  // This function converts a json string (utf8) to a C++ string
-  // All escaped sequences are resolved and it is made sure that no invalid
-  // UTF-8 character is present in string after parsing (any invalid character
-  // is replaced with the replacement character: U+FFFFD)
-  // Care must be taken to not call it two times for a string inside an operation
-  // (for example, while using [] operator)
-
-  std::string parseUtf8JsonString(const std::string &inp) {
-    std::string out = "";
-
-    std::string temp;
-    size_t inplength = inp.length();
-
-    for (unsigned i = 0; i < inplength; i++) {
-      if (inp[i] != '\\') {
-        out += inp[i];
-      }
-      else {
-        if ( (i + 1) >= inplength)
-          throw JSONException("Cannot end a string with \\ charcter");
-        i++;
-        char hex[4];
-        int32_t first16bit, second16bit;
-        int32_t codepoint;
-        switch(inp[i]) {
-          case '"':  out += '"';   break;
-          case '\\': out += '\\'; break;
-          case '/':  out += '/';   break;
-          case 'b':  out += '\b';  break;
-          case 'f':  out += '\f';  break;
-          case 'n':  out += '\n';  break;
-          case 'r':  out += '\r';  break;
-          case 't':  out += '\t';  break;
-
-          case 'u':
-            if (i + 4 >= inplength)
-              throw JSONException("Expected exactly 4 hex digits after \\u");
-            copy(inp.begin() + i + 1, inp.begin() + i + 1 + 5, hex);
-            i += 4;
-            first16bit = string4_to_hex(hex);
-            codepoint = first16bit;
-            if (0xD800 <= first16bit && first16bit <= 0xDBFF) {
-              // Surrogate pair case
-              // Must have next 6 characters of the form: \uxxxx as well
-
-              if ( (i + 6) >= inplength || inp[i + 1] != '\\' || inp[i + 2] != 'u')
-                throw JSONException("Missing surrogate pair in unicode sequence");
-              i += 2;
-              copy(inp.begin() + i + 1, inp.begin() + i + 1 + 5, hex);
-              i += 4;
-              second16bit = string4_to_hex(hex);
-
-              if (0xDC00 <= second16bit && second16bit <= 0xDFFF) {
-                /* valid second surrogate */
-                codepoint = ((first16bit - 0xD800) << 10) + (second16bit - 0xDC00) + 0x10000;
-              }
-              else {
-                // Invalid second surrogate
-                throw JSONException("Invalid second 16 bit value in surrogate pair: first 16 bit = " + JSON_Utility::itos(first16bit) + " and second 16 bit = " + JSON_Utility::itos(second16bit));
-              }
-            }
-            try {
-              utf8::append(codepoint, back_inserter(out));
-            }
-            catch(utf8::invalid_code_point &e) {
-                throw JSONException("Invalid UTF-8 code point found in text. Value = " + itos(codepoint) + ". Location = " + inp + "\nInternal message = " + e.what());
-            }
-            break;
-          default:
-            throw JSONException("Illegal escape sequence:" + std::string(1, inp[i]));
-        }
-      }
-    }
-    return getValidatedUTF8String(out);
-  }
-
   std::string ReadString(std::istream &in) {
-    std::string out = "";
     int ch = in.get();
     assert(ch == '"'); // First character in a string should be quote
-    std::string str;
+    std::string str = "\"";
     int prev = 0;
     do {
       ch = in.get();
       if (in.eof() || in.fail())
         throw JSONException("Unexpected EOF while reading string");
+      str += char(ch);
       if (ch ==  '"' && prev != '\\') // String is over
         break;
-      str += char(ch);
       prev = (prev == '\\') ? 0 : ch;
     } while (1);
-    return parseUtf8JsonString(str);
+
+    // Decode the (now quote delimited) serialized string from memory
+    std::string out;
+    JSONScanner scanner(str.data(), str.size());
+    scanner.readString(out);
+    return out;
+  }
+
+  // The functions below parse JSON directly from a contiguous buffer (using
+  // JSONScanner), and are used by JSON::readFromBuffer(). Grammar and error
+  // messages are exactly the same as their std::istream counterparts above.
+
+  void ReadJSONValue(JSONScanner &in, JSON &j);
+
+  void ReadObject(JSONScanner &in, Object &o) {
+    int ch = in.get();
+    assert(ch == '{'); // Must be a valid object for ReadObject to be called
+
+    bool firstKey = true;
+    std::string key;
+    do {
+      in.skipWhiteSpace();
+      ch = in.get();
+      if (ch == EOF)
+        throw JSONException("Unexpected EOF while parsing object. ch = " + std::string(1, ch));
+
+      // End of parsing for this JSON object
+      if (ch == '}')
+        break;
+
+      // Keys:value pairs must be separated by , inside JSON object
+      if (!firstKey && ch != ',')
+        throw JSONException("Expected , while parsing object. Got : " + std::string(1, ch));
+
+      if (!firstKey) {
+        in.skipWhiteSpace();
+        ch = in.get();
+      }
+
+      if (!isStringStart(ch))
+        throw JSONException("Expected start of a valid object key (string) at this location");
+
+      // Push back the quote (") again, and parse the key value (string)
+      in.unget();
+
+      key.clear();
+      in.readString(key);
+      in.skipWhiteSpace();
+      ch = in.get();
+      if (ch != ':')
+        throw JSONException("Expected :, got : " + std::string(1, ch));
+      ReadJSONValue(in, o.val[key]);
+      firstKey = false;
+    } while (true);
   }
+
+  void ReadArray(JSONScanner &in, Array &a) {
+    int ch = in.get();
+    assert(ch == '['); // Must be a valid array for ReadArray to be called
+
+    bool firstKey = true;
+    do {
+      in.skipWhiteSpace();
+      ch = in.get();
+      if (ch == EOF)
+        throw JSONException("Unexpected EOF while parsing array");
+
+      // End of parsing this array
+      if (ch == ']')
+        break;
+
+      if (!firstKey && ch != ',')
+        throw JSONException("Expected ,(comma) GOT: " + std::string(1, ch));
+
+      if (firstKey)
+        in.unget();
+
+      a.val.push_back(JSON()); // Append a blank json object. We will fill it soon
+      ReadJSONValue(in, a.val.back());
+      firstKey = false;
+    } while (true);
+  }
+
+  void ReadJSONValue(JSONScanner &in, JSON &j) {
+    j.clear();
+    in.skipWhiteSpace();
+
+    int ch = in.peek();
+    if (ch == EOF)
+      throw JSONException("Unexpected EOF");
+
+    switch (ch) {
+      case '{': {
+        Object *o = new Object();
+        j.tag = JSON_OBJECT;
+        j.val = o;
+        ReadObject(in, *o);
+        break;
+      }
+      case '[': {
+        Array *a = new Array();
+        j.tag = JSON_ARRAY;
+        j.val = a;
+        ReadArray(in, *a);
+        break;
+      }
+      case '"': {
+        String *s = new String();
+        j.tag = JSON_STRING;
+        j.val = s;
+        in.readString(s->val);
+        break;
+      }
+      case 't':
+      case 'f':
+        j.b = in.readBoolean();
+        j.tag = JSON_BOOLEAN;
+        break;
+      case 'n':
+        in.readNull();
+        j.tag = JSON_NULL;
+        break;
+      default:
+        // Treat number case slightly differently - since there can be two different types of numbers
+        if (!isNumberStart(ch))
+          throw JSONException("Illegal JSON value. Cannot start with : " + std::string(1, char(ch)));
+        JSONScanner::Number n;
+        in.readNumber(n);
+        if (n.isReal)
+          j = n.d;
+        else
+          j = n.i;
+    }
+  }
+}
+
+void Integer::write(JSONWriter &out) const {
+  out.writeInteger(val);
+}
+
+void Real::write(JSONWriter &out) const {
+  out.writeReal(val);
 }
 
-void String::write(std::ostream &out) const {
-  JSON_Utility::WriteEscapedString(this->val, out, true);
+void String::write(JSONWriter &out) const {
+  out.writeString(val);
 }
 
-void Object::write(std::ostream &out) const {
-  out<<"{";
+void Object::write(JSONWriter &out) const {
+  out.put('{');
   bool firstElem = true;
 
-  for (std::map<std::string, JSON>::const_iterator it = val.begin(); it != val.end(); ++it, firstElem = false) {
+  for (JSON::const_object_iterator it = val.begin(); it != val.end(); ++it, firstElem = false) {
     if (!firstElem)
-      out<<",";
-    JSON_Utility::WriteEscapedString((*it).first, out, true);
-    out<<":";
-    (*it).second.write(out);
+      out.put(',');
+    out.writeString((*it).first);
+    out.put(':');
+    JSON_Utility::WriteJSONValue((*it).second, out);
+    out.checkpoint();
   }
-  out<<"}";
+  out.put('}');
 }
 
-void Array::write(std::ostream &out) const {
-  out<<"[";
+void Array::write(JSONWriter &out) const {
+  out.put('[');
   bool firstElem = true;
   for (unsigned i = 0; i < val.size(); ++i, firstElem = false) {
     if (!firstElem)
-      out<<",";
-    val[i].write(out);
+      out.put(',');
+    JSON_Utility::WriteJSONValue(val[i], out);
+    out.checkpoint();
   }
-  out<<"]";
+  out.put(']');
+}
+
+void Boolean::write(JSONWriter &out) const {
+  if (val)
+    out.write("true", 4);
+  else
+    out.write("false", 5);
+}
+
+void Null::write(JSONWriter &out) const {
+  out.write("null", 4);
 }
 
 const JSON& Array::jsonAtIndex(size_t i) const {
@@ -444,7 +396,7 @@ const JSON& Array::jsonAtIndex(size_t i) const {
 
 // STL map's [] operator cannot be used on constant objects
 const JSON& Object::jsonAtKey(const std::string &s) const {
-  std::map<std::string, JSON>::const_iterator it = this->val.find(s);
+  JSON::const_object_iterator it = this->val.find(s);
   if (it == val.end())
     throw JSONException("Cannot add new key to a constant JSON_OBJECT");
   return it->second;
@@ -455,17 +407,97 @@ JSON& Object::jsonAtKey(const std::string &s) {
 }
 
 void JSON::write(std::ostream &out) const {
-  if (this->type() == JSON_UNDEFINED) {
-    throw JSONException("Cannot call write() method on uninitialized json object");
-  }
-  out.precision(std::numeric_limits<double>::digits10);
-  val->write(out);
+  JSONWriter writer(out);
+  JSON_Utility::WriteJSONValue(*this, writer);
+  writer.flush();
   out.flush();
 }
 
+void JSON::write(std::string &out) const {
+  JSONWriter writer(out);
+  JSON_Utility::WriteJSONValue(*this, writer);
+}
+
+// Returns the unparsed value held by j (see JSON::parseLazy()), or NULL
+static const RawValue* unparsedValue(const JSON &j) {
+  return (j.tag == JSON_UNDEFINED) ? static_cast<const RawValue*>(j.val) : NULL;
+}
+
+size_t JSON::estimateSize() const {
+  if (const RawValue *raw = unparsedValue(*this))
+    return raw->length();
+  switch (this->type()) {
+    case JSON_INTEGER: {
+      uint64_t u = (i < 0) ? ~static_cast<uint64_t>(i) + 1 : static_cast<uint64_t>(i);
+      size_t digits = 1;
+      while (u >= 10) {
+        u /= 10;
+        ++digits;
+      }
+      return digits + ((i < 0) ? 1 : 0);
+    }
+    case JSON_REAL: return 24; // Typical length of a shortest round trip representation
+    case JSON_STRING: return static_cast<String*>(this->val)->val.size() + 2;
+    case JSON_BOOLEAN: return (b) ? 4 : 5;
+    case JSON_NULL: return 4;
+    case JSON_ARRAY: {
+      const std::vector<JSON> &arr = static_cast<Array*>(this->val)->val;
+      size_t total = 2 + ((arr.empty()) ? 0 : arr.size() - 1);
+      for (size_t i = 0; i < arr.size(); ++i)
+        total += arr[i].estimateSize();
+      return total;
+    }
+    case JSON_OBJECT: {
+      const Object *o = static_cast<Object*>(this->val);
+      size_t total = 2 + ((o->val.empty()) ? 0 : o->val.size() - 1);
+      for (const_object_iterator it = o->val.begin(); it != o->val.end(); ++it)
+        total += it->first.size() + 3 + it->second.estimateSize();
+      return total;
+    }
+    default:
+      return 0;
+  }
+}
+
 void JSON::readFromString(const std::string &jstr) {
-  std::stringstream inp(jstr);
-  this->read(inp);
+  readFromBuffer(jstr.data(), jstr.size());
+}
+
+void JSON::readFromBuffer(const char *data, size_t len) {
+  invalidateHashes();
+  JSONScanner scanner(data, len);
+  JSON_Utility::ReadJSONValue(scanner, *this);
+}
+
+JSON JSON::loadFile(const std::string &path) {
+  JSONMappedFile file(path);
+  return JSON::parse(file.data(), file.size());
+}
+
+JSON JSON::parseLazy(std::string &&str) {
+  std::shared_ptr<const std::string> doc = std::make_shared<const std::string>(std::move(str));
+  JSONScanner scanner(doc->data(), doc->size());
+  scanner.skipWhiteSpace();
+  if (scanner.eof())
+    throw JSONException("Unexpected EOF");
+  const char *begin = scanner.position();
+  scanner.skipValue();
+  const char *end = scanner.position();
+  scanner.skipWhiteSpace();
+  if (!scanner.eof())
+    throw JSONException("Unexpected character after a value: " + std::string(1, *scanner.position()));
+  JSON tmp;
+  tmp.val = new RawValue(doc, begin, end);
+  return tmp;
+}
+
+JSONValue JSON::materialize() const {
+  JSON parsed;
+  static_cast<const RawValue*>(val)->parse(parsed);
+  // Logically const: the value stays the same, only its representation
+  // changes (the unparsed value ends up in "parsed", and is deleted with it)
+  const_cast<JSON*>(this)->swap(parsed);
+  return tag;
 }
 
 const JSON& JSON::operator[](const std::string &s) const {
@@ -486,6 +518,7 @@ JSON& JSON::operator[](const std::string &s) {
   // No need for dynamic_cast (since I already checked for JSON_OBJECT case), and
   // dynamic_cast is expensive
   Object *o = static_cast<Object*>(val);
+  invalidateHashes(); // Adds the key if it's not present
   return o->jsonAtKey(s);
 }
 
@@ -539,16 +572,28 @@ JSON& JSON::operator [](const size_t &indx) { return const_cast<JSON&>( (*(const
 //JSON& JSON::operator [](const JSON &j) { return const_cast<JSON&>( (*(const_cast<const JSON*>(this)))[j]); }
 //JSON& JSON::operator [](const char *str) { return const_cast<JSON&>( (*(const_cast<const JSON*>(this)))[str]); }
 
-JSON::JSON(const JSONValue &rhs) {
-  val = NULL; // So that clear() works fine on this, else we will be deallocating some arbitrary memory - dangerous!
+JSON::JSON(const JSONValue &rhs): tag(JSON_UNDEFINED), val(NULL) { // So that clear() works fine on this
   *this = operator=(rhs);
 }
 
-JSON::JSON(const JSON &rhs) {
-  if (rhs.type() != JSON_UNDEFINED)
-    val = rhs.val->returnMyNewCopy();
+// Copies the value held by rhs (an unparsed value is copied as is)
+static Value* copyValue(const JSON &rhs) {
+  switch (rhs.tag) {
+    case JSON_STRING: return new String(*static_cast<const String*>(rhs.val));
+    case JSON_OBJECT: return new Object(*static_cast<const Object*>(rhs.val));
+    case JSON_ARRAY: return new Array(*static_cast<const Array*>(rhs.val));
+    default: return (rhs.val != NULL) ? rhs.val->returnMyNewCopy() : NULL;
+  }
+}
+
+JSON::JSON(const JSON &rhs): tag(rhs.tag) {
+  if (holdsPointer())
+    val = copyValue(rhs);
   else
-    val = NULL;
+    copyPayload(rhs);
+}
+
+JSON::JSON(std::string &&s): tag(JSON_STRING), val(new String(std::move(s))) {
 }
 
 JSON& JSON::operator =(const JSONValue &rhs) {
@@ -556,13 +601,14 @@ JSON& JSON::operator =(const JSONValue &rhs) {
   switch(rhs) {
     case JSON_ARRAY: val = new Array(); break;
     case JSON_OBJECT: val = new Object(); break;
-    case JSON_INTEGER: val = new Integer(); break;
-    case JSON_REAL: val = new Real(); break;
+    case JSON_INTEGER: i = 0; break;
+    case JSON_REAL: d = 0.0; break;
     case JSON_STRING: val = new String(); break;
-    case JSON_BOOLEAN: val = new Boolean(); break;
-    case JSON_NULL: val = new Null(); break;
+    case JSON_BOOLEAN: b = false; break;
+    case JSON_NULL: break;
     default: throw JSONException("Illegal JSONValue value for JSON initialization");
   }
+  tag = rhs;
   return *this;
 }
 
@@ -570,19 +616,59 @@ JSON& JSON::operator =(const JSON &rhs) {
   if (this == &rhs) // Self-assignment check
     return *this;
 
-  clear();
+  // rhs may be part of the current value (e.g., j = j["a"]): it's copied
+  // before the current value is destroyed (along with tmp)
+  JSON tmp(rhs);
+  swap(tmp);
+  return *this;
+}
 
-  if (rhs.type() != JSON_UNDEFINED)
-    val = rhs.val->returnMyNewCopy();
-  else
-    val = NULL;
+JSON& JSON::operator =(JSON &&rhs) noexcept {
+  if (this == &rhs)
+    return *this;
 
+  // Same as above, for j = std::move(j["a"])
+  JSON tmp(std::move(rhs));
+  swap(tmp);
   return *this;
 }
 
 JSON& JSON::operator =(const std::string &s) {
+  Value *tmp = new String(s);
   clear();
-  val = new String(s);
+  tag = JSON_STRING;
+  val = tmp;
+  return *this;
+}
+
+JSON& JSON::operator =(std::string &&s) {
+  Value *tmp = new String(std::move(s));
+  clear();
+  tag = JSON_STRING;
+  val = tmp;
+  return *this;
+}
+
+JSON& JSON::operator =(std::vector<JSON> &&vec) {
+  Value *tmp = new Array(std::move(vec));
+  clear();
+  tag = JSON_ARRAY;
+  val = tmp;
+  return *this;
+}
+
+JSON& JSON::operator =(std::map<std::string, JSON> &&m) {
+#ifdef DXJSON_FLAT_OBJECTS
+  Object *tmp = new Object();
+  for (std::map<std::string, JSON>::iterator it = m.begin(); it != m.end(); ++it)
+    tmp->val[it->first] = std::move(it->second);
+  m.clear();
+#else
+  Object *tmp = new Object(std::move(m));
+#endif
+  clear();
+  tag = JSON_OBJECT;
+  val = tmp;
   return *this;
 }
 
@@ -592,14 +678,15 @@ JSON& JSON::operator =(const char &c) {
 
 JSON& JSON::operator =(const bool &x) {
   clear();
-  val = new Boolean(x);
+  tag = JSON_BOOLEAN;
+  b = x;
   return *this;
 }
 
 JSON& JSON::operator =(const Null &x __attribute__ ((unused)) ) {
   // x is intended to be unused in this function. Since null has exactly one value.
   clear();
-  val = new Null();
+  tag = JSON_NULL;
   return *this;
 }
 
@@ -634,15 +721,36 @@ void JSON::push_back(const JSON &j) {
     throw JSONException("Cannot push_back to a non-array");
   Array *tmp = static_cast<Array*>(this->val);
   assert(tmp != NULL);
+  invalidateHashes();
   tmp->push_back(j);
 }
 
+void JSON::push_back(JSON &&j) {
+  if (this->type() != JSON_ARRAY)
+    throw JSONException("Cannot push_back to a non-array");
+  Array *tmp = static_cast<Array*>(this->val);
+  assert(tmp != NULL);
+  invalidateHashes();
+  tmp->push_back(std::move(j));
+}
+
+void JSON::insert(const std::string &key, JSON &&j) {
+  if (this->type() != JSON_OBJECT)
+    throw JSONException("Cannot insert a key/value pair in a non-object");
+  Object *tmp = static_cast<Object*>(this->val);
+  assert(tmp != NULL);
+  invalidateHashes();
+  tmp->val[key] = std::move(j);
+}
+
 std::string JSON::toString(bool onlyTopLevel) const {
-  if (onlyTopLevel && this->type() != JSON_OBJECT && this->type() != JSON_ARRAY)
+  const RawValue *raw = unparsedValue(*this);
+  if (onlyTopLevel && ((raw != NULL) ? !raw->isContainer() : (this->type() != JSON_OBJECT && this->type() != JSON_ARRAY)))
     throw JSONException("Only a JSON_OBJECT/JSON_ARRAY can call toString() with onlyTopLevel flag set to true");
-  std::stringstream in;
-  write(in);
-  return in.str();
+  std::string out;
+  out.reserve(estimateSize());
+  write(out);
+  return out;
 }
 
 bool JSON::has(const size_t &indx) const {
@@ -676,18 +784,21 @@ bool JSON::has(const JSON &j) const {
 }
 
 void JSON::read(std::istream &in) {
+  invalidateHashes();
   JSON_Utility::ReadJSONValue(in, *this, false);
 }
 
 void JSON::erase(const size_t &indx) {
   if (this->type() != JSON_ARRAY)
     throw JSONException("erase(size_t) can only be called for a JSON_ARRAY");
+  invalidateHashes();
   (static_cast<Array*>(this->val))->erase(indx);
 }
 
 void JSON::erase(const std::string &indx) {
   if (this->type() != JSON_OBJECT)
     throw JSONException("erase(string) can only be called for a JSON_OBJECT");
+  invalidateHashes();
   (static_cast<Object*>(this->val))->erase(indx);
 }
 
@@ -825,17 +936,11 @@ bool Integer::isEqual(const Value *other) const {
   return (p != NULL && this->val == p->val);
 }
 
-bool Real::isEqual(const Value* other) const {
-  const Real *p = dynamic_cast<const Real*>(other);
-  
-  // In our implementation of isEqual, "Real" is *never* equal to Integer
-  // TODO: Decide if this is desired behavior ?
-  if (p == NULL)
-    return false;
-
+// Compares two JSON_REAL values (see json_epsilon)
+static bool realsEqual(double a, double b) {
   //Ref: 1. http://floating-point-gui.de/errors/comparison/
   //     2. http://randomascii.wordpress.com/2012/02/25/comparing-floating-point-numbers-2012-edition/
-  double diff = fabs(this->val - p->val);
+  double diff = fabs(a - b);
   double eps = JSON::getEpsilon();
 
   // If numbers are really close (absolute error), return true
@@ -844,16 +949,24 @@ bool Real::isEqual(const Value* other) const {
     return true;
   }
   // Now use absolute error to check for "closeness"
-  double absA = fabs(this->val);
-  double absB = fabs(p->val);
+  double absA = fabs(a);
+  double absB = fabs(b);
   double largest = (absA > absB) ? absA : absB;
   // always use largest to check for relative error
   // so that isEqual() remain commutative
   return diff <= (largest * eps);
 }
 
+bool Real::isEqual(const Value* other) const {
+  const Real *p = dynamic_cast<const Real*>(other);
+  
+  // In our implementation of isEqual, "Real" is *never* equal to Integer
+  // TODO: Decide if this is desired behavior ?
+  return (p != NULL && realsEqual(this->val, p->val));
+}
+
 bool String::isEqual(const Value* other) const {
-  const String *p = dynamic_cast<const String*>(other);
+  const String *p = (other->type() == JSON_STRING) ? static_cast<const String*>(other) : NULL;
   return (p != NULL && this->val == p->val);
 }
 
@@ -867,28 +980,218 @@ bool Null::isEqual(const Value* other) const {
   return (p != NULL);
 }
 
+// type() instead of dynamic_cast (which is expensive) for the final classes below
+
 bool Array::isEqual(const Value* other) const {
-  const Array *p = dynamic_cast<const Array*>(other);
+  const Array *p = (other->type() == JSON_ARRAY) ? static_cast<const Array*>(other) : NULL;
   return (p != NULL && this->val.size() == p->val.size() && equal(this->val.begin(), this->val.end(), p->val.begin()));
 }
 
 bool Object::isEqual(const Value* other) const {
-  const Object *p = dynamic_cast<const Object*>(other);
+  const Object *p = (other->type() == JSON_OBJECT) ? static_cast<const Object*>(other) : NULL;
   if (p == NULL || this->val.size() != p->val.size())
     return false;
+#ifdef DXJSON_FLAT_OBJECTS
+  // Members are not sorted (order of insertion does not matter for equality)
+  for (JSON::const_object_iterator it1 = this->val.begin(); it1 != this->val.end(); ++it1) {
+    JSON::const_object_iterator it2 = p->val.find(it1->first);
+    if (it2 == p->val.end() || it1->second != it2->second)
+      return false;
+  }
+  return true;
+#else
   std::map<std::string, JSON>::const_iterator it1,it2;
   for (it1 = this->val.begin(), it2 = p->val.begin(); it1 != this->val.end() && it2 != p->val.end(); ++it1, ++it2) {
     if (it1->first != it2->first || it1->second != it2->second)
       return false;
   }
   return (it1 == this->val.end() && it2 == p->val.end());
+#endif
 }
 
+#ifdef DXJSON_FLAT_OBJECTS
+namespace {
+  // FNV-1a hash
+  inline size_t hashKey(const std::string &key) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.size(); ++i) {
+      h ^= static_cast<unsigned char>(key[i]);
+      h *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(h);
+  }
+}
+
+void FlatObjectMap::clear() {
+  members.clear();
+  index.clear();
+}
+
+size_t FlatObjectMap::lookup(const std::string &key) const {
+  if (index.empty()) {
+    for (size_t i = 0; i < members.size(); ++i) {
+      if (members[i].first == key)
+        return i;
+    }
+    return NOT_FOUND;
+  }
+  const size_t mask = index.size() - 1;
+  for (size_t slot = hashKey(key) & mask; index[slot] != 0; slot = (slot + 1) & mask) {
+    const size_t pos = index[slot] - 1;
+    if (members[pos].first == key)
+      return pos;
+  }
+  return NOT_FOUND;
+}
+
+FlatObjectMap::iterator FlatObjectMap::find(const std::string &key) {
+  const size_t pos = lookup(key);
+  return (pos == NOT_FOUND) ? end() : begin() + pos;
+}
+
+FlatObjectMap::const_iterator FlatObjectMap::find(const std::string &key) const {
+  const size_t pos = lookup(key);
+  return (pos == NOT_FOUND) ? end() : begin() + pos;
+}
+
+JSON& FlatObjectMap::operator[](const std::string &key) {
+  const size_t pos = lookup(key);
+  if (pos != NOT_FOUND)
+    return members[pos].second;
+
+  members.push_back(value_type(key, JSON()));
+  // Keep load factor of the hash index at most 1/2
+  if (members.size() > LINEAR_SEARCH_LIMIT && 2 * members.size() > index.size())
+    rebuildIndex();
+  else if (!index.empty())
+    addToIndex(members.size() - 1);
+  return members.back().second;
+}
+
+size_t FlatObjectMap::erase(const std::string &key) {
+  const size_t pos = lookup(key);
+  if (pos == NOT_FOUND)
+    return 0;
+  members.erase(members.begin() + pos);
+  if (!index.empty())
+    rebuildIndex();
+  return 1;
+}
+
+void FlatObjectMap::addToIndex(size_t pos) {
+  const size_t mask = index.size() - 1;
+  size_t slot = hashKey(members[pos].first) & mask;
+  while (index[slot] != 0)
+    slot = (slot + 1) & mask;
+  index[slot] = static_cast<uint32_t>(pos + 1);
+}
+
+void FlatObjectMap::rebuildIndex() {
+  if (members.size() <= LINEAR_SEARCH_LIMIT) {
+    index.clear();
+    return;
+  }
+  size_t slots = 64;
+  while (slots < 4 * members.size())
+    slots *= 2;
+  index.assign(slots, 0);
+  for (size_t i = 0; i < members.size(); ++i)
+    addToIndex(i);
+}
+#endif
+
+
+namespace {
+  // Finalizer of splitmix64: spreads the bits of h
+  uint64_t mixHash(uint64_t h) {
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+  }
+
+  uint64_t combineHash(uint64_t seed, uint64_t h) {
+    return mixHash(seed ^ (h + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+  }
+
+  uint64_t hashString(const std::string &s) {
+    return combineHash(JSON_STRING, std::hash<std::string>()(s));
+  }
+
+  // Returns the hash of j, using (and filling) the caches of containers
+  // which are valid in the given epoch
+  uint64_t hashValue(const JSON &j, uint64_t epoch) {
+    switch (j.type()) {
+      case JSON_INTEGER: return combineHash(JSON_INTEGER, static_cast<uint64_t>(j.i));
+      case JSON_REAL: return mixHash(JSON_REAL); // See JSON::hash()
+      case JSON_BOOLEAN: return combineHash(JSON_BOOLEAN, j.b);
+      case JSON_NULL: return mixHash(JSON_NULL);
+      case JSON_STRING: return hashString(static_cast<const String*>(j.val)->val);
+      case JSON_ARRAY: {
+        const Array *a = static_cast<const Array*>(j.val);
+        if (a->hashCache.epoch.load(std::memory_order_acquire) == epoch)
+          return a->hashCache.value.load(std::memory_order_relaxed);
+        uint64_t h = mixHash(JSON_ARRAY);
+        for (size_t i = 0; i < a->val.size(); ++i)
+          h = combineHash(h, hashValue(a->val[i], epoch));
+        a->hashCache.value.store(h, std::memory_order_relaxed);
+        a->hashCache.epoch.store(epoch, std::memory_order_release);
+        return h;
+      }
+      case JSON_OBJECT: {
+        const Object *o = static_cast<const Object*>(j.val);
+        if (o->hashCache.epoch.load(std::memory_order_acquire) == epoch)
+          return o->hashCache.value.load(std::memory_order_relaxed);
+        // Members are summed up, so that their order does not matter
+        uint64_t sum = 0;
+        for (JSON::const_object_iterator it = o->val.begin(); it != o->val.end(); ++it)
+          sum += combineHash(hashString(it->first), hashValue(it->second, epoch));
+        const uint64_t h = combineHash(mixHash(JSON_OBJECT), sum);
+        o->hashCache.value.store(h, std::memory_order_relaxed);
+        o->hashCache.epoch.store(epoch, std::memory_order_release);
+        return h;
+      }
+      default:
+        return 0;
+    }
+  }
+
+  // false if both containers have a hash cached in the current epoch, and they differ
+  bool mayBeEqual(const JSONHashCache &a, const JSONHashCache &b) {
+    const uint64_t epoch = hash_epoch.load(std::memory_order_acquire);
+    return (a.epoch.load(std::memory_order_acquire) != epoch || b.epoch.load(std::memory_order_acquire) != epoch ||
+            a.value.load(std::memory_order_relaxed) == b.value.load(std::memory_order_relaxed));
+  }
+}
+
+size_t JSON::hash() const {
+  const uint64_t epoch = hash_epoch.load(std::memory_order_acquire);
+  const uint64_t h = hashValue(*this, epoch);
+  uint64_t cachedAt = hash_cached_at.load(std::memory_order_relaxed);
+  while (cachedAt < epoch && !hash_cached_at.compare_exchange_weak(cachedAt, epoch, std::memory_order_relaxed)) { }
+  return static_cast<size_t>(h);
+}
 
 bool JSON::operator ==(const JSON& other) const {
-  if (this->type() != other.type() || this->type() == JSON_UNDEFINED)
+  const JSONValue t = this->type();
+  if (t != other.type() || t == JSON_UNDEFINED)
     return false;
-  return (this->val->isEqual(other.val));
+  if (this == &other)
+    return true;
+  switch (t) {
+    case JSON_INTEGER: return (i == other.i);
+    case JSON_REAL: return realsEqual(d, other.d);
+    case JSON_BOOLEAN: return (b == other.b);
+    case JSON_NULL: return true;
+    case JSON_STRING: return (static_cast<const String*>(val)->val == static_cast<const String*>(other.val)->val);
+    case JSON_OBJECT: {
+      const Object *o = static_cast<const Object*>(val);
+      return mayBeEqual(o->hashCache, static_cast<const Object*>(other.val)->hashCache) && o->isEqual(other.val);
+    }
+    default: {
+      const Array *a = static_cast<const Array*>(val);
+      return mayBeEqual(a->hashCache, static_cast<const Array*>(other.val)->hashCache) && a->isEqual(other.val);
+    }
+  }
 }
 
 JSON::const_object_iterator JSON::object_begin() const {
@@ -991,5 +1294,6 @@ JSON::array_reverse_iterator JSON::array_rend() {
 void JSON::resize_array(size_t desired_size) {
   if (this->type() != JSON_ARRAY)
     throw JSONException("Cannot call resize_array() on a non JSON_ARRAY object");
+  invalidateHashes();
   (static_cast<Array*>(this->val))->val.resize(desired_size);
 }
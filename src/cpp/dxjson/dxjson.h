@@ -21,6 +21,8 @@
 #include <cstring>
 #include <vector>
 #include <map>
+#include <iterator>
+#include <utility>
 #include <cstdlib>
 #include <string>
 #include <iostream>
@@ -34,6 +36,8 @@
 #include <typeinfo>
 #include <cmath>
 #include <algorithm>
+#include <atomic>
+#include <functional>
 #include <stdint.h>
 #include <boost/math/special_functions/fpclassify.hpp>
 #include <boost/lexical_cast.hpp>
@@ -109,13 +113,15 @@ namespace dx {
     JSON_NULL = 7
   };
 
+  class JSONWriter;
+
   /** An abstract base class to allow making a heterogenous container
    *  Classes for all possible JSON values are derived from this base class.
    */
   class Value {
   public:
     virtual JSONValue type() const = 0; // Return type of particular derived class
-    virtual void write(std::ostream &out) const = 0;
+    virtual void write(JSONWriter &out) const = 0;
     virtual Value* returnMyNewCopy() const = 0;
     virtual void read(std::istream &in) = 0;
     virtual bool isEqual(const Value* other) const = 0;
@@ -137,19 +143,45 @@ namespace dx {
   class JSON {
   public:
     
+#ifdef DXJSON_FLAT_OBJECTS
+    typedef std::pair<std::string, JSON>* object_iterator;
+    typedef const std::pair<std::string, JSON>* const_object_iterator;
+#else
     typedef std::map<std::string, JSON>::iterator object_iterator;
     typedef std::map<std::string, JSON>::const_iterator const_object_iterator;
+#endif
     typedef std::vector<JSON>::iterator array_iterator;
     typedef std::vector<JSON>::const_iterator const_array_iterator;
 
+#ifdef DXJSON_FLAT_OBJECTS
+    typedef std::reverse_iterator<const_object_iterator> object_reverse_iterator;
+    typedef std::reverse_iterator<object_iterator> const_object_reverse_iterator;
+#else
     typedef std::map<std::string, JSON>::const_reverse_iterator object_reverse_iterator;
     typedef std::map<std::string, JSON>::reverse_iterator const_object_reverse_iterator;
+#endif
     typedef std::vector<JSON>::reverse_iterator array_reverse_iterator;
     typedef std::vector<JSON>::const_reverse_iterator const_array_reverse_iterator;
 
-    /** This will store pointer to actual JSON value
+    /** Type of the value held. JSON_UNDEFINED (with val == NULL) for an
+      * uninitialized object, or (with val != NULL) for a value which is not
+      * parsed yet (see parseLazy()): use type() instead, which handles this.
+      */
+    JSONValue tag;
+
+    /** The value itself: numbers and booleans are held inline (a JSON_NULL
+      * needs nothing), everything else through the pointer "val".
       */
-    Value *val;
+    union {
+      int64_t i; // JSON_INTEGER
+      double d; // JSON_REAL
+      bool b; // JSON_BOOLEAN
+
+      /** Pointer to the String/Object/Array holding a JSON_STRING/JSON_OBJECT/JSON_ARRAY
+        * (or to the value not parsed yet).
+        */
+      Value *val;
+    };
 
     /** Returns the current "epsilon" paramerer value.
       * This value determines the "slack" while checking equality
@@ -170,15 +202,122 @@ namespace dx {
       return tmp;
     }
 
+    /** Creates a new JSON object from a serialized representation held in a
+      * contiguous buffer (which need not be NUL terminated).
+      * See notes for read() (applies here as well)
+      * @param data Pointer to the serialized json object.
+      * @param len Number of bytes available at data.
+      * @return
+      */
+    static JSON parse(const char *data, size_t len) {
+      JSON tmp;
+      tmp.readFromBuffer(data, len);
+      return tmp;
+    }
+
+    /** Creates a new JSON object from the contents of a file. The file is
+      * mapped in memory (see JSONMappedFile in mapped.h) and parsed in place,
+      * instead of being read through a stream. For a huge file of which only
+      * a few values are needed, see JSONLazyFile.
+      * See notes for read() (applies here as well)
+      * @param path Path of the file
+      * @return
+      * @throw JSONException If the file cannot be opened, or does not contain
+      * valid JSON.
+      */
+    static JSON loadFile(const std::string &path);
+
+    /** Creates a new JSON object from a serialized representation, without
+      * parsing it: only the extent of the value is found (by matching
+      * brackets and quotes). Each value is parsed when it's first accessed
+      * (by type(), operator[], get(), iterators, etc), and a JSON_OBJECT or
+      * JSON_ARRAY only one level deep, i.e., its members/elements are located
+      * but remain unparsed themselves. A value which has not been accessed is
+      * written out by write()/toString() by copying its original text, and
+      * copied by reference, so a big document of which only a few values are
+      * looked at can be handed around and written out again at almost no
+      * cost.
+      * @note
+      * - Text of the document is held (in a single buffer, shared by all the
+      * values taken from it, and their copies) as long as any unparsed value
+      * taken from it exists.
+      * - Errors in a value are detected only when the part containing them
+      * is parsed (and never, if the value is written out unparsed), so this
+      * is meant for documents known to be valid JSON, e.g., responses
+      * returned by DXHTTPRequestRaw().
+      * - Even the const accessors modify the object (when they parse a value
+      * inside it), so a JSON object created this way must not be accessed
+      * from several threads at once.
+      * @param str The serialized json object.
+      * @return
+      * @throw JSONException If the end of the (top level) value is not found,
+      * or if anything but white space follows it.
+      */
+    static JSON parseLazy(const std::string &str) { return parseLazy(std::string(str)); }
+
+    /** Same as parseLazy(const std::string &), but takes over the provided
+      * string instead of copying it.
+      */
+    static JSON parseLazy(std::string &&str);
+
+    /** Same as parse(), but a large JSON_ARRAY at the top level, or held by
+      * a member of a JSON_OBJECT at the top level (e.g., "results" in the
+      * response of /system/findDataObjects), is parsed on several threads:
+      * its elements are located first (by matching brackets and quotes), and
+      * then parsed in contiguous ranges, one per thread. The result (and the
+      * errors detected) are same as for parse(); small inputs are simply
+      * handed to parse().
+      * @param data Pointer to the serialized json object.
+      * @param len Number of bytes available at data.
+      * @param threads Maximum number of threads to use (including the
+      * calling one). 0 means getParallelThreads().
+      * @return
+      */
+    static JSON parseParallel(const char *data, size_t len, unsigned threads);
+    static JSON parseParallel(const std::string &str, unsigned threads = 0) {
+      return parseParallel(str.data(), str.size(), threads);
+    }
+
+    /** Sets the number of threads used by parseParallel() when none is
+      * given, for the whole process. 0 restores the default: one per
+      * hardware thread, but at most 4 (callers are often multithreaded
+      * themselves).
+      */
+    static void setParallelThreads(unsigned threads);
+    static unsigned getParallelThreads();
+
+    /** Returns true if setParallelThreads() was last called with more than
+      * one thread. Code which has to hold a whole input in memory to use
+      * parseParallel() (e.g., dxcpp, for large API responses it would
+      * otherwise parse while they download) only does so when asked to.
+      */
+    static bool parallelParseRequested();
+
     /** Default constructor for JSON. Creates JSON of type JSON_UNDEFINED.
       */
-    JSON():val(NULL) {}
+    JSON(): tag(JSON_UNDEFINED), val(NULL) {}
 
     /** Copy constructor
       * @param rhs This is the JSON object which will be copied.
       */
     JSON(const JSON &rhs);
 
+    /** Move constructor: takes over the value held by rhs, without copying it.
+      * rhs.type() == JSON_UNDEFINED after the call.
+      * @param rhs The JSON object whose value will be moved.
+      */
+    JSON(JSON &&rhs) noexcept: tag(rhs.tag) {
+      invalidateHashes(); // rhs is modified
+      copyPayload(rhs);
+      rhs.tag = JSON_UNDEFINED;
+      rhs.val = NULL;
+    }
+
+    /** Constructs a JSON_STRING by moving the provided std::string into it.
+      * @param s The string to be moved.
+      */
+    JSON(std::string &&s);
+
     /** Construct a blank JSON object of a particular JSONValue type, i.e.,
       * (this->type() == rhs) after construction.
       */
@@ -194,7 +333,13 @@ namespace dx {
 
     /** Clears the content of JSON object. 
       * this->type() == JSON_UNDEFINED after the call*/
-    void clear() { delete val; val=NULL; }
+    void clear() {
+      invalidateHashes();
+      if (holdsPointer())
+        delete val;
+      tag = JSON_UNDEFINED;
+      val = NULL;
+    }
 
     /** Writes the serialized JSON object to the output stream
       * @param out Output stream object, to which the serialized object will be written to
@@ -204,6 +349,22 @@ namespace dx {
       */
     void write(std::ostream &out) const;
 
+    /** Appends the serialized JSON object to a string. This is faster than
+      * writing to a std::ostream, and allows reusing a buffer (e.g., after
+      * clear()ing it, or reserve()ing estimateSize() bytes in it) across calls.
+      * @param out String to which the serialized object will be appended
+      * @throw JSONException
+      * @see toString()
+      */
+    void write(std::string &out) const;
+
+    /** Returns an estimate of the length of toString() output, computed without
+      * serializing the object (it's exact unless strings inside contain characters
+      * which must be escaped, or real numbers are present). JSON_UNDEFINED values
+      * (which cannot be serialized) count as 0 bytes.
+      */
+    size_t estimateSize() const;
+
     /** Reads and populates current JSON object from specified input stream
       * containing a valid serialized represntation of JSON value.
       * @note 
@@ -244,6 +405,17 @@ namespace dx {
       */
     void readFromString(const std::string &jstr); // Populate JSON from a string
 
+    /** Populates current JSON object from the stringified json value held in
+      * the buffer [data, data + len). The buffer is parsed in place (no copy of
+      * it is made), so this is the preferred way of parsing large documents.
+      * See notes for read() (applies here as well).
+      * @param data Pointer to the first character of serialized JSON
+      * @param len Number of bytes available at data
+      * @exception JSONException If the buffer contains illegaly formatted JSON
+      * @see readFromString()
+      */
+    void readFromBuffer(const char *data, size_t len);
+
     /** Returns the stringified representation of JSON object.
       * @param onlyTopLevel If set to true, then only JSON objects of type JSON_OBJECT
       *                     or JSON_ARRAY can call this function.
@@ -264,6 +436,20 @@ namespace dx {
       */
     bool operator ==(const JSON& other) const;
 
+    /** Returns a structural hash of the value, consistent with operator==()
+      * (i.e., equal values have equal hashes), so that JSON objects can be
+      * used as keys of unordered containers (see std::hash<dx::JSON>).
+      * The hash of each JSON_OBJECT/JSON_ARRAY inside the value is cached,
+      * and used by operator==() to tell unequal values apart without a deep
+      * comparison. Cached hashes are dropped as soon as any JSON value is
+      * modified (see invalidateHashes()), so they never go stale.
+      * @note Since JSON_REAL values are compared with a (relative) tolerance
+      * (see getEpsilon()), all of them have the same hash.
+      * @note JSON_UNDEFINED values have hash 0.
+      * @return The hash.
+      */
+    size_t hash() const;
+
     /** Inequality comparison operator.
       * @param other The JSON object to which current object will be compared.
       * @return false if *this == other, else true.
@@ -365,6 +551,26 @@ namespace dx {
       * @return Reference to current object (to allow chaining of = operations).
       */
     JSON& operator =(const JSON &);
+
+    /** Moves the provided JSON object's value to current JSON object (no copy is made).
+      * @note Current value of object will be erased, and rhs.type() == JSON_UNDEFINED
+      *       after the call (unless rhs is the current object itself).
+      * @param rhs The value which will be moved to current object.
+      * @return Reference to current object (to allow chaining of = operations).
+      */
+    JSON& operator =(JSON &&rhs) noexcept;
+
+    /** Exchanges the values of current JSON object and "other" (no copy is made).
+      * @param other The JSON object to swap values with.
+      */
+    void swap(JSON &other) noexcept {
+      invalidateHashes();
+      std::swap(tag, other.tag);
+      int64_t tmp;
+      memcpy(&tmp, &i, sizeof(i));
+      copyPayload(other);
+      memcpy(&other.i, &tmp, sizeof(tmp));
+    }
     
     /** Creates a blank JSON object of a particular JSONValue type, i.e.,
       * this->type() == rhs; to the function, after the call.
@@ -388,6 +594,13 @@ namespace dx {
       */
     JSON& operator =(const std::string &s);
 
+    /** Moves the provided std::string value to current JSON object (as a JSON_STRING)
+      * @note Current value of object will be erased.
+      * @param rhs The value which will be moved to current object.
+      * @return Reference to current object (to allow chaining of = operations).
+      */
+    JSON& operator =(std::string &&s);
+
     /** Copies the provided boolean value to current JSON object (as a JSON_BOOLEAN)
       * @note Current value of object will be erased.
       * @param rhs The value which will be copied to current object.
@@ -417,6 +630,13 @@ namespace dx {
     template<typename T>
     JSON& operator =(const std::vector<T> &vec);
 
+    /** Moves the provided std::vector of JSON values to current JSON object (as a JSON_ARRAY)
+      * @note Current value of object will be erased.
+      * @param rhs The value which will be moved to current object.
+      * @return Reference to current object (to allow chaining of = operations).
+      */
+    JSON& operator =(std::vector<JSON> &&vec);
+
     /** Copies the provided std::map value to current JSON object (as a JSON_OBJECT)
       * @note Current value of object will be erased.
       * @param rhs The value which will be copied to current object.
@@ -425,6 +645,13 @@ namespace dx {
     template<typename T>
     JSON& operator =(const std::map<std::string, T> &m);
 
+    /** Moves the provided std::map of JSON values to current JSON object (as a JSON_OBJECT)
+      * @note Current value of object will be erased.
+      * @param rhs The value which will be moved to current object.
+      * @return Reference to current object (to allow chaining of = operations).
+      */
+    JSON& operator =(std::map<std::string, JSON> &&m);
+
     /** Conversion operator. Currently only typecasting to a numeric type (real/integer/bool)
       * is supported.
       * @return The typecasted value of JSON object in requested type.
@@ -447,7 +674,11 @@ namespace dx {
     /** Returns the type of current JSON object.
       * @return Type (a variable of type enum JSONValue) of current JSON object.
       */
-    JSONValue type() const { return (val == NULL) ? JSON_UNDEFINED : val->type(); }
+    JSONValue type() const {
+      if (tag != JSON_UNDEFINED || val == NULL)
+        return tag;
+      return materialize(); // Not parsed yet (see parseLazy())
+    }
 
     /** Resizes an JSON_ARRAY.
       * If current size of array = curr_size, and desired size provided by user = desired_size, then
@@ -520,6 +751,27 @@ namespace dx {
       */
     void push_back(const JSON &j);
 
+    /** Appends a JSON value at end of current JSON_ARRAY object, by moving it.
+      * @throw JSONException If called for non JSON_ARRAY object.
+      * @param j The value to be moved to the end of array.
+      */
+    void push_back(JSON &&j);
+
+    /** Constructs a JSON value in place at end of current JSON_ARRAY object.
+      * @throw JSONException If called for non JSON_ARRAY object.
+      * @param args Arguments forwarded to the JSON constructor.
+      */
+    template<typename... Args>
+    void emplace_back(Args&&... args);
+
+    /** Inserts a key/value pair in current JSON_OBJECT, by moving the value.
+      * If the key is already present, its value is replaced.
+      * @throw JSONException If called for non JSON_OBJECT object.
+      * @param key The key to insert.
+      * @param j The value to be moved into the object.
+      */
+    void insert(const std::string &key, JSON &&j);
+
     /** Removes a particular index inside a JSON_ARRAY
       * @throw JSONException If called for non JSON_ARRAY object.
       * @param indx The index to be removed from array
@@ -533,6 +785,47 @@ namespace dx {
       */
     void erase(const std::string &key);
 
+    /** Applies a JSON Patch (RFC 6902) to this value, in place: values are
+      * added, removed, replaced, moved (without being copied), copied, or
+      * tested as described by the operations in patch, in order.
+      * @param patch A JSON_ARRAY of operations, e.g.,
+      * [{"op": "replace", "path": "/details/reads/0", "value": "file-xxxx"}]
+      * @throw JSONException If an operation is malformed, refers to a
+      * location which does not exist, or a "test" fails. The operations
+      * preceding it remain applied.
+      */
+    void applyPatch(const JSON &patch);
+
+    /** Same as applyPatch(const JSON&), but values are moved out of patch
+      * rather than copied.
+      */
+    void applyPatch(JSON &&patch);
+
+    /** Applies a JSON Merge Patch (RFC 7386) to this value, in place: if
+      * patch is a JSON_OBJECT, its members are merged recursively into this
+      * value (a null member removes the key), otherwise it replaces the value.
+      */
+    void applyMergePatch(const JSON &patch);
+
+    /** Same as applyMergePatch(const JSON&), but values are moved out of
+      * patch rather than copied.
+      */
+    void applyMergePatch(JSON &&patch);
+
+    /** Returns a JSON Patch (RFC 6902) turning "from" into "to" (an empty
+      * JSON_ARRAY if they are equal). Only the members/elements which differ
+      * are included.
+      */
+    static JSON diffPatch(const JSON &from, const JSON &to);
+
+    /** Returns a JSON Merge Patch (RFC 7386) turning "from" into "to" (an
+      * empty JSON_OBJECT if they are equal JSON_OBJECTs). Only the members
+      * which differ are included; arrays are replaced as a whole.
+      * @throw JSONException If a member of "to" (in a JSON_OBJECT) is null,
+      * and differs from "from": merge patches cannot express that.
+      */
+    static JSON diffMergePatch(const JSON &from, const JSON &to);
+
     /** Returns iterator to beginning.
       * @throw JSONException If called on an object which is not a JSON_HASH
       * @return A const iterator to the first element in the container.
@@ -607,8 +900,35 @@ namespace dx {
       */  
     array_reverse_iterator array_rend();
 
-    /** Erases and deallocate any memory for the current JSON object */
-    ~JSON() { clear(); }
+    /** @internal
+      * Replaces the unparsed value held by this object (see parseLazy()) by
+      * its parsed version, and returns its type.
+      */
+    JSONValue materialize() const;
+
+    /** @internal true if "val" is the active member of the union (it may be NULL) */
+    bool holdsPointer() const { return (tag == JSON_UNDEFINED || tag == JSON_OBJECT || tag == JSON_ARRAY || tag == JSON_STRING); }
+
+    /** @internal Copies the union holding the value (whichever member is active) from rhs */
+    void copyPayload(const JSON &rhs) { memcpy(&i, &rhs.i, sizeof(i)); }
+    static_assert(sizeof(int64_t) >= sizeof(Value*), "copyPayload() copies the union as an int64_t");
+
+    /** @internal
+      * Must be called by every member function which modifies a JSON value:
+      * it makes hashes cached by hash() invalid. Cheap (no shared memory is
+      * written) when no hash has been cached since the last call.
+      */
+    static void invalidateHashes();
+
+    /** Erases and deallocate any memory for the current JSON object
+      * (unlike clear(), does not invalidate cached hashes: a value which is
+      * destroyed cannot be looked at, and containers invalidate them when
+      * they remove values).
+      */
+    ~JSON() {
+      if (holdsPointer())
+        delete val;
+    }
   };
 
   class Integer: public Value {
@@ -617,7 +937,7 @@ namespace dx {
 
     Integer() {}
     Integer(const int64_t &v): val(v) {}
-    void write(std::ostream &out) const { out << val; }
+    void write(JSONWriter &out) const;
     JSONValue type() const { return JSON_INTEGER; }
     size_t returnAsArrayIndex() const { return static_cast<size_t>(val);}
     Value* returnMyNewCopy() const { return new Integer(*this); }
@@ -640,7 +960,7 @@ namespace dx {
       assertValidityOfNumericType(v);
       val = v;
     }
-    void write(std::ostream &out) const { out << val; }
+    void write(JSONWriter &out) const;
     JSONValue type() const { return JSON_REAL; }
     size_t returnAsArrayIndex() const { return static_cast<size_t>(val);}
     Value* returnMyNewCopy() const { return new Real(*this); }
@@ -653,14 +973,15 @@ namespace dx {
     void read(std::istream &in __attribute__ ((unused)) ) { assert(false); }
   };
 
-  class String: public Value {
+  class String final: public Value {
   public:
     std::string val;
 
     String() {}
     String(const std::string &v):val(v) {}
+    String(std::string &&v):val(std::move(v)) {}
     // TODO: Make sure cout << stl::string works as expected;
-    void write(std::ostream &out) const;
+    void write(JSONWriter &out) const;
     JSONValue type() const { return JSON_STRING; }
     std::string returnString() const { return val; }
     Value* returnMyNewCopy() const { return new String(*this); }
@@ -672,12 +993,98 @@ namespace dx {
     // Should have a constructor which allows creation from std::string directly.
   };
 
-  class Object: public Value {
+#ifdef DXJSON_FLAT_OBJECTS
+  /** Storage for members of a JSON_OBJECT, used instead of std::map when
+    * compiled with DXJSON_FLAT_OBJECTS defined (it must be defined, or not,
+    * consistently for all the code using dxjson).
+    *
+    * Members are kept in a single vector, in order of insertion (which is
+    * also the order in which they are iterated over, and written out). Keys
+    * are looked up by a linear search in small objects (most of the objects
+    * returned by API calls have a handful of keys), and through a hash index
+    * otherwise. Interface is the subset of std::map used by Object.
+    */
+  class FlatObjectMap {
   public:
+    typedef std::pair<std::string, JSON> value_type;
+    typedef value_type* iterator;
+    typedef const value_type* const_iterator;
+
+    /** Objects with more members than this have a hash index */
+    static const size_t LINEAR_SEARCH_LIMIT = 16;
+
+    FlatObjectMap() {}
+
+    size_t size() const { return members.size(); }
+    bool empty() const { return members.empty(); }
+    void clear();
+
+    iterator begin() { return members.data(); }
+    iterator end() { return members.data() + members.size(); }
+    const_iterator begin() const { return members.data(); }
+    const_iterator end() const { return members.data() + members.size(); }
+
+    iterator find(const std::string &key);
+    const_iterator find(const std::string &key) const;
+    size_t count(const std::string &key) const { return (lookup(key) != NOT_FOUND) ? 1u : 0u; }
+
+    /** Returns value associated with key, appending a JSON_UNDEFINED value if key is not present */
+    JSON& operator[](const std::string &key);
+
+    /** Removes the member with given key. Returns the number of members removed (0 or 1) */
+    size_t erase(const std::string &key);
+
+    /** Appends the members in [first, last) whose keys are not present already (same as std::map) */
+    template<typename InputIterator>
+    void insert(InputIterator first, InputIterator last) {
+      for (; first != last; ++first) {
+        if (lookup(first->first) == NOT_FOUND)
+          (*this)[first->first] = first->second;
+      }
+    }
+
+  private:
+    static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+    std::vector<value_type> members;
+    // Open addressing hash table (empty if size() <= LINEAR_SEARCH_LIMIT): each
+    // slot holds 1 + index of a member in "members", or 0 for an empty slot.
+    std::vector<uint32_t> index;
+
+    size_t lookup(const std::string &key) const;
+    void addToIndex(size_t pos);
+    void rebuildIndex();
+  };
+#endif
+
+  /** @internal
+    * Hash of a JSON_OBJECT/JSON_ARRAY cached by JSON::hash(), valid as long
+    * as "epoch" is the current hash epoch (0: nothing cached). Not copied
+    * along with the value.
+    */
+  struct JSONHashCache {
+    std::atomic<uint64_t> epoch;
+    std::atomic<uint64_t> value;
+
+    JSONHashCache(): epoch(0), value(0) {}
+    JSONHashCache(const JSONHashCache &): epoch(0), value(0) {}
+    JSONHashCache& operator=(const JSONHashCache &) { epoch = 0; return *this; }
+  };
+
+  class Object final: public Value {
+  public:
+#ifdef DXJSON_FLAT_OBJECTS
+    FlatObjectMap val;
+#else
     std::map<std::string, JSON> val;
+#endif
+    mutable JSONHashCache hashCache;
 
     Object() { }
     Object(const Object &rhs): val(rhs.val) {}
+#ifndef DXJSON_FLAT_OBJECTS
+    Object(std::map<std::string, JSON> &&v): val(std::move(v)) {}
+#endif
 
     template<typename T>
     Object(const std::map<std::string, T> &v) {
@@ -686,7 +1093,7 @@ namespace dx {
 
     JSON& jsonAtKey(const std::string &s);
     const JSON& jsonAtKey(const std::string &s) const;
-    void write(std::ostream &out) const;
+    void write(JSONWriter &out) const;
     JSONValue type() const { return JSON_OBJECT; }
     Value* returnMyNewCopy() const { return new Object(*this); }
     void read(std::istream &in);
@@ -696,12 +1103,14 @@ namespace dx {
     bool operator !=(const Object& other) const { return !(*this == other); }
   };
 
-  class Array: public Value {
+  class Array final: public Value {
   public:
     std::vector<JSON> val;
+    mutable JSONHashCache hashCache;
 
     Array() { }
     Array(const Array& arr): val(arr.val) {}
+    Array(std::vector<JSON> &&vec): val(std::move(vec)) {}
 
     template<typename T>
     Array(const std::vector<T> &vec) {
@@ -712,13 +1121,16 @@ namespace dx {
     }
 
     const JSON& jsonAtIndex(size_t i) const;
-    void write(std::ostream &out) const;
+    void write(JSONWriter &out) const;
     JSONValue type() const { return JSON_ARRAY; }
     Value* returnMyNewCopy() const { return new Array(*this); }
     void read(std::istream &in);
     void push_back(const JSON &j) {
       val.push_back(j);
     }
+    void push_back(JSON &&j) {
+      val.push_back(std::move(j));
+    }
     void erase(const size_t &i);
     bool isEqual(const Value* other) const;
     bool operator ==(const Array& other) const { return isEqual(&other); }
@@ -735,7 +1147,7 @@ namespace dx {
     JSON& jsonAtKey(const std::string &s);
     const JSON& jsonAtKey(const std::string &s) const;
     JSONValue type() const { return JSON_BOOLEAN; }
-    void write(std::ostream &out) const { out << ((val) ? "true" : "false"); }
+    void write(JSONWriter &out) const;
     Value* returnMyNewCopy() const { return new Boolean(*this); }
     void read(std::istream &in);
     bool isEqual(const Value* other) const;
@@ -745,7 +1157,7 @@ namespace dx {
 
   class Null: public Value {
   public:
-    void write(std::ostream &out) const { out << "null"; }
+    void write(JSONWriter &out) const;
     JSONValue type() const { return JSON_NULL; }
     Value* returnMyNewCopy() const { return new Null(*this); }
     void read(std::istream &in);
@@ -756,8 +1168,7 @@ namespace dx {
   };
 
   template<typename T>
-  JSON::JSON(const T& x) {
-    val = NULL; // So that clear() works fine on this, else we will be deallocating some arbitrary memory - dangerous!
+  JSON::JSON(const T& x): tag(JSON_UNDEFINED), val(NULL) { // So that clear() works fine on this
     *this = operator=(x);
   }
 
@@ -771,10 +1182,13 @@ namespace dx {
       assertValidityOfNumericType(x);
 
     clear();
-    if(std::numeric_limits<T>::is_integer)
-      this->val = new Integer(static_cast<int64_t>(x));
-    else
-      this->val = new Real(static_cast<double>(x));
+    if (std::numeric_limits<T>::is_integer) {
+      this->tag = JSON_INTEGER;
+      this->i = static_cast<int64_t>(x);
+    } else {
+      this->tag = JSON_REAL;
+      this->d = static_cast<double>(x);
+    }
     return *this;
   }
 
@@ -782,6 +1196,7 @@ namespace dx {
   JSON& JSON::operator =(const std::vector<T> &vec) {
     clear();
     this->val = new Array(vec);
+    this->tag = JSON_ARRAY;
     return *this;
   }
 
@@ -789,9 +1204,21 @@ namespace dx {
   JSON& JSON::operator =(const std::map<std::string, T> &m) {
     clear();
     this->val = new Object(m);
+    this->tag = JSON_OBJECT;
     return *this;
   }
 
+  template<typename... Args>
+  void JSON::emplace_back(Args&&... args) {
+    if (this->type() != JSON_ARRAY)
+      throw JSONException("Cannot emplace_back to a non-array");
+    invalidateHashes();
+    static_cast<Array*>(this->val)->val.emplace_back(std::forward<Args>(args)...);
+  }
+
+  /** Exchanges the values of two JSON objects (no copy is made) */
+  inline void swap(JSON &a, JSON &b) noexcept { a.swap(b); }
+
   template<typename T>
   JSON::operator T() const {
     JSONValue typ = this->type();
@@ -803,11 +1230,11 @@ namespace dx {
 
     switch(typ) {
       case JSON_INTEGER:
-        return static_cast<T>( ((Integer*)this->val)->val);
+        return static_cast<T>(this->i);
       case JSON_REAL:
-        return static_cast<T>( ((Real*)this->val)->val);
+        return static_cast<T>(this->d);
       case JSON_BOOLEAN:
-        return static_cast<T>( ((Boolean*)this->val)->val);
+        return static_cast<T>(this->b);
       default: assert(false); // Should never happen (already checked at top)
     }
   }
@@ -833,4 +1260,12 @@ namespace dx {
 
 }
 
+namespace std {
+  /** Hashes JSON objects by value (see dx::JSON::hash()) */
+  template<>
+  struct hash<dx::JSON> {
+    size_t operator()(const dx::JSON &j) const { return j.hash(); }
+  };
+}
+
 #endif
@@ -0,0 +1,64 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "lazy.h"
+#include "scanner.h"
+#include "writer.h"
+
+#include <vector>
+
+using namespace dx;
+
+void RawValue::write(JSONWriter &out) const {
+  out.write(begin, length());
+}
+
+void RawValue::parse(JSON &out) const {
+  if (!isContainer()) {
+    // The extent of a number or literal is found without checking it, so
+    // the whole slice must be taken by the value
+    JSONScanner in(begin, length());
+    JSON_Utility::ReadJSONValue(in, out);
+    if (!in.eof())
+      throw JSONException("Unexpected character after a value: " + std::string(1, *in.position()));
+    return;
+  }
+  JSONScanner in(begin, length());
+  std::vector<const char*> bounds;
+  if (*begin == '[') {
+    in.indexContainer(bounds, NULL);
+    std::unique_ptr<Array> a(new Array());
+    a->val.resize(bounds.size() / 2);
+    for (size_t i = 0; i < bounds.size(); i += 2)
+      a->val[i / 2].val = new RawValue(doc, bounds[i], bounds[i + 1]);
+    out.clear();
+    out.tag = JSON_ARRAY;
+    out.val = a.release();
+    return;
+  }
+  std::vector<std::string> keys;
+  in.indexContainer(bounds, &keys);
+  std::unique_ptr<Object> o(new Object());
+  for (size_t i = 0; i < bounds.size(); i += 2) {
+    // For repeated keys the last one wins (same as JSON::parse())
+    JSON &member = o->val[keys[i / 2]];
+    member.clear();
+    member.val = new RawValue(doc, bounds[i], bounds[i + 1]);
+  }
+  out.clear();
+  out.tag = JSON_OBJECT;
+  out.val = o.release();
+}
@@ -0,0 +1,77 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_LAZY_H__
+#define __DXJSON_LAZY_H__
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "dxjson.h"
+
+/** @file */
+
+namespace dx {
+
+  /** @internal
+    * A value which has not been parsed yet: a slice of a serialized document
+    * (see JSON::parseLazy()), shared by all the unparsed values taken from it.
+    *
+    * A JSON holding a RawValue is tagged JSON_UNDEFINED (with a non-NULL
+    * pointer), so that JSON::type() can tell it apart, and replace it by its
+    * parsed version (see parse()) before the value is accessed in any way. write() and
+    * returnMyNewCopy() work on the unparsed value: writing it out copies the
+    * original text, and copying it copies a reference to the document.
+    */
+  class RawValue: public Value {
+  public:
+    RawValue(const std::shared_ptr<const std::string> &doc_, const char *begin_, const char *end_):
+      doc(doc_), begin(begin_), end(end_) {}
+
+    JSONValue type() const { return JSON_UNDEFINED; }
+    void write(JSONWriter &out) const;
+    Value* returnMyNewCopy() const { return new RawValue(*this); }
+
+    // JSON::type() parses the value before any of these can be called
+    void read(std::istream &in __attribute__ ((unused)) ) { assert(false); }
+    bool isEqual(const Value *other __attribute__ ((unused)) ) const { assert(false); return false; }
+
+    /** true if the value is a JSON_OBJECT or a JSON_ARRAY */
+    bool isContainer() const { return (*begin == '{' || *begin == '['); }
+
+    /** Length of the text of the value */
+    size_t length() const { return static_cast<size_t>(end - begin); }
+
+    /** Parses the value. A container is parsed one level deep only: its
+      * members/elements are located (see JSONScanner::indexContainer()), and
+      * held as RawValue objects themselves.
+      * @param out Receives the parsed value (out must not be the JSON holding
+      * this RawValue, which would be destroyed in the process).
+      * @throw JSONException If the value (or the structure of a container)
+      * is not valid JSON.
+      */
+    void parse(JSON &out) const;
+
+  private:
+    std::shared_ptr<const std::string> doc;
+    const char *begin;
+    const char *end;
+  };
+}
+
+#endif
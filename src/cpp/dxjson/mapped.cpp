@@ -0,0 +1,208 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "mapped.h"
+#include "scanner.h"
+
+#include <fstream>
+#include <iterator>
+
+#if !WINDOWS_BUILD
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace dx;
+
+JSONMappedFile::JSONMappedFile(const std::string &path): ptr(NULL), len(0), mapped(false) {
+#if !WINDOWS_BUILD
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw JSONException("Unable to open file '" + path + "': " + strerror(errno));
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    throw JSONException("Unable to map file '" + path + "': not a regular file");
+  }
+  len = static_cast<size_t>(st.st_size);
+  if (len > 0) {
+    void *m = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+      const int err = errno;
+      close(fd);
+      throw JSONException("Unable to map file '" + path + "': " + strerror(err));
+    }
+    // The file is read front to back (and mostly only once)
+    madvise(m, len, MADV_SEQUENTIAL);
+    ptr = static_cast<const char*>(m);
+    mapped = true;
+  }
+  close(fd);
+#else
+  std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+  if (!in.is_open())
+    throw JSONException("Unable to open file '" + path + "'");
+  copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  ptr = copy.data();
+  len = copy.size();
+#endif
+}
+
+JSONMappedFile::~JSONMappedFile() {
+#if !WINDOWS_BUILD
+  if (mapped)
+    munmap(const_cast<char*>(ptr), len);
+#endif
+}
+
+JSONLazyFile::JSONLazyFile(const std::string &path): file(path) {
+  JSONScanner in(file.data(), file.size());
+  in.skipWhiteSpace();
+  if (in.eof())
+    throw JSONException("Unexpected EOF");
+  // The end of top level value is found only if needed (it's the end of the
+  // complete file, most of the time)
+  addEntry(in.position(), NULL);
+}
+
+size_t JSONLazyFile::addEntry(const char *begin, const char *end) const {
+  Entry e;
+  e.begin = begin;
+  e.end = end;
+  e.indexed = false;
+  switch (*begin) {
+    case '{': e.type = JSON_OBJECT; break;
+    case '[': e.type = JSON_ARRAY; break;
+    case '"': e.type = JSON_STRING; break;
+    case 't':
+    case 'f': e.type = JSON_BOOLEAN; break;
+    case 'n': e.type = JSON_NULL; break;
+    default: {
+      e.type = JSON_INTEGER;
+      const char *fileEnd = file.data() + file.size();
+      for (const char *p = begin; p < fileEnd && JSONScanner::isNumberChar(*p); ++p) {
+        if (*p == '.' || *p == 'e' || *p == 'E') {
+          e.type = JSON_REAL;
+          break;
+        }
+      }
+    }
+  }
+  entries.push_back(e);
+  return entries.size() - 1;
+}
+
+// Locates the members/elements of a container (if not done already)
+JSONLazyFile::Entry& JSONLazyFile::indexed(size_t idx) const {
+  if (entries[idx].indexed)
+    return entries[idx];
+  const bool isObject = (entries[idx].type == JSON_OBJECT);
+  if (!isObject && entries[idx].type != JSON_ARRAY)
+    throw JSONException("Cannot index a value which is neither a JSON_OBJECT nor a JSON_ARRAY");
+
+  const char *fileEnd = file.data() + file.size();
+  JSONScanner in(entries[idx].begin, fileEnd - entries[idx].begin);
+  std::vector<const char*> bounds;
+  std::vector<size_t> children;
+  std::vector<std::string> keys;
+  in.indexContainer(bounds, (isObject) ? &keys : NULL);
+  for (size_t i = 0; i < bounds.size(); i += 2)
+    children.push_back(addEntry(bounds[i], bounds[i + 1]));
+
+  Entry &e = entries[idx];
+  e.end = in.position();
+  e.children.swap(children);
+  e.keys.swap(keys);
+  for (size_t i = 0; i < e.keys.size(); ++i)
+    e.lookup[e.keys[i]] = e.children[i];
+  e.indexed = true;
+  return e;
+}
+
+const char* JSONLazyFile::endOf(size_t idx) const {
+  if (entries[idx].end == NULL) {
+    const char *fileEnd = file.data() + file.size();
+    JSONScanner in(entries[idx].begin, fileEnd - entries[idx].begin);
+    in.skipValue();
+    entries[idx].end = in.position();
+  }
+  return entries[idx].end;
+}
+
+JSONValue JSONLazyValue::type() const {
+  return file->entries[idx].type;
+}
+
+size_t JSONLazyValue::size() const {
+  if (type() != JSON_OBJECT && type() != JSON_ARRAY)
+    throw JSONException("size()/length() can only be called for JSON_ARRAY/JSON_OBJECT");
+  return file->indexed(idx).children.size();
+}
+
+bool JSONLazyValue::has(const size_t &indx) const {
+  if (type() != JSON_ARRAY)
+    throw JSONException("Illegal call to has(size_t) for non JSON_ARRAY object");
+  return indx < file->indexed(idx).children.size();
+}
+
+bool JSONLazyValue::has(const std::string &key) const {
+  if (type() != JSON_OBJECT)
+    throw JSONException("Illegal call to has(string) for non JSON_OBJECT object");
+  const JSONLazyFile::Entry &e = file->indexed(idx);
+  return e.lookup.find(key) != e.lookup.end();
+}
+
+JSONLazyValue JSONLazyValue::operator[](const size_t &indx) const {
+  if (type() != JSON_ARRAY)
+    throw JSONException("Cannot use size_t to index value of a non-JSON_ARRAY using [] operator");
+  const JSONLazyFile::Entry &e = file->indexed(idx);
+  if (indx >= e.children.size())
+    throw JSONException("Illegal: Out of bound JSON_ARRAY access");
+  return JSONLazyValue(file, e.children[indx]);
+}
+
+JSONLazyValue JSONLazyValue::operator[](const std::string &key) const {
+  if (type() != JSON_OBJECT)
+    throw JSONException("Cannot use string to index value of a non-JSON_OBJECT using [] operator");
+  const JSONLazyFile::Entry &e = file->indexed(idx);
+  std::map<std::string, size_t>::const_iterator it = e.lookup.find(key);
+  if (it == e.lookup.end())
+    throw JSONException("Key \"" + key + "\" not found in JSON_OBJECT");
+  return JSONLazyValue(file, it->second);
+}
+
+std::vector<std::string> JSONLazyValue::keys() const {
+  if (type() != JSON_OBJECT)
+    throw JSONException("keys() can only be called for a JSON_OBJECT");
+  return file->indexed(idx).keys;
+}
+
+JSON JSONLazyValue::toJSON() const {
+  const char *begin = file->entries[idx].begin;
+  const char *end = file->entries[idx].end;
+  if (end == NULL) // No need to find the end: parsing stops there anyway
+    end = file->file.data() + file->file.size();
+  return JSON::parse(begin, end - begin);
+}
+
+std::string JSONLazyValue::raw() const {
+  const char *begin = file->entries[idx].begin;
+  return std::string(begin, file->endOf(idx));
+}
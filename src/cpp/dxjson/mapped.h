@@ -0,0 +1,185 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_MAPPED_H__
+#define __DXJSON_MAPPED_H__
+
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "dxjson.h"
+
+/** @file */
+
+namespace dx {
+
+  /** A file mapped read-only into memory (on Windows, where mmap() is not
+    * available, the file is read into memory instead). The contents are
+    * accessible as a contiguous buffer until the object is destroyed.
+    */
+  class JSONMappedFile {
+  public:
+    /** @param path Path of the file to map
+      * @throw JSONException If the file cannot be opened or mapped.
+      */
+    explicit JSONMappedFile(const std::string &path);
+    ~JSONMappedFile();
+
+    const char* data() const { return ptr; }
+    size_t size() const { return len; }
+
+  private:
+    const char *ptr;
+    size_t len;
+    bool mapped; // true if ptr must be munmap()ed (false for an empty file, or on Windows)
+    std::string copy; // Contents of the file, if it is not mapped
+
+    // Not copyable
+    JSONMappedFile(const JSONMappedFile &);
+    JSONMappedFile& operator=(const JSONMappedFile &);
+  };
+
+  class JSONLazyFile;
+
+  /** A handle to a value inside a JSONLazyFile. Only the structure needed to
+    * reach the value has been examined: its contents are parsed when
+    * toJSON()/get<T>() is called, and its members/elements are located (but
+    * not parsed) the first time size(), has() or operator[] is called.
+    * A JSONLazyValue is valid only as long as the JSONLazyFile it belongs to.
+    */
+  class JSONLazyValue {
+  public:
+    JSONLazyValue(const JSONLazyFile *file_, size_t idx_): file(file_), idx(idx_) {}
+
+    /** Returns the type of the value (JSON_INTEGER or JSON_REAL for a number,
+      * based on its text)
+      */
+    JSONValue type() const;
+
+    /** Returns number of elements/members of a JSON_ARRAY/JSON_OBJECT
+      * @throw JSONException For any other type
+      */
+    size_t size() const;
+    size_t length() const { return size(); }
+
+    /** Same as JSON::has() */
+    bool has(const size_t &indx) const;
+    bool has(const std::string &key) const;
+    bool has(const char *key) const { return has(std::string(key)); }
+    template<typename T>
+    bool has(const T &indx) const { return has(static_cast<size_t>(indx)); }
+
+    /** Returns the element at index indx of a JSON_ARRAY
+      * @throw JSONException If not a JSON_ARRAY, or indx is out of bounds
+      */
+    JSONLazyValue operator[](const size_t &indx) const;
+
+    /** Returns the value associated with key in a JSON_OBJECT
+      * @throw JSONException If not a JSON_OBJECT, or the key is not present
+      */
+    JSONLazyValue operator[](const std::string &key) const;
+    JSONLazyValue operator[](const char *key) const { return (*this)[std::string(key)]; }
+    template<typename T>
+    JSONLazyValue operator[](const T &indx) const { return (*this)[static_cast<size_t>(indx)]; }
+
+    /** Returns the object keys, in order of their appearance in the file
+      * @throw JSONException If not a JSON_OBJECT
+      */
+    std::vector<std::string> keys() const;
+
+    /** Parses the value (and everything inside it)
+      * @throw JSONException If it is not valid JSON
+      */
+    JSON toJSON() const;
+
+    /** Same as toJSON().get<T>() */
+    template<typename T>
+    T get() const { return toJSON().get<T>(); }
+
+    /** Returns the text of the value in the file, exactly as it appears there */
+    std::string raw() const;
+
+  private:
+    const JSONLazyFile *file;
+    size_t idx;
+  };
+
+  /** A JSON file which is parsed on demand: only the parts of it which are
+    * accessed are ever looked at. Opening the file maps it in memory (see
+    * JSONMappedFile) without reading it; the members/elements of a container
+    * are located by a structural scan (matching brackets and quotes, without
+    * decoding anything) the first time it is accessed, and values are parsed
+    * only by toJSON(). So fetching a few small fields out of a huge file
+    * (e.g., a job input with large embedded arrays) costs a fraction of
+    * parsing all of it:
+    * @code
+    * JSONLazyFile input(joinPath(getUserHomeDirectory(), "job_input.json"));
+    * const int64_t n = input["n"].get<int64_t>();
+    * const size_t count = input["samples"].size(); // "samples" is not parsed
+    * @endcode
+    * The structure of a container is checked when it is indexed, but its
+    * values are validated only when parsed.
+    * @note Not thread safe (even the const methods update the index).
+    */
+  class JSONLazyFile {
+  public:
+    /** Maps the file (see JSONMappedFile)
+      * @throw JSONException If the file cannot be opened.
+      */
+    explicit JSONLazyFile(const std::string &path);
+
+    /** Returns the top level value */
+    JSONLazyValue root() const { return JSONLazyValue(this, 0); }
+
+    /** Shorthands for root().type(), root().has(), root()[] */
+    JSONValue type() const { return root().type(); }
+    template<typename T>
+    bool has(const T &x) const { return root().has(x); }
+    template<typename T>
+    JSONLazyValue operator[](const T &x) const { return root()[x]; }
+
+  private:
+    friend class JSONLazyValue;
+
+    // A value located in the file. Members/elements of a container are listed
+    // (as indices into "entries") once it is indexed.
+    struct Entry {
+      const char *begin; // First character of the value
+      const char *end; // Past its last character (NULL if not known yet)
+      JSONValue type;
+      bool indexed;
+      std::vector<size_t> children; // In order of appearance in the file
+      std::vector<std::string> keys; // Keys corresponding to "children" (objects only)
+      std::map<std::string, size_t> lookup; // Key -> entry (the last one, for repeated keys)
+    };
+
+    JSONMappedFile file;
+    mutable std::deque<Entry> entries;
+
+    size_t addEntry(const char *begin, const char *end) const;
+    Entry& indexed(size_t idx) const;
+    const char* endOf(size_t idx) const;
+
+    // Not copyable
+    JSONLazyFile(const JSONLazyFile &);
+    JSONLazyFile& operator=(const JSONLazyFile &);
+  };
+}
+
+#endif
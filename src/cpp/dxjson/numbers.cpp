@@ -0,0 +1,331 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "numbers.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+// Implementation of Grisu2 algorithm, as described in:
+//   Florian Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+//   with Integers", PLDI 2010.
+// Grisu2 always produces a representation which reads back as the original
+// value, and (for ~99.9% of doubles) it is the shortest possible one.
+
+using namespace dx;
+
+namespace {
+
+  const uint64_t DP_SIGNIFICAND_MASK = 0x000FFFFFFFFFFFFFULL;
+  const uint64_t DP_EXPONENT_MASK = 0x7FF0000000000000ULL;
+  const uint64_t DP_HIDDEN_BIT = 0x0010000000000000ULL;
+  const int DP_SIGNIFICAND_SIZE = 52;
+  const int DP_EXPONENT_BIAS = 0x3FF + DP_SIGNIFICAND_SIZE;
+  const int DP_MIN_EXPONENT = -DP_EXPONENT_BIAS;
+
+  // A floating point number with a 64 bit significand: f * 2^e
+  struct DiyFp {
+    uint64_t f;
+    int e;
+
+    DiyFp(uint64_t f_, int e_): f(f_), e(e_) {}
+
+    // d must be positive (and finite)
+    explicit DiyFp(double d) {
+      uint64_t u;
+      memcpy(&u, &d, sizeof(u));
+      const int biasedE = static_cast<int>((u & DP_EXPONENT_MASK) >> DP_SIGNIFICAND_SIZE);
+      const uint64_t significand = u & DP_SIGNIFICAND_MASK;
+      if (biasedE != 0) {
+        f = significand + DP_HIDDEN_BIT;
+        e = biasedE - DP_EXPONENT_BIAS;
+      } else {
+        // Subnormal number
+        f = significand;
+        e = DP_MIN_EXPONENT + 1;
+      }
+    }
+
+    DiyFp operator-(const DiyFp &rhs) const {
+      assert(e == rhs.e && f >= rhs.f);
+      return DiyFp(f - rhs.f, e);
+    }
+
+    // Product rounded to 64 bits
+    DiyFp operator*(const DiyFp &rhs) const {
+      const uint64_t M32 = 0xFFFFFFFFULL;
+      const uint64_t a = f >> 32, b = f & M32;
+      const uint64_t c = rhs.f >> 32, d = rhs.f & M32;
+      const uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+      uint64_t tmp = (bd >> 32) + (ad & M32) + (bc & M32);
+      tmp += 1ULL << 31; // round
+      return DiyFp(ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + rhs.e + 64);
+    }
+
+    DiyFp normalize() const {
+      DiyFp res = *this;
+      while (!(res.f & (1ULL << 63))) {
+        res.f <<= 1;
+        res.e--;
+      }
+      return res;
+    }
+
+    // Computes the (normalized) boundaries m- and m+ of the interval of real
+    // numbers which round to this value. Both have the same exponent.
+    void normalizedBoundaries(DiyFp &minus, DiyFp &plus) const {
+      DiyFp pl(((f << 1) + 1), e - 1);
+      while (!(pl.f & (DP_HIDDEN_BIT << 1))) {
+        pl.f <<= 1;
+        pl.e--;
+      }
+      pl.f <<= 64 - DP_SIGNIFICAND_SIZE - 2;
+      pl.e -= 64 - DP_SIGNIFICAND_SIZE - 2;
+      // The lower boundary is closer if f is a power of 2
+      DiyFp mi = (f == DP_HIDDEN_BIT) ? DiyFp((f << 2) - 1, e - 2) : DiyFp((f << 1) - 1, e - 1);
+      mi.f <<= mi.e - pl.e;
+      mi.e = pl.e;
+      minus = mi;
+      plus = pl;
+    }
+  };
+
+  // Normalized significands (and binary exponents) of 10^-348, 10^-340, ..., 10^340
+  const uint64_t CACHED_POWERS_F[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL,
+  };
+  const int16_t CACHED_POWERS_E[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+    -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+    -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+    -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+    56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+    694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+    1013, 1039, 1066,
+  };
+
+  // Returns a cached power of ten c = 10^-k such that the binary exponent
+  // of (w * c) lies in [-60, -32], where e is the binary exponent of w
+  DiyFp getCachedPower(int e, int &k) {
+    const double dk = (-61 - e) * 0.30102999566398114 + 347; // dk must be positive, so can do ceiling in positive
+    int ik = static_cast<int>(dk);
+    if (dk - ik > 0.0)
+      ik++;
+    const unsigned index = static_cast<unsigned>((ik >> 3) + 1);
+    k = -(-348 + static_cast<int>(index << 3)); // decimal exponent no need lookup table
+    return DiyFp(CACHED_POWERS_F[index], CACHED_POWERS_E[index]);
+  }
+
+  const uint32_t POW10_32[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+  int countDecimalDigits(uint32_t n) {
+    int count = 1;
+    while (count < 10 && n >= POW10_32[count])
+      count++;
+    return count;
+  }
+
+  // Moves the last digit of buffer closer to w, while staying inside the
+  // (safe) interval
+  void grisuRound(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpW) {
+    while (rest < wpW && delta - rest >= tenKappa &&
+           (rest + tenKappa < wpW || wpW - rest > rest + tenKappa - wpW)) {
+      buffer[len - 1]--;
+      rest += tenKappa;
+    }
+  }
+
+  // Generates the shortest digits of a number in (Mp - delta, Mp], closest to W.
+  void digitGen(const DiyFp &W, const DiyFp &Mp, uint64_t delta, char *buffer, int &len, int &K) {
+    const DiyFp one(1ULL << -Mp.e, Mp.e);
+    const DiyFp wpW = Mp - W;
+    uint32_t p1 = static_cast<uint32_t>(Mp.f >> -one.e);
+    uint64_t p2 = Mp.f & (one.f - 1);
+    int kappa = countDecimalDigits(p1);
+    len = 0;
+
+    // Integral part
+    while (kappa > 0) {
+      const uint32_t div = POW10_32[kappa - 1];
+      const uint32_t d = p1 / div;
+      p1 %= div;
+      if (d || len)
+        buffer[len++] = static_cast<char>('0' + d);
+      kappa--;
+      const uint64_t rest = (static_cast<uint64_t>(p1) << -one.e) + p2;
+      if (rest <= delta) {
+        K += kappa;
+        grisuRound(buffer, len, delta, rest, static_cast<uint64_t>(POW10_32[kappa]) << -one.e, wpW.f);
+        return;
+      }
+    }
+
+    // Fractional part
+    uint64_t unit = 1;
+    for (;;) {
+      p2 *= 10;
+      delta *= 10;
+      unit *= 10;
+      const char d = static_cast<char>(p2 >> -one.e);
+      if (d || len)
+        buffer[len++] = static_cast<char>('0' + d);
+      p2 &= one.f - 1;
+      kappa--;
+      if (p2 < delta) {
+        K += kappa;
+        grisuRound(buffer, len, delta, p2, one.f, wpW.f * unit);
+        return;
+      }
+    }
+  }
+
+  // Writes digits of v (> 0) in buffer, such that v = buffer * 10^K
+  void grisu2(double v, char *buffer, int &len, int &K) {
+    const DiyFp w(v);
+    DiyFp wm(0, 0), wp(0, 0);
+    w.normalizedBoundaries(wm, wp);
+
+    const DiyFp cMk = getCachedPower(wp.e, K);
+    const DiyFp W = w.normalize() * cMk;
+    DiyFp Wp = wp * cMk;
+    DiyFp Wm = wm * cMk;
+    // Account for the imprecision of the cached power (and multiplication)
+    Wm.f++;
+    Wp.f--;
+    digitGen(W, Wp, Wp.f - Wm.f, buffer, len, K);
+  }
+
+  char* writeExponent(int K, char *p) {
+    *p++ = 'e';
+    if (K < 0) {
+      *p++ = '-';
+      K = -K;
+    } else {
+      *p++ = '+';
+    }
+    if (K >= 100) {
+      *p++ = static_cast<char>('0' + K / 100);
+      K %= 100;
+      *p++ = static_cast<char>('0' + K / 10);
+    } else if (K >= 10) {
+      *p++ = static_cast<char>('0' + K / 10);
+    }
+    *p++ = static_cast<char>('0' + K % 10);
+    return p;
+  }
+
+  // Lays out digits in buffer[0, len) (with decimal exponent k) as a JSON real
+  // number. There is room for all the expansions in buffer.
+  char* prettify(char *buffer, int len, int k) {
+    const int kk = len + k; // 10^(kk - 1) <= v < 10^kk
+
+    if (0 <= k && kk <= 21) {
+      // 1234e7 -> 12340000000.0
+      for (int i = len; i < kk; i++)
+        buffer[i] = '0';
+      buffer[kk] = '.';
+      buffer[kk + 1] = '0';
+      return buffer + kk + 2;
+    }
+    if (0 < kk && kk <= 21) {
+      // 1234e-2 -> 12.34
+      memmove(buffer + kk + 1, buffer + kk, static_cast<size_t>(len - kk));
+      buffer[kk] = '.';
+      return buffer + len + 1;
+    }
+    if (-6 < kk && kk <= 0) {
+      // 1234e-6 -> 0.001234
+      const int offset = 2 - kk;
+      memmove(buffer + offset, buffer, static_cast<size_t>(len));
+      buffer[0] = '0';
+      buffer[1] = '.';
+      for (int i = 2; i < offset; i++)
+        buffer[i] = '0';
+      return buffer + len + offset;
+    }
+    if (len == 1) {
+      // 1e30
+      return writeExponent(kk - 1, buffer + 1);
+    }
+    // 1234e30 -> 1.234e+33
+    memmove(buffer + 2, buffer + 1, static_cast<size_t>(len - 1));
+    buffer[1] = '.';
+    return writeExponent(kk - 1, buffer + len + 1);
+  }
+}
+
+size_t dx::formatInteger(int64_t i, char *buf) {
+  char *p = buf;
+  uint64_t u = static_cast<uint64_t>(i);
+  if (i < 0) {
+    *p++ = '-';
+    u = ~u + 1; // works for INT64_MIN as well
+  }
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = static_cast<char>('0' + (u % 10));
+    u /= 10;
+  } while (u != 0);
+  while (n > 0)
+    *p++ = digits[--n];
+  return static_cast<size_t>(p - buf);
+}
+
+size_t dx::formatReal(double d, char *buf) {
+  char *p = buf;
+  if (std::signbit(d)) {
+    *p++ = '-';
+    d = -d;
+  }
+  if (d == 0) {
+    memcpy(p, "0.0", 3);
+    return static_cast<size_t>(p + 3 - buf);
+  }
+  int len, K;
+  grisu2(d, p, len, K);
+  return static_cast<size_t>(prettify(p, len, K) - buf);
+}
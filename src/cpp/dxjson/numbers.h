@@ -0,0 +1,53 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_NUMBERS_H__
+#define __DXJSON_NUMBERS_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+/** @file */
+
+namespace dx {
+
+  /** @internal
+    * Size of a buffer large enough to hold the output of formatInteger() or
+    * formatReal() (no terminating NUL is written).
+    */
+  const size_t NUMBER_BUFFER_SIZE = 32;
+
+  /** @internal
+    * Writes the decimal representation of an integer.
+    * @param i The value to format
+    * @param buf Buffer of at least NUMBER_BUFFER_SIZE bytes
+    * @return Number of characters written to buf
+    */
+  size_t formatInteger(int64_t i, char *buf);
+
+  /** @internal
+    * Writes the shortest decimal representation of a (finite) double which
+    * reads back as exactly the same value (Grisu2 algorithm). The output
+    * always contains a '.' or an exponent, so that it is read back as a
+    * JSON_REAL (and not a JSON_INTEGER), e.g. 1.0 is written as "1.0".
+    * @param d The value to format (must not be NaN or infinity)
+    * @param buf Buffer of at least NUMBER_BUFFER_SIZE bytes
+    * @return Number of characters written to buf
+    */
+  size_t formatReal(double d, char *buf);
+}
+
+#endif
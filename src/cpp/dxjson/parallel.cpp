@@ -0,0 +1,184 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "dxjson.h"
+#include "scanner.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <vector>
+#if !WINDOWS_BUILD
+#include <thread>
+#endif
+
+using namespace dx;
+
+namespace {
+  // Arrays smaller than this are not worth splitting
+  const size_t PARALLEL_MIN_BYTES = 1u << 20;
+
+  // Minimum amount of text handed to each thread
+  const size_t PARALLEL_CHUNK_BYTES = 256u * 1024u;
+
+  // Default number of threads (see JSON::setParallelThreads()): callers are
+  // often multithreaded themselves, so one per hardware thread would
+  // oversubscribe the machine
+  const unsigned PARALLEL_DEFAULT_MAX_THREADS = 4u;
+
+  unsigned defaultThreads() {
+#if WINDOWS_BUILD
+    return 1u;
+#else
+    return std::max(1u, std::min(PARALLEL_DEFAULT_MAX_THREADS, std::thread::hardware_concurrency()));
+#endif
+  }
+
+  std::atomic<unsigned> parallelThreads(0); // 0: defaultThreads()
+
+#if !WINDOWS_BUILD
+  // Joins the workers, however the scope is left (a joinable std::thread
+  // must not be destroyed, e.g., if starting another one throws)
+  struct WorkerJoiner {
+    std::vector<std::thread> &workers;
+    explicit WorkerJoiner(std::vector<std::thread> &w): workers(w) { }
+    ~WorkerJoiner() {
+      for (size_t t = 0; t < workers.size(); ++t) {
+        if (workers[t].joinable())
+          workers[t].join();
+      }
+    }
+  };
+#endif
+
+  // Parses a member/element located by JSONScanner::indexContainer(). The
+  // value must take up all of [begin, end) (e.g., not "1x"), as it would have
+  // to if the enclosing container was parsed as a whole.
+  void parseSlice(const char *begin, const char *end, JSON &out) {
+    JSONScanner in(begin, end - begin);
+    JSON_Utility::ReadJSONValue(in, out);
+    if (!in.eof())
+      throw JSONException("Unexpected character after a value: " + std::string(1, *in.position()));
+  }
+
+  // Parses elements [first, last) of an indexed array
+  void parseElements(const std::vector<const char*> &bounds, size_t first, size_t last, std::vector<JSON> &out) {
+    for (size_t i = first; i < last; ++i)
+      parseSlice(bounds[2 * i], bounds[2 * i + 1], out[i]);
+  }
+
+  // Parses the array held in [begin, end), splitting its elements (in
+  // contiguous ranges of roughly equal size in bytes) between threads
+  JSON parseArray(const char *begin, const char *end, unsigned threads) {
+    JSONScanner scanner(begin, end - begin);
+    std::vector<const char*> bounds;
+    scanner.indexContainer(bounds, NULL);
+    const size_t count = bounds.size() / 2;
+    threads = static_cast<unsigned>(std::min<size_t>(threads, (end - begin) / PARALLEL_CHUNK_BYTES));
+    threads = static_cast<unsigned>(std::min<size_t>(threads, count));
+
+    std::vector<JSON> elements(count);
+#if WINDOWS_BUILD
+    parseElements(bounds, 0, count, elements);
+#else
+    // ranges[t] is the index of the first element parsed by thread t
+    std::vector<size_t> ranges(1, 0);
+    for (size_t i = 0; i < count && ranges.size() < threads; ++i) {
+      if (static_cast<size_t>(bounds[2 * i] - begin) * threads >= ranges.size() * static_cast<size_t>(end - begin))
+        ranges.push_back(i);
+    }
+    ranges.push_back(count);
+
+    std::vector<std::exception_ptr> errors(ranges.size() - 1);
+    std::vector<std::thread> workers;
+    WorkerJoiner joiner(workers);
+    for (size_t t = 1; t + 1 < ranges.size(); ++t) {
+      workers.push_back(std::thread([&bounds, &ranges, &elements, &errors, t]() {
+        try {
+          parseElements(bounds, ranges[t], ranges[t + 1], elements);
+        } catch (...) {
+          errors[t] = std::current_exception();
+        }
+      }));
+    }
+    // The first range is parsed by the calling thread
+    try {
+      parseElements(bounds, ranges[0], ranges[1], elements);
+    } catch (...) {
+      errors[0] = std::current_exception();
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+      workers[t].join();
+    for (size_t t = 0; t < errors.size(); ++t) {
+      if (errors[t])
+        std::rethrow_exception(errors[t]);
+    }
+#endif
+    JSON out(JSON_ARRAY);
+    static_cast<Array*>(out.val)->val.swap(elements);
+    return out;
+  }
+
+  // Parses the member held in [begin, end): in parallel if it's a large
+  // array, sequentially otherwise
+  void parseMember(const char *begin, const char *end, unsigned threads, JSON &out) {
+    if (*begin == '[' && static_cast<size_t>(end - begin) >= PARALLEL_MIN_BYTES)
+      out = parseArray(begin, end, threads);
+    else
+      parseSlice(begin, end, out);
+  }
+}
+
+void JSON::setParallelThreads(unsigned threads) {
+  parallelThreads = threads;
+}
+
+bool JSON::parallelParseRequested() {
+  return parallelThreads > 1;
+}
+
+unsigned JSON::getParallelThreads() {
+  const unsigned threads = parallelThreads;
+  return (threads == 0) ? defaultThreads() : threads;
+}
+
+JSON JSON::parseParallel(const char *data, size_t len, unsigned threads) {
+  if (threads == 0)
+    threads = getParallelThreads();
+  JSONScanner scanner(data, len);
+  scanner.skipWhiteSpace();
+  if (threads < 2 || len < PARALLEL_MIN_BYTES || scanner.eof() || (scanner.peek() != '[' && scanner.peek() != '{'))
+    return JSON::parse(data, len);
+
+  const char *begin = scanner.position();
+  if (*begin == '[') {
+    scanner.skipValue();
+    return parseArray(begin, scanner.position(), threads);
+  }
+
+  // An object: members are parsed in order, each large array in parallel
+  std::vector<const char*> bounds;
+  std::vector<std::string> keys;
+  scanner.indexContainer(bounds, &keys);
+  JSON out(JSON_OBJECT);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    // For repeated keys the last one wins (same as JSON::parse())
+    JSON &member = out[keys[i]];
+    member.clear();
+    parseMember(bounds[2 * i], bounds[2 * i + 1], threads, member);
+  }
+  return out;
+}
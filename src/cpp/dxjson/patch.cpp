@@ -0,0 +1,368 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+// JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7386)
+
+#include "dxjson.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace dx;
+
+namespace {
+
+  // Splits a JSON Pointer (RFC 6901, without the wildcards of JSONPointer)
+  // into its unescaped reference tokens
+  std::vector<std::string> splitPointer(const std::string &pointer) {
+    std::vector<std::string> tokens;
+    if (pointer.empty())
+      return tokens;
+    if (pointer[0] != '/')
+      throw JSONException("Invalid JSON pointer: \"" + pointer + "\". Must be empty, or start with '/'");
+    for (size_t i = 0; i < pointer.size(); ++i) {
+      if (pointer[i] == '/') {
+        tokens.push_back(std::string());
+      } else if (pointer[i] != '~') {
+        tokens.back().push_back(pointer[i]);
+      } else {
+        if (i + 1 == pointer.size() || (pointer[i + 1] != '0' && pointer[i + 1] != '1'))
+          throw JSONException("Invalid JSON pointer: \"" + pointer + "\". '~' must be followed by '0' or '1'");
+        tokens.back().push_back((pointer[++i] == '0') ? '~' : '/');
+      }
+    }
+    return tokens;
+  }
+
+  std::string escapeToken(const std::string &token) {
+    std::string out;
+    out.reserve(token.size());
+    for (size_t i = 0; i < token.size(); ++i) {
+      if (token[i] == '~')
+        out += "~0";
+      else if (token[i] == '/')
+        out += "~1";
+      else
+        out.push_back(token[i]);
+    }
+    return out;
+  }
+
+  // Returns the index referred to by token in an array of given size ("-",
+  // the end of the array, only if allowEnd is set), or throws
+  size_t arrayIndex(const std::string &token, size_t size, bool allowEnd) {
+    if (token == "-" && allowEnd)
+      return size;
+    size_t index = 0;
+    bool valid = !token.empty() && token.size() <= 18 && (token[0] != '0' || token.size() == 1);
+    for (size_t i = 0; i < token.size() && valid; ++i) {
+      valid = (token[i] >= '0' && token[i] <= '9');
+      index = index * 10 + (token[i] - '0');
+    }
+    if (!valid || index > size || (index == size && !allowEnd))
+      throw JSONException("Invalid array index in JSON pointer: \"" + token + "\"");
+    return index;
+  }
+
+  std::vector<JSON>& elements(JSON &j) { return static_cast<Array*>(j.val)->val; }
+  const std::vector<JSON>& elements(const JSON &j) { return static_cast<const Array*>(j.val)->val; }
+
+  // Returns the value at tokens [0, last) of a pointer, or throws
+  JSON& resolve(JSON &root, const std::vector<std::string> &tokens, size_t last) {
+    JSON *j = &root;
+    for (size_t i = 0; i < last; ++i) {
+      const JSONValue t = j->type();
+      if (t == JSON_OBJECT) {
+        Object *o = static_cast<Object*>(j->val);
+        JSON::object_iterator it = o->val.find(tokens[i]);
+        if (it == o->val.end())
+          throw JSONException("Path not found: key \"" + tokens[i] + "\" does not exist");
+        j = &it->second;
+      } else if (t == JSON_ARRAY) {
+        j = &elements(*j)[arrayIndex(tokens[i], j->size(), false)];
+      } else {
+        throw JSONException("Path not found: \"" + tokens[i] + "\" is not in a JSON_OBJECT or JSON_ARRAY");
+      }
+    }
+    return *j;
+  }
+
+  // Adds value at the location given by tokens (an existing member is replaced)
+  void add(JSON &root, const std::vector<std::string> &tokens, JSON &&value) {
+    if (tokens.empty()) {
+      root = std::move(value);
+      return;
+    }
+    JSON &parent = resolve(root, tokens, tokens.size() - 1);
+    const std::string &last = tokens.back();
+    if (parent.type() == JSON_OBJECT) {
+      parent.insert(last, std::move(value));
+    } else if (parent.type() == JSON_ARRAY) {
+      std::vector<JSON> &arr = elements(parent);
+      const size_t index = arrayIndex(last, arr.size(), true);
+      JSON::invalidateHashes();
+      arr.insert(arr.begin() + index, std::move(value));
+    } else {
+      throw JSONException("Path not found: \"" + last + "\" is not in a JSON_OBJECT or JSON_ARRAY");
+    }
+  }
+
+  // Removes the value at the location given by tokens, and returns it
+  JSON take(JSON &root, const std::vector<std::string> &tokens) {
+    if (tokens.empty())
+      throw JSONException("Cannot remove the whole value");
+    JSON &parent = resolve(root, tokens, tokens.size() - 1);
+    const std::string &last = tokens.back();
+    JSON out;
+    if (parent.type() == JSON_OBJECT) {
+      Object *o = static_cast<Object*>(parent.val);
+      JSON::object_iterator it = o->val.find(last);
+      if (it == o->val.end())
+        throw JSONException("Path not found: key \"" + last + "\" does not exist");
+      out = std::move(it->second);
+      parent.erase(last);
+    } else if (parent.type() == JSON_ARRAY) {
+      const size_t index = arrayIndex(last, parent.size(), false);
+      out = std::move(elements(parent)[index]);
+      parent.erase(index);
+    } else {
+      throw JSONException("Path not found: \"" + last + "\" is not in a JSON_OBJECT or JSON_ARRAY");
+    }
+    return out;
+  }
+
+  const JSON& member(const JSON &op, const char *name) {
+    if (!op.has(name))
+      throw JSONException(std::string("Missing \"") + name + "\" in JSON Patch operation: " + op.toString());
+    return op[name];
+  }
+
+  std::vector<std::string> pathOf(const JSON &op, const char *name) {
+    const JSON &path = member(op, name);
+    if (path.type() != JSON_STRING)
+      throw JSONException(std::string("\"") + name + "\" must be a JSON_STRING in JSON Patch operation: " + op.toString());
+    return splitPointer(path.get<std::string>());
+  }
+
+  // The "value" of op: copied from it...
+  JSON valueOf(const JSON &op) {
+    return JSON(member(op, "value"));
+  }
+
+  // ... or moved out of it, for a patch passed as an rvalue
+  JSON valueOf(JSON &op) {
+    member(op, "value");
+    return std::move(op["value"]);
+  }
+
+  // Applies a single JSON Patch operation (Op is const JSON, or JSON for a
+  // patch passed as an rvalue: see valueOf())
+  template <typename Op>
+  void applyOperation(JSON &root, Op &op) {
+    if (op.type() != JSON_OBJECT)
+      throw JSONException("A JSON Patch operation must be a JSON_OBJECT");
+    const JSON &name = member(op, "op");
+    if (name.type() != JSON_STRING)
+      throw JSONException("\"op\" must be a JSON_STRING in JSON Patch operation: " + op.toString());
+    const std::string &opName = static_cast<const String*>(name.val)->val;
+    const std::vector<std::string> path = pathOf(op, "path");
+
+    if (opName == "add") {
+      add(root, path, valueOf(op));
+    } else if (opName == "remove") {
+      take(root, path);
+    } else if (opName == "replace") {
+      JSON &target = resolve(root, path, path.size());
+      target = valueOf(op);
+    } else if (opName == "move") {
+      const std::vector<std::string> from = pathOf(op, "from");
+      if (from == path)
+        return;
+      if (from.size() < path.size() && std::equal(from.begin(), from.end(), path.begin()))
+        throw JSONException("Cannot move a value into one of its children: " + op.toString());
+      add(root, path, take(root, from));
+    } else if (opName == "copy") {
+      const std::vector<std::string> from = pathOf(op, "from");
+      add(root, path, JSON(resolve(root, from, from.size())));
+    } else if (opName == "test") {
+      if (resolve(root, path, path.size()) != member(op, "value"))
+        throw JSONException("JSON Patch test failed: " + op.toString());
+    } else {
+      throw JSONException("Unknown JSON Patch operation: \"" + opName + "\"");
+    }
+  }
+
+  void applyPatchTo(JSON &root, const JSON &patch) {
+    if (patch.type() != JSON_ARRAY)
+      throw JSONException("A JSON Patch must be a JSON_ARRAY");
+    const std::vector<JSON> &ops = elements(patch);
+    for (size_t i = 0; i < ops.size(); ++i)
+      applyOperation(root, ops[i]);
+  }
+
+  // Same as above, moving the values out of patch
+  void applyPatchTo(JSON &root, JSON &patch) {
+    if (patch.type() != JSON_ARRAY)
+      throw JSONException("A JSON Patch must be a JSON_ARRAY");
+    std::vector<JSON> &ops = elements(patch);
+    for (size_t i = 0; i < ops.size(); ++i)
+      applyOperation(root, ops[i]);
+  }
+
+  // Makes target a JSON_OBJECT (if it's not one), and removes its members
+  // which patch sets to null: returns false if patch is not a JSON_OBJECT
+  bool prepareMergeTarget(JSON &target, const JSON &patch) {
+    if (patch.type() != JSON_OBJECT)
+      return false;
+    if (target.type() != JSON_OBJECT)
+      target = JSON(JSON_OBJECT);
+    Object *o = static_cast<Object*>(target.val);
+    for (JSON::const_object_iterator it = patch.object_begin(); it != patch.object_end(); ++it) {
+      if (it->second.type() == JSON_NULL && o->val.count(it->first) > 0)
+        target.erase(it->first);
+    }
+    return true;
+  }
+
+  void mergePatchTo(JSON &target, const JSON &patch) {
+    if (!prepareMergeTarget(target, patch)) {
+      target = patch;
+      return;
+    }
+    for (JSON::const_object_iterator it = patch.object_begin(); it != patch.object_end(); ++it) {
+      if (it->second.type() != JSON_NULL)
+        mergePatchTo(target[it->first], it->second);
+    }
+  }
+
+  // Same as above, moving the values out of patch
+  void mergePatchTo(JSON &target, JSON &patch) {
+    if (!prepareMergeTarget(target, patch)) {
+      target = std::move(patch);
+      return;
+    }
+    for (JSON::object_iterator it = patch.object_begin(); it != patch.object_end(); ++it) {
+      if (it->second.type() != JSON_NULL)
+        mergePatchTo(target[it->first], it->second);
+    }
+  }
+
+  void addOperation(JSON &patch, const char *op, const std::string &path, const JSON *value) {
+    JSON operation(JSON_OBJECT);
+    operation["op"] = op;
+    operation["path"] = path;
+    if (value != NULL)
+      operation["value"] = *value;
+    patch.push_back(std::move(operation));
+  }
+
+  // Appends to "patch" the operations turning "from" into "to" (which are
+  // located at "path")
+  void diffTo(const JSON &from, const JSON &to, const std::string &path, JSON &patch) {
+    if (from == to)
+      return;
+    const JSONValue t = from.type();
+    if (t != to.type() || (t != JSON_OBJECT && t != JSON_ARRAY)) {
+      addOperation(patch, "replace", path, &to);
+      return;
+    }
+
+    if (t == JSON_OBJECT) {
+      for (JSON::const_object_iterator it = from.object_begin(); it != from.object_end(); ++it) {
+        if (!to.has(it->first))
+          addOperation(patch, "remove", path + "/" + escapeToken(it->first), NULL);
+      }
+      for (JSON::const_object_iterator it = to.object_begin(); it != to.object_end(); ++it) {
+        const std::string memberPath = path + "/" + escapeToken(it->first);
+        if (from.has(it->first))
+          diffTo(from[it->first], it->second, memberPath, patch);
+        else
+          addOperation(patch, "add", memberPath, &it->second);
+      }
+      return;
+    }
+
+    // Arrays: elements common to the beginning/end of both are left alone,
+    // the ones in between are changed pairwise, then removed/added
+    const std::vector<JSON> &a = static_cast<const Array*>(from.val)->val;
+    const std::vector<JSON> &b = static_cast<const Array*>(to.val)->val;
+    size_t prefix = 0;
+    while (prefix < a.size() && prefix < b.size() && a[prefix] == b[prefix])
+      ++prefix;
+    size_t suffix = 0;
+    while (suffix < a.size() - prefix && suffix < b.size() - prefix && a[a.size() - 1 - suffix] == b[b.size() - 1 - suffix])
+      ++suffix;
+    const size_t countA = a.size() - prefix - suffix, countB = b.size() - prefix - suffix;
+    const size_t common = std::min(countA, countB);
+    for (size_t i = prefix; i < prefix + common; ++i)
+      diffTo(a[i], b[i], path + "/" + boost::lexical_cast<std::string>(i), patch);
+    const std::string next = path + "/" + boost::lexical_cast<std::string>(prefix + common);
+    for (size_t i = common; i < countA; ++i)
+      addOperation(patch, "remove", next, NULL);
+    for (size_t i = countB; i-- > common; )
+      addOperation(patch, "add", next, &b[prefix + i]);
+  }
+
+  // Returns the merge patch turning "from" (NULL: absent) into "to"
+  JSON mergeDiff(const JSON *from, const JSON &to) {
+    if (to.type() != JSON_OBJECT)
+      return to;
+    const bool fromObject = (from != NULL && from->type() == JSON_OBJECT);
+    JSON patch(JSON_OBJECT);
+    if (fromObject) {
+      for (JSON::const_object_iterator it = from->object_begin(); it != from->object_end(); ++it) {
+        if (!to.has(it->first))
+          patch[it->first] = JSON(JSON_NULL);
+      }
+    }
+    for (JSON::const_object_iterator it = to.object_begin(); it != to.object_end(); ++it) {
+      const JSON *old = (fromObject && from->has(it->first)) ? &(*from)[it->first] : NULL;
+      if (old != NULL && *old == it->second)
+        continue;
+      if (it->second.type() == JSON_NULL)
+        throw JSONException("A JSON Merge Patch cannot set a member to null (key \"" + it->first + "\")");
+      patch.insert(it->first, mergeDiff(old, it->second));
+    }
+    return patch;
+  }
+}
+
+void JSON::applyPatch(const JSON &patch) {
+  applyPatchTo(*this, patch);
+}
+
+void JSON::applyPatch(JSON &&patch) {
+  applyPatchTo(*this, patch);
+}
+
+void JSON::applyMergePatch(const JSON &patch) {
+  mergePatchTo(*this, patch);
+}
+
+void JSON::applyMergePatch(JSON &&patch) {
+  mergePatchTo(*this, patch);
+}
+
+JSON JSON::diffPatch(const JSON &from, const JSON &to) {
+  JSON patch(JSON_ARRAY);
+  diffTo(from, to, "", patch);
+  return patch;
+}
+
+JSON JSON::diffMergePatch(const JSON &from, const JSON &to) {
+  return mergeDiff(&from, to);
+}
@@ -0,0 +1,167 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "pointer.h"
+
+using namespace dx;
+
+namespace {
+
+  // Appends matching values as JSON objects
+  class JSONCollector: public JSONPointerHandler {
+  public:
+    std::vector<JSON> &out;
+
+    explicit JSONCollector(std::vector<JSON> &o): out(o) { }
+
+    void match(const std::vector<std::string> &, JSONReader &reader) {
+      out.push_back(reader.readValue());
+    }
+  };
+}
+
+JSONPointer::JSONPointer(const std::string &pointer) {
+  if (pointer.empty())
+    return;
+  if (pointer[0] != '/')
+    throw JSONException("Invalid JSON pointer: \"" + pointer + "\". Must be empty, or start with '/'");
+
+  size_t start = 1;
+  while (true) {
+    size_t end = pointer.find('/', start);
+    if (end == std::string::npos)
+      end = pointer.size();
+
+    Segment seg;
+    for (size_t i = start; i < end; ++i) {
+      if (pointer[i] != '~') {
+        seg.key.push_back(pointer[i]);
+        continue;
+      }
+      if (i + 1 == end || (pointer[i + 1] != '0' && pointer[i + 1] != '1'))
+        throw JSONException("Invalid JSON pointer: \"" + pointer + "\". '~' must be followed by '0' or '1'");
+      seg.key.push_back((pointer[++i] == '0') ? '~' : '/');
+    }
+    seg.wildcard = (end - start == 1 && pointer[start] == '*');
+    // Array indices are decimal numbers, without leading zeros
+    seg.isIndex = !seg.key.empty() && seg.key.size() <= 18 && (seg.key[0] != '0' || seg.key.size() == 1);
+    seg.index = 0;
+    for (size_t i = 0; i < seg.key.size() && seg.isIndex; ++i) {
+      if (seg.key[i] < '0' || seg.key[i] > '9')
+        seg.isIndex = false;
+      else
+        seg.index = seg.index * 10 + (seg.key[i] - '0');
+    }
+    segments.push_back(seg);
+
+    if (end == pointer.size())
+      break;
+    start = end + 1;
+  }
+}
+
+// Matches segments [i, size()) against j. Returns the first match, unless
+// "all" is given, in which case all the matches are appended to it.
+const JSON* JSONPointer::findFrom(const JSON &j, size_t i, std::vector<const JSON*> *all) const {
+  if (i == segments.size()) {
+    if (all != NULL)
+      all->push_back(&j);
+    return &j;
+  }
+  const Segment &seg = segments[i];
+  const JSONValue t = j.type();
+  if (t == JSON_OBJECT) {
+    if (!seg.wildcard) {
+      const Object *o = static_cast<const Object*>(j.val);
+      JSON::const_object_iterator it = o->val.find(seg.key);
+      return (it == o->val.end()) ? NULL : findFrom(it->second, i + 1, all);
+    }
+    for (JSON::const_object_iterator it = j.object_begin(); it != j.object_end(); ++it) {
+      const JSON *found = findFrom(it->second, i + 1, all);
+      if (found != NULL && all == NULL)
+        return found;
+    }
+  } else if (t == JSON_ARRAY) {
+    const std::vector<JSON> &arr = static_cast<const Array*>(j.val)->val;
+    if (!seg.wildcard)
+      return (seg.isIndex && seg.index < arr.size()) ? findFrom(arr[seg.index], i + 1, all) : NULL;
+    for (size_t k = 0; k < arr.size(); ++k) {
+      const JSON *found = findFrom(arr[k], i + 1, all);
+      if (found != NULL && all == NULL)
+        return found;
+    }
+  }
+  return NULL;
+}
+
+const JSON* JSONPointer::find(const JSON &j) const {
+  return findFrom(j, 0, NULL);
+}
+
+void JSONPointer::findAll(const JSON &j, std::vector<const JSON*> &out) const {
+  findFrom(j, 0, &out);
+}
+
+// The reader is at the first event of a value, which is matched against
+// segments [i, size()). The value is consumed completely.
+void JSONPointer::selectFrom(JSONReader &reader, size_t i, std::vector<std::string> &path, JSONPointerHandler &handler) const {
+  const JSONEvent e = reader.event();
+  if (i == segments.size()) {
+    const size_t depth = reader.depth();
+    handler.match(path, reader);
+    // Skip the container, unless the handler has read it
+    if ((e == JSON_EVENT_START_OBJECT || e == JSON_EVENT_START_ARRAY) && reader.event() == e && reader.depth() == depth)
+      reader.skip();
+    return;
+  }
+
+  const Segment &seg = segments[i];
+  if (e == JSON_EVENT_START_OBJECT) {
+    while (reader.next() && reader.event() == JSON_EVENT_KEY) {
+      if (!seg.wildcard && reader.key() != seg.key) {
+        reader.skip();
+        continue;
+      }
+      path.push_back(reader.key());
+      reader.next();
+      selectFrom(reader, i + 1, path, handler);
+      path.pop_back();
+    }
+  } else if (e == JSON_EVENT_START_ARRAY) {
+    for (size_t k = 0; reader.next() && reader.event() != JSON_EVENT_END_ARRAY; ++k) {
+      if (!seg.wildcard && !(seg.isIndex && seg.index == k)) {
+        reader.skip();
+        continue;
+      }
+      path.push_back(boost::lexical_cast<std::string>(k));
+      selectFrom(reader, i + 1, path, handler);
+      path.pop_back();
+    }
+  }
+}
+
+void JSONPointer::select(JSONReader &reader, JSONPointerHandler &handler) const {
+  if (reader.event() == JSON_EVENT_NONE)
+    reader.next();
+  std::vector<std::string> path;
+  selectFrom(reader, 0, path, handler);
+}
+
+void JSONPointer::select(const char *data, size_t len, std::vector<JSON> &out) const {
+  JSONReader reader(data, len);
+  JSONCollector collector(out);
+  select(reader, collector);
+}
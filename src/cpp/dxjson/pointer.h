@@ -0,0 +1,107 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_POINTER_H__
+#define __DXJSON_POINTER_H__
+
+#include <string>
+#include <vector>
+
+#include "dxjson.h"
+#include "reader.h"
+
+/** @file */
+
+namespace dx {
+
+  /** Receives the values matched by JSONPointer::select() */
+  class JSONPointerHandler {
+  public:
+    /** Called for each matching value, with the reader positioned at its first
+      * event (JSON_EVENT_VALUE, or JSON_EVENT_START_OBJECT/JSON_EVENT_START_ARRAY).
+      * The value can be read through the reader (e.g., by getString(), or
+      * readValue()); if it's not, it is skipped.
+      * @param path Keys (and array indices, in decimal) leading to the value
+      * @param reader The reader passed to select()
+      */
+    virtual void match(const std::vector<std::string> &path, JSONReader &reader) = 0;
+    virtual ~JSONPointerHandler() { }
+  };
+
+  /** A compiled JSON Pointer (RFC 6901), extended with wildcards: a "*"
+    * segment matches every member of an object, or element of an array (e.g.,
+    * the example below selects state of all the parts in a file describe
+    * hash). As in RFC 6901, "~1" and "~0" inside a segment stand for '/' and
+    * '~' respectively (there is no way to select a key which is exactly "*",
+    * other than with a wildcard).
+    *
+    * A pointer can be evaluated against a JSON object (without throwing for
+    * missing keys, or values of unexpected type), or against serialized JSON
+    * through a JSONReader, in which case only the matching values are
+    * materialized, and subtrees which cannot match are skipped.
+    * @code
+    * static const JSONPointer PART_STATES("/parts/" "*" "/state");
+    * std::vector<const JSON*> states;
+    * PART_STATES.findAll(fileDescription, states);
+    * @endcode
+    */
+  class JSONPointer {
+  public:
+    /** @param pointer The pointer ("" refers to the whole value)
+      * @throw JSONException If pointer is not empty, and does not start with '/',
+      * or contains a '~' not followed by '0' or '1'.
+      */
+    explicit JSONPointer(const std::string &pointer);
+
+    /** Returns the number of segments (keys/indices/wildcards) in the pointer */
+    size_t size() const { return segments.size(); }
+
+    /** Returns the first value (in iteration order) matched in j, or NULL if there is none */
+    const JSON* find(const JSON &j) const;
+    JSON* find(JSON &j) const { return const_cast<JSON*>(find(const_cast<const JSON&>(j))); }
+
+    /** Appends all the values matched in j to "out" (in iteration order) */
+    void findAll(const JSON &j, std::vector<const JSON*> &out) const;
+
+    /** Reads a serialized JSON value, and calls the handler for each match.
+      * @param reader Must be positioned before (JSON_EVENT_NONE), or at the first
+      * event of a value. The complete value is consumed.
+      * @param handler Receives the matches.
+      * @throw JSONException If illegal JSON is encountered.
+      */
+    void select(JSONReader &reader, JSONPointerHandler &handler) const;
+
+    /** Reads the serialized JSON value held in buffer, and appends the matching
+      * values to "out".
+      */
+    void select(const char *data, size_t len, std::vector<JSON> &out) const;
+
+  private:
+    struct Segment {
+      std::string key;
+      bool wildcard;
+      bool isIndex; // true if key is a valid array index (in which case it's stored in "index")
+      size_t index;
+    };
+
+    std::vector<Segment> segments;
+
+    const JSON* findFrom(const JSON &j, size_t i, std::vector<const JSON*> *all) const;
+    void selectFrom(JSONReader &reader, size_t i, std::vector<std::string> &path, JSONPointerHandler &handler) const;
+  };
+}
+
+#endif
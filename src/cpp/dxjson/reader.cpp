@@ -0,0 +1,478 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "reader.h"
+
+using namespace dx;
+
+JSON& JSONBuilder::nextValue() {
+  if (stack.empty())
+    return root;
+  JSON &parent = *stack.back();
+  if (parent.type() == JSON_OBJECT)
+    return parent[currentKey];
+  parent.push_back(JSON());
+  return parent[parent.size() - 1];
+}
+
+void JSONBuilder::startContainer(JSONValue type) {
+  JSON &j = nextValue();
+  j = type;
+  stack.push_back(&j);
+}
+
+JSONReader::JSONReader(const char *data, size_t len): in(data, len), evt(JSON_EVENT_NONE),
+                                                        afterKey(false), done(false), valType(JSON_UNDEFINED), boolVal(false) {
+  numVal.isReal = false;
+  numVal.i = 0;
+  numVal.d = 0.0;
+}
+
+JSONValue JSONReader::type() const {
+  switch (evt) {
+    case JSON_EVENT_START_OBJECT: return JSON_OBJECT;
+    case JSON_EVENT_START_ARRAY: return JSON_ARRAY;
+    case JSON_EVENT_VALUE: return valType;
+    default: return JSON_UNDEFINED;
+  }
+}
+
+const std::string& JSONReader::getString() const {
+  if (evt != JSON_EVENT_VALUE || valType != JSON_STRING)
+    throw JSONException("JSONReader::getString() can only be called for a JSON_STRING value");
+  return strVal;
+}
+
+int64_t JSONReader::getInteger() const {
+  if (evt != JSON_EVENT_VALUE || valType != JSON_INTEGER)
+    throw JSONException("JSONReader::getInteger() can only be called for a JSON_INTEGER value");
+  return numVal.i;
+}
+
+double JSONReader::getReal() const {
+  if (evt != JSON_EVENT_VALUE || valType != JSON_REAL)
+    throw JSONException("JSONReader::getReal() can only be called for a JSON_REAL value");
+  return numVal.d;
+}
+
+bool JSONReader::getBoolean() const {
+  if (evt != JSON_EVENT_VALUE || valType != JSON_BOOLEAN)
+    throw JSONException("JSONReader::getBoolean() can only be called for a JSON_BOOLEAN value");
+  return boolVal;
+}
+
+// Reads the first token of a value: either a complete scalar value, or the
+// opening bracket of a container
+void JSONReader::readValueStart() {
+  if (!stack.empty())
+    stack.back().hasMembers = true;
+
+  in.skipWhiteSpace();
+  int ch = in.peek();
+  if (ch == EOF)
+    throw JSONException("Unexpected EOF");
+
+  evt = JSON_EVENT_VALUE;
+  switch (ch) {
+    case '{':
+    case '[': {
+      in.get();
+      Container c = {char(ch), false};
+      stack.push_back(c);
+      evt = (ch == '{') ? JSON_EVENT_START_OBJECT : JSON_EVENT_START_ARRAY;
+      return;
+    }
+    case '"':
+      valType = JSON_STRING;
+      strVal.clear();
+      in.readString(strVal);
+      break;
+    case 't':
+    case 'f':
+      valType = JSON_BOOLEAN;
+      boolVal = in.readBoolean();
+      break;
+    case 'n':
+      valType = JSON_NULL;
+      in.readNull();
+      break;
+    default:
+      if (ch != '-' && !isdigit(ch))
+        throw JSONException("Illegal JSON value. Cannot start with : " + std::string(1, char(ch)));
+      in.readNumber(numVal);
+      valType = (numVal.isReal) ? JSON_REAL : JSON_INTEGER;
+  }
+  if (stack.empty())
+    done = true;
+}
+
+void JSONReader::endContainer(JSONEvent e) {
+  stack.pop_back();
+  evt = e;
+  if (stack.empty())
+    done = true;
+}
+
+bool JSONReader::next() {
+  if (done) {
+    evt = JSON_EVENT_END;
+    return false;
+  }
+  if (stack.empty()) {
+    readValueStart();
+    return true;
+  }
+  if (afterKey) {
+    afterKey = false;
+    readValueStart();
+    return true;
+  }
+
+  Container &c = stack.back();
+  in.skipWhiteSpace();
+  int ch = in.get();
+  if (c.kind == '{') {
+    if (ch == EOF)
+      throw JSONException("Unexpected EOF while parsing object. ch = " + std::string(1, ch));
+
+    // End of parsing for this JSON object
+    if (ch == '}') {
+      endContainer(JSON_EVENT_END_OBJECT);
+      return true;
+    }
+
+    // Keys:value pairs must be separated by , inside JSON object
+    if (c.hasMembers) {
+      if (ch != ',')
+        throw JSONException("Expected , while parsing object. Got : " + std::string(1, ch));
+      in.skipWhiteSpace();
+      ch = in.get();
+    }
+
+    if (ch != '"')
+      throw JSONException("Expected start of a valid object key (string) at this location");
+    in.unget();
+    keyStr.clear();
+    in.readString(keyStr);
+    in.skipWhiteSpace();
+    ch = in.get();
+    if (ch != ':')
+      throw JSONException("Expected :, got : " + std::string(1, ch));
+    afterKey = true;
+    evt = JSON_EVENT_KEY;
+    return true;
+  }
+
+  if (ch == EOF)
+    throw JSONException("Unexpected EOF while parsing array");
+
+  // End of parsing this array
+  if (ch == ']') {
+    endContainer(JSON_EVENT_END_ARRAY);
+    return true;
+  }
+
+  if (c.hasMembers) {
+    if (ch != ',')
+      throw JSONException("Expected ,(comma) GOT: " + std::string(1, ch));
+  }
+  else
+    in.unget();
+  readValueStart();
+  return true;
+}
+
+void JSONReader::skip() {
+  if (evt == JSON_EVENT_KEY) {
+    next();
+    skip();
+    return;
+  }
+  if (evt != JSON_EVENT_START_OBJECT && evt != JSON_EVENT_START_ARRAY)
+    return;
+  const size_t d = stack.size();
+  while (stack.size() >= d)
+    next();
+}
+
+// Calls handler method for the current event
+void JSONReader::emitCurrent(JSONHandler &handler) {
+  switch (evt) {
+    case JSON_EVENT_START_OBJECT: handler.startObject(); break;
+    case JSON_EVENT_END_OBJECT: handler.endObject(); break;
+    case JSON_EVENT_START_ARRAY: handler.startArray(); break;
+    case JSON_EVENT_END_ARRAY: handler.endArray(); break;
+    case JSON_EVENT_KEY: handler.key(keyStr); break;
+    case JSON_EVENT_VALUE:
+      switch (valType) {
+        case JSON_STRING: handler.stringValue(strVal); break;
+        case JSON_INTEGER: handler.integerValue(numVal.i); break;
+        case JSON_REAL: handler.realValue(numVal.d); break;
+        case JSON_BOOLEAN: handler.booleanValue(boolVal); break;
+        default: handler.nullValue(); break;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+// Calls handler methods for all events of the current value
+void JSONReader::emitValue(JSONHandler &handler) {
+  emitCurrent(handler);
+  if (evt != JSON_EVENT_START_OBJECT && evt != JSON_EVENT_START_ARRAY)
+    return;
+  const size_t d = stack.size();
+  while (stack.size() >= d) {
+    next();
+    emitCurrent(handler);
+  }
+}
+
+JSON JSONReader::readValue() {
+  if (evt == JSON_EVENT_KEY)
+    next();
+  if (evt != JSON_EVENT_VALUE && evt != JSON_EVENT_START_OBJECT && evt != JSON_EVENT_START_ARRAY)
+    throw JSONException("JSONReader::readValue() can only be called at start of a value, or on a key");
+  JSONBuilder builder;
+  emitValue(builder);
+  return std::move(builder.result());
+}
+
+void JSONReader::parse(JSONHandler &handler) {
+  while (next())
+    emitCurrent(handler);
+}
+
+JSONPushParser::JSONPushParser(JSONHandler &h): handler(h) {
+  reset();
+}
+
+void JSONPushParser::reset() {
+  state = STATE_VALUE;
+  stack.clear();
+  token = TOKEN_NONE;
+  isKey = false;
+  escaped = false;
+  pending.clear();
+}
+
+void JSONPushParser::feed(const char *data, size_t len) {
+  const char *p = data;
+  const char *end = data + len;
+  if (token != TOKEN_NONE && p < end)
+    p = resumeToken(p, end);
+
+  while (p < end && token == TOKEN_NONE && state != STATE_DONE) {
+    const char ch = *p;
+    if (JSONScanner::isWhiteSpace(ch)) {
+      ++p;
+      continue;
+    }
+    switch (state) {
+      case STATE_COLON:
+        if (ch != ':')
+          throw JSONException("Expected :, got : " + std::string(1, ch));
+        state = STATE_VALUE;
+        ++p;
+        break;
+      case STATE_COMMA_OR_END: {
+        const bool inObject = (stack.back() == '{');
+        if (ch == ((inObject) ? '}' : ']'))
+          closeContainer();
+        else if (ch == ',')
+          state = (inObject) ? STATE_KEY : STATE_VALUE;
+        else if (inObject)
+          throw JSONException("Expected , while parsing object. Got : " + std::string(1, ch));
+        else
+          throw JSONException("Expected ,(comma) GOT: " + std::string(1, ch));
+        ++p;
+        break;
+      }
+      case STATE_KEY_OR_END:
+      case STATE_KEY:
+        if (ch == '}' && state == STATE_KEY_OR_END) {
+          closeContainer();
+          ++p;
+          break;
+        }
+        if (ch != '"')
+          throw JSONException("Expected start of a valid object key (string) at this location");
+        token = TOKEN_STRING;
+        isKey = true;
+        p = startToken(p, end);
+        break;
+      case STATE_VALUE_OR_END:
+        if (ch == ']') {
+          closeContainer();
+          ++p;
+          break;
+        }
+        p = startValue(p, end);
+        break;
+      default:
+        p = startValue(p, end);
+    }
+  }
+}
+
+void JSONPushParser::finish() {
+  // A number at top level is terminated only by end of input
+  if (token == TOKEN_NUMBER && stack.empty()) {
+    completeToken(pending.data(), pending.size());
+    pending.clear();
+  }
+  if (state != STATE_DONE)
+    throw JSONException("Unexpected EOF");
+}
+
+// Handles the first character of a value, at p
+const char* JSONPushParser::startValue(const char *p, const char *end) {
+  const char ch = *p;
+  if (ch == '{' || ch == '[') {
+    stack.push_back(ch);
+    if (ch == '{') {
+      handler.startObject();
+      state = STATE_KEY_OR_END;
+    } else {
+      handler.startArray();
+      state = STATE_VALUE_OR_END;
+    }
+    return p + 1;
+  }
+  if (ch == '"')
+    token = TOKEN_STRING;
+  else if (ch == 't' || ch == 'f' || ch == 'n')
+    token = TOKEN_LITERAL;
+  else if (ch == '-' || (ch >= '0' && ch <= '9'))
+    token = TOKEN_NUMBER;
+  else
+    throw JSONException("Illegal JSON value. Cannot start with : " + std::string(1, ch));
+  isKey = false;
+  return startToken(p, end);
+}
+
+// Returns pointer just past the end of current string/number token, scanning
+// from p (inside the token), or NULL if the token does not end before "end"
+const char* JSONPushParser::findTokenEnd(const char *p, const char *end) {
+  if (token == TOKEN_NUMBER) {
+    while (p < end && JSONScanner::isNumberChar(*p))
+      ++p;
+    return (p < end) ? p : NULL;
+  }
+  if (escaped) {
+    if (p == end)
+      return NULL;
+    escaped = false;
+    ++p; // Character following the backslash
+  }
+  while ((p = JSONScanner::findStringSpecial(p, end)) < end) {
+    if (*p == '"')
+      return p + 1;
+    if (*p == '\\' && ++p == end) {
+      escaped = true;
+      return NULL;
+    }
+    ++p;
+  }
+  return NULL;
+}
+
+// Handles a token starting at p. If the token is complete before "end" it's
+// decoded in place, otherwise it's buffered until rest of it arrives.
+const char* JSONPushParser::startToken(const char *p, const char *end) {
+  const char *tokEnd;
+  if (token == TOKEN_LITERAL) {
+    const size_t need = (*p == 'f') ? 5 : 4;
+    tokEnd = (static_cast<size_t>(end - p) >= need) ? p + need : NULL;
+  } else {
+    tokEnd = findTokenEnd(p + 1, end);
+  }
+  if (tokEnd == NULL) {
+    pending.assign(p, end);
+    return end;
+  }
+  completeToken(p, tokEnd - p);
+  return tokEnd;
+}
+
+// Continues the buffered token with input starting at p
+const char* JSONPushParser::resumeToken(const char *p, const char *end) {
+  const char *tokEnd;
+  if (token == TOKEN_LITERAL) {
+    const size_t need = (pending[0] == 'f') ? 5 : 4;
+    tokEnd = p + std::min(need - pending.size(), static_cast<size_t>(end - p));
+    pending.append(p, tokEnd);
+    if (pending.size() < need)
+      return end;
+  } else {
+    tokEnd = findTokenEnd(p, end);
+    if (tokEnd == NULL) {
+      pending.append(p, end);
+      return end;
+    }
+    pending.append(p, tokEnd);
+  }
+  completeToken(pending.data(), pending.size());
+  pending.clear();
+  return tokEnd;
+}
+
+// Decodes the complete token [tok, tok + len), and calls the handler for it
+void JSONPushParser::completeToken(const char *tok, size_t len) {
+  JSONScanner in(tok, len);
+  const Token t = token;
+  token = TOKEN_NONE;
+  switch (t) {
+    case TOKEN_STRING:
+      strVal.clear();
+      in.readString(strVal);
+      if (isKey) {
+        handler.key(strVal);
+        state = STATE_COLON;
+        return;
+      }
+      handler.stringValue(strVal);
+      break;
+    case TOKEN_NUMBER: {
+      JSONScanner::Number n;
+      in.readNumber(n);
+      if (n.isReal)
+        handler.realValue(n.d);
+      else
+        handler.integerValue(n.i);
+      break;
+    }
+    default:
+      if (*tok == 'n') {
+        in.readNull();
+        handler.nullValue();
+      } else {
+        handler.booleanValue(in.readBoolean());
+      }
+  }
+  afterValue();
+}
+
+void JSONPushParser::closeContainer() {
+  const char kind = stack.back();
+  stack.pop_back();
+  if (kind == '{')
+    handler.endObject();
+  else
+    handler.endArray();
+  afterValue();
+}
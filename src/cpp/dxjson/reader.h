@@ -0,0 +1,285 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_READER_H__
+#define __DXJSON_READER_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "dxjson.h"
+#include "scanner.h"
+
+/** @file */
+
+namespace dx {
+
+  /** \enum JSONEvent Events produced by JSONReader while walking over serialized JSON.
+    * - JSON_EVENT_NONE: next() has not been called yet.
+    * - JSON_EVENT_START_OBJECT: A '{' was read.
+    * - JSON_EVENT_END_OBJECT: A '}' was read.
+    * - JSON_EVENT_START_ARRAY: A '[' was read.
+    * - JSON_EVENT_END_ARRAY: A ']' was read.
+    * - JSON_EVENT_KEY: A key inside an object (and the following ':') was read.
+    * - JSON_EVENT_VALUE: A string, number, boolean or null value was read.
+    * - JSON_EVENT_END: The top level JSON value has been read completely.
+    */
+  enum JSONEvent {
+    JSON_EVENT_NONE = 0,
+    JSON_EVENT_START_OBJECT = 1,
+    JSON_EVENT_END_OBJECT = 2,
+    JSON_EVENT_START_ARRAY = 3,
+    JSON_EVENT_END_ARRAY = 4,
+    JSON_EVENT_KEY = 5,
+    JSON_EVENT_VALUE = 6,
+    JSON_EVENT_END = 7
+  };
+
+  /** Callback interface for JSONReader::parse(). Override the methods for the
+    * events of interest, default implementations ignore the event.
+    */
+  class JSONHandler {
+  public:
+    virtual void startObject() { }
+    virtual void endObject() { }
+    virtual void startArray() { }
+    virtual void endArray() { }
+    virtual void key(const std::string &) { }
+    virtual void stringValue(const std::string &) { }
+    virtual void integerValue(int64_t) { }
+    virtual void realValue(double) { }
+    virtual void booleanValue(bool) { }
+    virtual void nullValue() { }
+    virtual ~JSONHandler() { }
+  };
+
+  /** A JSONHandler which builds a JSON object out of the events it receives.
+    */
+  class JSONBuilder: public JSONHandler {
+  public:
+    void startObject() { startContainer(JSON_OBJECT); }
+    void endObject() { stack.pop_back(); }
+    void startArray() { startContainer(JSON_ARRAY); }
+    void endArray() { stack.pop_back(); }
+    void key(const std::string &k) { currentKey = k; }
+    void stringValue(const std::string &s) { nextValue() = s; }
+    void integerValue(int64_t i) { nextValue() = i; }
+    void realValue(double d) { nextValue() = d; }
+    void booleanValue(bool b) { nextValue() = b; }
+    void nullValue() { nextValue() = JSON_NULL; }
+
+    /** The JSON value built so far (complete once all events of the value are received) */
+    JSON& result() { return root; }
+
+  private:
+    JSON root;
+    std::vector<JSON*> stack; // Containers which are currently open
+    std::string currentKey;
+
+    JSON& nextValue();
+    void startContainer(JSONValue type);
+  };
+
+  /** A pull parser over serialized JSON held in a contiguous buffer.
+    * Instead of building a complete JSON object, the reader returns one
+    * event (see JSONEvent) at a time, so that a document can be scanned in
+    * constant memory. The grammar (and error messages) are same as for
+    * JSON::readFromBuffer(). For example, to sum up sizes of all parts
+    * in a file describe response:
+    * @code
+    * JSONReader r(resp.data(), resp.size());
+    * int64_t total = 0;
+    * while (r.next()) {
+    *   if (r.event() == JSON_EVENT_KEY && r.depth() == 1 && r.key() != "parts")
+    *     r.skip();
+    *   else if (r.event() == JSON_EVENT_KEY && r.depth() == 3 && r.key() == "size" && r.next())
+    *     total += r.getInteger();
+    * }
+    * @endcode
+    * @note The buffer is not copied, it must outlive the reader.
+    */
+  class JSONReader {
+  public:
+    /** @param data Pointer to the first character of serialized JSON
+      * @param len Number of bytes available at "data"
+      */
+    JSONReader(const char *data, size_t len);
+
+    /** Advances to the next event.
+      * @return false once the top level value has been read completely (event()
+      * returns JSON_EVENT_END after that), true otherwise.
+      * @throw JSONException If illegal JSON is encountered.
+      */
+    bool next();
+
+    /** Returns the current event */
+    JSONEvent event() const { return evt; }
+
+    /** Returns the type of the current value: JSON_OBJECT/JSON_ARRAY for
+      * JSON_EVENT_START_OBJECT/JSON_EVENT_START_ARRAY events, the scalar type for
+      * JSON_EVENT_VALUE events, and JSON_UNDEFINED otherwise.
+      */
+    JSONValue type() const;
+
+    /** Number of containers (objects/arrays) enclosing the current position.
+      * For a JSON_EVENT_START_* event it includes the container just opened.
+      */
+    size_t depth() const { return stack.size(); }
+
+    /** Returns the most recently read key (available for JSON_EVENT_KEY event,
+      * and until the next key is read).
+      */
+    const std::string& key() const { return keyStr; }
+
+    /** Returns value of the current JSON_STRING value */
+    const std::string& getString() const;
+
+    /** Returns value of the current JSON_INTEGER value */
+    int64_t getInteger() const;
+
+    /** Returns value of the current JSON_REAL value */
+    double getReal() const;
+
+    /** Returns value of the current JSON_BOOLEAN value */
+    bool getBoolean() const;
+
+    /** Skips the current value without producing events for it:
+      * - On a JSON_EVENT_KEY event: skips the value associated with the key.
+      * - On a JSON_EVENT_START_* event: skips to the matching JSON_EVENT_END_* event.
+      * - No-op for other events.
+      */
+    void skip();
+
+    /** Materializes the current value as a JSON object (for a JSON_EVENT_KEY
+      * event, the value associated with the key), and consumes all of its events.
+      * @throw JSONException If called for any other event.
+      */
+    JSON readValue();
+
+    /** Calls the handler methods corresponding to all the remaining events. */
+    void parse(JSONHandler &handler);
+
+    /** Reads the complete JSON value held in buffer, and calls handler methods
+      * for each event.
+      */
+    static void parse(const char *data, size_t len, JSONHandler &handler) {
+      JSONReader r(data, len);
+      r.parse(handler);
+    }
+
+  private:
+    struct Container {
+      char kind; // '{' or '['
+      bool hasMembers;
+    };
+
+    JSONScanner in;
+    JSONEvent evt;
+    std::vector<Container> stack;
+    bool afterKey; // true if last event was JSON_EVENT_KEY
+    bool done; // true once top level value is read
+
+    std::string keyStr;
+    JSONValue valType;
+    std::string strVal;
+    JSONScanner::Number numVal;
+    bool boolVal;
+
+    void readValueStart();
+    void endContainer(JSONEvent e);
+    void emitCurrent(JSONHandler &handler);
+    void emitValue(JSONHandler &handler);
+  };
+
+  /** A push parser: serialized JSON is fed to it in pieces of arbitrary size
+    * (e.g., as they are received over the network), and the JSONHandler methods
+    * are called as soon as each token is complete. A token split between two
+    * pieces is resumed when the next piece arrives, so only the incomplete
+    * token (and never the complete input) is buffered. For example, to build a
+    * JSON object:
+    * @code
+    * JSONBuilder builder;
+    * JSONPushParser parser(builder);
+    * while ((len = receive(buf, sizeof(buf))) > 0)
+    *   parser.feed(buf, len);
+    * parser.finish();
+    * JSON j = std::move(builder.result());
+    * @endcode
+    * The grammar (and error messages) are same as for JSONReader. Any input
+    * following the top level value is ignored.
+    */
+  class JSONPushParser {
+  public:
+    /** @param handler Receives the events for the parsed value (must outlive the parser) */
+    explicit JSONPushParser(JSONHandler &handler);
+
+    /** Parses the next piece of input. The buffer is not used after the call returns.
+      * @throw JSONException If illegal JSON is encountered.
+      */
+    void feed(const char *data, size_t len);
+
+    /** Signals end of input.
+      * @throw JSONException If the top level value is incomplete.
+      */
+    void finish();
+
+    /** Returns true once the top level value has been read completely */
+    bool done() const { return state == STATE_DONE; }
+
+    /** Discards all state, so that a new value can be parsed (the handler is not reset) */
+    void reset();
+
+  private:
+    // What is expected next (ignoring whitespace)
+    enum State {
+      STATE_VALUE, // A value (at top level, after ':', or after ',' in array)
+      STATE_VALUE_OR_END, // A value or ']' (after '[')
+      STATE_KEY, // A key (after ',' in object)
+      STATE_KEY_OR_END, // A key or '}' (after '{')
+      STATE_COLON, // ':' (after a key)
+      STATE_COMMA_OR_END, // ',' or end of container (after a value in container)
+      STATE_DONE // Top level value has been read
+    };
+
+    // Kind of token which is incomplete at end of the last piece of input
+    enum Token {
+      TOKEN_NONE,
+      TOKEN_STRING,
+      TOKEN_NUMBER,
+      TOKEN_LITERAL // true, false or null
+    };
+
+    JSONHandler &handler;
+    State state;
+    std::vector<char> stack; // '{' or '[' for each open container
+    Token token;
+    bool isKey; // true if the string token is a key
+    bool escaped; // true if the incomplete string token ends with a backslash
+    std::string pending; // Bytes of the incomplete token
+    std::string strVal;
+
+    const char* startValue(const char *p, const char *end);
+    const char* startToken(const char *p, const char *end);
+    const char* resumeToken(const char *p, const char *end);
+    const char* findTokenEnd(const char *p, const char *end);
+    void completeToken(const char *tok, size_t len);
+    void closeContainer();
+    void afterValue() { state = (stack.empty()) ? STATE_DONE : STATE_COMMA_OR_END; }
+  };
+}
+
+#endif
@@ -0,0 +1,477 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "scanner.h"
+#include "dxjson.h"
+#include <cfloat>
+#include <locale>
+
+// Vectorized string scanning is used on x86 when compiling with GCC/Clang (the
+// AVX2 version is selected at runtime). Define DXJSON_NO_SIMD to disable it.
+#if !defined(DXJSON_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define DXJSON_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define DXJSON_X86_SIMD 0
+#endif
+
+using namespace dx;
+
+namespace {
+
+  // UTF-8 encoding of the replacement character (U+FFFD)
+  const char REPLACEMENT_CHAR[] = "\xef\xbf\xbd";
+
+  // Bytes inside a string which cannot be copied verbatim: the closing quote,
+  // start of an escape sequence and any non-ASCII byte (which must be
+  // validated as UTF-8).
+  inline bool isStringSpecial(char ch) {
+    return (ch == '"' || ch == '\\' || (ch & 0x80));
+  }
+
+  // Each of the scan*() functions below returns a pointer to the first
+  // special byte (see isStringSpecial()) in [p, end), or end if there is none.
+  typedef const char* (*ScanFunction)(const char *p, const char *end);
+
+  const char* scanScalar(const char *p, const char *end) {
+    while (p < end && !isStringSpecial(*p))
+      ++p;
+    return p;
+  }
+
+#if DXJSON_X86_SIMD
+  // Looks at 16 bytes at a time. SSE2 is part of the x86-64 baseline, so this
+  // is always available there.
+  const char* scanSSE2(const char *p, const char *end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+      // The high bit of every non-ASCII byte in "v" is set as well
+      int mask = _mm_movemask_epi8(_mm_or_si128(special, v));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+    }
+    return scanScalar(p, end);
+  }
+
+  // Looks at 32 bytes at a time. Compiled for AVX2 regardless of the target
+  // architecture of rest of the library, and only called if the CPU supports it.
+  __attribute__((target("avx2")))
+  const char* scanAVX2(const char *p, const char *end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    for (; end - p >= 32; p += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(special, v)));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+    }
+    return scanSSE2(p, end);
+  }
+#endif
+
+  ScanFunction selectScanFunction() {
+#if DXJSON_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return scanAVX2;
+    return scanSSE2;
+#else
+    return scanScalar;
+#endif
+  }
+
+  // Returns pointer to first special byte in [p, end) using the fastest
+  // implementation supported by the CPU we are running on.
+  inline const char* scanPlainRun(const char *p, const char *end) {
+    static const ScanFunction scan = selectScanFunction();
+    return scan(p, end);
+  }
+
+  // Appends the replacement character for the invalid UTF-8 sequence
+  // starting at p, and advances p past it. Replacement rules are the same as
+  // utf8::replace_invalid(), except that a sequence truncated by "end" is
+  // replaced too (rather than throwing).
+  inline void replaceInvalidSequence(const char *&p, const char *end, bool invalidLead, std::string &out) {
+    out.append(REPLACEMENT_CHAR, 3);
+    ++p;
+    if (!invalidLead) {
+      // Just one replacement mark for the whole sequence
+      while (p < end && utf8::internal::is_trail(*p))
+        ++p;
+    }
+  }
+
+  inline int32_t hexdigit_to_num(char ch) {
+    if (ch >= '0' && ch <= '9')
+      return ch - '0';
+    if (ch >= 'a' && ch <= 'f')
+      return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F')
+      return ch - 'A' + 10;
+    throw JSONException("Invalid Hex digit in unicode escape \\uxxxx: " + std::string(1, ch));
+  }
+
+  inline bool isDigit(char ch) {
+    return (ch >= '0' && ch <= '9');
+  }
+
+  // Powers of 10 which are exactly representable as a double
+  const double EXACT_POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const int MAX_EXACT_POW10 = 22;
+  const uint64_t MAX_EXACT_INTEGER = 1ULL << 53;
+
+  // Computes mantissa * 10^exp10 exactly rounded, if it can be done with a
+  // single floating point operation on exact operands (Clinger's fast path).
+  // Returns false otherwise.
+  // Not used if intermediate results are kept with a higher precision (e.g.,
+  // on x87), since that would result in double rounding.
+  bool fastPathToDouble(uint64_t mantissa, int exp10, double &d) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    if (mantissa > MAX_EXACT_INTEGER)
+      return false;
+    if (exp10 < 0) {
+      if (exp10 < -MAX_EXACT_POW10)
+        return false;
+      d = static_cast<double>(mantissa) / EXACT_POW10[-exp10];
+      return true;
+    }
+    // Move some of the exponent into the mantissa (as long as it stays exact), e.g. 12e30 = 12000000000e22
+    for (; exp10 > MAX_EXACT_POW10; --exp10) {
+      if (mantissa > MAX_EXACT_INTEGER / 10)
+        return false;
+      mantissa *= 10;
+    }
+    d = static_cast<double>(mantissa) * EXACT_POW10[exp10];
+    return true;
+#else
+    (void) mantissa;
+    (void) exp10;
+    (void) d;
+    return false;
+#endif
+  }
+}
+
+void JSONScanner::readString(std::string &out) {
+  const char *strStart = p;
+  assert(p < end && *p == '"'); // First character in a string should be quote
+  ++p;
+  do {
+    // Find the longest run of characters which need no decoding, validating
+    // any UTF-8 sequence on the way, and copy it in one go.
+    const char *run = p;
+    while ((p = scanPlainRun(p, end)) < end && (*p & 0x80)) {
+      const char *seq = p;
+      utf8::internal::utf_error err = utf8::internal::validate_next(p, end);
+      if (err != utf8::internal::UTF8_OK) {
+        out.append(run, seq - run);
+        replaceInvalidSequence(p, end, (err == utf8::internal::INVALID_LEAD), out);
+        run = p;
+      }
+    }
+    out.append(run, p - run);
+
+    if (p >= end)
+      throw JSONException("Unexpected EOF while reading string");
+    if (*p++ == '"') // String is over
+      return;
+
+    // Escape sequence
+    if (p >= end)
+      throw JSONException("Unexpected EOF while reading string");
+    switch (*p++) {
+      case '"':  out += '"';  break;
+      case '\\': out += '\\'; break;
+      case '/':  out += '/';  break;
+      case 'b':  out += '\b'; break;
+      case 'f':  out += '\f'; break;
+      case 'n':  out += '\n'; break;
+      case 'r':  out += '\r'; break;
+      case 't':  out += '\t'; break;
+      case 'u':  readUnicodeEscape(strStart, out); break;
+      default:
+        throw JSONException("Illegal escape sequence:" + std::string(1, p[-1]));
+    }
+  } while (true);
+}
+
+uint32_t JSONScanner::readHex4() {
+  uint32_t val = 0;
+  for (int i = 0; i < 4; ++i, ++p) {
+    if (p >= end || *p == '"')
+      throw JSONException("Expected exactly 4 hex digits after \\u");
+    val = (val << 4) + hexdigit_to_num(*p);
+  }
+  return val;
+}
+
+// Called with p just after "\u"
+void JSONScanner::readUnicodeEscape(const char *strStart, std::string &out) {
+  uint32_t codepoint = readHex4();
+  if (0xD800 <= codepoint && codepoint <= 0xDBFF) {
+    // Surrogate pair case
+    // Must have next 6 characters of the form: \uxxxx as well
+    if ((end - p) < 6 || p[0] != '\\' || p[1] != 'u')
+      throw JSONException("Missing surrogate pair in unicode sequence");
+    p += 2;
+    uint32_t second16bit = readHex4();
+    if (0xDC00 <= second16bit && second16bit <= 0xDFFF) {
+      /* valid second surrogate */
+      codepoint = ((codepoint - 0xD800) << 10) + (second16bit - 0xDC00) + 0x10000;
+    }
+    else {
+      // Invalid second surrogate
+      throw JSONException("Invalid second 16 bit value in surrogate pair: first 16 bit = " + boost::lexical_cast<std::string>(codepoint) + " and second 16 bit = " + boost::lexical_cast<std::string>(second16bit));
+    }
+  }
+  try {
+    utf8::append(codepoint, back_inserter(out));
+  }
+  catch(utf8::invalid_code_point &e) {
+    throw JSONException("Invalid UTF-8 code point found in text. Value = " + boost::lexical_cast<std::string>(codepoint) + ". Location = " + std::string(strStart, p) + "\nInternal message = " + e.what());
+  }
+}
+
+const char* JSONScanner::findStringSpecial(const char *p, const char *end) {
+  return scanPlainRun(p, end);
+}
+
+// Numbers are validated, and decoded, in a single pass. At most 19 significant
+// digits are accumulated in a 64 bit integer, which is then converted to a
+// double with a single (correctly rounded) floating point operation in
+// most of the cases. Rest of the cases (more digits, or very large/small
+// exponents) fall back to the standard library (which is slower, but correct).
+// Ref: http://www.json.org
+//      http://jsonlint.com/
+void JSONScanner::readNumber(Number &n) {
+  const char *start = p;
+  const char *q = p;
+  n.isReal = false; // By default the number is integer, unless set otherwise
+
+  const bool negative = (q < end && *q == '-');
+  if (negative)
+    ++q;
+
+  uint64_t mantissa = 0;
+  int sigDigits = 0; // number of significant digits in mantissa
+  bool truncated = false; // true if some non-zero digit did not fit in mantissa
+  int exp10 = 0; // value = mantissa * 10^exp10 (if not truncated)
+  bool valid = true;
+
+  // Integer part: either a single 0, or a sequence of digits without leading zeros
+  const char *intStart = q;
+  for (; q < end && isDigit(*q); ++q) {
+    if (sigDigits < 19) {
+      mantissa = mantissa * 10 + (*q - '0');
+      if (mantissa != 0)
+        ++sigDigits;
+    } else {
+      ++exp10;
+      truncated = truncated || (*q != '0');
+    }
+  }
+  const char *intEnd = q;
+  if (intEnd == intStart || (*intStart == '0' && intEnd - intStart > 1))
+    valid = false;
+
+  // Fraction
+  if (valid && q < end && *q == '.') {
+    n.isReal = true;
+    const char *fracStart = ++q;
+    for (; q < end && isDigit(*q); ++q) {
+      if (sigDigits < 19) {
+        mantissa = mantissa * 10 + (*q - '0');
+        --exp10;
+        if (mantissa != 0)
+          ++sigDigits;
+      } else {
+        truncated = truncated || (*q != '0');
+      }
+    }
+    if (q == fracStart)
+      valid = false;
+  }
+
+  // Exponent
+  if (valid && q < end && (*q == 'e' || *q == 'E')) {
+    n.isReal = true;
+    ++q;
+    bool negativeExp = false;
+    if (q < end && (*q == '+' || *q == '-'))
+      negativeExp = (*q++ == '-');
+    const char *expStart = q;
+    int e = 0;
+    for (; q < end && isDigit(*q); ++q) {
+      if (e < 100000) // Anything larger is an overflow/underflow anyway
+        e = e * 10 + (*q - '0');
+    }
+    if (q == expStart)
+      valid = false;
+    exp10 += (negativeExp) ? -e : e;
+  }
+
+  // The whole run of number-like characters must have been consumed
+  if (!valid || (q < end && isNumberChar(*q))) {
+    while (q < end && isNumberChar(*q))
+      ++q;
+    throw JSONException("Invalid JSON number: \"" + std::string(start, q) + "\". Unable to parse");
+  }
+  p = q;
+
+  if (!n.isReal) {
+    if (!truncated && exp10 == 0 && sigDigits < 19) {
+      n.i = (negative) ? -static_cast<int64_t>(mantissa) : static_cast<int64_t>(mantissa);
+      return;
+    }
+    // Might overflow: clamp to the range of int64_t (same as std::istream)
+    uint64_t u = 0;
+    const uint64_t limit = (negative) ? (1ULL << 63) : ((1ULL << 63) - 1);
+    bool overflow = false;
+    for (const char *c = intStart; c < intEnd && !overflow; ++c) {
+      const uint64_t digit = static_cast<uint64_t>(*c - '0');
+      if (u > (limit - digit) / 10)
+        overflow = true;
+      else
+        u = u * 10 + digit;
+    }
+    if (overflow)
+      u = limit;
+    n.i = (negative) ? static_cast<int64_t>(~u + 1) : static_cast<int64_t>(u);
+    return;
+  }
+
+  if (mantissa == 0 && !truncated) {
+    n.d = (negative) ? -0.0 : 0.0;
+    return;
+  }
+  if (truncated || !fastPathToDouble(mantissa, exp10, n.d)) {
+    std::istringstream stream(std::string(start, p));
+    stream.imbue(std::locale::classic());
+    stream >> n.d;
+    return;
+  }
+  if (negative)
+    n.d = -n.d;
+}
+
+bool JSONScanner::readBoolean() {
+  if ((end - p) >= 4 && memcmp(p, "true", 4) == 0) {
+    p += 4;
+    return true;
+  }
+  if ((end - p) >= 5 && memcmp(p, "false", 5) == 0) {
+    p += 5;
+    return false;
+  }
+  throw JSONException("Invalid Boolean value, expected exactly one of : 'true' or 'false'");
+}
+
+void JSONScanner::readNull() {
+  if ((end - p) < 4 || memcmp(p, "null", 4) != 0)
+    throw JSONException("Invalid JSON null, expected exactly: null");
+  p += 4;
+}
+
+// Skips a string (the next character must be the opening quote)
+void JSONScanner::skipString() {
+  ++p;
+  while (true) {
+    p = scanPlainRun(p, end);
+    if (p >= end)
+      throw JSONException("Unexpected EOF while parsing string");
+    if (*p == '"') {
+      ++p;
+      return;
+    }
+    // An escape sequence (the escaped character is skipped too, so that \" is
+    // not taken as end of the string), or a non-ASCII byte
+    p += (*p == '\\') ? 2 : 1;
+  }
+}
+
+void JSONScanner::skipValue() {
+  skipWhiteSpace();
+  if (p >= end)
+    throw JSONException("Unexpected EOF");
+  if (*p == '"') {
+    skipString();
+    return;
+  }
+  if (*p != '{' && *p != '[') {
+    // A number or literal: runs till the next delimiter
+    const char *start = p;
+    while (p < end && !isWhiteSpace(*p) && *p != ',' && *p != ':' && *p != ']' && *p != '}')
+      ++p;
+    if (p == start)
+      throw JSONException("Illegal JSON value. Cannot start with : " + std::string(1, *p));
+    return;
+  }
+  size_t depth = 0;
+  while (p < end) {
+    const char ch = *p;
+    if (ch == '"') {
+      skipString();
+      continue;
+    }
+    ++p;
+    if (ch == '{' || ch == '[')
+      ++depth;
+    else if ((ch == '}' || ch == ']') && --depth == 0)
+      return;
+  }
+  throw JSONException("Unexpected EOF");
+}
+
+void JSONScanner::indexContainer(std::vector<const char*> &bounds, std::vector<std::string> *keys) {
+  const bool isObject = (get() == '{');
+  const char closing = (isObject) ? '}' : ']';
+  skipWhiteSpace();
+  if (peek() == closing) {
+    ++p;
+    return;
+  }
+  std::string key;
+  while (true) {
+    if (isObject) {
+      if (peek() != '"')
+        throw JSONException("Expected start of a valid object key (string) at this location");
+      key.clear();
+      readString(key);
+      keys->push_back(key);
+      skipWhiteSpace();
+      if (get() != ':')
+        throw JSONException("Expected : after an object key");
+    }
+    skipWhiteSpace();
+    bounds.push_back(p);
+    skipValue();
+    bounds.push_back(p);
+    skipWhiteSpace();
+    const int ch = get();
+    if (ch == closing)
+      return;
+    if (ch != ',')
+      throw JSONException(std::string("Expected , or ") + closing + " while indexing " + ((isObject) ? "object" : "array"));
+    skipWhiteSpace();
+  }
+}
@@ -0,0 +1,152 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_SCANNER_H__
+#define __DXJSON_SCANNER_H__
+
+#include <cstddef>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/** @file */
+
+namespace dx {
+
+  /** @internal
+    * A forward-only scanner over a contiguous buffer holding serialized JSON.
+    * The scanner never copies its input: it advances a pointer through the
+    * buffer and decodes tokens (strings, numbers, literals) directly from it.
+    *
+    * Only the lexical part of JSON is handled here; the grammar (objects and
+    * arrays) is driven by the callers.
+    * All errors are reported by throwing JSONException.
+    */
+  class JSONScanner {
+  public:
+    /** A decoded JSON number. Exactly one of "i" (isReal == false) or "d"
+      * (isReal == true) is meaningful.
+      */
+    struct Number {
+      bool isReal;
+      int64_t i;
+      double d;
+    };
+
+    /** @param data Pointer to the first character of serialized JSON
+      * @param len Number of bytes available at "data"
+      */
+    JSONScanner(const char *data, size_t len): p(data), end(data + len) {}
+
+    /** Returns the next character (as an unsigned char) without consuming it,
+      * or EOF if the buffer is exhausted.
+      */
+    int peek() const { return (p < end) ? static_cast<unsigned char>(*p) : EOF; }
+
+    /** Consumes and returns the next character, or EOF if the buffer is exhausted */
+    int get() { return (p < end) ? static_cast<unsigned char>(*p++) : EOF; }
+
+    /** Steps back over the character returned by the last successful get() */
+    void unget() { --p; }
+
+    bool eof() const { return p >= end; }
+
+    /** Current read position inside the buffer */
+    const char* position() const { return p; }
+
+    /** Skips all whitespace characters (same set as isspace() in "C" locale) */
+    void skipWhiteSpace() {
+      while (p < end && isWhiteSpace(*p))
+        ++p;
+    }
+
+    /** Reads a JSON string. The next character must be the opening quote.
+      * All escape sequences are resolved and any invalid UTF-8 sequence is
+      * replaced by the replacement character (U+FFFD).
+      * @param out The decoded string is appended to it.
+      */
+    void readString(std::string &out);
+
+    /** Reads a JSON number. The next character must be a '-' or a digit.
+      * @param n Populated with the decoded value.
+      */
+    void readNumber(Number &n);
+
+    /** Reads exactly one of the literals "true" or "false" */
+    bool readBoolean();
+
+    /** Reads exactly the literal "null" */
+    void readNull();
+
+    /** Skips a complete value (and any whitespace before it) by matching
+      * brackets and string quotes only. Nothing inside the value is decoded
+      * or validated (e.g., mismatched bracket kinds, or an invalid number
+      * are not detected), so this is much cheaper than reading it: it is
+      * used to find boundaries of values which are parsed later, if at all.
+      * @throw JSONException If the value is not terminated before the end of
+      * the buffer.
+      */
+    void skipValue();
+
+    /** Locates the members/elements of the object/array starting at the
+      * current position (the next character must be '{' or '['), using
+      * skipValue() for each of them, and consumes the complete container.
+      * Object keys are decoded, and the structure (commas, colons, closing
+      * bracket) is checked, but the values themselves are not.
+      * @param bounds For each member/element, the position of its first
+      * character and the position past its last character are appended.
+      * @param keys For an object, the key of each member is appended (may be
+      * NULL for an array).
+      * @throw JSONException If the container is not well formed.
+      */
+    void indexContainer(std::vector<const char*> &bounds, std::vector<std::string> *keys);
+
+    static bool isWhiteSpace(char ch) {
+      return (ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t' || ch == '\v' || ch == '\f');
+    }
+
+    /** Characters which can appear in a JSON number */
+    static bool isNumberChar(char ch) {
+      return ((ch >= '0' && ch <= '9') || ch == '+' || ch == '-' || ch == '.' || ch == 'e' || ch == 'E');
+    }
+
+    /** Returns pointer to the first byte in [p, end) which is a '"', a '\\' or
+      * a non-ASCII byte, or end if there is none.
+      */
+    static const char* findStringSpecial(const char *p, const char *end);
+
+  private:
+    const char *p;
+    const char *end;
+
+    void skipString();
+    void readUnicodeEscape(const char *strStart, std::string &out);
+    uint32_t readHex4();
+  };
+
+  class JSON;
+}
+
+namespace JSON_Utility {
+  /** @internal
+    * Reads a JSON value from the scanner (defined in dxjson.cpp, and used by
+    * JSON::readFromBuffer()). Stops right after the value.
+    */
+  void ReadJSONValue(dx::JSONScanner &in, dx::JSON &j);
+}
+
+#endif
@@ -0,0 +1,148 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#include "writer.h"
+#include "numbers.h"
+
+// Same conditions as for the string scanner (see scanner.cpp)
+#if !defined(DXJSON_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define DXJSON_X86_SIMD 1
+#include <immintrin.h>
+#else
+#define DXJSON_X86_SIMD 0
+#endif
+
+using namespace dx;
+
+namespace {
+
+  // Bytes which must be escaped inside a JSON string: the quote, the
+  // backslash and control characters (U+0000 to U+001F)
+  inline bool needsEscape(char ch) {
+    return (ch == '"' || ch == '\\' || static_cast<unsigned char>(ch) < 0x20);
+  }
+
+  // Each of the find*() functions below returns a pointer to the first byte
+  // in [p, end) which must be escaped, or end if there is none.
+  typedef const char* (*FindFunction)(const char *p, const char *end);
+
+  const char* findScalar(const char *p, const char *end) {
+    while (p < end && !needsEscape(*p))
+      ++p;
+    return p;
+  }
+
+#if DXJSON_X86_SIMD
+  const char* findSSE2(const char *p, const char *end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i maxControl = _mm_set1_epi8(0x1f);
+    for (; end - p >= 16; p += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      // max(v, 0x1f) == 0x1f exactly for the (unsigned) bytes <= 0x1f
+      __m128i control = _mm_cmpeq_epi8(_mm_max_epu8(v, maxControl), maxControl);
+      __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+      int mask = _mm_movemask_epi8(_mm_or_si128(special, control));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+    }
+    return findScalar(p, end);
+  }
+
+  __attribute__((target("avx2")))
+  const char* findAVX2(const char *p, const char *end) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i maxControl = _mm256_set1_epi8(0x1f);
+    for (; end - p >= 32; p += 32) {
+      __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+      __m256i control = _mm256_cmpeq_epi8(_mm256_max_epu8(v, maxControl), maxControl);
+      __m256i special = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash));
+      unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(special, control)));
+      if (mask != 0)
+        return p + __builtin_ctz(mask);
+    }
+    return findSSE2(p, end);
+  }
+#endif
+
+  FindFunction selectFindFunction() {
+#if DXJSON_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return findAVX2;
+    return findSSE2;
+#else
+    return findScalar;
+#endif
+  }
+
+  inline const char* findEscape(const char *p, const char *end) {
+    static const FindFunction find = selectFindFunction();
+    return find(p, end);
+  }
+
+  // Appends the escape sequence for ch (which must satisfy needsEscape()).
+  // Control characters without a short form are written as \u00XX, with
+  // lower case hex digits.
+  void appendEscape(char ch, std::string &out) {
+    static const char HEX[] = "0123456789abcdef";
+    switch (ch) {
+      case '"': out.append("\\\"", 2); break;
+      case '\\': out.append("\\\\", 2); break;
+      case '\b': out.append("\\b", 2); break;
+      case '\f': out.append("\\f", 2); break;
+      case '\n': out.append("\\n", 2); break;
+      case '\r': out.append("\\r", 2); break;
+      case '\t': out.append("\\t", 2); break;
+      default: {
+        const char seq[6] = {'\\', 'u', '0', '0', HEX[(ch >> 4) & 0xf], HEX[ch & 0xf]};
+        out.append(seq, 6);
+      }
+    }
+  }
+}
+
+void JSONWriter::writeString(const char *s, size_t len) {
+  const char *end = s + len;
+  buf.push_back('"');
+  while (true) {
+    const char *run = findEscape(s, end);
+    buf.append(s, run - s);
+    if (run == end)
+      break;
+    appendEscape(*run, buf);
+    s = run + 1;
+  }
+  buf.push_back('"');
+}
+
+void JSONWriter::writeInteger(int64_t i) {
+  char tmp[NUMBER_BUFFER_SIZE];
+  buf.append(tmp, formatInteger(i, tmp));
+}
+
+void JSONWriter::writeReal(double d) {
+  char tmp[NUMBER_BUFFER_SIZE];
+  buf.append(tmp, formatReal(d, tmp));
+}
+
+void JSONWriter::flush() {
+  if (stream == NULL || buf.empty())
+    return;
+  stream->write(buf.data(), buf.size());
+  buf.clear();
+}
@@ -0,0 +1,82 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+#ifndef __DXJSON_WRITER_H__
+#define __DXJSON_WRITER_H__
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <stdint.h>
+
+/** @file */
+
+namespace dx {
+
+  /** @internal
+    * Serializes JSON tokens by appending them to a contiguous buffer. The
+    * buffer is either a std::string provided by the caller (which just keeps
+    * growing, so it can be reserve()d up front), or an internal one which is
+    * handed over to a std::ostream each time it grows past FLUSH_SIZE bytes.
+    *
+    * Strings are escaped a run at a time: the bytes between two characters
+    * which need escaping are appended with a single call.
+    */
+  class JSONWriter {
+  public:
+    /** Size at which output buffered for a std::ostream is written out */
+    static const size_t FLUSH_SIZE = 64 * 1024;
+
+    /** @param out Serialized output is appended to it */
+    explicit JSONWriter(std::string &out): buf(out), stream(NULL) {}
+
+    /** @param out Serialized output is written to it (call flush() when done) */
+    explicit JSONWriter(std::ostream &out): buf(local), stream(&out) {}
+
+    void put(char ch) { buf.push_back(ch); }
+    void write(const char *s, size_t len) { buf.append(s, len); }
+
+    /** Writes s as a JSON string: enclosed in quotes, with '"', '\\' and
+      * control characters escaped. Other bytes are copied verbatim.
+      */
+    void writeString(const char *s, size_t len);
+    void writeString(const std::string &s) { writeString(s.data(), s.size()); }
+
+    void writeInteger(int64_t i);
+    void writeReal(double d);
+
+    /** Writes out the buffered output if it has grown past FLUSH_SIZE (no-op
+      * when writing to a std::string). Called between elements of containers.
+      */
+    void checkpoint() {
+      if (stream != NULL && buf.size() >= FLUSH_SIZE)
+        flush();
+    }
+
+    /** Writes out all buffered output (no-op when writing to a std::string) */
+    void flush();
+
+  private:
+    std::string local; // Buffer used when writing to a std::ostream
+    std::string &buf;
+    std::ostream *stream;
+
+    JSONWriter(const JSONWriter&);
+    JSONWriter& operator =(const JSONWriter&);
+  };
+}
+
+#endif
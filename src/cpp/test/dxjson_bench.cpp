@@ -0,0 +1,283 @@
+// Copyright (C) 2013-2016 DNAnexus, Inc.
+//
+// This file is part of dx-toolkit (DNAnexus platform client libraries).
+//
+//   Licensed under the Apache License, Version 2.0 (the "License"); you may
+//   not use this file except in compliance with the License. You may obtain a
+//   copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+//   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+//   License for the specific language governing permissions and limitations
+//   under the License.
+
+// Benchmark suite for dxjson (not a gtest test: timings are not asserted).
+//
+// For each corpus, every operation below is timed (throughput over the size
+// of the serialized corpus), and run once more with allocation accounting:
+// the number of allocations made by one run, and the peak number of bytes
+// allocated at any point during that run (on top of what was live before it).
+//
+// Corpora:
+// - pass1.json, json-test-suite.json: from the test resources directory
+//   ($DNANEXUS_HOME/src/cpp/test/resources, unless --resources is given).
+// - findDataObjects: a synthetic /system/findDataObjects response, with
+//   describe output for each result (--results).
+// - describe: a synthetic file describe hash, with upload parts (--parts).
+//
+// Usage: dxjson_bench [--results N (default: 20000)] [--parts N (default: 10000)]
+//                     [--min-time SECONDS (default: 0.5)] [--resources DIR]
+//                     [--corpus NAME (only run corpora whose name contains NAME)]
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+#include <boost/lexical_cast.hpp>
+#include "dxjson.h"
+#include "document.h"
+#include "reader.h"
+
+using namespace std;
+using namespace dx;
+
+// Allocation accounting: each block is prefixed by its size, so that the
+// number of live bytes (and its peak) can be tracked.
+namespace {
+  const size_t ALLOC_HEADER = 16; // Keeps the returned pointers 16-byte aligned
+
+  atomic<size_t> allocCount(0);
+  atomic<size_t> liveBytes(0);
+  atomic<size_t> peakBytes(0);
+
+  void* countedAlloc(size_t n) {
+    char *p = static_cast<char*>(malloc(n + ALLOC_HEADER));
+    if (p == NULL)
+      throw bad_alloc();
+    *reinterpret_cast<size_t*>(p) = n;
+    allocCount.fetch_add(1, memory_order_relaxed);
+    const size_t live = liveBytes.fetch_add(n, memory_order_relaxed) + n;
+    size_t peak = peakBytes.load(memory_order_relaxed);
+    while (live > peak && !peakBytes.compare_exchange_weak(peak, live, memory_order_relaxed)) { }
+    return p + ALLOC_HEADER;
+  }
+
+  void countedFree(void *ptr) {
+    if (ptr == NULL)
+      return;
+    char *p = static_cast<char*>(ptr) - ALLOC_HEADER;
+    liveBytes.fetch_sub(*reinterpret_cast<size_t*>(p), memory_order_relaxed);
+    free(p);
+  }
+}
+
+void* operator new(size_t n) { return countedAlloc(n); }
+void* operator new[](size_t n) { return countedAlloc(n); }
+void operator delete(void *p) noexcept { countedFree(p); }
+void operator delete[](void *p) noexcept { countedFree(p); }
+
+namespace {
+
+  struct Options {
+    size_t results;
+    size_t parts;
+    double minTime;
+    string resourceDir;
+    string corpus;
+  };
+
+  struct Corpus {
+    string name;
+    string text;
+  };
+
+  string makeFindDataObjectsResponse(size_t results) {
+    string out = "{\"results\": [";
+    for (size_t i = 0; i < results; ++i) {
+      const string n = boost::lexical_cast<string>(i);
+      out += (i > 0) ? ", " : "";
+      out += "{\"project\": \"project-B3X8bjBqqBk1y9yYfbYx3k1f\", \"id\": \"file-B3X8bjBqqBk1y9yYfbY" + n + "\", "
+             "\"describe\": {\"id\": \"file-B3X8bjBqqBk1y9yYfbY" + n + "\", \"class\": \"file\", "
+             "\"name\": \"sample_" + n + ".fastq.gz\", \"state\": \"closed\", \"hidden\": false, "
+             "\"size\": " + boost::lexical_cast<string>(1000000 + 37 * i) + ", \"created\": 1389650373000, "
+             "\"media\": \"application/x-gzip\", \"sponsored\": false, \"types\": [], \"tags\": [\"reads\", \"lane" + n + "\"], "
+             "\"properties\": {\"quality\": \"" + boost::lexical_cast<string>(0.5 + i / 1e6) + "\"}, "
+             "\"details\": {\"score\": " + boost::lexical_cast<string>(i * 0.25) + ", \"paired\": true, \"mate\": null}}}";
+    }
+    out += "], \"next\": null}";
+    return out;
+  }
+
+  string makeFileDescribe(size_t parts) {
+    string out = "{\"id\": \"file-B3X8bjBqqBk1y9yYfbYx3k1f\", \"project\": \"project-B3X8bjBqqBk1y9yYfbYx3k1f\", "
+                 "\"class\": \"file\", \"name\": \"reads.bam\", \"state\": \"closing\", \"folder\": \"/\", "
+                 "\"hidden\": false, \"types\": [], \"tags\": [], \"properties\": {}, \"details\": {}, "
+                 "\"media\": \"application/octet-stream\", \"created\": 1389650373000, \"modified\": 1389650379000, "
+                 "\"parts\": {";
+    for (size_t i = 1; i <= parts; ++i) {
+      const string n = boost::lexical_cast<string>(i);
+      out += (i > 1) ? ", " : "";
+      out += "\"" + n + "\": {\"state\": \"complete\", \"size\": 104857600, \"md5\": \"" +
+             string(32 - n.size(), 'a') + n + "\"}";
+    }
+    out += "}}";
+    return out;
+  }
+
+  bool loadResource(const Options &opts, const string &file, vector<Corpus> &corpora) {
+    ifstream ifs((opts.resourceDir + "/" + file).c_str(), ios::in | ios::binary);
+    if (!ifs) {
+      cerr << "Warning: skipping " << file << " (not found in " << opts.resourceDir << ")" << endl;
+      return false;
+    }
+    Corpus c;
+    c.name = file;
+    c.text.assign(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+    corpora.push_back(c);
+    return true;
+  }
+
+  typedef function<void()> Op;
+
+  // Runs op for at least minTime seconds (after a warm-up run, which is the
+  // one used for allocation accounting), and prints the results.
+  void run(const string &name, const Corpus &corpus, double minTime, Op op) {
+    const size_t count0 = allocCount.load();
+    const size_t live0 = liveBytes.load();
+    peakBytes.store(live0);
+    op();
+    const size_t allocs = allocCount.load() - count0;
+    const size_t peak = peakBytes.load() - live0;
+
+    size_t reps = 0;
+    double elapsed = 0;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    do {
+      op();
+      ++reps;
+      elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    } while (elapsed < minTime);
+
+    const double mb = corpus.text.size() / 1e6;
+    cout << left << setw(24) << corpus.name << setw(12) << name << right << fixed
+         << setprecision(3) << setw(12) << (elapsed / reps) * 1e3
+         << setprecision(2) << setw(16) << (mb * reps) / elapsed
+         << setw(12) << allocs
+         << setprecision(1) << setw(14) << peak / 1024.0 << endl;
+  }
+
+  // Returns the last scalar (or empty container) in j, in iteration order
+  JSON& lastLeaf(JSON &j) {
+    if (j.type() == JSON_ARRAY && j.size() > 0)
+      return lastLeaf(j[j.size() - 1]);
+    if (j.type() == JSON_OBJECT && j.size() > 0) {
+      JSON::object_iterator last;
+      for (JSON::object_iterator it = j.object_begin(); it != j.object_end(); ++it)
+        last = it;
+      return lastLeaf(last->second);
+    }
+    return j;
+  }
+
+  // Returns false if the round trip (parse/serialize) does not preserve the
+  // value, or comparisons/hashes are not consistent
+  bool benchmark(const Corpus &c, double minTime) {
+    JSON parsed;
+    run("parse", c, minTime, [&]() { parsed = JSON::parse(c.text); });
+    run("parallel", c, minTime, [&]() { parsed = JSON::parseParallel(c.text); });
+    run("lazy", c, minTime, [&]() { JSON lazy = JSON::parseLazy(c.text); lazy.type(); });
+    run("document", c, minTime, [&]() { JSONDocument doc; doc.parse(c.text); });
+    run("reader", c, minTime, [&]() {
+      JSONReader r(c.text.data(), c.text.size());
+      while (r.next()) { }
+    });
+    JSON copy;
+    run("copy", c, minTime, [&]() { copy = parsed; });
+    bool equal = false;
+    run("compare", c, minTime, [&]() { equal = (copy == parsed); });
+
+    size_t h = 0;
+    run("hash", c, minTime, [&]() { JSON::invalidateHashes(); h = parsed.hash(); });
+    // Values which differ only in their last leaf: compared as such, and
+    // after hashing them (when cached hashes tell them apart)
+    JSON changed = parsed;
+    JSON &leaf = lastLeaf(changed);
+    leaf = (leaf.type() == JSON_NULL) ? JSON(0) : JSON(JSON_NULL);
+    bool different = false;
+    run("diff", c, minTime, [&]() { JSON::invalidateHashes(); different = (changed != parsed); });
+    changed.hash();
+    parsed.hash();
+    run("diff-hashed", c, minTime, [&]() { different = (changed != parsed); });
+    equal = equal && different && (h == copy.hash());
+    string serialized;
+    run("serialize", c, minTime, [&]() { serialized = parsed.toString(); });
+    return (equal && JSON::parse(serialized) == parsed);
+  }
+
+  void usage() {
+    cerr << "Usage: dxjson_bench [--results N] [--parts N] [--min-time SECONDS] [--resources DIR] [--corpus NAME]" << endl;
+    exit(2);
+  }
+}
+
+int main(int argc, char **argv) {
+  Options opts;
+  opts.results = 20000;
+  opts.parts = 10000;
+  opts.minTime = 0.5;
+  if (getenv("DNANEXUS_HOME") != NULL)
+    opts.resourceDir = string(getenv("DNANEXUS_HOME")) + "/src/cpp/test/resources";
+  for (int i = 1; i < argc; ++i) {
+    const string arg = argv[i];
+    if (i + 1 == argc)
+      usage();
+    const string val = argv[++i];
+    try {
+      if (arg == "--results")
+        opts.results = boost::lexical_cast<size_t>(val);
+      else if (arg == "--parts")
+        opts.parts = boost::lexical_cast<size_t>(val);
+      else if (arg == "--min-time")
+        opts.minTime = boost::lexical_cast<double>(val);
+      else if (arg == "--resources")
+        opts.resourceDir = val;
+      else if (arg == "--corpus")
+        opts.corpus = val;
+      else
+        usage();
+    } catch (boost::bad_lexical_cast &) {
+      usage();
+    }
+  }
+
+  vector<Corpus> corpora;
+  loadResource(opts, "pass1.json", corpora);
+  loadResource(opts, "json-test-suite.json", corpora);
+  Corpus fdo = {"findDataObjects", makeFindDataObjectsResponse(opts.results)};
+  corpora.push_back(fdo);
+  Corpus describe = {"describe", makeFileDescribe(opts.parts)};
+  corpora.push_back(describe);
+
+  cout << left << setw(24) << "corpus" << setw(12) << "operation" << right
+       << setw(12) << "ms/run" << setw(16) << "MB/s" << setw(12) << "allocs" << setw(14) << "peak KB" << endl;
+  int ret = 0;
+  for (size_t i = 0; i < corpora.size(); ++i) {
+    if (corpora[i].name.find(opts.corpus) == string::npos)
+      continue;
+    if (!benchmark(corpora[i], opts.minTime)) {
+      cerr << "Error: round trip failed for " << corpora[i].name << endl;
+      ret = 1;
+    }
+  }
+  return ret;
+}
@@ -993,6 +993,36 @@ TEST_F(DXFileTest, WriteReadFile) {
   ASSERT_EQ(foostr.substr(1), string(stored, same_dxfile.gcount()));
 }
 
+TEST_F(DXFileTest, LinearQuery) {
+  // Bytes differ from one chunk to the next, so that a chunk out of order
+  // (or from the wrong range) is caught
+  string data(300 * 1000 + 7, '\0');
+  for (size_t i = 0; i < data.size(); ++i)
+    data[i] = (char) (i % 251);
+  dxfile = DXFile::newDXFile();
+  dxfile.write(data);
+  dxfile.close(true);
+
+  // Small chunks, with more requests in flight (8) than chunks kept (4)
+  const int64_t start = 1001, num_bytes = data.size() - start - 5;
+  string chunk, read;
+  dxfile.startLinearQuery(start, num_bytes, 16 * 1000, 4, 8);
+  while (dxfile.getNextChunk(chunk))
+    read += chunk;
+  ASSERT_EQ(read, data.substr(start, num_bytes));
+
+  // Stopped with requests in flight (which are cancelled), and restarted
+  // where it stopped
+  read.clear();
+  dxfile.startLinearQuery(0, -1, 10 * 1000, 4, 8);
+  ASSERT_TRUE(dxfile.getNextChunk(read));
+  dxfile.stopLinearQuery();
+  dxfile.startLinearQuery(read.size(), -1, 10 * 1000, 4, 8);
+  while (dxfile.getNextChunk(chunk))
+    read += chunk;
+  ASSERT_EQ(read, data);
+}
+
 TEST(DXSystemTest, findDataObjects) {
   // We skip running of findDataObjects test in automated test suits (jenkins)
   // because these tests rely heavily on server & client clock being in total sync
@@ -17,7 +17,15 @@
 #include <gtest/gtest.h>
 #include <iostream>
 #include "dxjson.h"
+#include "reader.h"
+#include "document.h"
+#include "pointer.h"
+#include "cbor.h"
+#include "mapped.h"
+#include "lazy.h"
+#include "bind.h"
 #include <fstream>
+#include <unordered_set>
 using namespace std;
 using namespace dx;
 
@@ -677,7 +685,20 @@ TEST(JSONTest, Numbers) {
 }
 
 TEST(JSONTest, TestPerformance) {
-  // TODO
+  // Throughput, allocation counts and peak memory are measured by dxjson_bench
+  // (see dxjson_bench.cpp), since timings cannot be asserted reliably here.
+  // This only checks that a large document survives a round trip.
+  JSON arr(JSON_ARRAY);
+  for (int i = 0; i < 100000; ++i) {
+    JSON part(JSON_OBJECT);
+    part["state"] = "complete";
+    part["size"] = i;
+    part["ratio"] = i / 7.0;
+    arr.push_back(part);
+  }
+  const std::string str = arr.toString();
+  ASSERT_EQ(JSON::parse(str), arr);
+  ASSERT_EQ(JSON::parse(str).toString(), str);
 }
 
 TEST(JSONTest, Iterators) {
@@ -829,6 +850,1172 @@ TEST(JSONTest, UnableToCreateKeysInConstJSON) {
   //j3_c[0] = 12;
 }
 
+TEST(JSONTest, ParseFromBuffer) {
+  // Buffer need not be NUL terminated, and only "len" bytes should be looked at
+  const char buf[] = {'[', '1', ',', ' ', '"', 'a', '"', ']', '9', '9'};
+  JSON j1 = JSON::parse(buf, 8);
+  ASSERT_EQ(j1, JSON::parse("[1, \"a\"]"));
+  ASSERT_JSONEXCEPTION(JSON::parse(buf, 7));
+  ASSERT_JSONEXCEPTION(JSON::parse(buf, 0));
+  ASSERT_EQ(JSON::parse(buf + 1, 1), 1);
+  ASSERT_EQ(JSON::parse(buf + 8, 2), 99);
+
+  // Trailing content is ignored (same as read())
+  ASSERT_EQ(JSON::parse("{\"hello\": 12}blah"), JSON::parse("{\"hello\": 12}"));
+  ASSERT_EQ(JSON::parse("truenull"), JSON(true));
+  ASSERT_JSONEXCEPTION(JSON::parse("truHtrue"));
+  ASSERT_JSONEXCEPTION(JSON::parse("nul"));
+  ASSERT_JSONEXCEPTION(JSON::parse("{\"a\": 1"));
+  ASSERT_JSONEXCEPTION(JSON::parse("{\"a\" 1}"));
+  ASSERT_JSONEXCEPTION(JSON::parse("{\"a\": 1 \"b\": 2}"));
+  ASSERT_JSONEXCEPTION(JSON::parse("[1, 2"));
+  ASSERT_JSONEXCEPTION(JSON::parse("[1,]"));
+  ASSERT_JSONEXCEPTION(JSON::parse("\"abc"));
+  ASSERT_JSONEXCEPTION(JSON::parse("\"\\u00"));
+
+  // A sequence truncated by end of string is replaced too
+  std::string temp = "\"a";
+  temp.push_back(char(0xe0));
+  temp += "\"";
+  ASSERT_EQ(JSON::parse(temp).get<std::string>(), "a�");
+
+  // Parsing from a buffer and from a stream must give same results
+  std::fstream ifs;
+  ifs.open(getResourceDir() + "/pass1.json", std::fstream::in);
+  ASSERT_FALSE(ifs.fail());
+  std::string str((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  ifs.close();
+  std::stringstream ss(str);
+  JSON j2;
+  j2.read(ss);
+  JSON j3 = JSON::parse(str.data(), str.size());
+  ASSERT_EQ(j2, j3);
+  ASSERT_EQ(j2.toString(), j3.toString());
+}
+
+TEST(JSONTest, LongStrings) {
+  // Strings are scanned several bytes at a time, so place escapes, multi-byte
+  // characters and invalid UTF-8 sequences at all possible offsets
+  const std::string euro = "\xe2\x82\xac";
+  for (size_t offset = 0; offset < 70; ++offset) {
+    std::string pad(offset, 'x');
+
+    ASSERT_EQ(JSON::parse("\"" + pad + "\"").get<std::string>(), pad);
+    ASSERT_EQ(JSON::parse("\"" + pad + "\\\"" + pad + "\\n\"").get<std::string>(), pad + "\"" + pad + "\n");
+    ASSERT_EQ(JSON::parse("\"" + pad + euro + pad + "\\\\" + euro + "\"").get<std::string>(), pad + euro + pad + "\\" + euro);
+    ASSERT_EQ(JSON::parse("[\"" + pad + "\", \"" + pad + "\"]")[1].get<std::string>(), pad);
+
+    std::string invalid = "\"" + pad + "\xc0\x8a" + pad + "\xe2\x82\"";
+    ASSERT_EQ(JSON::parse(invalid).get<std::string>(), pad + "\ufffd" + pad + "\ufffd");
+    invalid = "\"" + pad + "\x80" + euro + "\x80\"";
+    ASSERT_EQ(JSON::parse(invalid).get<std::string>(), pad + "\ufffd" + euro + "\ufffd");
+
+    ASSERT_JSONEXCEPTION(JSON::parse("\"" + pad + euro + pad));
+    ASSERT_JSONEXCEPTION(JSON::parse("\"" + pad + "\\"));
+  }
+
+  std::string big(1 << 20, 'a');
+  for (size_t i = 0; i < big.size(); i += 4093)
+    big[i] = '\n';
+  JSON j1 = big;
+  ASSERT_EQ(JSON::parse(j1.toString()), j1);
+}
+
+TEST(JSONTest, PullReader) {
+  const std::string str = "{\"a\": [1, 2.5, \"x\", true, null], \"b\": {\"c\": {}}, \"d\": []}";
+  JSONReader r(str.data(), str.size());
+  ASSERT_EQ(r.event(), JSON_EVENT_NONE);
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.event(), JSON_EVENT_START_OBJECT);
+  ASSERT_EQ(r.type(), JSON_OBJECT);
+  ASSERT_EQ(r.depth(), 1u);
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.event(), JSON_EVENT_KEY);
+  ASSERT_EQ(r.key(), "a");
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.event(), JSON_EVENT_START_ARRAY);
+  ASSERT_EQ(r.depth(), 2u);
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.type(), JSON_INTEGER);
+  ASSERT_EQ(r.getInteger(), 1);
+  ASSERT_JSONEXCEPTION(r.getReal());
+  ASSERT_JSONEXCEPTION(r.getString());
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.type(), JSON_REAL);
+  ASSERT_EQ(r.getReal(), 2.5);
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.getString(), "x");
+  ASSERT_TRUE(r.next());
+  ASSERT_TRUE(r.getBoolean());
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.type(), JSON_NULL);
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.event(), JSON_EVENT_END_ARRAY);
+  ASSERT_EQ(r.depth(), 1u);
+
+  // Skipping a key skips its whole value
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.key(), "b");
+  r.skip();
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.key(), "d");
+  ASSERT_EQ(r.readValue(), JSON(JSON_ARRAY));
+  ASSERT_TRUE(r.next());
+  ASSERT_EQ(r.event(), JSON_EVENT_END_OBJECT);
+  ASSERT_EQ(r.depth(), 0u);
+  ASSERT_FALSE(r.next());
+  ASSERT_EQ(r.event(), JSON_EVENT_END);
+
+  // readValue() materializes just the current value
+  JSONReader r2(str.data(), str.size());
+  r2.next();
+  r2.next();
+  r2.skip();
+  r2.next();
+  ASSERT_EQ(r2.readValue(), JSON::parse("{\"c\": {}}"));
+  r2.next();
+  ASSERT_EQ(r2.key(), "d");
+
+  // Top level scalar values
+  JSONReader r3("  12  ", 6);
+  ASSERT_TRUE(r3.next());
+  ASSERT_EQ(r3.getInteger(), 12);
+  ASSERT_FALSE(r3.next());
+
+  // Building JSON from events must give same result as parsing it
+  std::fstream ifs;
+  ifs.open(getResourceDir() + "/pass1.json", std::fstream::in);
+  ASSERT_FALSE(ifs.fail());
+  std::string pass1((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  ifs.close();
+  JSONBuilder builder;
+  JSONReader::parse(pass1.data(), pass1.size(), builder);
+  ASSERT_EQ(builder.result(), JSON::parse(pass1));
+  JSONReader r4(pass1.data(), pass1.size());
+  ASSERT_TRUE(r4.next());
+  ASSERT_EQ(r4.readValue(), JSON::parse(pass1));
+
+  // Invalid JSON
+  const char *invalid[] = {"", "{\"a\": 1", "{\"a\" 1}", "{\"a\": 1 \"b\": 2}", "[1, 2", "[1,]", "[1 2]", "{1: 2}", "\"abc", "nul"};
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    JSONReader r5(invalid[i], strlen(invalid[i]));
+    ASSERT_JSONEXCEPTION(while (r5.next()));
+  }
+}
+
+TEST(JSONTest, NumberRoundTrip) {
+  // Reals are always written such that they are read back as reals
+  ASSERT_EQ(JSON(1.0).toString(), "1.0");
+  ASSERT_EQ(JSON(-0.0).toString(), "-0.0");
+  ASSERT_EQ(JSON(100.0).toString(), "100.0");
+  ASSERT_EQ(JSON(0.1).toString(), "0.1");
+  ASSERT_EQ(JSON(1.5e-7).toString(), "1.5e-7");
+  ASSERT_EQ(JSON(1e300).toString(), "1e+300");
+  ASSERT_EQ(JSON(0.1 + 0.2).toString(), "0.30000000000000004");
+  ASSERT_EQ(JSON::parse(JSON(1.0).toString()).type(), JSON_REAL);
+
+  ASSERT_EQ(JSON(0).toString(), "0");
+  ASSERT_EQ(JSON(std::numeric_limits<int64_t>::max()).toString(), "9223372036854775807");
+  ASSERT_EQ(JSON(std::numeric_limits<int64_t>::min()).toString(), "-9223372036854775808");
+  ASSERT_EQ(JSON::parse("9223372036854775807").get<int64_t>(), std::numeric_limits<int64_t>::max());
+  ASSERT_EQ(JSON::parse("-9223372036854775808").get<int64_t>(), std::numeric_limits<int64_t>::min());
+  // Integers which do not fit in int64_t are clamped
+  ASSERT_EQ(JSON::parse("123456789012345678901234567890").get<int64_t>(), std::numeric_limits<int64_t>::max());
+  ASSERT_EQ(JSON::parse("-9223372036854775809").get<int64_t>(), std::numeric_limits<int64_t>::min());
+
+  // Correct rounding, including the cases which need more than 19 significant digits
+  ASSERT_EQ(JSON::parse("9007199254740993.0").get<double>(), 9007199254740992.0);
+  ASSERT_EQ(JSON::parse("9007199254740993.00000000000000000001").get<double>(), 9007199254740994.0);
+  ASSERT_EQ(JSON::parse("2.2250738585072011e-308").get<double>(), 2.2250738585072011e-308);
+  ASSERT_EQ(JSON::parse("4.9406564584124654e-324").get<double>(), std::numeric_limits<double>::denorm_min());
+  ASSERT_EQ(JSON::parse("1.7976931348623157e308").get<double>(), std::numeric_limits<double>::max());
+  ASSERT_EQ(JSON::parse("0.000000000000000000000000000001234").get<double>(), 1.234e-30);
+  ASSERT_EQ(JSON::parse("12e30").get<double>(), 1.2e31);
+
+  // Every double must be read back exactly as it was written
+  uint64_t bits = 0x123456789abcdefULL;
+  for (int i = 0; i < 100000; ++i) {
+    bits = bits * 6364136223846793005ULL + 1442695040888963407ULL;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    if (!boost::math::isfinite(d))
+      continue;
+    JSON j = d;
+    double back = JSON::parse(j.toString()).get<double>();
+    ASSERT_EQ(memcmp(&d, &back, sizeof(d)), 0) << j.toString();
+  }
+}
+
+TEST(JSONTest, ArenaDocument) {
+  JSONDocument doc;
+  ASSERT_EQ(doc.type(), JSON_UNDEFINED);
+  const std::string str = "{\"state\": \"open\", \"size\": 12, \"parts\": {\"2\": {\"size\": 5, \"md5\": \"b\"}, \"1\": {\"size\": 7, \"md5\": \"a\"}},"
+                          " \"tags\": [\"x\", 1.5, true, null, []], \"dup\": 1, \"dup\": 2, \"nul\": \"a\\u0000b\"}";
+  doc.parse(str);
+  ASSERT_EQ(doc.type(), JSON_OBJECT);
+  ASSERT_EQ(doc.root().size(), 6u);
+  ASSERT_TRUE(doc.has("state"));
+  ASSERT_FALSE(doc.has("stat"));
+  ASSERT_EQ(doc["state"].get<std::string>(), "open");
+  ASSERT_EQ(doc["size"].get<int64_t>(), 12);
+  ASSERT_EQ(doc["size"].get<double>(), 12.0);
+  ASSERT_EQ(doc["parts"]["1"]["md5"].get<std::string>(), "a");
+  ASSERT_EQ(doc["tags"].size(), 5u);
+  ASSERT_TRUE(doc["tags"].has(4));
+  ASSERT_FALSE(doc["tags"].has(5));
+  ASSERT_EQ(doc["tags"][1].get<double>(), 1.5);
+  ASSERT_TRUE(doc["tags"][2].get<bool>());
+  ASSERT_EQ(doc["tags"][3].type(), JSON_NULL);
+  ASSERT_EQ(doc["tags"][4].size(), 0u);
+  ASSERT_EQ(doc["dup"].get<int>(), 2); // last one wins (same as JSON)
+  ASSERT_EQ(doc["nul"].size(), 3u);
+  ASSERT_EQ(doc["nul"].get<std::string>(), std::string("a\0b", 3));
+  ASSERT_EQ(strcmp(doc["state"].c_str(), "open"), 0);
+
+  ASSERT_JSONEXCEPTION(doc["missing"]);
+  ASSERT_JSONEXCEPTION(doc["tags"][5]);
+  ASSERT_JSONEXCEPTION(doc["tags"]["x"]);
+  ASSERT_JSONEXCEPTION(doc["size"].get<std::string>());
+  ASSERT_JSONEXCEPTION(doc["state"].get<int>());
+  ASSERT_JSONEXCEPTION(doc["state"].object_begin());
+
+  // Members are iterated in order of keys
+  JSON j = JSON::parse(str);
+  ASSERT_EQ(doc.root().toJSON(), j);
+  std::string prevKey;
+  int64_t total = 0;
+  for (JSONNode::const_object_iterator it = doc["parts"].object_begin(); it != doc["parts"].object_end(); ++it) {
+    ASSERT_LT(prevKey, it->first);
+    ASSERT_EQ(it->second.toJSON(), j["parts"][it->first]);
+    prevKey = it->first;
+    total += it->second["size"].get<int64_t>();
+  }
+  ASSERT_EQ(total, 12);
+  size_t count = 0;
+  for (JSONNode::const_array_iterator it = doc["tags"].array_begin(); it != doc["tags"].array_end(); ++it, ++count)
+    ASSERT_EQ((*it).toJSON(), j["tags"][count]);
+  ASSERT_EQ(count, 5u);
+
+  // Parsing again replaces previous contents
+  std::fstream ifs;
+  ifs.open(getResourceDir() + "/pass1.json", std::fstream::in);
+  ASSERT_FALSE(ifs.fail());
+  std::string pass1((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  ifs.close();
+  doc.parse(pass1);
+  ASSERT_EQ(doc.root().toJSON(), JSON::parse(pass1));
+  doc.parse("\"abc\"");
+  ASSERT_EQ(doc.root().get<std::string>(), "abc");
+
+  // A large document
+  std::string big = "[";
+  for (int i = 0; i < 100000; ++i)
+    big += (i ? ",{\"id\":" : "{\"id\":") + boost::lexical_cast<std::string>(i) + ",\"name\":\"item\"}";
+  big += "]";
+  doc.parse(big);
+  ASSERT_EQ(doc.root().size(), 100000u);
+  ASSERT_EQ(doc[99999]["id"].get<int>(), 99999);
+  ASSERT_EQ(doc.root().toJSON(), JSON::parse(big));
+
+  ASSERT_JSONEXCEPTION(doc.parse("{\"a\": [1, 2}"));
+  ASSERT_JSONEXCEPTION(doc.parse(""));
+}
+
+TEST(JSONTest, ObjectStorage) {
+  // Enough keys for lookups to go through the hash index (with DXJSON_FLAT_OBJECTS)
+  JSON j1(JSON_OBJECT), j2(JSON_OBJECT);
+  for (int i = 0; i < 1000; ++i) {
+    j1["key" + boost::lexical_cast<std::string>(i)] = i;
+    j2["key" + boost::lexical_cast<std::string>(999 - i)] = 999 - i;
+  }
+  ASSERT_EQ(j1.size(), 1000u);
+  ASSERT_EQ(j1, j2); // Order of insertion does not matter
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(j1.has("key" + boost::lexical_cast<std::string>(i)));
+    ASSERT_EQ(j1["key" + boost::lexical_cast<std::string>(i)], i);
+  }
+  ASSERT_FALSE(j1.has("key1000"));
+
+  for (int i = 0; i < 1000; i += 2)
+    j1.erase("key" + boost::lexical_cast<std::string>(i));
+  ASSERT_EQ(j1.size(), 500u);
+  ASSERT_NE(j1, j2);
+  for (int i = 0; i < 1000; ++i)
+    ASSERT_EQ(j1.has("key" + boost::lexical_cast<std::string>(i)), (i % 2 == 1));
+  ASSERT_JSONEXCEPTION(j1.erase("key0"));
+  ASSERT_EQ(JSON::parse(j1.toString()), j1);
+
+  // Small objects
+  JSON j3 = JSON::parse("{\"b\": 1, \"a\": {\"y\": 2, \"x\": 3}, \"c\": [1]}");
+  ASSERT_EQ(j3["a"]["x"], 3);
+  j3.erase("b");
+  ASSERT_EQ(j3, JSON::parse("{\"c\": [1], \"a\": {\"x\": 3, \"y\": 2}}"));
+  std::map<std::string, int> m;
+  m["z"] = 1;
+  m["w"] = 2;
+  JSON j4 = m;
+  ASSERT_EQ(j4.size(), 2u);
+  ASSERT_EQ(j4["w"], 2);
+
+#ifdef DXJSON_FLAT_OBJECTS
+  // Insertion order is preserved
+  ASSERT_EQ(j3.toString(), "{\"a\":{\"y\":2,\"x\":3},\"c\":[1]}");
+  ASSERT_EQ(j2.object_begin()->first, "key999");
+#else
+  ASSERT_EQ(j3.toString(), "{\"a\":{\"x\":3,\"y\":2},\"c\":[1]}");
+  ASSERT_EQ(j2.object_begin()->first, "key0");
+#endif
+}
+
+TEST(JSONTest, MoveSemantics) {
+  JSON j1 = JSON::parse("{\"a\": [1, 2, 3], \"b\": \"str\"}");
+  const JSON copy = j1;
+  JSON j2(std::move(j1));
+  ASSERT_EQ(j1.type(), JSON_UNDEFINED);
+  ASSERT_EQ(j2, copy);
+
+  j1 = std::move(j2);
+  ASSERT_EQ(j2.type(), JSON_UNDEFINED);
+  ASSERT_EQ(j1, copy);
+  j1 = std::move(j1); // Self move-assignment is a no-op
+  ASSERT_EQ(j1, copy);
+
+  // A value can be replaced by one of its own members, or elements
+  JSON parent = JSON::parse("{\"a\": {\"b\": [1, {\"c\": \"str\"}]}, \"d\": 2}");
+  parent = std::move(parent["a"]);
+  ASSERT_EQ(parent, JSON::parse("{\"b\": [1, {\"c\": \"str\"}]}"));
+  parent = std::move(parent["b"]);
+  ASSERT_EQ(parent, JSON::parse("[1, {\"c\": \"str\"}]"));
+  parent = std::move(parent[1]);
+  ASSERT_EQ(parent, JSON::parse("{\"c\": \"str\"}"));
+  parent = JSON::parse("[[1, [2]], 3]");
+  parent = parent[0]; // Copied
+  ASSERT_EQ(parent, JSON::parse("[1, [2]]"));
+  parent = parent[1];
+  ASSERT_EQ(parent, JSON::parse("[2]"));
+
+  // Moving a value does not change the address of its contents
+  const JSON *elem = &j1["a"][0];
+  JSON j3 = std::move(j1["a"]);
+  ASSERT_EQ(&j3[0], elem);
+  ASSERT_EQ(j1["a"].type(), JSON_UNDEFINED);
+
+  JSON arr(JSON_ARRAY);
+  JSON big = JSON::parse("[\"x\", \"y\"]");
+  const JSON *bigElem = &big[1];
+  arr.push_back(std::move(big));
+  ASSERT_EQ(big.type(), JSON_UNDEFINED);
+  ASSERT_EQ(&arr[0][1], bigElem);
+  arr.emplace_back(5);
+  arr.emplace_back(std::string("abc"));
+  arr.emplace_back(JSON_NULL);
+  arr.emplace_back();
+  ASSERT_EQ(arr.size(), 5u);
+  ASSERT_EQ(arr[1], 5);
+  ASSERT_EQ(arr[2], "abc");
+  ASSERT_EQ(arr[3].type(), JSON_NULL);
+  ASSERT_EQ(arr[4].type(), JSON_UNDEFINED);
+  JSON notArr(JSON_OBJECT);
+  ASSERT_JSONEXCEPTION(notArr.emplace_back(1));
+  ASSERT_JSONEXCEPTION(notArr.push_back(JSON(1)));
+
+  notArr.insert("k", std::move(j3));
+  ASSERT_EQ(&notArr["k"][0], elem);
+  ASSERT_JSONEXCEPTION(arr.insert("k", JSON(1)));
+
+  std::string s(1000, 'x');
+  const char *sdata = s.data();
+  JSON js(std::move(s));
+  ASSERT_EQ(js.get<std::string>().size(), 1000u);
+  ASSERT_EQ(static_cast<String*>(js.val)->val.data(), sdata);
+  js = std::string("short");
+  ASSERT_EQ(js, "short");
+
+  std::vector<JSON> vec(3, JSON(7));
+  JSON jv;
+  jv = std::move(vec);
+  ASSERT_EQ(jv, JSON::parse("[7, 7, 7]"));
+
+  std::map<std::string, JSON> m;
+  m["p"] = JSON_ARRAY;
+  m["q"] = true;
+  JSON jm;
+  jm = std::move(m);
+  ASSERT_EQ(jm, JSON::parse("{\"p\": [], \"q\": true}"));
+
+  JSON x(1), y("two");
+  x.swap(y);
+  ASSERT_EQ(x, "two");
+  ASSERT_EQ(y, 1);
+  swap(x, y);
+  ASSERT_EQ(x, 1);
+  ASSERT_EQ(y, "two");
+}
+
+TEST(JSONTest, SerializeToBuffer) {
+  // Every character which must be escaped, at every offset within a vector
+  // sized block (and in the scalar tail)
+  std::string plain(70, 'a');
+  for (int ch = 0; ch < 0x20; ++ch) {
+    for (size_t pos = 0; pos < plain.size(); pos += 7) {
+      std::string s = plain;
+      s[pos] = static_cast<char>(ch);
+      std::string expected = "\"" + plain + "\"";
+      std::string esc;
+      switch (ch) {
+        case '\b': esc = "\\b"; break;
+        case '\f': esc = "\\f"; break;
+        case '\n': esc = "\\n"; break;
+        case '\r': esc = "\\r"; break;
+        case '\t': esc = "\\t"; break;
+        default: {
+          char hex[8];
+          sprintf(hex, "\\u%04x", ch);
+          esc = hex;
+        }
+      }
+      expected.replace(pos + 1, 1, esc);
+      ASSERT_EQ(JSON(s).toString(), expected);
+      ASSERT_EQ(JSON::parse(expected), JSON(s));
+    }
+  }
+  std::string special = plain + "\"" + plain + "\\" + "\x7f\xc3\xa9" + plain;
+  ASSERT_EQ(JSON(special).toString(), "\"" + plain + "\\\"" + plain + "\\\\" + "\x7f\xc3\xa9" + plain + "\"");
+
+  JSON j = JSON::parse("{\"a\": [1, -23, true, false, null, \"x\\ny\"], \"bc\": {\"d\": 1.5, \"e\": []}, \"f\": {}}");
+  std::string out = "prefix:";
+  j.write(out);
+  ASSERT_EQ(out, "prefix:" + j.toString());
+  std::stringstream ss;
+  j.write(ss);
+  ASSERT_EQ(ss.str(), j.toString());
+  JSON noReals = JSON::parse("{\"a\": [1, -23, 1000, true, false, null, \"xy\", [], {}], \"bc\": {\"d\": \"\", \"e\": [[]]}}");
+  ASSERT_EQ(noReals.estimateSize(), noReals.toString().size());
+
+  // Large enough to be written to the stream in several pieces
+  JSON big(JSON_ARRAY);
+  for (int i = 0; i < 20000; ++i)
+    big.push_back(JSON::parse("{\"id\": " + boost::lexical_cast<std::string>(i) + ", \"name\": \"file\\t" + boost::lexical_cast<std::string>(i) + "\"}"));
+  std::stringstream bigStream;
+  big.write(bigStream);
+  ASSERT_EQ(bigStream.str(), big.toString());
+  ASSERT_EQ(JSON::parse(bigStream.str()), big);
+
+  JSON undef(JSON_ARRAY);
+  undef.push_back(JSON());
+  ASSERT_JSONEXCEPTION(undef.toString());
+  std::string partial;
+  ASSERT_JSONEXCEPTION(JSON().write(partial));
+}
+
+TEST(JSONTest, PushParser) {
+  const std::string input = "{\"a\": [1, -2.5e3, true, false, null, \"x\\\"y\\\\z\\u00e9\\ud83d\\ude00\", {}], "
+                            "\"long\": \"" + std::string(100, 'q') + "\\n\", \"\\u0041key\": {\"b\": [[], {\"c\": 123456789012}]}}  ";
+  const JSON expected = JSON::parse(input);
+
+  // Split the input into two pieces at every possible position, and into single bytes
+  for (size_t split = 0; split <= input.size(); ++split) {
+    JSONBuilder builder;
+    JSONPushParser parser(builder);
+    parser.feed(input.data(), split);
+    parser.feed(input.data() + split, input.size() - split);
+    parser.finish();
+    ASSERT_TRUE(parser.done());
+    ASSERT_EQ(builder.result(), expected);
+  }
+  JSONBuilder builder;
+  JSONPushParser parser(builder);
+  for (size_t i = 0; i < input.size(); ++i)
+    parser.feed(input.data() + i, 1);
+  parser.finish();
+  ASSERT_EQ(builder.result(), expected);
+
+  // Scalars at top level (a number is complete only at end of input)
+  const char *scalars[] = {"12", "-0.5", "true", "false", "null", "\"s\"", " 7 "};
+  for (size_t i = 0; i < sizeof(scalars) / sizeof(scalars[0]); ++i) {
+    JSONBuilder b;
+    JSONPushParser pp(b);
+    for (const char *c = scalars[i]; *c != '\0'; ++c)
+      pp.feed(c, 1);
+    pp.finish();
+    ASSERT_EQ(b.result(), JSON::parse(scalars[i]));
+  }
+
+  // reset() allows parsing another value
+  JSONBuilder b2;
+  JSONPushParser pp2(b2);
+  pp2.feed("[1, 2", 5);
+  pp2.reset();
+  b2 = JSONBuilder();
+  pp2.feed("[3]", 3);
+  pp2.finish();
+  ASSERT_EQ(b2.result(), JSON::parse("[3]"));
+
+  const char *illegal[] = {"{\"a\" 1}", "[1 2]", "{\"a\": 1,}", "[1,]", "{1: 2}", "[tru]", "[nul]", "[-]", "[1.2.3]",
+                           "[\"\\x\"]", "x", "{\"a\": 1", "[\"abc", "", "   "};
+  for (size_t i = 0; i < sizeof(illegal) / sizeof(illegal[0]); ++i) {
+    JSONBuilder b;
+    JSONPushParser pp(b);
+    ASSERT_JSONEXCEPTION({ pp.feed(illegal[i], strlen(illegal[i])); pp.finish(); });
+    ASSERT_JSONEXCEPTION(JSON::parse(illegal[i]));
+  }
+}
+
+// Collects the paths and values of matches
+class PointerMatches: public JSONPointerHandler {
+public:
+  std::vector<std::string> paths;
+  std::vector<JSON> values;
+  bool readContainers;
+
+  PointerMatches(bool r): readContainers(r) { }
+
+  void match(const std::vector<std::string> &path, JSONReader &reader) {
+    std::string p;
+    for (size_t i = 0; i < path.size(); ++i)
+      p += "/" + path[i];
+    paths.push_back(p);
+    if (reader.event() == JSON_EVENT_VALUE || readContainers)
+      values.push_back(reader.readValue());
+  }
+};
+
+TEST(JSONTest, Pointer) {
+  const std::string input = "{\"id\": \"file-1\", \"describe\": {\"parts\": {\"1\": {\"state\": \"complete\", \"size\": 10}, "
+                            "\"2\": {\"state\": \"pending\"}, \"3\": {\"size\": 5}}, \"a/b\": 1, \"m~n\": [2, [3, 4]], \"*\": 5}, "
+                            "\"list\": [{\"x\": 1}, {\"x\": [7]}, {\"y\": 3}]}";
+  const JSON j = JSON::parse(input);
+
+  ASSERT_EQ(*JSONPointer("").find(j), j);
+  ASSERT_EQ(*JSONPointer("/id").find(j), "file-1");
+  ASSERT_EQ(*JSONPointer("/describe/parts/1/state").find(j), "complete");
+  ASSERT_EQ(*JSONPointer("/describe/a~1b").find(j), 1);
+  ASSERT_EQ(*JSONPointer("/describe/m~0n/1/0").find(j), 3);
+  ASSERT_EQ(*JSONPointer("/list/1/x/0").find(j), 7);
+  ASSERT_EQ(JSONPointer("/describe/parts/4/state").find(j), (const JSON*)NULL);
+  ASSERT_EQ(JSONPointer("/id/x").find(j), (const JSON*)NULL);
+  ASSERT_EQ(JSONPointer("/list/01").find(j), (const JSON*)NULL);
+  ASSERT_EQ(JSONPointer("/list/3").find(j), (const JSON*)NULL);
+  ASSERT_EQ(JSONPointer("/list/x").find(j), (const JSON*)NULL);
+  ASSERT_EQ(JSONPointer("/describe/parts/*/state").size(), 4u);
+
+  JSON copy = j;
+  *JSONPointer("/list/0/x").find(copy) = 2;
+  ASSERT_EQ(copy["list"][0]["x"], 2);
+
+  std::vector<const JSON*> found;
+  JSONPointer("/describe/parts/*/state").findAll(j, found);
+  ASSERT_EQ(found.size(), 2u);
+  ASSERT_EQ(*found[0], "complete");
+  ASSERT_EQ(*found[1], "pending");
+  ASSERT_EQ(*JSONPointer("/list/*/x").find(j), 1);
+  found.clear();
+  JSONPointer("/list/*/x").findAll(j, found);
+  ASSERT_EQ(found.size(), 2u);
+  ASSERT_EQ(*found[1], JSON::parse("[7]"));
+
+  ASSERT_JSONEXCEPTION(JSONPointer("id"));
+  ASSERT_JSONEXCEPTION(JSONPointer("/a~2"));
+  ASSERT_JSONEXCEPTION(JSONPointer("/a~"));
+
+  // Same queries on serialized JSON
+  std::vector<JSON> selected;
+  JSONPointer("/describe/parts/*/state").select(input.data(), input.size(), selected);
+  ASSERT_EQ(selected.size(), 2u);
+  ASSERT_EQ(selected[0], "complete");
+  ASSERT_EQ(selected[1], "pending");
+  selected.clear();
+  JSONPointer("/describe/m~0n/1").select(input.data(), input.size(), selected);
+  ASSERT_EQ(selected.size(), 1u);
+  ASSERT_EQ(selected[0], JSON::parse("[3, 4]"));
+  selected.clear();
+  JSONPointer("").select(input.data(), input.size(), selected);
+  ASSERT_EQ(selected.size(), 1u);
+  ASSERT_EQ(selected[0], j);
+
+  for (int readContainers = 0; readContainers < 2; ++readContainers) {
+    PointerMatches m(readContainers == 1);
+    JSONReader reader(input.data(), input.size());
+    JSONPointer("/*/*").select(reader, m);
+    ASSERT_EQ(reader.event(), JSON_EVENT_END_OBJECT);
+    ASSERT_FALSE(reader.next());
+    ASSERT_EQ(m.paths.size(), 7u);
+    ASSERT_EQ(m.paths[0], "/describe/parts");
+    ASSERT_EQ(m.paths[3], "/describe/*");
+    ASSERT_EQ(m.paths[4], "/list/0");
+    ASSERT_EQ(m.paths[6], "/list/2");
+    ASSERT_EQ(m.values.size(), (readContainers == 1) ? 7u : 2u);
+  }
+}
+
+TEST(JSONTest, CBOR) {
+  const JSON j = JSON::parse("{\"id\": \"file-1\", \"n\": 3, \"r\": 3.0, \"neg\": -500, \"big\": 9223372036854775807, "
+                             "\"min\": -9223372036854775808, \"pi\": 3.25, \"ok\": true, \"no\": false, \"nil\": null, "
+                             "\"s\": \"a\\u0000b\\n\\u00e9\", \"list\": [1, [2.5, {}], [], \"x\"]}");
+  const std::string enc = toCBOR(j);
+  const JSON dec = fromCBOR(enc);
+  ASSERT_EQ(dec, j);
+  ASSERT_EQ(dec.toString(), j.toString());
+  ASSERT_EQ(dec["n"].type(), JSON_INTEGER);
+  ASSERT_EQ(dec["r"].type(), JSON_REAL);
+  ASSERT_EQ(dec["big"].get<int64_t>(), std::numeric_limits<int64_t>::max());
+  ASSERT_EQ(dec["min"].get<int64_t>(), std::numeric_limits<int64_t>::min());
+  ASSERT_EQ(dec["s"].get<std::string>(), std::string("a\0b\n\xc3\xa9", 6));
+
+  // Known encodings (RFC 8949, Appendix A)
+  ASSERT_EQ(toCBOR(JSON(0)), std::string("\x00", 1));
+  ASSERT_EQ(toCBOR(JSON(23)), "\x17");
+  ASSERT_EQ(toCBOR(JSON(24)), "\x18\x18");
+  ASSERT_EQ(toCBOR(JSON(1000)), "\x19\x03\xe8");
+  ASSERT_EQ(toCBOR(JSON(-1000)), "\x39\x03\xe7");
+  ASSERT_EQ(toCBOR(JSON(1.5)), std::string("\xfb\x3f\xf8\x00\x00\x00\x00\x00\x00", 9));
+  ASSERT_EQ(toCBOR(JSON::parse("[\"a\", {\"b\": null}]")), "\x82\x61\x61\xa1\x61\x62\xf6");
+  ASSERT_EQ(fromCBOR(std::string("\xf9\x3e\x00", 3)), 1.5); // half precision
+  ASSERT_EQ(fromCBOR(std::string("\xfa\x47\xc3\x50\x00", 5)), 100000.0); // single precision
+  ASSERT_EQ(fromCBOR(std::string("\xc1\x1a\x51\x4b\x67\xb0", 6)), 1363896240); // tagged
+  ASSERT_EQ(fromCBOR(std::string("\x1b\xff\xff\xff\xff\xff\xff\xff\xff", 9)).get<int64_t>(), std::numeric_limits<int64_t>::max());
+
+  ASSERT_JSONEXCEPTION(toCBOR(JSON()));
+  ASSERT_JSONEXCEPTION(fromCBOR(""));
+  ASSERT_JSONEXCEPTION(fromCBOR(enc.substr(0, enc.size() - 1)));
+  ASSERT_JSONEXCEPTION(fromCBOR("\x9f\xff")); // indefinite length
+  ASSERT_JSONEXCEPTION(fromCBOR("\x41\x61")); // byte string
+  ASSERT_JSONEXCEPTION(fromCBOR("\xa1\x01\x02")); // integer key
+  ASSERT_JSONEXCEPTION(fromCBOR("\xf7")); // undefined
+  ASSERT_JSONEXCEPTION(fromCBOR("\xf9\x7c\x00")); // infinity
+  ASSERT_JSONEXCEPTION(fromCBOR("\x9b\x00\x00\x00\x01\x00\x00\x00\x00"));
+
+  // Pull parsing, with strings referring to the buffer
+  CBORReader reader(enc.data(), enc.size());
+  ASSERT_EQ(reader.event(), JSON_EVENT_NONE);
+  ASSERT_TRUE(reader.next());
+  ASSERT_EQ(reader.event(), JSON_EVENT_START_OBJECT);
+  size_t keys = 0;
+  while (reader.next() && reader.event() == JSON_EVENT_KEY) {
+    ++keys;
+    if (reader.key() == "id") {
+      reader.next();
+      ASSERT_EQ(reader.getString(), "file-1");
+      ASSERT_GE(reader.getString().data, enc.data());
+      ASSERT_LT(reader.getString().data, enc.data() + enc.size());
+    } else if (reader.key() == "r") {
+      reader.next();
+      ASSERT_EQ(reader.type(), JSON_REAL);
+      ASSERT_EQ(reader.getReal(), 3.0);
+      ASSERT_JSONEXCEPTION(reader.getInteger());
+    } else if (reader.key() == "neg") {
+      reader.next();
+      ASSERT_EQ(reader.getInteger(), -500);
+    } else if (reader.key() == "ok") {
+      reader.next();
+      ASSERT_TRUE(reader.getBoolean());
+    } else if (reader.key() == "list") {
+      reader.next();
+      ASSERT_EQ(reader.event(), JSON_EVENT_START_ARRAY);
+      ASSERT_TRUE(reader.next());
+      ASSERT_EQ(reader.getInteger(), 1);
+      ASSERT_TRUE(reader.next());
+      ASSERT_EQ(reader.depth(), 3u);
+      ASSERT_EQ(reader.readValue(), JSON::parse("[2.5, {}]"));
+      ASSERT_EQ(reader.depth(), 2u);
+      ASSERT_TRUE(reader.next());
+      reader.skip();
+      ASSERT_TRUE(reader.next());
+      ASSERT_EQ(reader.readValue(), "x");
+      ASSERT_TRUE(reader.next());
+      ASSERT_EQ(reader.event(), JSON_EVENT_END_ARRAY);
+    } else {
+      reader.skip();
+    }
+  }
+  ASSERT_EQ(keys, j.size());
+  ASSERT_EQ(reader.event(), JSON_EVENT_END_OBJECT);
+  ASSERT_FALSE(reader.next());
+  ASSERT_EQ(reader.event(), JSON_EVENT_END);
+
+  CBORReader whole(enc.data(), enc.size());
+  whole.next();
+  ASSERT_EQ(whole.readValue(), j);
+  ASSERT_FALSE(whole.next());
+}
+
+TEST(JSONTest, LoadFile) {
+  std::ifstream ifs((getResourceDir() + "/pass1.json").c_str(), std::fstream::in);
+  JSON pass1;
+  pass1.read(ifs);
+  ASSERT_EQ(JSON::loadFile(getResourceDir() + "/pass1.json"), pass1);
+  ASSERT_JSONEXCEPTION(JSON::loadFile(getResourceDir() + "/no-such-file.json"));
+  ASSERT_JSONEXCEPTION(JSON::loadFile(getResourceDir()));
+
+  const std::string path = "test_dxjson_lazy.json";
+  const std::string contents = " {\"n\": 12, \"r\": -1.5e3, \"name\": \"a \\\"quoted\\\" [name]\", "
+                               "\"big\": [{\"x\": [1, 2, {\"y\": \"}\"}]}, true, null, \"\\\\\"],\n"
+                               "\"esc\\u0061ped\": {}, \"n\": 13, \"bad\": [1, 2,, 3], \"empty\": [ ]} ";
+  std::ofstream(path.c_str()) << contents;
+  {
+    ASSERT_JSONEXCEPTION(JSON::loadFile(path)); // Because of "bad"
+    JSONLazyFile f(path);
+    ASSERT_EQ(f.type(), JSON_OBJECT);
+    ASSERT_EQ(f.root().size(), 8u);
+    ASSERT_EQ(f["n"].get<int>(), 13); // Last one wins
+    ASSERT_EQ(f["r"].type(), JSON_REAL);
+    ASSERT_EQ(f["r"].get<double>(), -1500.0);
+    ASSERT_EQ(f["name"].toJSON(), "a \"quoted\" [name]");
+    ASSERT_TRUE(f.has("escaped"));
+    ASSERT_FALSE(f.has("x"));
+    ASSERT_JSONEXCEPTION(f["x"]);
+    ASSERT_EQ(f["big"].type(), JSON_ARRAY);
+    ASSERT_EQ(f["big"].size(), 4u);
+    ASSERT_EQ(f["big"][0]["x"][2]["y"].toJSON(), "}");
+    ASSERT_EQ(f["big"][0].raw(), "{\"x\": [1, 2, {\"y\": \"}\"}]}");
+    ASSERT_EQ(f["big"][1].type(), JSON_BOOLEAN);
+    ASSERT_EQ(f["big"][2].type(), JSON_NULL);
+    ASSERT_EQ(f["big"][3].toJSON(), "\\");
+    ASSERT_FALSE(f["big"].has(4));
+    ASSERT_JSONEXCEPTION(f["big"][4]);
+    ASSERT_EQ(f["big"].toJSON(), JSON::parse(f["big"].raw()));
+    ASSERT_EQ(f["empty"].size(), 0u);
+    ASSERT_JSONEXCEPTION(f["n"].size());
+    ASSERT_JSONEXCEPTION(f["bad"].size()); // Only detected once accessed
+    ASSERT_EQ(f.root().keys().size(), 8u);
+    ASSERT_EQ(f.root().keys()[4], "escaped");
+    ASSERT_EQ(f.root().raw(), contents.substr(1, contents.size() - 2));
+  }
+  std::remove(path.c_str());
+}
+
+TEST(JSONTest, LazyParse) {
+  const std::string text = "{\"id\": \"file-xxxx\",  \"parts\": {\"1\": {\"state\" : \"complete\", \"size\": 10}, "
+                           "\"2\": {\"state\": \"pending\"}},\n\"details\": [1.50, \"a\\u0062c\", {}, [ ]], \"n\": 1, \"n\": 2}";
+  JSON j = JSON::parseLazy(text);
+  ASSERT_EQ(j.toString(), text);
+  ASSERT_EQ(j.toString(true), text);
+  ASSERT_EQ(j.estimateSize(), text.size());
+
+  // Copies are not parsed either
+  JSON copy = j;
+  ASSERT_EQ(copy.toString(), text);
+
+  ASSERT_EQ(j.type(), JSON_OBJECT);
+  ASSERT_EQ(j.size(), 4u);
+  ASSERT_EQ(j["n"], 2);
+  ASSERT_EQ(j["parts"]["2"]["state"].get<std::string>(), "pending");
+  // Only accessed values are re-written, the others are copied as is
+  ASSERT_EQ(j["parts"].toString(), "{\"1\":{\"state\" : \"complete\", \"size\": 10},\"2\":{\"state\":\"pending\"}}");
+  ASSERT_EQ(j["details"].toString(), "[1.50, \"a\\u0062c\", {}, [ ]]");
+  ASSERT_EQ(j["details"][1].get<std::string>(), "abc");
+  ASSERT_EQ(j["details"][0].type(), JSON_REAL);
+  ASSERT_EQ(j["details"].size(), 4u);
+  ASSERT_EQ(j["details"][3].size(), 0u);
+  ASSERT_EQ(j, JSON::parse(text));
+  ASSERT_EQ(copy, j);
+
+  j["parts"]["1"]["size"] = 11;
+  ASSERT_EQ(j["parts"]["1"], JSON::parse("{\"size\": 11, \"state\": \"complete\"}"));
+  j["parts"].erase("2");
+  ASSERT_EQ(j["parts"].size(), 1u);
+
+  ASSERT_EQ(JSON::parseLazy(" 12 ").get<int>(), 12);
+  ASSERT_EQ(JSON::parseLazy("\"x\"").toString(), "\"x\"");
+  ASSERT_JSONEXCEPTION(JSON::parseLazy(""));
+  ASSERT_JSONEXCEPTION(JSON::parseLazy("[1, 2"));
+  ASSERT_JSONEXCEPTION(JSON::parseLazy("[1, 2] ]"));
+  ASSERT_JSONEXCEPTION(JSON::parseLazy("{} x"));
+  ASSERT_JSONEXCEPTION(JSON::parseLazy("12").toString(true));
+
+  // Errors are found only when the invalid part is parsed
+  JSON bad = JSON::parseLazy("{\"a\": 1, \"b\": [1, 2,, 3], \"c\": tru}");
+  ASSERT_EQ(bad["a"], 1);
+  ASSERT_JSONEXCEPTION(bad["b"].size());
+  ASSERT_JSONEXCEPTION(bad["c"].type());
+  ASSERT_EQ(bad["c"].toString(), "tru");
+
+  // Numbers and literals must end where their extent does (as for parse())
+  JSON trailing = JSON::parseLazy("[1x, nullx, 2]");
+  ASSERT_EQ(trailing.size(), 3u);
+  ASSERT_JSONEXCEPTION(trailing[0].type());
+  ASSERT_JSONEXCEPTION(trailing[1].type());
+  ASSERT_EQ(trailing[2], 2);
+  ASSERT_JSONEXCEPTION(JSON::parseLazy("1x").type());
+}
+
+TEST(JSONTest, DocumentInternedKeys) {
+  std::string text = "{\"results\": [";
+  for (int i = 0; i < 100; ++i) {
+    text += (i > 0) ? ", " : "";
+    text += "{\"id\": \"file-" + boost::lexical_cast<std::string>(i) + "\", \"state\": \"" + ((i % 3 == 0) ? "closed" : "open") + "\"";
+    if (i % 10 == 0)
+      text += ", \"describe\": {\"size\": " + boost::lexical_cast<std::string>(i) + ", \"id\": \"\"}";
+    text += "}";
+  }
+  text += "], \"next\": null}";
+
+  JSONDocument doc;
+  doc.parse(text);
+  ASSERT_EQ(doc.keyCount(), 6u); // results, id, state, describe, size, next
+
+  const JSONKey state = doc.key("state"), size = doc.key("size"), missing = doc.key("name");
+  ASSERT_TRUE(state.valid());
+  ASSERT_FALSE(missing.valid());
+  size_t closed = 0;
+  for (size_t i = 0; i < doc["results"].size(); ++i) {
+    const JSONNode r = doc["results"][i];
+    ASSERT_FALSE(r.has(missing));
+    ASSERT_FALSE(r.has(size));
+    if (r[state].get<std::string>() == "closed")
+      ++closed;
+    ASSERT_EQ(r.has(doc.key("describe")), (i % 10 == 0));
+  }
+  ASSERT_EQ(closed, 34u);
+  ASSERT_EQ(doc["results"][20]["describe"][size].get<int>(), 20);
+  ASSERT_JSONEXCEPTION(doc["results"][0][missing]);
+  ASSERT_JSONEXCEPTION(doc["results"][0][size]);
+  ASSERT_JSONEXCEPTION(doc["results"][state]);
+  ASSERT_JSONEXCEPTION(JSONNode()[JSONKey()]);
+
+  // Large objects are binary searched
+  JSON big(JSON_OBJECT);
+  for (int i = 0; i < 100; ++i)
+    big["key" + boost::lexical_cast<std::string>(i)] = i;
+  doc.parse(big.toString());
+  ASSERT_EQ(doc.keyCount(), 100u);
+  ASSERT_EQ(doc.root()[doc.key("key57")].get<int>(), 57);
+  ASSERT_FALSE(doc.root().has(doc.key("key100")));
+
+  // Short strings are held inline, and long ones in the arena
+  std::string chars("ab\0cdefghijklmnop", 17);
+  JSON strings(JSON_ARRAY);
+  for (size_t len = 0; len <= chars.size(); ++len)
+    strings.push_back(chars.substr(0, len));
+  doc.parse(strings.toString());
+  for (size_t len = 0; len <= chars.size(); ++len) {
+    ASSERT_EQ(doc[len].get<std::string>(), chars.substr(0, len));
+    ASSERT_EQ(std::string(doc[len].c_str(), doc[len].size()), chars.substr(0, len));
+    ASSERT_EQ(doc[len].c_str()[len], '\0');
+  }
+  ASSERT_EQ(doc.root().toJSON(), strings);
+  doc.parse("\"short\"");
+  ASSERT_EQ(std::string(doc.root().c_str()), "short");
+  ASSERT_EQ(doc.keyCount(), 0u);
+}
+
+TEST(JSONTest, ParseParallel) {
+  // Large enough (> 1 MB) to be split between threads
+  JSON results(JSON_ARRAY);
+  for (int i = 0; i < 30000; ++i) {
+    JSON r(JSON_OBJECT);
+    r["id"] = "file-" + boost::lexical_cast<std::string>(i);
+    r["describe"] = JSON::parse("{\"size\": " + boost::lexical_cast<std::string>(i) + ", \"tags\": [\"a\", 1.5, null, true]}");
+    results.push_back(r);
+  }
+  const std::string arr = results.toString();
+  ASSERT_GT(arr.size(), 1u << 20);
+  ASSERT_EQ(JSON::parseParallel(arr, 4), results);
+  ASSERT_EQ(JSON::parseParallel("  " + arr + "  ", 3), results);
+
+  JSON response(JSON_OBJECT);
+  response["results"] = results;
+  response["next"] = JSON_NULL;
+  const std::string obj = "{\"next\": 12, " + response.toString().substr(1);
+  ASSERT_EQ(JSON::parseParallel(obj, 4), response); // last "next" wins
+  ASSERT_EQ(JSON::parseParallel(obj, 1), response);
+  ASSERT_EQ(JSON::parseParallel(obj), JSON::parse(obj));
+  ASSERT_FALSE(JSON::parallelParseRequested());
+  JSON::setParallelThreads(2);
+  ASSERT_EQ(JSON::getParallelThreads(), 2u);
+  ASSERT_TRUE(JSON::parallelParseRequested());
+  ASSERT_EQ(JSON::parseParallel(obj), response);
+  JSON::setParallelThreads(1);
+  ASSERT_FALSE(JSON::parallelParseRequested());
+  JSON::setParallelThreads(0);
+  ASSERT_FALSE(JSON::parallelParseRequested());
+  ASSERT_GE(JSON::getParallelThreads(), 1u);
+  ASSERT_LE(JSON::getParallelThreads(), 4u);
+
+  // Small values are parsed as usual
+  ASSERT_EQ(JSON::parseParallel("[1, 2, 3]", 4), JSON::parse("[1, 2, 3]"));
+  ASSERT_EQ(JSON::parseParallel("12", 4), 12);
+
+  // Errors in any of the elements are reported
+  std::string bad = arr;
+  const size_t mid = bad.find("},", bad.size() / 2); // Between two values (whatever the key order)
+  ASSERT_NE(mid, std::string::npos);
+  bad.insert(mid + 2, "1x, ");
+  ASSERT_JSONEXCEPTION(JSON::parse(bad));
+  ASSERT_JSONEXCEPTION(JSON::parseParallel(bad, 4));
+  bad = arr;
+  bad.insert(bad.size() - 1, ", [");
+  ASSERT_JSONEXCEPTION(JSON::parseParallel(bad, 4));
+  bad = "{\"results\": " + arr + ", \"next\": tru}";
+  ASSERT_JSONEXCEPTION(JSON::parseParallel(bad, 4));
+  bad = "{\"results\": " + arr + ", \"next\": nullx}";
+  ASSERT_JSONEXCEPTION(JSON::parse(bad));
+  ASSERT_JSONEXCEPTION(JSON::parseParallel(bad, 4));
+}
+
+TEST(JSONTest, Hash) {
+  const std::string text = "{\"id\": \"file-xxxx\", \"size\": 12, \"ratio\": 0.5, \"tags\": [\"a\", true, null],"
+                           " \"parts\": {\"1\": {\"state\": \"complete\", \"size\": 5}, \"2\": {\"state\": \"pending\"}}}";
+  JSON a = JSON::parse(text);
+  JSON b = a;
+  ASSERT_EQ(a.hash(), b.hash());
+  ASSERT_EQ(std::hash<JSON>()(a), a.hash());
+  ASSERT_EQ(JSON::parseLazy(text).hash(), a.hash());
+  ASSERT_EQ(JSON::parse("{\"b\": 1, \"a\": 2}").hash(), JSON::parse("{\"a\": 2, \"b\": 1}").hash());
+  ASSERT_NE(JSON::parse("[1, 2]").hash(), JSON::parse("[2, 1]").hash());
+  ASSERT_NE(JSON(1).hash(), JSON("1").hash());
+  ASSERT_EQ(JSON(1.0).hash(), JSON(1.0 + std::numeric_limits<double>::epsilon()).hash());
+
+  // Modifying a value (even through a reference, or an iterator, obtained
+  // before hashes were cached) invalidates cached hashes
+  JSON &state = a["parts"]["2"]["state"];
+  JSON::array_iterator tag = a["tags"].array_begin();
+  a.hash();
+  b.hash();
+  ASSERT_EQ(a, b);
+  state = "complete";
+  ASSERT_NE(a, b);
+  b["parts"]["2"]["state"] = "complete";
+  ASSERT_EQ(a.hash(), b.hash());
+  ASSERT_EQ(a, b);
+  *tag = "b";
+  ASSERT_NE(a, b);
+  JSON moved(std::move(b["tags"][0]));
+  b.hash();
+  a.hash();
+  ASSERT_NE(a, b);
+  b["tags"][0] = "b";
+  ASSERT_EQ(a, b);
+  a["tags"].push_back(1);
+  ASSERT_NE(a, b);
+  a["tags"].erase(3);
+  ASSERT_EQ(a, b);
+  JSON c = b;
+  c.hash();
+  b.hash();
+  c["parts"].erase("1");
+  ASSERT_NE(b, c);
+
+  // Deduplication
+  std::unordered_set<JSON> unique;
+  for (int i = 0; i < 100; ++i) {
+    JSON j(JSON_OBJECT);
+    j["id"] = i % 10;
+    j["tags"] = JSON(JSON_ARRAY);
+    j["tags"].push_back(i % 5);
+    unique.insert(j);
+  }
+  ASSERT_EQ(unique.size(), 10u);
+  JSON probe(JSON_OBJECT);
+  probe["tags"] = JSON::parse("[3]");
+  probe["id"] = 8;
+  ASSERT_EQ(unique.count(probe), 1u);
+  probe["id"] = 7;
+  ASSERT_EQ(unique.count(probe), 0u);
+}
+
+struct BoundPart {
+  std::string state;
+  int64_t size;
+  unsigned int index;
+
+  BoundPart(): size(-1), index(0) {}
+
+  static const JSONFields<BoundPart>& jsonFields() {
+    static const JSONFields<BoundPart> fields = JSONFields<BoundPart>()
+      .required("state", &BoundPart::state)
+      .optional("size", &BoundPart::size)
+      .optional("index", &BoundPart::index);
+    return fields;
+  }
+};
+
+struct BoundDescribe {
+  std::string id;
+  bool hidden;
+  double ratio;
+  std::vector<std::string> tags;
+  std::map<std::string, BoundPart> parts;
+  std::vector<BoundPart> list;
+  JSON details;
+
+  BoundDescribe(): hidden(false), ratio(0) {}
+
+  static const JSONFields<BoundDescribe>& jsonFields() {
+    static const JSONFields<BoundDescribe> fields = JSONFields<BoundDescribe>()
+      .required("id", &BoundDescribe::id)
+      .optional("hidden", &BoundDescribe::hidden)
+      .optional("ratio", &BoundDescribe::ratio)
+      .optional("tags", &BoundDescribe::tags)
+      .optional("parts", &BoundDescribe::parts)
+      .optional("list", &BoundDescribe::list)
+      .optional("details", &BoundDescribe::details);
+    return fields;
+  }
+};
+
+TEST(JSONTest, Bind) {
+  BoundDescribe d;
+  bindJSON("{\"unknown\": [1, {\"id\": 2}], \"id\": \"file-xxxx\", \"hidden\": true, \"ratio\": 2,"
+           " \"tags\": [\"a\", \"b\"], \"parts\": {\"1\": {\"state\": \"complete\", \"size\": 5, \"md5\": \"x\"},"
+           " \"2\": {\"state\": \"pending\", \"size\": null}}, \"list\": [{\"state\": \"a\", \"index\": 3}],"
+           " \"details\": {\"x\": [null]}, \"next\": null}", d);
+  ASSERT_EQ(d.id, "file-xxxx");
+  ASSERT_TRUE(d.hidden);
+  ASSERT_EQ(d.ratio, 2.0);
+  ASSERT_EQ(d.tags, std::vector<std::string>({"a", "b"}));
+  ASSERT_EQ(d.parts.size(), 2u);
+  ASSERT_EQ(d.parts["1"].state, "complete");
+  ASSERT_EQ(d.parts["1"].size, 5);
+  ASSERT_EQ(d.parts["2"].size, -1); // null: kept as is
+  ASSERT_EQ(d.list.size(), 1u);
+  ASSERT_EQ(d.list[0].index, 3u);
+  ASSERT_EQ(d.details, JSON::parse("{\"x\": [null]}"));
+
+  // Through a reader positioned at a key
+  JSONReader r("{\"a\": {\"state\": \"open\"}}", 24);
+  r.next();
+  r.next();
+  BoundPart p;
+  bindJSON(r, p);
+  ASSERT_EQ(p.state, "open");
+  ASSERT_EQ(r.event(), JSON_EVENT_END_OBJECT);
+  ASSERT_TRUE(r.next()); // The enclosing object
+  ASSERT_EQ(r.event(), JSON_EVENT_END_OBJECT);
+  ASSERT_FALSE(r.next());
+
+  ASSERT_JSONEXCEPTION(bindJSON("{\"hidden\": true}", d)); // "id" missing
+  ASSERT_JSONEXCEPTION(bindJSON("{\"id\": null}", d));
+  ASSERT_JSONEXCEPTION(bindJSON("{\"id\": 12}", d));
+  ASSERT_JSONEXCEPTION(bindJSON("[]", d));
+  ASSERT_JSONEXCEPTION(bindJSON("{\"id\": \"x\", \"parts\": {\"1\": {\"size\": 1}}}", d));
+  ASSERT_JSONEXCEPTION(bindJSON("{\"id\": \"x\", \"list\": [{\"state\": \"a\", \"index\": -1}]}", d));
+  ASSERT_JSONEXCEPTION(bindJSON("{\"id\": \"x\", \"tags\": [1]}", d));
+  ASSERT_JSONEXCEPTION(bindJSON("{\"id\": \"x\", \"hidden\": tru}", d));
+  try {
+    bindJSON("{\"id\": \"x\", \"parts\": {\"7\": {\"state\": 1}}}", d);
+    ASSERT_TRUE(false);
+  } catch (JSONException &e) {
+    ASSERT_EQ(std::string(e.what()), "Value of key \"parts\": Value of key \"7\": Value of key \"state\": Expected a JSON_STRING");
+  }
+}
+
+TEST(JSONTest, Patch) {
+  // Examples from RFC 6902, appendix A
+  JSON j = JSON::parse("{\"foo\": \"bar\"}");
+  j.applyPatch(JSON::parse("[{\"op\": \"add\", \"path\": \"/baz\", \"value\": \"qux\"}]"));
+  ASSERT_EQ(j, JSON::parse("{\"baz\": \"qux\", \"foo\": \"bar\"}"));
+
+  j = JSON::parse("{\"foo\": [\"bar\", \"baz\"]}");
+  j.applyPatch(JSON::parse("[{\"op\": \"add\", \"path\": \"/foo/1\", \"value\": \"qux\"}, {\"op\": \"add\", \"path\": \"/foo/-\", \"value\": 1}]"));
+  ASSERT_EQ(j, JSON::parse("{\"foo\": [\"bar\", \"qux\", \"baz\", 1]}"));
+
+  j = JSON::parse("{\"foo\": {\"bar\": \"baz\", \"waldo\": \"fred\"}, \"qux\": {\"corge\": \"grault\"}}");
+  j.applyPatch(JSON::parse("[{\"op\": \"move\", \"from\": \"/foo/waldo\", \"path\": \"/qux/thud\"},"
+                           " {\"op\": \"remove\", \"path\": \"/foo/bar\"},"
+                           " {\"op\": \"copy\", \"from\": \"/qux\", \"path\": \"/foo/q\"},"
+                           " {\"op\": \"replace\", \"path\": \"/qux/corge\", \"value\": [1]},"
+                           " {\"op\": \"test\", \"path\": \"/foo/q/thud\", \"value\": \"fred\"}]"));
+  ASSERT_EQ(j, JSON::parse("{\"foo\": {\"q\": {\"corge\": \"grault\", \"thud\": \"fred\"}}, \"qux\": {\"corge\": [1], \"thud\": \"fred\"}}"));
+
+  j = JSON::parse("{\"a/b\": {\"m~n\": [0, 1, 2]}}");
+  j.applyPatch(JSON::parse("[{\"op\": \"move\", \"from\": \"/a~1b/m~0n/0\", \"path\": \"/a~1b/m~0n/2\"}]"));
+  ASSERT_EQ(j, JSON::parse("{\"a/b\": {\"m~n\": [1, 2, 0]}}"));
+
+  // Values copied from a const patch, which is left as is
+  const JSON constPatch = JSON::parse("[{\"op\": \"add\", \"path\": \"/a~1b/x\", \"value\": [3]}]");
+  j.applyPatch(constPatch);
+  ASSERT_EQ(j, JSON::parse("{\"a/b\": {\"m~n\": [1, 2, 0], \"x\": [3]}}"));
+  ASSERT_EQ(constPatch, JSON::parse("[{\"op\": \"add\", \"path\": \"/a~1b/x\", \"value\": [3]}]"));
+
+  // Values moved out of an rvalue patch
+  JSON patch = JSON::parse("[{\"op\": \"replace\", \"path\": \"\", \"value\": {\"x\": [1, 2]}}]");
+  j.applyPatch(std::move(patch));
+  ASSERT_EQ(j, JSON::parse("{\"x\": [1, 2]}"));
+
+  // Errors (operations before the failing one remain applied)
+  j = JSON::parse("{\"foo\": [\"bar\"]}");
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"remove\", \"path\": \"/baz\"}]")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"add\", \"path\": \"/foo/2\", \"value\": 1}]")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"add\", \"path\": \"/foo/01\", \"value\": 1}]")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"replace\", \"path\": \"/foo/-\", \"value\": 1}]")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"add\", \"path\": \"/a/b\", \"value\": 1}]")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"add\", \"path\": \"/foo\"}]")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"frobnicate\", \"path\": \"/foo\"}]")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"move\", \"from\": \"/foo\", \"path\": \"/foo/0\"}]")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("{\"op\": \"remove\", \"path\": \"/foo\"}")));
+  ASSERT_JSONEXCEPTION(j.applyPatch(JSON::parse("[{\"op\": \"add\", \"path\": \"/x\", \"value\": 1},"
+                                                " {\"op\": \"test\", \"path\": \"/foo/0\", \"value\": \"baz\"}]")));
+  ASSERT_EQ(j, JSON::parse("{\"foo\": [\"bar\"], \"x\": 1}"));
+
+  // Cached hashes do not survive changes made by a patch
+  j.hash();
+  j.applyPatch(JSON::parse("[{\"op\": \"add\", \"path\": \"/foo/0\", \"value\": 0}, {\"op\": \"test\", \"path\": \"\", \"value\": {\"foo\": [0, \"bar\"], \"x\": 1}}]"));
+
+  // Diffs
+  const char *pairs[][2] = {
+    {"{\"a\": 1, \"b\": {\"c\": [1, 2, 3, 4]}, \"d/~\": null}", "{\"a\": 1, \"b\": {\"c\": [1, 3, 4, 5], \"e\": true}}"},
+    {"[1, 2, 3]", "[0, 1, 2, 3]"},
+    {"[0, 1, 2, 3]", "[3]"},
+    {"[{\"x\": 1}, 2]", "[{\"x\": 2}, 2]"},
+    {"{\"a\": []}", "[]"},
+    {"{\"a\": 1}", "{\"a\": 1}"}
+  };
+  for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); ++i) {
+    const JSON from = JSON::parse(pairs[i][0]), to = JSON::parse(pairs[i][1]);
+    JSON patched = from;
+    patched.applyPatch(JSON::diffPatch(from, to));
+    ASSERT_EQ(patched, to);
+  }
+  ASSERT_EQ(JSON::diffPatch(JSON::parse(pairs[3][0]), JSON::parse(pairs[3][1])),
+            JSON::parse("[{\"op\": \"replace\", \"path\": \"/0/x\", \"value\": 2}]"));
+  ASSERT_EQ(JSON::diffPatch(JSON::parse(pairs[1][0]), JSON::parse(pairs[1][1])),
+            JSON::parse("[{\"op\": \"add\", \"path\": \"/0\", \"value\": 0}]"));
+  ASSERT_EQ(JSON::diffPatch(JSON::parse(pairs[5][0]), JSON::parse(pairs[5][1])).size(), 0u);
+}
+
+TEST(JSONTest, MergePatch) {
+  // Examples from RFC 7386, appendix A
+  const char *cases[][3] = {
+    {"{\"a\":\"b\"}", "{\"a\":\"c\"}", "{\"a\":\"c\"}"},
+    {"{\"a\":\"b\"}", "{\"b\":\"c\"}", "{\"a\":\"b\",\"b\":\"c\"}"},
+    {"{\"a\":\"b\"}", "{\"a\":null}", "{}"},
+    {"{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":null}", "{\"b\":\"c\"}"},
+    {"{\"a\":[\"b\"]}", "{\"a\":\"c\"}", "{\"a\":\"c\"}"},
+    {"{\"a\":\"c\"}", "{\"a\":[\"b\"]}", "{\"a\":[\"b\"]}"},
+    {"{\"a\":{\"b\":\"c\"}}", "{\"a\":{\"b\":\"d\",\"c\":null}}", "{\"a\":{\"b\":\"d\"}}"},
+    {"{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}", "{\"a\":[1]}"},
+    {"[\"a\",\"b\"]", "[\"c\",\"d\"]", "[\"c\",\"d\"]"},
+    {"{\"a\":\"b\"}", "[\"c\"]", "[\"c\"]"},
+    {"{\"a\":\"foo\"}", "null", "null"},
+    {"{\"a\":\"foo\"}", "\"bar\"", "\"bar\""},
+    {"{\"e\":null}", "{\"a\":1}", "{\"e\":null,\"a\":1}"},
+    {"[1,2]", "{\"a\":\"b\",\"c\":null}", "{\"a\":\"b\"}"},
+    {"{}", "{\"a\":{\"bb\":{\"ccc\":null}}}", "{\"a\":{\"bb\":{}}}"}
+  };
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    JSON j = JSON::parse(cases[i][0]);
+    const JSON patch = JSON::parse(cases[i][1]);
+    j.applyMergePatch(patch); // Copied from (and left as is)
+    ASSERT_EQ(j, JSON::parse(cases[i][2]));
+    ASSERT_EQ(patch, JSON::parse(cases[i][1]));
+    JSON k = JSON::parse(cases[i][0]);
+    k.applyMergePatch(JSON::parse(cases[i][1])); // Moved from
+    ASSERT_EQ(k, j);
+  }
+
+  const JSON from = JSON::parse("{\"a\": 1, \"b\": {\"c\": \"x\", \"d\": [1]}, \"e\": \"y\"}");
+  const JSON to = JSON::parse("{\"a\": 1, \"b\": {\"c\": \"z\", \"d\": [1]}, \"f\": {\"g\": [null]}}");
+  const JSON diff = JSON::diffMergePatch(from, to);
+  ASSERT_EQ(diff, JSON::parse("{\"b\": {\"c\": \"z\"}, \"e\": null, \"f\": {\"g\": [null]}}"));
+  JSON patched = from;
+  patched.applyMergePatch(diff);
+  ASSERT_EQ(patched, to);
+  ASSERT_EQ(JSON::diffMergePatch(from, from).size(), 0u);
+  // Null members cannot be set by a merge patch
+  ASSERT_JSONEXCEPTION(JSON::diffMergePatch(from, JSON::parse("{\"a\": null}")));
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -15,6 +15,16 @@
 //   under the License.
 
 #include <gtest/gtest.h>
+#include <atomic>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
 #include "SimpleHttp.h"
 
 using namespace std;
@@ -88,6 +98,509 @@ TEST(HttpRequestTest, Test_HTTPS_HEAD_AND_GET) {
   ASSERT_TRUE(h2.isPresent("Date"));
 }
 
+TEST(HttpConnectionPoolTest, HostKey) {
+  ASSERT_EQ(HttpConnectionPool::hostKey("https://API.dnanexus.com/file-xxxx/describe"), "https://api.dnanexus.com:443");
+  ASSERT_EQ(HttpConnectionPool::hostKey("http://user:pw@localhost:8124?a=b"), "http://localhost:8124");
+  ASSERT_EQ(HttpConnectionPool::hostKey("HTTP://[::1]/x"), "http://[::1]:80");
+  ASSERT_EQ(HttpConnectionPool::hostKey("http://[::1]:8080#x"), "http://[::1]:8080");
+  ASSERT_EQ(HttpConnectionPool::hostKey("www.google.com"), "http://www.google.com:80");
+}
+
+TEST(HttpConnectionPoolTest, AcquireRelease) {
+  HttpConnectionPool &pool = HttpConnectionPool::instance();
+  const size_t maxIdle = pool.getMaxIdlePerHost();
+  const long timeout = pool.getIdleTimeout();
+  pool.clear();
+  pool.setMaxIdlePerHost(2);
+  pool.setIdleTimeout(3600);
+
+  CURL *a = pool.acquire("http://example.com/a");
+  CURL *b = pool.acquire("http://EXAMPLE.com:80/b");
+  CURL *c = pool.acquire("http://example.com/c");
+  ASSERT_TRUE(a != NULL && b != NULL && c != NULL);
+  ASSERT_EQ(pool.idleCount(), 0u);
+  pool.release("http://example.com/a", a);
+  pool.release("http://example.com/b", b);
+  pool.release("http://example.com/c", c); // Over the limit: cleaned up
+  ASSERT_EQ(pool.idleCount(), 2u);
+
+  // Another scheme/port gets a handle of its own
+  CURL *d = pool.acquire("https://example.com/d");
+  ASSERT_TRUE(d != a && d != b);
+  HttpConnectionPool::discard(d);
+
+  // The handle released last is reused first
+  CURL *e = pool.acquire("http://example.com/e");
+  ASSERT_EQ(e, b);
+  ASSERT_EQ(pool.idleCount(), 1u);
+  pool.release("http://example.com/e", e);
+
+  // A handle pinned to an IP is only reused for the same pin
+  const std::string pin = "example.com:80:10.0.0.1";
+  CURL *f = pool.acquire("http://example.com/f", pin);
+  ASSERT_TRUE(f != a && f != b);
+  pool.release("http://example.com/f", f, pin);
+  ASSERT_EQ(pool.acquire("http://example.com/g"), b);
+  pool.release("http://example.com/g", b);
+  ASSERT_EQ(pool.acquire("http://example.com/h", pin), f);
+  HttpConnectionPool::discard(f);
+
+  // Idle handles past the timeout are not reused
+  pool.setIdleTimeout(0);
+  HttpConnectionPool::discard(pool.acquire("http://example.com/f"));
+  ASSERT_EQ(pool.idleCount(), 0u);
+
+  pool.setMaxIdlePerHost(0);
+  pool.release("http://example.com/g", pool.acquire("http://example.com/g"));
+  ASSERT_EQ(pool.idleCount(), 0u);
+
+  pool.setMaxIdlePerHost(maxIdle);
+  pool.setIdleTimeout(timeout);
+}
+
+TEST(HttpResponseSinkTest, Buffer) {
+  char buf[8];
+  HttpBufferSink sink(buf, sizeof(buf));
+  ASSERT_FALSE(sink.begin(404)); // Error bodies go to respData
+  ASSERT_TRUE(sink.begin(206));
+  sink.reserve(8);
+  sink.write("abc", 3);
+  sink.write("defgh", 5);
+  ASSERT_EQ(sink.size(), 8u);
+  ASSERT_EQ(string(buf, 8), "abcdefgh");
+  ASSERT_HTTPEXCEPTION(sink.write("i", 1));
+  ASSERT_HTTPEXCEPTION(sink.reserve(9));
+
+  // Sent again: starts over
+  ASSERT_TRUE(sink.begin(200));
+  sink.write("xy", 2);
+  ASSERT_EQ(sink.size(), 2u);
+  ASSERT_EQ(string(buf, 3), "xyc");
+}
+
+TEST(HttpResponseSinkTest, String) {
+  string out = "head:";
+  HttpStringSink sink(out);
+  ASSERT_TRUE(sink.begin(200));
+  sink.reserve(1000);
+  ASSERT_GE(out.capacity(), 1005u);
+  sink.write("abc", 3);
+  ASSERT_EQ(out, "head:abc");
+  ASSERT_EQ(sink.size(), 3u);
+
+  // Sent again: replaces what the previous attempt appended
+  ASSERT_TRUE(sink.begin(200));
+  sink.write("de", 2);
+  ASSERT_EQ(out, "head:de");
+  ASSERT_EQ(sink.size(), 2u);
+}
+
+TEST(HttpResponseSinkTest, File) {
+  char path[] = "/tmp/test_simplehttp_XXXXXX";
+  const int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  unlink(path);
+  // Two ranges of a download, written out of order
+  HttpFileSink second(fd, 3), first(fd, 0);
+  ASSERT_TRUE(second.begin(206));
+  second.write("def", 3);
+  ASSERT_TRUE(first.begin(206));
+  first.write("ab", 2);
+  first.write("c", 1);
+  ASSERT_EQ(first.size(), 3u);
+  char buf[7] = {0};
+  ASSERT_EQ(pread(fd, buf, 6, 0), 6);
+  ASSERT_EQ(string(buf), "abcdef");
+  close(fd);
+  ASSERT_HTTPEXCEPTION(first.write("x", 1)); // Closed file
+}
+
+// A minimal HTTP/1.1 server, on a port of 127.0.0.1 picked by the system. It
+// answers every (body-less) request with its path as body, on a keep-alive
+// connection, except requests for "/hang", which are never answered.
+class LocalHttpServer {
+public:
+  LocalHttpServer(): connections(0), port(0) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (fd < 0 || bind(fd, (sockaddr*) &addr, len) != 0 || listen(fd, 128) != 0 ||
+        getsockname(fd, (sockaddr*) &addr, &len) != 0)
+      throw std::runtime_error("Unable to start the local HTTP server");
+    port = ntohs(addr.sin_port);
+    acceptor = std::thread(&LocalHttpServer::run, this);
+  }
+
+  ~LocalHttpServer() {
+    shutdown(fd, SHUT_RDWR); // Ends accept()
+    acceptor.join();
+    close(fd);
+    std::lock_guard<std::mutex> l(lock);
+    for (size_t i = 0; i < clients.size(); ++i)
+      shutdown(clients[i], SHUT_RDWR); // Ends recv()
+    for (size_t i = 0; i < clients.size(); ++i) {
+      servers[i].join();
+      close(clients[i]);
+    }
+  }
+
+  string url(const string &path) const {
+    return "http://127.0.0.1:" + std::to_string(port) + path;
+  }
+
+  // Number of connections accepted so far
+  std::atomic<int> connections;
+
+private:
+  int fd, port;
+  std::thread acceptor;
+  std::mutex lock;
+  std::vector<int> clients;
+  std::vector<std::thread> servers;
+
+  void run() {
+    int c;
+    while ((c = accept(fd, NULL, NULL)) >= 0) {
+      ++connections;
+      std::lock_guard<std::mutex> l(lock);
+      clients.push_back(c);
+      servers.push_back(std::thread(&LocalHttpServer::serve, c));
+    }
+  }
+
+  static void serve(int c) {
+    string in;
+    char buf[4096];
+    while (true) {
+      size_t end;
+      while ((end = in.find("\r\n\r\n")) == string::npos) {
+        const ssize_t n = recv(c, buf, sizeof(buf), 0);
+        if (n <= 0)
+          return;
+        in.append(buf, n);
+      }
+      // "GET /path HTTP/1.1"
+      const size_t from = in.find(' ') + 1;
+      const string path = in.substr(from, in.find(' ', from) - from);
+      in.erase(0, end + 4);
+      if (path == "/hang")
+        continue;
+      const string resp = "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(path.size()) + "\r\n\r\n" + path;
+      if (send(c, resp.data(), resp.size(), MSG_NOSIGNAL) != (ssize_t) resp.size())
+        return;
+    }
+  }
+};
+
+TEST(HttpEngineTest, ErrorReachesCallback) {
+  // Nothing listens on port 1: the error must reach the callbacks (rather
+  // than be thrown by submit())
+  const int N = 8;
+  HttpRequest reqs[N];
+  std::promise<void> done[N];
+  int errors[N];
+  for (int i = 0; i < N; ++i) {
+    reqs[i].buildRequest(HTTP_GET, "http://127.0.0.1:1/x", HttpHeaders());
+    HttpEngine::instance().submit(reqs[i], [&, i](HttpRequest &, std::exception_ptr error) {
+      errors[i] = 0;
+      try {
+        if (error)
+          std::rethrow_exception(error);
+      } catch (HttpRequestException &e) {
+        errors[i] = e.errorCode;
+      }
+      done[i].set_value();
+    });
+  }
+  for (int i = 0; i < N; ++i) {
+    done[i].get_future().wait();
+    ASSERT_EQ(errors[i], CURLE_COULDNT_CONNECT);
+  }
+}
+
+TEST(HttpEngineTest, Transfer) {
+  LocalHttpServer server;
+  const int N = 16;
+  HttpRequest reqs[N];
+  std::promise<void> done[N];
+  string bodies[N];
+  std::vector<HttpStringSink> sinks;
+  for (int i = 0; i < N; ++i)
+    sinks.push_back(HttpStringSink(bodies[i]));
+  for (int i = 0; i < N; ++i) {
+    reqs[i].buildRequest(HTTP_GET, server.url("/r" + std::to_string(i)), HttpHeaders());
+    if (i % 2 == 0)
+      reqs[i].respSink = &sinks[i]; // The others' bodies go to respData
+    HttpEngine::instance().submit(reqs[i], [&, i](HttpRequest &r, std::exception_ptr error) {
+      if (error)
+        done[i].set_exception(error);
+      else if (&r != &reqs[i])
+        done[i].set_exception(std::make_exception_ptr(std::runtime_error("Wrong request")));
+      else
+        done[i].set_value();
+    });
+  }
+  for (int i = 0; i < N; ++i) {
+    done[i].get_future().get();
+    ASSERT_EQ(reqs[i].responseCode, 200);
+    ASSERT_EQ((i % 2 == 0) ? bodies[i] : reqs[i].respData, "/r" + std::to_string(i));
+  }
+
+  // The connections are kept open, and reused
+  const int connections = server.connections;
+  HttpRequest req;
+  req.buildRequest(HTTP_GET, server.url("/again"), HttpHeaders());
+  HttpEngine::instance().send(req);
+  ASSERT_EQ(req.respData, "/again");
+  ASSERT_EQ(server.connections, connections);
+}
+
+TEST(HttpEngineTest, Cancel) {
+  LocalHttpServer server;
+  HttpEngine &engine = HttpEngine::instance();
+  HttpRequest req;
+  int errorCode = 0;
+  std::unique_ptr<std::promise<void> > done;
+  const HttpEngine::Callback callback = [&](HttpRequest &, std::exception_ptr error) {
+    errorCode = 0;
+    try {
+      if (error)
+        std::rethrow_exception(error);
+    } catch (HttpRequestException &e) {
+      errorCode = e.errorCode;
+    }
+    done->set_value();
+  };
+
+  // Never answered: over only once cancelled
+  done.reset(new std::promise<void>());
+  req.buildRequest(HTTP_GET, server.url("/hang"), HttpHeaders());
+  const HttpEngine::TransferId hung = engine.submit(req, callback);
+  ASSERT_NE(hung, 0u);
+  engine.cancel(hung);
+  done->get_future().wait();
+  ASSERT_EQ(errorCode, HttpRequestException::CANCELLED);
+
+  // Cancelling a complete transfer does nothing, even when its request is
+  // sent again
+  done.reset(new std::promise<void>());
+  req.buildRequest(HTTP_GET, server.url("/ok"), HttpHeaders());
+  const HttpEngine::TransferId first = engine.submit(req, callback);
+  done->get_future().wait();
+  ASSERT_EQ(errorCode, 0);
+  done.reset(new std::promise<void>());
+  req.buildRequest(HTTP_GET, server.url("/hang"), HttpHeaders());
+  const HttpEngine::TransferId second = engine.submit(req, callback);
+  ASSERT_NE(first, second);
+  engine.cancel(first);
+  std::future<void> f = done->get_future();
+  ASSERT_EQ(f.wait_for(std::chrono::milliseconds(200)), std::future_status::timeout);
+  engine.cancel(second);
+  f.wait();
+  ASSERT_EQ(errorCode, HttpRequestException::CANCELLED);
+}
+
+// Turns HTTP/2 mode on (see HttpEngine::http2()) while in scope
+struct Http2Mode {
+  Http2Mode() { config::HTTP2() = "1"; }
+  ~Http2Mode() { config::HTTP2() = ""; }
+};
+
+// nghttpd (from nghttp2), serving "/index.html" over HTTP/2 (with a
+// self-signed certificate, made by openssl), on a free port of 127.0.0.1.
+// ok() is false if it could not be started (e.g., if either is not installed).
+class LocalHttp2Server {
+public:
+  LocalHttp2Server(): pid(-1), port(0), listening(false) {
+    char dir[] = "/tmp/test_simplehttp_h2_XXXXXX";
+    if (mkdtemp(dir) == NULL)
+      return;
+    docroot = dir;
+    std::ofstream(docroot + "/index.html") << "hello";
+    const string key = docroot + "/key.pem", cert = docroot + "/cert.pem";
+    if (system(("openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=127.0.0.1 -keyout " + key +
+                " -out " + cert + " >/dev/null 2>&1").c_str()) != 0)
+      return;
+    port = freePort();
+    const string portStr = std::to_string(port);
+    pid = fork();
+    if (pid == 0) {
+      const int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      execlp("nghttpd", "nghttpd", "-a", "127.0.0.1", "-d", docroot.c_str(), portStr.c_str(), key.c_str(), cert.c_str(), (char*) NULL);
+      _exit(127);
+    }
+    // Waits (up to 5s) for it to listen, or to exit
+    for (int i = 0; pid > 0 && i < 100 && !listening; ++i) {
+      if (waitpid(pid, NULL, WNOHANG) == pid)
+        pid = -1;
+      else if (!(listening = canConnect()))
+        usleep(50 * 1000);
+    }
+  }
+
+  ~LocalHttp2Server() {
+    if (pid > 0) {
+      kill(pid, SIGTERM);
+      waitpid(pid, NULL, 0);
+    }
+    if (!docroot.empty()) {
+      const char *files[] = {"/index.html", "/key.pem", "/cert.pem"};
+      for (size_t i = 0; i < 3; ++i)
+        unlink((docroot + files[i]).c_str());
+      rmdir(docroot.c_str());
+    }
+  }
+
+  bool ok() const { return pid > 0 && listening; }
+
+  string url(const string &path) const {
+    return "https://127.0.0.1:" + std::to_string(port) + path;
+  }
+
+private:
+  pid_t pid;
+  int port;
+  bool listening;
+  string docroot;
+
+  static sockaddr_in loopback(int port) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    return addr;
+  }
+
+  // A port nothing listens on (which stays free, unless something else
+  // grabs it in the meantime)
+  static int freePort() {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = loopback(0);
+    socklen_t len = sizeof(addr);
+    int port = 0;
+    if (fd >= 0 && bind(fd, (sockaddr*) &addr, len) == 0 && getsockname(fd, (sockaddr*) &addr, &len) == 0)
+      port = ntohs(addr.sin_port);
+    if (fd >= 0)
+      close(fd);
+    return port;
+  }
+
+  bool canConnect() const {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = loopback(port);
+    const bool connected = fd >= 0 && connect(fd, (sockaddr*) &addr, sizeof(addr)) == 0;
+    if (fd >= 0)
+      close(fd);
+    return connected;
+  }
+};
+
+// Records the threads it's used from
+class ThreadRecordingSink: public HttpResponseSink {
+public:
+  string body;
+  std::vector<std::thread::id> threads;
+
+  bool begin(long) {
+    body.clear();
+    threads.push_back(std::this_thread::get_id());
+    return true;
+  }
+
+  void write(const char *data, size_t len) {
+    body.append(data, len);
+    threads.push_back(std::this_thread::get_id());
+  }
+};
+
+TEST(HttpEngineTest, Http2SinkOnCallingThread) {
+  // In HTTP/2 mode, send() goes through the engine, but the sink must not
+  // run on its I/O thread
+  LocalHttpServer server;
+  Http2Mode mode;
+  ThreadRecordingSink sink;
+  HttpRequest req;
+  req.buildRequest(HTTP_GET, server.url("/sink"), HttpHeaders());
+  req.respSink = &sink;
+  req.send();
+  ASSERT_TRUE(req.respSinkUsed);
+  ASSERT_EQ(sink.body, "/sink");
+  ASSERT_EQ(req.respData, "");
+  ASSERT_FALSE(sink.threads.empty());
+  for (size_t i = 0; i < sink.threads.size(); ++i)
+    ASSERT_EQ(sink.threads[i], std::this_thread::get_id());
+}
+
+class StoringThreadRecordingSink: public ThreadRecordingSink {
+public:
+  bool storesOnly() const { return true; }
+};
+
+TEST(HttpEngineTest, Http2StoringSinkOnIOThread) {
+  // ... unless it only stores the body: it then gets it as it downloads,
+  // rather than from respData
+  LocalHttpServer server;
+  Http2Mode mode;
+  StoringThreadRecordingSink sink;
+  HttpRequest req;
+  req.buildRequest(HTTP_GET, server.url("/store"), HttpHeaders());
+  req.respSink = &sink;
+  req.send();
+  ASSERT_TRUE(req.respSinkUsed);
+  ASSERT_EQ(sink.body, "/store");
+  ASSERT_EQ(req.respData, "");
+  ASSERT_EQ(req.respSink, &sink);
+  ASSERT_FALSE(sink.threads.empty());
+  for (size_t i = 0; i < sink.threads.size(); ++i)
+    ASSERT_NE(sink.threads[i], std::this_thread::get_id());
+}
+
+TEST(HttpEngineTest, Http2) {
+  HttpEngine &engine = HttpEngine::instance();
+  engine.setMaxConcurrentStreams(8);
+  engine.setMaxHostConnections(4);
+  ASSERT_EQ(engine.getMaxConcurrentStreams(), 8);
+  ASSERT_EQ(engine.getMaxHostConnections(), 4);
+  engine.setMaxConcurrentStreams(0);
+  engine.setMaxHostConnections(0);
+
+  LocalHttp2Server server;
+  if (!server.ok()) {
+    cerr << "Skipping HTTP/2 test because nghttpd (from nghttp2), or openssl, could not be run" << endl;
+    return;
+  }
+
+  // Requests from several threads at once, multiplexed on a single connection
+  Http2Mode mode;
+  struct NoVerify { // The certificate is self-signed
+    NoVerify() { config::CA_CERT() = "NOVERIFY"; }
+    ~NoVerify() { config::CA_CERT() = ""; }
+  } noVerify;
+  ASSERT_TRUE(HttpEngine::http2());
+  const int N = 8;
+  HttpRequest reqs[N];
+  std::future<void> sent[N];
+  for (int i = 0; i < N; ++i) {
+    sent[i] = std::async(std::launch::async, [&reqs, &server, i]() {
+      reqs[i] = HttpRequest::request(HTTP_GET, server.url("/index.html"));
+    });
+  }
+  long connects = 0;
+  for (int i = 0; i < N; ++i) {
+    sent[i].get();
+    ASSERT_EQ(reqs[i].responseCode, 200);
+    ASSERT_EQ(reqs[i].httpVersion, CURL_HTTP_VERSION_2_0);
+    ASSERT_EQ(reqs[i].respData, "hello");
+    connects += reqs[i].numConnects;
+  }
+  ASSERT_EQ(connects, 1);
+}
 
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
@@ -16,6 +16,7 @@
 
 #include "File.h"
 #include "dxcpp/dxcpp.h"
+#include "dxjson/reader.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
@@ -63,14 +64,70 @@ void File::init() {
   //Call file describe on remote file to get "parts" size
   JSON inp(JSON_HASH);
   inp["parts"] = true;
-  JSON out;
+  string out;
   try {
-    out = fileDescribe(remoteFile, inp);
+    out = DXHTTPRequestRaw("/" + remoteFile + "/describe", inp.toString(), true);
   } catch (exception &e) {
     throw runtime_error("Call to describe remote file (" + remoteFile + ") failed. Error message: " + e.what());
   }
-  if (!out.has("parts") || out["parts"].type() != JSON_HASH) {
-    throw runtime_error("Describe call output does not contain 'parts' key (or it's not a hash): Unexpected. Output from describe call: '" + out.toString() + "'");
+
+  // The "parts" hash can be huge (upto 10000 parts), so instead of building a JSON
+  // object out of the describe output, we pick the few fields we need while reading it.
+  string state, incompletePart;
+  int64_t remoteSize = -1;
+  bool hasParts = false;
+  map<int, Part> remoteParts;
+  JSONReader r(out.data(), out.size());
+  if (!r.next() || r.event() != JSON_EVENT_START_OBJECT) {
+    throw runtime_error("Describe call output is not a hash: Unexpected. Output from describe call: '" + out + "'");
+  }
+  while (r.next() && r.event() == JSON_EVENT_KEY) {
+    if (r.key() == "state") {
+      r.next();
+      state = r.getString();
+    } else if (r.key() == "size") {
+      r.next();
+      remoteSize = r.getInteger();
+    } else if (r.key() == "parts") {
+      if (!r.next() || r.event() != JSON_EVENT_START_OBJECT) {
+        break; // reported below
+      }
+      hasParts = true;
+      while (r.next() && r.event() == JSON_EVENT_KEY) {
+        // Assert the structure of each value in "parts" hash
+        const string partID = r.key();
+        r.next();
+        assert(r.event() == JSON_EVENT_START_OBJECT);
+        Part part = {-1, ""};
+        string partState;
+        while (r.next() && r.event() == JSON_EVENT_KEY) {
+          if (r.key() == "state") {
+            r.next();
+            partState = r.getString();
+          } else if (r.key() == "size") {
+            r.next();
+            part.size = r.getInteger();
+          } else if (r.key() == "md5") {
+            r.next();
+            part.md5 = r.getString();
+          } else {
+            r.skip();
+          }
+        }
+        if (partState != "complete") {
+          if (incompletePart.empty())
+            incompletePart = partID;
+          continue;
+        }
+        assert(part.size >= 0 && !part.md5.empty());
+        remoteParts[boost::lexical_cast<int>(partID)] = part;
+      }
+    } else {
+      r.skip();
+    }
+  }
+  if (!hasParts) {
+    throw runtime_error("Describe call output does not contain 'parts' key (or it's not a hash): Unexpected. Output from describe call: '" + out + "'");
   }
 
   ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -78,10 +135,10 @@ void File::init() {
   //  - Remote file size must match local file size (if file is "closed")
   //  - All parts must be in "completed" state, and sum of total size of all parts == local file size
   // If any of these check fail, mark the file as a non-match directly
-  assert(out.has("state") && out["state"].type() == JSON_STRING);
-  if (out["state"].get<string>() == "closed") {
-    assert(out.has("size") && out["size"].type() == JSON_INTEGER);
-    if (out["size"].get<int64_t>() != size) {
+  assert(!state.empty());
+  if (state == "closed") {
+    assert(remoteSize >= 0);
+    if (remoteSize != size) {
       LOG << "Size of local file '" << localFile << "' & remote file '" << remoteFile << "' differ. Marking it as a non-match" << endl;
       matchStatus = Status::FAILED_TO_MATCH_REMOTE_FILE;
       return;
@@ -91,18 +148,13 @@ void File::init() {
                           "This program should only be used for 'closed' files.");
   }
 
+  if (!incompletePart.empty()) {
+    throw runtime_error("Part ID: '" + incompletePart + "' of remote file ('" + remoteFile + "') is not in 'complete' state.\n"
+                        "This program should only be used once all parts are in 'complete' state");
+  }
   int64_t totalPartSize = 0;
-  for (JSON::object_iterator it = out["parts"].object_begin(); it != out["parts"].object_end(); ++it) {
-    // Assert the structure of each value in "parts" hash
-    assert(it->second.type() == JSON_HASH);
-    assert (it->second.has("state") && it->second["state"].type() == JSON_STRING);
-    if (it->second["state"].get<string>() != "complete") {
-      throw runtime_error("Part ID: '" + it->first + "' of remote file ('" + remoteFile + "') is not in 'complete' state.\n"
-                          "This program should only be used once all parts are in 'complete' state");
-    }
-    assert(it->second.has("size") && it->second.has("md5") &&
-           it->second["size"].type() == JSON_INTEGER && it->second["md5"].type() == JSON_STRING);
-    totalPartSize += it->second["size"].get<int64_t>();
+  for (map<int, Part>::const_iterator it = remoteParts.begin(); it != remoteParts.end(); ++it) {
+    totalPartSize += it->second.size;
   }
   if (totalPartSize != size) {
     LOG << "Size of local file '" << localFile << "' & sum of all part sizes of remote file '" << remoteFile << "' differ. Marking it as a non-match" << endl;
@@ -110,42 +162,29 @@ void File::init() {
     return;
   }
   ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-  parts = out["parts"]; // copy "parts" hash in a local variable in File class
+  parts.swap(remoteParts);
 }
 
 unsigned int File::createChunks(BlockingQueue<Chunk *> &queue) {
   using namespace dx;
-  // For creating chunks:
-  //  1) We sort the part IDs in increasing order (by pushing them all in a std::map after converting to int)
-  //  2) We start creating file chunks
+  // Parts are already sorted by their index (in increasing order), so chunk boundaries
+  // in the local file are simply the running sum of part sizes.
 
   if (matchStatus == Status::FAILED_TO_MATCH_REMOTE_FILE) {
     return 0; // we have already marked the file as a non-match, no need to create chunks
   }
 
-  // We will do it in 2 pass .. first create all "keys" in the map .. then in second pass we will add their sizes etc
-  map<int, JSON> chunkInfo;
-  // Note: We are not asserting for "parts" JSON structure, since it has been already done in init()
-  for (JSON::object_iterator it = parts.object_begin(); it != parts.object_end(); ++it) {
-    chunkInfo[boost::lexical_cast<int>(it->first)] = JSON::parse("{\"md5\": \"" + it->second["md5"].get<string>() + "\"}");
-  }
-
-  // second pass: Add start and end location for chunks in the local file
-  int64_t start = 0;
-  for (map<int, JSON>::iterator it = chunkInfo.begin(); it != chunkInfo.end(); ++it) {
-    it->second["start"] = start;
-    start = it->second["end"] = (start + parts[boost::lexical_cast<string>(it->first)]["size"].get<int64_t>());
-  }
   // TODO: Sanity check that this works for empty file as well
-
   LOG << "Creating chunks:" << endl;
-  fs::path p(localFile);
   int actualChunksCreated = 0;
-  for (map<int, JSON>::iterator it = chunkInfo.begin(); it != chunkInfo.end(); ++it) {
-    Chunk *c = new Chunk(localFile, it->second["md5"].get<string>(), it->second["start"].get<int64_t>(), it->second["end"].get<int64_t>(), fileIndex);
+  int64_t start = 0;
+  for (map<int, Part>::const_iterator it = parts.begin(); it != parts.end(); ++it) {
+    const int64_t end = start + it->second.size;
+    Chunk *c = new Chunk(localFile, it->second.md5, start, end, fileIndex);
     c->log("created");
     queue.produce(c);
     actualChunksCreated++;
+    start = end;
   }
   return actualChunksCreated;
 }
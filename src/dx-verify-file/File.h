@@ -17,6 +17,7 @@
 #ifndef UA_FILE_H
 #define UA_FILE_H
 
+#include <map>
 #include <string>
 
 #include "dxcpp/bqueue.h"
@@ -47,8 +48,14 @@ public:
   /* Set to value from enum in File class */
   Status matchStatus;
 
-  /* Parts JSON from file-xxxx/describe call */
-  dx::JSON parts;
+  /* Size and md5 of a single part of the remote file */
+  struct Part {
+    int64_t size;
+    std::string md5;
+  };
+
+  /* Parts of the remote file (from file-xxxx/describe call), keyed by part index */
+  std::map<int, Part> parts;
 
   /* Size of the local file to be uploaded */
   int64_t size;
@@ -23,6 +23,7 @@
 
 #include "dxcpp/utils.h"
 #include "dxcpp/dxcpp.h"
+#include "SimpleHttp.h"
 
 extern "C" {
 #include "compress.h"
@@ -258,9 +259,15 @@ static size_t write_callback(void *buffer, size_t size, size_t nmemb, void *user
   return result;
 }
 
-void upload_cleanup(CURL **curl, curl_slist **l1, curl_slist **l2) {
+// Frees the header lists, and gives the curl handle back to the connection
+// pool (after a successful upload, with the pin it was acquired with), or
+// cleans it up (after a failure, since its connection may be in an unknown state)
+void upload_cleanup(CURL **curl, curl_slist **l1, curl_slist **l2, const string &url = "", const string &pin = "") {
   if (*curl != NULL) {
-    curl_easy_cleanup(*curl);
+    if (!url.empty())
+      dx::HttpConnectionPool::instance().release(url, *curl, pin);
+    else
+      dx::HttpConnectionPool::discard(*curl);
     *curl = NULL;
   }
   if (*l1 != NULL) {
@@ -280,27 +287,22 @@ void Chunk::upload(Options &opt) {
   long responseCode;
   try {
     uploadOffset = 0;
-    pair<string, dx::JSON> uploadResp = uploadURL(opt);
-    string &url = uploadResp.first;
-    const dx::JSON &headersToSend = uploadResp.second;
+    dx::DXUploadURL uploadResp = uploadURL(opt);
+    string &url = uploadResp.url;
+    const map<string, string> &headersToSend = uploadResp.headers;
+    // The CURLOPT_RESOLVE entries, which the pooled handle must be pinned to
+    string pin;
 
     log("Upload URL: " + url);
 
-    curl = curl_easy_init();
-    if (curl == NULL) {
-      throw runtime_error("An error occurred when initializing the HTTP connection");
-    }
-    char errorBuffer[CURL_ERROR_SIZE + 1] = {0}; // setting to zero (since it can be the case that despite an error, nothing is written to the buffer)
-    // Set errorBuffer to recieve human readable error messages from libcurl
-    // http://curl.haxx.se/libcurl/c/curl_easy_setopt.html#CURLOPTERRORBUFFER
-    checkConfigCURLcode(curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer), errorBuffer);
-
     if (!hostName.empty() && !resolvedIP.empty()) { // Will never be true when compiling on windows
       log("Adding ip '" + resolvedIP + "' to resolve list for hostname '" + hostName + "'");
       slist_resolved_ip = curl_slist_append(slist_resolved_ip, (hostName + ":443:" + resolvedIP).c_str());
       slist_resolved_ip = curl_slist_append(slist_resolved_ip, (hostName + ":80:" + resolvedIP).c_str());
-      // Note: We don't remove this extra host name resolution info by setting "-HOST:PORT:IP" at the end,
-      // since we don't reuse the curl handle anyway
+      pin += hostName + ":443:" + resolvedIP + "," + hostName + ":80:" + resolvedIP;
+      // Note: We don't remove this extra host name resolution info by setting "-HOST:PORT:IP" at the end:
+      // a pinned handle doesn't use the shared DNS cache, and is only reused for the same pin
+      // (see dx::HttpConnectionPool), so the entries can't leak into other chunks' transfers
     } else {
       log("Not adding any explicit IP address using CURLOPT_RESOLVE. resolvedIP = '" + resolvedIP + "', hostName = '" + hostName + "'", dx::logWARNING);
     }
@@ -324,10 +326,22 @@ void Chunk::upload(Options &opt) {
       log(string("Substituting hostname ") + AWS_HOSTNAME + " for " + TCP_TUNNEL_HOSTNAME + ".");
       log(string("Adding substitute ip '") + ipAddr + "' to resolve list for hostname '" + AWS_HOSTNAME + ":" + port + "'");
       slist_resolved_ip = curl_slist_append(slist_resolved_ip, (string(AWS_HOSTNAME) + ":" + port + ":" + ipAddr).c_str());
+      pin += (pin.empty() ? "" : ",") + string(AWS_HOSTNAME) + ":" + port + ":" + ipAddr;
 
       url.replace(index, strlen(TCP_TUNNEL_HOSTNAME), AWS_HOSTNAME);
     }
 
+    // A handle which may still be connected to the host in url (to the same IP, if pinned; see
+    // dx::HttpConnectionPool)
+    curl = dx::HttpConnectionPool::instance().acquire(url, pin);
+    if (curl == NULL) {
+      throw runtime_error("An error occurred when initializing the HTTP connection");
+    }
+    char errorBuffer[CURL_ERROR_SIZE + 1] = {0}; // setting to zero (since it can be the case that despite an error, nothing is written to the buffer)
+    // Set errorBuffer to recieve human readable error messages from libcurl
+    // http://curl.haxx.se/libcurl/c/curl_easy_setopt.html#CURLOPTERRORBUFFER
+    checkConfigCURLcode(curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errorBuffer), errorBuffer);
+
     // Now, if we have added any URL's to the slist, call CURLOPT_RESOLVE.
     if (slist_resolved_ip != NULL) {
       checkConfigCURLcode(curl_easy_setopt(curl, CURLOPT_RESOLVE, slist_resolved_ip), errorBuffer);
@@ -395,9 +409,9 @@ void Chunk::upload(Options &opt) {
     slist_headers = curl_slist_append(slist_headers, "Content-Type:");
 
     // Append additional headers requested by /file-xxxx/upload call
-    for (dx::JSON::const_object_iterator it = headersToSend.object_begin(); it != headersToSend.object_end(); ++it) {
+    for (map<string, string>::const_iterator it = headersToSend.begin(); it != headersToSend.end(); ++it) {
       ostringstream tempStream;
-      tempStream << it->first << ": " << it->second.get<string>();
+      tempStream << it->first << ": " << it->second;
       slist_headers = curl_slist_append(slist_headers, tempStream.str().c_str());
     }
 
@@ -414,7 +428,7 @@ void Chunk::upload(Options &opt) {
     checkPerformCURLcode(curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &responseCode), errorBuffer);
     log("Returned from curl_easy_perform; responseCode is " + boost::lexical_cast<string>(responseCode));
 
-    upload_cleanup(&curl, &slist_headers, &slist_resolved_ip);
+    upload_cleanup(&curl, &slist_headers, &slist_resolved_ip, url, pin);
   } catch (...) {
     // This catch is only intended for cleanup (when checkPerformCURLcode() or checkConfigCURLcode() throw)
     // We will rethrow the error again.
@@ -493,15 +507,14 @@ static bool attemptExplicitDNSResolve(const string &host) {
   return !boost::regex_search(host.begin(), host.end(), what, expression, boost::match_default);
 }
 
-pair<string, dx::JSON> Chunk::uploadURL(Options &opt) {
+dx::DXUploadURL Chunk::uploadURL(Options &opt) {
   dx::JSON params(dx::JSON_OBJECT);
   params["index"] = index + 1;  // minimum part index is 1
   params["size"] = data.size();
   params["md5"] = dx::getHexifiedMD5(data);
   log("Generating Upload URL for index = " + boost::lexical_cast<string>(params["index"].get<int>()));
-  dx::JSON result = fileUpload(fileID, params);
-  pair<string, dx::JSON> toReturn = make_pair(result["url"].get<string>(), result["headers"]);
-  const string &url = toReturn.first;
+  dx::DXUploadURL toReturn = dx::fileUploadURL(fileID, params);
+  const string &url = toReturn.url;
   log("/" + fileID + "/upload call returned this url: " + url);
 
   if (!opt.noRoundRobinDNS) {
@@ -23,6 +23,7 @@
 #include <boost/thread.hpp>
 
 #include "dxjson/dxjson.h"
+#include "dxcpp/dxcpp.h"
 #include "dxcpp/dxlog.h"
 #include "dxcpp/bqueue.h"
 
@@ -129,7 +130,7 @@ public:
 
 private:
 
-  std::pair<std::string, dx::JSON> uploadURL(Options &opt);
+  dx::DXUploadURL uploadURL(Options &opt);
 };
 
 #endif
@@ -16,8 +16,11 @@
 
 #include "file.h"
 #include "dxcpp/dxcpp.h"
+#include "dxjson/reader.h"
+#include "dxjson/pointer.h"
 #include "options.h"
 
+#include <set>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 
@@ -54,9 +57,12 @@ void testLocalFileExists(const string &filename) {
 }
 
 int numberOfCompletedParts(const dx::JSON &parts) {
+  static const dx::JSONPointer PART_STATES("/" "*" "/state");
+  vector<const dx::JSON*> states;
+  PART_STATES.findAll(parts, states);
   int64_t numParts = 0;
-  for (dx::JSON::const_object_iterator it = parts.object_begin(); it != parts.object_end(); ++it) {
-    if (it->second["state"].get<string>() == "complete") {
+  for (unsigned i = 0; i < states.size(); ++i) {
+    if (*states[i] == "complete") {
       numParts++;
     }
   }
@@ -79,6 +85,42 @@ double percentageComplete(const dx::JSON &parts, const int64_t size, const int64
   return (double(totalBytesUploaded) / size) * 100.0;
 }
 
+/*
+ * Calls file-xxxx/describe, and returns the state of the remote file. Indices of all the
+ * parts in "complete" state are put in completeParts. Since the "parts" hash can be large,
+ * the response is read with a JSONReader (rather than being parsed into a dx::JSON).
+ */
+string describeFileParts(const string &fileID, set<int> &completeParts) {
+  const string resp = dx::DXHTTPRequestRaw("/" + fileID + "/describe", "{}", true);
+  dx::JSONReader r(resp.data(), resp.size());
+  string state;
+  r.next();
+  assert(r.event() == dx::JSON_EVENT_START_OBJECT);
+  while (r.next() && r.event() == dx::JSON_EVENT_KEY) {
+    if (r.key() == "state") {
+      r.next();
+      state = r.getString();
+    } else if (r.key() == "parts") {
+      r.next();
+      assert(r.event() == dx::JSON_EVENT_START_OBJECT);
+      while (r.next() && r.event() == dx::JSON_EVENT_KEY) {
+        const int partIndex = boost::lexical_cast<int>(r.key());
+        r.next();
+        while (r.next() && r.event() == dx::JSON_EVENT_KEY) {
+          if (r.key() == "state" && r.next() && r.type() == dx::JSON_STRING && r.getString() == "complete") {
+            completeParts.insert(partIndex);
+          } else {
+            r.skip();
+          }
+        }
+      }
+    } else {
+      r.skip();
+    }
+  }
+  return state;
+}
+
 File::File(const string &localFile_, const string &projectSpec_, const string &folder_, const string &name_,
 	   const std::string &visibility_, const dx::JSON &properties_, 
 	   const dx::JSON &type_, const dx::JSON &tags_, const dx::JSON &details_,
@@ -195,13 +237,14 @@ unsigned int File::createChunks(dx::BlockingQueue<Chunk *> &queue, const int tri
     // 2. OR, Remote resumable target is already in "closing" or "closed" state.
     return 0;
   }
-  const dx::JSON desc = dx::fileDescribe(fileID);
+  set<int> completeParts;
+  const string state = describeFileParts(fileID, completeParts);
   // sanity check
-  assert(desc["state"].get<string>() == "open");
+  assert(state == "open");
 
   // Treat special case of empty file here
   if (size == 0) {
-    if (desc["parts"].has("1") && desc["parts"]["1"]["state"].get<string>() == "complete") {
+    if (completeParts.count(1) > 0) {
       DXLOG(logINFO) << "Part index 1 for fileID " << fileID << " is in complete state. Will not create an upload chunk for it.";
       atleastOnePartDone = true;
       return 0;
@@ -218,9 +261,9 @@ unsigned int File::createChunks(dx::BlockingQueue<Chunk *> &queue, const int tri
   unsigned int actualChunksCreated = 0; // is not incremented for chunks which are already in "complete" state (when resuming)
 
   for (uint64_t start = 0; start < size; start += chunkSize) {
-    string partIndex = boost::lexical_cast<string>(countChunks + 1); // minimum part index is 1
+    const int partIndex = countChunks + 1; // minimum part index is 1
     const uint64_t end = min(start + chunkSize, size);
-    if (desc["parts"].has(partIndex) && desc["parts"][partIndex]["state"].get<string>() == "complete") {
+    if (completeParts.count(partIndex) > 0) {
       DXLOG(logINFO) << "Part index " << partIndex << " for fileID " << fileID << " is in complete state. Will not create an upload chunk for it.";
       bytesUploaded += (end - start);
       atleastOnePartDone = true;
@@ -36,6 +36,7 @@
 #endif
 
 #include "dxcpp/dxcpp.h"
+#include "dxjson/pointer.h"
 #include "dxcpp/bqueue.h"
 #include "api_helper.h"
 #include "options.h"
@@ -328,7 +329,8 @@ void compressChunks() {
 bool is_chunk_complete(Chunk *c, JSON &fileDescription) {
     string partIndex = boost::lexical_cast<string>(c->index + 1); // minimum part index is 1
 
-    return (fileDescription["parts"].has(partIndex) && fileDescription["parts"][partIndex]["state"].get<string>() == "complete");
+    const JSON *state = dx::JSONPointer("/parts/" + partIndex + "/state").find(fileDescription);
+    return (state != NULL && *state == "complete");
 }
 
 void uploadChunks(vector<File> &files) {
@@ -696,10 +698,11 @@ void check_for_complete_chunks(vector<File> &files) {
 
       // Cache file descriptions so we only have to do once per file,
       // not once per chunk.
-      if (fileDescriptions.find(c->fileID) == fileDescriptions.end())
-        fileDescriptions[c->fileID] = fileDescribe(c->fileID);
+      map<string, JSON>::iterator desc = fileDescriptions.find(c->fileID);
+      if (desc == fileDescriptions.end())
+        desc = fileDescriptions.insert(make_pair(c->fileID, fileDescribe(c->fileID))).first;
 
-      if (!is_chunk_complete(c, fileDescriptions[c->fileID])) {
+      if (!is_chunk_complete(c, desc->second)) {
         // After the chunk was uploaded, it was cleared, removing the data
         // from the buffer.  We need to reload if we're going to upload again.
         chunksToRead.produce(c);
@@ -735,10 +738,11 @@ void check_for_complete_chunks(vector<File> &files) {
 
     // Cache file descriptions so we only have to do once per file,
     // not once per chunk.
-    if (fileDescriptions.find(c->fileID) == fileDescriptions.end())
-        fileDescriptions[c->fileID] = fileDescribe(c->fileID);
+    map<string, JSON>::iterator desc = fileDescriptions.find(c->fileID);
+    if (desc == fileDescriptions.end())
+      desc = fileDescriptions.insert(make_pair(c->fileID, fileDescribe(c->fileID))).first;
 
-    if (!is_chunk_complete(c, fileDescriptions[c->fileID])) {
+    if (!is_chunk_complete(c, desc->second)) {
         DXLOG(logUSERINFO) << "Chunk " << c->index << " of file " << c->fileID << " did not complete.  This file will not be accessible.  PLease try to upload this file again." << endl;
     }
   }